@@ -0,0 +1,710 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef LEARNING_BENCHMARK_H
+#define LEARNING_BENCHMARK_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "io.h"
+#include "glfw_app.h"
+#include "vulkan_vertex.h"
+#include "vulkan_batch_2d.h"
+#include "vulkan_texture.h"
+#include "obj_importer.h"
+#include "mesh_pack.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+
+typedef enum BenchmarkMode {
+    BENCHMARK_NONE,
+    BENCHMARK_BATCH_2D, // Quads appended to the 2D batcher
+    BENCHMARK_MESH_BUFFERS, // The same quads with a vertex buffer each
+    BENCHMARK_OBJ_IMPORT, // Parses a generated OBJ grid of quads
+    BENCHMARK_MESH_PACK, // Loads the same grid as OBJ and as a mesh pack
+    BENCHMARK_SCENE, // Generated stress scene drawn through drawFrame
+    BENCHMARK_PARTICLES // LEARNING_PARTICLES GPU particles drawn through drawFrame
+} BenchmarkMode;
+
+#define SCENE_MAX_MESHES 4096
+#define SCENE_MAX_SIDES 32 // Meshes are polygons of 3 to SCENE_MAX_SIDES sides
+
+constexpr uint32_t SCENE_TEXTURE_SIZE = 64;
+constexpr float SCENE_TIME_STEP = 1.0f / 60.0f; // Fixed so dynamic objects move the same in every run
+
+typedef struct SceneObject {
+    uint32_t mesh; // Mesh buffer index
+    uint32_t material;
+    InstanceData data;
+    Vector2D velocity; // Per second, only read for dynamic objects
+    float spin; // Radians per second
+    bool dynamic;
+} SceneObject;
+
+typedef struct SceneMaterial {
+    uint32_t texture; // Texture handle, resolved through getTextureIndex every frame
+    Vector3D color;
+} SceneMaterial;
+
+/**
+ * A scene generated from the benchmark seed so every run and build draws the
+ * same thing. Each axis is swept on its own:
+ *   objects      instances pushed every frame, CPU submission
+ *   meshes       unique meshes, draws per frame
+ *   materials    unique textures, uploads at startup and texture variety
+ *   dynamic      fraction of objects moved every frame
+ *   overdraw     how many times the objects cover the screen on average, GPU fill
+ **/
+typedef struct StressScene {
+    uint32_t objectCount;
+    uint32_t meshCount;
+    uint32_t materialCount;
+    float dynamicFraction;
+    float overdraw;
+    Uint32SizedMutableArray objects; // SceneObject
+    Uint32SizedMutableArray materials; // SceneMaterial
+    uint32_t *materialTextures; // Bindless index per material for the current frame
+    uint32_t dynamicCount;
+    double setupSeconds; // Mesh and texture uploads
+    double cpuSeconds; // Updating and pushing the objects, over every frame
+    double lastFrameTime;
+    double worstFrameSeconds;
+} StressScene;
+
+/**
+ * Benchmark mode is picked with environment variables so the
+ * benchmark/average script can keep launching the plain binary.
+ *   LEARNING_BENCHMARK        batch2d | meshbuffers | obj | meshpack | scene | particles
+ *   LEARNING_BENCHMARK_QUADS  quads per frame, or quads in the generated OBJ (default 10000)
+ *   LEARNING_BENCHMARK_FRAMES frames to run before reporting (default 600)
+ *   LEARNING_BENCHMARK_OBJ    where obj and meshpack write their generated file (default /tmp/learning_benchmark.obj)
+ *   LEARNING_BENCHMARK_SEED   seed of every generated workload (default 1)
+ *   LEARNING_SCENE_OBJECTS    scene objects (default 10000)
+ *   LEARNING_SCENE_MESHES     unique scene meshes (default 16)
+ *   LEARNING_SCENE_MATERIALS  unique scene textures (default 8)
+ *   LEARNING_SCENE_DYNAMIC    fraction of scene objects that move (default 0.1)
+ *   LEARNING_SCENE_OVERDRAW   average times the scene covers the screen (default 1)
+ *   LEARNING_DEPTH_SORT       0 draws instances in push order instead of front to back (default 1)
+ *   LEARNING_PARTICLES        GPU particles, read when the window is created (default 0)
+ *   LEARNING_ASYNC_COMPUTE    0 keeps compute on the graphics queue (default 1)
+ **/
+typedef struct Benchmark {
+    BenchmarkMode mode;
+    uint32_t quadCount;
+    uint32_t frameCount;
+    uint32_t frame;
+    uint32_t seed;
+    double startTime;
+    StressScene scene; // Only used by BENCHMARK_SCENE
+} Benchmark;
+
+double getTimeInSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+uint32_t getEnvUint32(const char *name, const uint32_t fallback) {
+    const char *value = getenv(name);
+    if (value == nullptr || *value == '\0') return fallback;
+    return (uint32_t) strtoul(value, nullptr, 10);
+}
+
+float getEnvFloat(const char *name, const float fallback) {
+    const char *value = getenv(name);
+    if (value == nullptr || *value == '\0') return fallback;
+    return strtof(value, nullptr);
+}
+
+/**
+ * Counts are clamped to what the mesh buffer, the instance buffers and the
+ * texture table hold, mesh 0 and the default texture are already taken.
+ **/
+void readSceneConfig(StressScene *scene) {
+    *scene = (StressScene){
+        .objectCount = getEnvUint32("LEARNING_SCENE_OBJECTS", 10000),
+        .meshCount = getEnvUint32("LEARNING_SCENE_MESHES", 16),
+        .materialCount = getEnvUint32("LEARNING_SCENE_MATERIALS", 8),
+        .dynamicFraction = getEnvFloat("LEARNING_SCENE_DYNAMIC", 0.1f),
+        .overdraw = getEnvFloat("LEARNING_SCENE_OVERDRAW", 1.0f),
+        .objects = {.items = nullptr, .size = 0, .count = 0},
+        .materials = {.items = nullptr, .size = 0, .count = 0}
+    };
+
+    if (scene->objectCount > MAX_INSTANCES_PER_FRAME - 1) scene->objectCount = MAX_INSTANCES_PER_FRAME - 1;
+    if (scene->meshCount < 1) scene->meshCount = 1;
+    if (scene->meshCount > SCENE_MAX_MESHES) scene->meshCount = SCENE_MAX_MESHES;
+    if (scene->materialCount < 1) scene->materialCount = 1;
+    if (scene->materialCount > MAX_TEXTURES - 1) scene->materialCount = MAX_TEXTURES - 1;
+    if (scene->dynamicFraction < 0.0f) scene->dynamicFraction = 0.0f;
+    if (scene->dynamicFraction > 1.0f) scene->dynamicFraction = 1.0f;
+    if (scene->overdraw <= 0.0f) scene->overdraw = 1.0f;
+
+    printLn(
+        "Scene of %d objects, %d meshes, %d materials, %.2f dynamic, %.2fx overdraw",
+        scene->objectCount,
+        scene->meshCount,
+        scene->materialCount,
+        scene->dynamicFraction,
+        scene->overdraw
+    );
+}
+
+Benchmark readBenchmarkConfig() {
+    Benchmark benchmark = {
+        .mode = BENCHMARK_NONE,
+        .quadCount = getEnvUint32("LEARNING_BENCHMARK_QUADS", 10000),
+        .frameCount = getEnvUint32("LEARNING_BENCHMARK_FRAMES", 600),
+        .frame = 0,
+        .seed = getEnvUint32("LEARNING_BENCHMARK_SEED", 1),
+        .startTime = 0.0
+    };
+
+    const char *mode = getenv("LEARNING_BENCHMARK");
+    if (mode == nullptr) return benchmark;
+
+    if (strcmp(mode, "batch2d") == 0) benchmark.mode = BENCHMARK_BATCH_2D;
+    else if (strcmp(mode, "meshbuffers") == 0) benchmark.mode = BENCHMARK_MESH_BUFFERS;
+    else if (strcmp(mode, "obj") == 0) benchmark.mode = BENCHMARK_OBJ_IMPORT;
+    else if (strcmp(mode, "meshpack") == 0) benchmark.mode = BENCHMARK_MESH_PACK;
+    else if (strcmp(mode, "scene") == 0) {
+        benchmark.mode = BENCHMARK_SCENE;
+        readSceneConfig(&benchmark.scene);
+    }
+    else if (strcmp(mode, "particles") == 0) benchmark.mode = BENCHMARK_PARTICLES;
+    else printLn("Unknown benchmark %s", mode);
+
+    if (benchmark.mode != BENCHMARK_NONE)
+        printLn("Running benchmark %s with %d quads for %d frames", mode, benchmark.quadCount, benchmark.frameCount);
+
+    return benchmark;
+}
+
+float nextBenchmarkFloat(Benchmark *benchmark) {
+    // Fixed seed LCG so every run and build draws the same quads
+    benchmark->seed = benchmark->seed * 1664525u + 1013904223u;
+    return (float) (benchmark->seed >> 8) / 16777216.0f;
+}
+
+void nextBenchmarkQuad(Benchmark *benchmark, Vector2D *min, Vector2D *max, Vector3D *color) {
+    min->x = nextBenchmarkFloat(benchmark) * 2.0f - 1.0f;
+    min->y = nextBenchmarkFloat(benchmark) * 2.0f - 1.0f;
+    max->x = min->x + 0.02f;
+    max->y = min->y + 0.02f;
+    color->x = nextBenchmarkFloat(benchmark);
+    color->y = nextBenchmarkFloat(benchmark);
+    color->z = nextBenchmarkFloat(benchmark);
+}
+
+void runBatch2DBenchmarkFrame(const GLFWApp *app, VulkanWindow *window, Benchmark *benchmark) {
+    Batch2D *batch = &window->batch2D;
+    beginBatch2D(
+        batch,
+        app->logicalDevice,
+        ((VkFence *) window->inFlightFences.items)[window->currentFrame],
+        window->currentFrame
+    );
+
+    Vector2D min, max;
+    Vector3D color;
+    for (uint32_t i = 0; i < benchmark->quadCount; i++) {
+        nextBenchmarkQuad(benchmark, &min, &max, &color);
+        batchQuad2D(batch, min, max, color);
+    }
+}
+
+/**
+ * The same quads when every quad owns its own vertex buffer, the way meshes
+ * were uploaded before the mesh buffer. They go through the batcher and
+ * drawFrame like runBatch2DBenchmarkFrame's, so only the buffer layout
+ * differs: a buffer created and bound per quad and a draw each.
+ **/
+void runMeshBuffersBenchmarkFrame(const GLFWApp *app, VulkanWindow *window, Benchmark *benchmark) {
+    enableBatch2DSeparateBuffers(
+        &window->batch2D,
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice]
+    );
+    runBatch2DBenchmarkFrame(app, window, benchmark);
+}
+
+/**
+ * A square grid of at least quadCount quads with per vertex colors,
+ * written the way exporters do: every v line first, then one f line per quad.
+ **/
+bool writeBenchmarkObj(const char *path, Benchmark *benchmark) {
+    FILE *file = fopen(path, "w");
+    if (file == nullptr) {
+        printLn("Failed to create %s", path);
+        return false;
+    }
+
+    uint32_t side = 1;
+    while (side * side < benchmark->quadCount) side++;
+
+    fprintf(file, "# %d x %d quad grid\n", side, side);
+    for (uint32_t y = 0; y <= side; y++) {
+        for (uint32_t x = 0; x <= side; x++) {
+            fprintf(
+                file,
+                "v %.6f %.6f 0.000000 %.4f %.4f %.4f\n",
+                (float) x / (float) side * 2.0f - 1.0f,
+                (float) y / (float) side * 2.0f - 1.0f,
+                nextBenchmarkFloat(benchmark),
+                nextBenchmarkFloat(benchmark),
+                nextBenchmarkFloat(benchmark)
+            );
+        }
+    }
+
+    for (uint32_t y = 0; y < side; y++) {
+        for (uint32_t x = 0; x < side; x++) {
+            const uint32_t first = y * (side + 1) + x + 1;
+            fprintf(file, "f %d %d %d %d\n", first, first + 1, first + side + 2, first + side + 1);
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+#define OBJ_BENCHMARK_RUNS 5
+
+/**
+ * Imports the generated file a few times and reports the average,
+ * the first run also pays for reading the file into the page cache.
+ **/
+const char *getBenchmarkObjPath() {
+    const char *path = getenv("LEARNING_BENCHMARK_OBJ");
+    return path == nullptr || *path == '\0' ? "/tmp/learning_benchmark.obj" : path;
+}
+
+void runObjImportBenchmark(Benchmark *benchmark) {
+    const char *path = getBenchmarkObjPath();
+
+    if (!writeBenchmarkObj(path, benchmark)) return;
+
+    double seconds = 0.0, parseSeconds = 0.0, mergeSeconds = 0.0;
+    ObjImportStats stats = {};
+
+    for (uint32_t run = 0; run < OBJ_BENCHMARK_RUNS; run++) {
+        BufferVertices bufferVertices;
+        const double start = getTimeInSeconds();
+        if (!importObj(path, &bufferVertices, &stats)) return;
+        seconds += getTimeInSeconds() - start;
+        parseSeconds += stats.parseSeconds;
+        mergeSeconds += stats.mergeSeconds;
+        freeBufferVertices(&bufferVertices);
+    }
+
+    seconds /= OBJ_BENCHMARK_RUNS;
+    printLn(
+        "BENCHMARK obj: %.1f MB, %d triangles on %d threads in %.3fs (parse %.3fs, merge %.3fs), %.1f MB/s, %.0f triangles/s",
+        (double) stats.fileSize / 1e6,
+        stats.triangleCount,
+        stats.threadCount,
+        seconds,
+        parseSeconds / OBJ_BENCHMARK_RUNS,
+        mergeSeconds / OBJ_BENCHMARK_RUNS,
+        (double) stats.fileSize / 1e6 / seconds,
+        stats.triangleCount / seconds
+    );
+}
+
+/**
+ * Time from file to bytes ready for staging, with the staging memory stood in
+ * by a host allocation so the grid isn't limited by the mesh buffer capacity.
+ * The OBJ path parses and packs, the mesh pack path maps and copies.
+ * Both read from a warm page cache.
+ **/
+void runMeshPackBenchmark(Benchmark *benchmark) {
+    const char *objPath = getBenchmarkObjPath();
+    char packPath[4096];
+    snprintf(packPath, sizeof(packPath), "%s.pack", objPath);
+
+    if (!writeBenchmarkObj(objPath, benchmark)) return;
+
+    BufferVertices bufferVertices;
+    ObjImportStats stats;
+    if (!importObj(objPath, &bufferVertices, &stats)) return;
+    optimizeMesh(&bufferVertices);
+    const bool converted = writeMeshPack(packPath, &bufferVertices, 1);
+    freeBufferVertices(&bufferVertices);
+    if (!converted) return;
+
+    double objSeconds = 0.0, packSeconds = 0.0;
+    for (uint32_t run = 0; run < OBJ_BENCHMARK_RUNS; run++) {
+        double start = getTimeInSeconds();
+        if (!importObj(objPath, &bufferVertices, &stats)) return;
+        const VkIndexType indexType = selectIndexType(bufferVertices.vertices.count);
+        const size_t verticesSize = sizeof(PackedVertex) * bufferVertices.vertices.count;
+        uint8_t *staging = malloc(verticesSize + getIndexSize(indexType) * bufferVertices.indices.count);
+        packVertices((Vertex *) bufferVertices.vertices.items, (PackedVertex *) staging, bufferVertices.vertices.count);
+        packIndices(
+            (uint32_t *) bufferVertices.indices.items,
+            staging + verticesSize,
+            bufferVertices.indices.count,
+            indexType
+        );
+        objSeconds += getTimeInSeconds() - start;
+        free(staging);
+        freeBufferVertices(&bufferVertices);
+
+        start = getTimeInSeconds();
+        MeshPack pack;
+        if (!openMeshPack(packPath, &pack)) return;
+        staging = malloc(pack.header->vertexBlockSize + pack.header->indexBlockSize);
+        memcpy(staging, pack.mapping + pack.header->vertexBlockOffset, pack.header->vertexBlockSize);
+        memcpy(
+            staging + pack.header->vertexBlockSize,
+            pack.mapping + pack.header->indexBlockOffset,
+            pack.header->indexBlockSize
+        );
+        packSeconds += getTimeInSeconds() - start;
+        free(staging);
+        closeMeshPack(&pack);
+    }
+
+    objSeconds /= OBJ_BENCHMARK_RUNS;
+    packSeconds /= OBJ_BENCHMARK_RUNS;
+    printLn(
+        "BENCHMARK meshpack: %d triangles, obj %.1f MB in %.4fs, pack in %.4fs, %.1fx faster",
+        stats.triangleCount,
+        (double) stats.fileSize / 1e6,
+        objSeconds,
+        packSeconds,
+        objSeconds / packSeconds
+    );
+}
+
+/**
+ * A polygon of sides sides around the origin, radius jittered per rim vertex
+ * so meshes with the same side count still differ. Drawn as a fan.
+ **/
+BufferVertices createSceneMesh(Benchmark *benchmark, const uint32_t sides) {
+    BufferVertices mesh = {
+        .vertices = {.count = sides + 1, .size = sizeof(Vertex) * (sides + 1)},
+        .indices = {.count = sides * 3, .size = sizeof(uint32_t) * sides * 3},
+        .packed = false
+    };
+    mesh.vertices.items = malloc(mesh.vertices.size);
+    mesh.indices.items = malloc(mesh.indices.size);
+
+    Vertex *vertices = (Vertex *) mesh.vertices.items;
+    uint32_t *indices = (uint32_t *) mesh.indices.items;
+    vertices[0] = (Vertex){{0.0f, 0.0f}, {1.0f, 1.0f, 1.0f}, {0.5f, 0.5f}};
+    for (uint32_t i = 0; i < sides; i++) {
+        const float angle = 6.2831853f * (float) i / (float) sides;
+        const float radius = 0.8f + 0.2f * nextBenchmarkFloat(benchmark);
+        vertices[i + 1] = (Vertex){
+            {cosf(angle) * radius, sinf(angle) * radius},
+            {1.0f, 1.0f, 1.0f},
+            {0.5f + 0.5f * cosf(angle), 0.5f + 0.5f * sinf(angle)}
+        };
+        indices[i * 3] = 0;
+        indices[i * 3 + 1] = i + 1;
+        indices[i * 3 + 2] = (i + 1) % sides + 1;
+    }
+
+    return mesh;
+}
+
+/**
+ * A two color checker, uploaded with mips through the texture module.
+ **/
+uint32_t createSceneTexture(
+    const GLFWApp *app,
+    VulkanWindow *window,
+    Benchmark *benchmark,
+    const VkPhysicalDevice physicalDevice
+) {
+    uint8_t colors[2][4];
+    for (uint32_t i = 0; i < 2; i++) {
+        for (uint32_t j = 0; j < 3; j++) colors[i][j] = (uint8_t) (nextBenchmarkFloat(benchmark) * 255.0f);
+        colors[i][3] = 255;
+    }
+
+    uint8_t *pixels = malloc(SCENE_TEXTURE_SIZE * SCENE_TEXTURE_SIZE * 4);
+    for (uint32_t y = 0; y < SCENE_TEXTURE_SIZE; y++) {
+        for (uint32_t x = 0; x < SCENE_TEXTURE_SIZE; x++) {
+            memcpy(&pixels[(y * SCENE_TEXTURE_SIZE + x) * 4], colors[(x / 8 + y / 8) % 2], 4);
+        }
+    }
+
+    const DecodedImage image = {
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .width = SCENE_TEXTURE_SIZE,
+        .height = SCENE_TEXTURE_SIZE,
+        .mipLevels = 1,
+        .generateMips = true,
+        .data = pixels,
+        .size = SCENE_TEXTURE_SIZE * SCENE_TEXTURE_SIZE * 4
+    };
+    const uint32_t handle = uploadTexture(
+        &window->textures,
+        &window->bindless,
+        &image,
+        DEFAULT_SAMPLER,
+        physicalDevice,
+        app->logicalDevice,
+        app->graphicsQueue
+    );
+
+    free(pixels);
+    return handle;
+}
+
+/**
+ * Uploads the meshes and textures and places the objects. Object sizes are
+ * picked so their summed area is overdraw times the screen.
+ **/
+void createStressScene(const GLFWApp *app, VulkanWindow *window, Benchmark *benchmark) {
+    StressScene *scene = &benchmark->scene;
+    const VkPhysicalDevice physicalDevice = ((VkPhysicalDevice *) app->physicalDevices->items)[app->
+        currentPhysicalDevice];
+    const double start = getTimeInSeconds();
+
+    const uint32_t firstMesh = window->meshBuffer.meshes.count;
+    for (uint32_t i = 0; i < scene->meshCount; i++) {
+        BufferVertices mesh = createSceneMesh(benchmark, 3 + i * 7 % (SCENE_MAX_SIDES - 2));
+        addMeshToMeshBuffer(
+            &window->meshBuffer,
+            mesh,
+            window->commandPool,
+            physicalDevice,
+            app->logicalDevice,
+            app->graphicsQueue
+        );
+        freeBufferVertices(&mesh);
+    }
+
+    scene->materials.count = scene->materialCount;
+    scene->materials.size = sizeof(SceneMaterial) * scene->materialCount;
+    scene->materials.items = malloc(scene->materials.size);
+    scene->materialTextures = malloc(sizeof(uint32_t) * scene->materialCount);
+    for (uint32_t i = 0; i < scene->materialCount; i++) {
+        SceneMaterial *material = &((SceneMaterial *) scene->materials.items)[i];
+        material->texture = createSceneTexture(app, window, benchmark, physicalDevice);
+        material->color = (Vector3D){
+            0.5f + 0.5f * nextBenchmarkFloat(benchmark),
+            0.5f + 0.5f * nextBenchmarkFloat(benchmark),
+            0.5f + 0.5f * nextBenchmarkFloat(benchmark)
+        };
+    }
+
+    // The screen is 2 x 2 and a mesh of radius 1 covers about pi, per object scale varies around the mean
+    const float meanScale = sqrtf(scene->overdraw * 4.0f / (3.14159265f * (float) scene->objectCount));
+    scene->objects.count = scene->objectCount;
+    scene->objects.size = sizeof(SceneObject) * scene->objectCount;
+    scene->objects.items = malloc(scene->objects.size);
+    scene->dynamicCount = 0;
+    for (uint32_t i = 0; i < scene->objectCount; i++) {
+        SceneObject *object = &((SceneObject *) scene->objects.items)[i];
+        const float scale = meanScale * (0.5f + nextBenchmarkFloat(benchmark));
+        object->mesh = firstMesh + (uint32_t) (nextBenchmarkFloat(benchmark) * (float) scene->meshCount);
+        object->material = (uint32_t) (nextBenchmarkFloat(benchmark) * (float) scene->materialCount);
+        object->data = (InstanceData){
+            .translation = {nextBenchmarkFloat(benchmark) * 2.0f - 1.0f, nextBenchmarkFloat(benchmark) * 2.0f - 1.0f},
+            .scale = {scale, scale},
+            .rotation = nextBenchmarkFloat(benchmark) * 6.2831853f,
+            .color = ((SceneMaterial *) scene->materials.items)[object->material].color,
+            .texture = 0,
+            // Spread over the depth range independently of push order, without taking from the seeded sequence
+            .depth = (float) (i * 2654435761u % scene->objectCount) / (float) scene->objectCount
+        };
+        object->dynamic = nextBenchmarkFloat(benchmark) < scene->dynamicFraction;
+        object->velocity = (Vector2D){nextBenchmarkFloat(benchmark) - 0.5f, nextBenchmarkFloat(benchmark) - 0.5f};
+        object->spin = (nextBenchmarkFloat(benchmark) - 0.5f) * 6.2831853f;
+        if (object->dynamic) scene->dynamicCount++;
+    }
+
+    scene->setupSeconds = getTimeInSeconds() - start;
+    printLn(
+        "Created the stress scene in %.3fs, %d objects are dynamic",
+        scene->setupSeconds,
+        scene->dynamicCount
+    );
+}
+
+/**
+ * Moves the dynamic objects and pushes every object for the next drawFrame.
+ **/
+void updateStressScene(VulkanWindow *window, StressScene *scene) {
+    const SceneMaterial *materials = (SceneMaterial *) scene->materials.items;
+    // Textures resolve to the default one until their upload retires
+    for (uint32_t i = 0; i < scene->materialCount; i++)
+        scene->materialTextures[i] = getTextureIndex(&window->textures, materials[i].texture);
+
+    SceneObject *objects = (SceneObject *) scene->objects.items;
+    for (uint32_t i = 0; i < scene->objectCount; i++) {
+        SceneObject *object = &objects[i];
+        if (object->dynamic) {
+            InstanceData *data = &object->data;
+            data->translation.x += object->velocity.x * SCENE_TIME_STEP;
+            data->translation.y += object->velocity.y * SCENE_TIME_STEP;
+            if (data->translation.x < -1.0f || data->translation.x > 1.0f) object->velocity.x = -object->velocity.x;
+            if (data->translation.y < -1.0f || data->translation.y > 1.0f) object->velocity.y = -object->velocity.y;
+            data->rotation += object->spin * SCENE_TIME_STEP;
+        }
+
+        object->data.texture = scene->materialTextures[object->material];
+        pushMeshInstance(&window->instances, object->mesh, object->data);
+    }
+}
+
+void destroyStressScene(StressScene *scene) {
+    free(scene->objects.items);
+    free(scene->materials.items);
+    free(scene->materialTextures);
+    scene->objects = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    scene->materials = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    scene->materialTextures = nullptr;
+}
+
+/**
+ * Frame times are measured between calls, so they cover the whole drawFrame
+ * including the wait on the frame's fence.
+ **/
+bool runSceneBenchmarkFrame(const GLFWApp *app, VulkanWindow *window, Benchmark *benchmark) {
+    StressScene *scene = &benchmark->scene;
+    const double now = getTimeInSeconds();
+
+    if (benchmark->frame == 0) {
+        createStressScene(app, window, benchmark);
+        resetPipelineStatisticsTotals(&window->pipelineStatistics);
+        resetDrawListStats(&window->drawList);
+        benchmark->startTime = getTimeInSeconds();
+        scene->lastFrameTime = benchmark->startTime;
+    } else {
+        const double frameSeconds = now - scene->lastFrameTime;
+        if (frameSeconds > scene->worstFrameSeconds) scene->worstFrameSeconds = frameSeconds;
+        scene->lastFrameTime = now;
+    }
+
+    if (benchmark->frame == benchmark->frameCount) {
+        const double elapsed = now - benchmark->startTime;
+        printLn(
+            "BENCHMARK scene: %d objects, %d meshes, %d materials, %.2f dynamic, %.2fx overdraw, "
+            "%d frames in %.3fs, %.1f fps, %.3f ms/frame (worst %.3f), %.3f ms/frame scene CPU, setup %.3fs, "
+            "%s, %.0f fragment invocations/frame",
+            scene->objectCount,
+            scene->meshCount,
+            scene->materialCount,
+            scene->dynamicFraction,
+            scene->overdraw,
+            benchmark->frameCount,
+            elapsed,
+            benchmark->frameCount / elapsed,
+            elapsed * 1000.0 / benchmark->frameCount,
+            scene->worstFrameSeconds * 1000.0,
+            scene->cpuSeconds * 1000.0 / benchmark->frameCount,
+            scene->setupSeconds,
+            window->instances.sortByDepth ? "front to back" : "push order",
+            getAverageFragmentInvocations(&window->pipelineStatistics)
+        );
+        printMemoryBudget(&memoryBudget);
+        printRenderGraphStats(&window->renderGraph);
+        printDrawListStats(&window->drawList);
+        destroyStressScene(scene);
+        return false;
+    }
+
+    const double updateStart = getTimeInSeconds();
+    updateStressScene(window, scene);
+    scene->cpuSeconds += getTimeInSeconds() - updateStart;
+
+    benchmark->frame++;
+    return true;
+}
+
+/**
+ * The particles are created with the window, this only times the frames.
+ * Run once with LEARNING_ASYNC_COMPUTE=0 to compare against the graphics queue.
+ **/
+bool runParticlesBenchmarkFrame(VulkanWindow *window, Benchmark *benchmark) {
+    const ParticleSystem *particles = &window->particles;
+    if (!particles->enabled) {
+        printLn("BENCHMARK particles: no particles, set LEARNING_PARTICLES");
+        return false;
+    }
+
+    if (benchmark->frame == 0) {
+        resetDrawListStats(&window->drawList);
+        benchmark->startTime = getTimeInSeconds();
+    }
+
+    if (benchmark->frame == benchmark->frameCount) {
+        const double elapsed = getTimeInSeconds() - benchmark->startTime;
+        printLn(
+            "BENCHMARK particles: %d particles on the %s queue, %d frames in %.3fs, %.1f fps, %.3f ms/frame, "
+            "%.0f particle updates/s",
+            particles->particleCount,
+            particles->async ? "async compute" : "graphics",
+            benchmark->frameCount,
+            elapsed,
+            benchmark->frameCount / elapsed,
+            elapsed * 1000.0 / benchmark->frameCount,
+            (double) particles->particleCount * benchmark->frameCount / elapsed
+        );
+        printMemoryBudget(&memoryBudget);
+        printRenderGraphStats(&window->renderGraph);
+        printDrawListStats(&window->drawList);
+        return false;
+    }
+
+    benchmark->frame++;
+    return true;
+}
+
+/**
+ * Called once per loop iteration before drawFrame.
+ * Returns false once the benchmark is done and the window should close.
+ **/
+bool runBenchmarkFrame(const GLFWApp *app, VulkanWindow *window, Benchmark *benchmark) {
+    if (benchmark->mode == BENCHMARK_NONE) return true;
+
+    if (benchmark->mode == BENCHMARK_OBJ_IMPORT) {
+        runObjImportBenchmark(benchmark);
+        return false;
+    }
+
+    if (benchmark->mode == BENCHMARK_MESH_PACK) {
+        runMeshPackBenchmark(benchmark);
+        return false;
+    }
+
+    if (benchmark->mode == BENCHMARK_SCENE) return runSceneBenchmarkFrame(app, window, benchmark);
+    if (benchmark->mode == BENCHMARK_PARTICLES) return runParticlesBenchmarkFrame(window, benchmark);
+
+    if (benchmark->frame == 0) {
+        resetDrawListStats(&window->drawList);
+        benchmark->startTime = getTimeInSeconds();
+    }
+
+    if (benchmark->frame == benchmark->frameCount) {
+        const double elapsed = getTimeInSeconds() - benchmark->startTime;
+        const double quads = (double) benchmark->quadCount * benchmark->frameCount;
+        printLn(
+            "BENCHMARK %s: %d frames in %.3fs, %.1f fps, %.0f quads/s",
+            benchmark->mode == BENCHMARK_BATCH_2D ? "batch2d" : "meshbuffers",
+            benchmark->frameCount,
+            elapsed,
+            benchmark->frameCount / elapsed,
+            quads / elapsed
+        );
+        printMemoryBudget(&memoryBudget);
+        printRenderGraphStats(&window->renderGraph);
+        printDrawListStats(&window->drawList);
+        return false;
+    }
+
+    if (benchmark->mode == BENCHMARK_BATCH_2D) runBatch2DBenchmarkFrame(app, window, benchmark);
+    else runMeshBuffersBenchmarkFrame(app, window, benchmark);
+
+    benchmark->frame++;
+    return true;
+}
+
+#endif //LEARNING_BENCHMARK_H
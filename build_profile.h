@@ -0,0 +1,48 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef BUILD_PROFILE_H
+#define BUILD_PROFILE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include "io.h"
+
+/**
+ * Debug and Release come from CMAKE_BUILD_TYPE, Release defines LEARNING_RELEASE.
+ * Release compiles out the debug messenger, per frame logging and the
+ * bounds checks below, validation layers are only loaded when
+ * LEARNING_VALIDATION=1 asks for them. LEARNING_VALIDATION=0 turns them off
+ * in Debug.
+ **/
+#ifdef LEARNING_RELEASE
+#define LEARNING_DEBUG_BUILD 0
+#else
+#define LEARNING_DEBUG_BUILD 1
+#endif
+
+/**
+ * Exits with code when condition fails, nothing is evaluated in Release.
+ * Only for checks that guard against caller mistakes, capacity checks that
+ * keep writes in bounds stay in both builds.
+ **/
+#if LEARNING_DEBUG_BUILD
+#define debugCheck(condition, code, ...) \
+    do { \
+        if (!(condition)) { \
+            printLn(__VA_ARGS__); \
+            exit(code); \
+        } \
+    } while (0)
+#else
+#define debugCheck(condition, code, ...) ((void) 0)
+#endif
+
+bool isValidationEnabled() {
+    const char *validation = getenv("LEARNING_VALIDATION");
+    if (validation == nullptr || validation[0] == '\0') return LEARNING_DEBUG_BUILD;
+    return strcmp(validation, "0") != 0;
+}
+
+#endif //BUILD_PROFILE_H
@@ -20,4 +20,47 @@ constexpr uint32_t MAX_FRAMES_IN_FLIGHT =  2;
 #define FAILED_TO_CREATE_SWAP_CHAIN_IMAGE_VIEWS 103
 #define FAILED_TO_CREATE_RENDER_PASS 125
 #define VULKAN_FAILED_TO_END_COMMAND_BUFFER 130
+// Mesh buffer errors start from 400
+#define MESH_BUFFER_CAPACITY_EXCEEDED 400
+#define MESH_NOT_FOUND 401
+#define EMPTY_MESH 402
+// Culling errors start from 450
+#define FAILED_TO_CREATE_CULLING_PASS 450
+#define CULLING_PASS_CAPACITY_EXCEEDED 451
+// Mesh import errors start from 500
+#define FAILED_TO_IMPORT_MESH 500
+#define FAILED_TO_LOAD_MESH_PACK 501
+// Texture errors start from 550
+#define FAILED_TO_CREATE_TEXTURE 550
+#define TEXTURE_CAPACITY_EXCEEDED 551
+// Bindless table errors start from 600
+#define FAILED_TO_CREATE_BINDLESS_TABLE 600
+#define BINDLESS_TABLE_CAPACITY_EXCEEDED 601
+#define DESCRIPTOR_INDEXING_NOT_SUPPORTED 602
+// Uniform ring errors start from 650
+#define FAILED_TO_CREATE_UNIFORM_RING 650
+#define UNIFORM_RING_CAPACITY_EXCEEDED 651
+// Render graph errors start from 700
+#define FAILED_TO_COMPILE_RENDER_GRAPH 700
+#define RENDER_GRAPH_CAPACITY_EXCEEDED 701
+// Particle errors start from 750
+#define FAILED_TO_CREATE_PARTICLES 750
+#define FAILED_TO_SUBMIT_PARTICLES 751
+// Depth buffer errors start from 800
+#define FAILED_TO_CREATE_DEPTH_IMAGE 800
+// Draw list errors start from 850
+#define DRAW_LIST_CAPACITY_EXCEEDED 850
+
+// Shared mesh storage sizes per window
+constexpr uint32_t MESH_BUFFER_VERTEX_CAPACITY = 262144;
+constexpr uint32_t MESH_BUFFER_INDEX_CAPACITY = 1048576;
+constexpr uint32_t MAX_INSTANCES_PER_FRAME = 65536;
+constexpr uint32_t MAX_CULLING_OBJECTS = 262144;
+constexpr uint32_t MAX_CULLING_MESHES = 4096;
+constexpr uint32_t MAX_BATCH_2D_QUADS = 65536;
+constexpr uint32_t MAX_TEXTURES = 1024;
+constexpr uint32_t MAX_SAMPLERS = 32;
+constexpr uint32_t MAX_BINDLESS_BUFFERS = 1024;
+constexpr uint32_t UNIFORM_RING_FRAME_SIZE = 65536;
+constexpr uint32_t MAX_PARTICLES = 1048576;
 #endif //CONSTANTS_H
@@ -8,6 +8,7 @@
 #include <GLFW/glfw3.h>
 #include "array.h"
 #include "vulkan_window.h"
+#include "shader_library.h"
 
 typedef struct GLFWApp {
     const char *name;
@@ -23,6 +24,18 @@ typedef struct GLFWApp {
     uint32_t queueFamilyIndex;
     uint32_t presentFamilyIndex;
     VkQueue presentQueue;
+    uint32_t computeFamilyIndex; // queueFamilyIndex when compute shares the graphics queue
+    VkQueue computeQueue;
+    VkBool32 drawIndirectCount; // Vulkan 1.2 feature needed by the GPU culling pass
+    VkBool32 descriptorIndexing; // Vulkan 1.2 features needed by the bindless table
+    VkBool32 textureCompressionBC; // Enabled when supported so DDS textures can stay compressed
+    float maxSamplerAnisotropy; // 0 when samplerAnisotropy isn't supported
+    VkBool32 synchronization2; // VK_KHR_synchronization2, the render graph falls back to vkCmdPipelineBarrier
+    VkBool32 pipelineStatistics; // pipelineStatisticsQuery, counts fragment invocations
+    VkPhysicalDeviceProperties physicalDeviceProperties; // Cached by selectPhysicalDevice
+    VkPhysicalDeviceFeatures physicalDeviceFeatures;
+    VkPhysicalDeviceVulkan12Features physicalDeviceFeatures12; // Supported, not enabled
+    ShaderLibrary shaders; // Freed once startup has built every pipeline
 } GLFWApp;
 
 
@@ -57,9 +70,9 @@ VkSurfaceKHR getCurrentSurface(const GLFWApp app) {
 
 void framebufferResizeCallback(GLFWwindow *window,const int width,const int height) {
     VulkanWindow *vulkanWindow = (VulkanWindow *) glfwGetWindowUserPointer(window);
-    vulkanWindow->resized = true;
-    vulkanWindow->extent.height = height;
-    vulkanWindow->extent.width = width;
+    // extent stays that of the swap chain until it's recreated, frames recorded
+    // before then still target the old framebuffers
+    noteResizeEvent(&vulkanWindow->resize, glfwGetTime());
 }
 
 void createVulkanWindow(const int width, const int height, const char *title, GLFWmonitor *monitor, GLFWApp *app) {
@@ -70,7 +83,14 @@ void createVulkanWindow(const int width, const int height, const char *title, GL
     VulkanWindow *vulkanWindow = malloc(winSize);
     vulkanWindow->window = glfwCreateWindow(width, height, title, monitor,NULL);
     vulkanWindow->currentFrame = 0;
-    vulkanWindow->resized = false;
+    // Created with the graphics pipeline, the first swap chain's framebuffers wait for it
+    vulkanWindow->renderPass = VK_NULL_HANDLE;
+    vulkanWindow->depthImages = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    createResizeController(&vulkanWindow->resize);
+    vulkanWindow->frameNumber = 0;
+    createRetireQueue(&vulkanWindow->retireQueue);
+    vulkanWindow->cullingPass.enabled = false;
+    vulkanWindow->camera = (Camera2D){.position = {0.0f, 0.0f}, .zoom = 1.0f, .rotation = 0.0f};
 
     addToUint32SizedMutableArray(
         winSize, // sizeof(window) should always equate to the same value roughly i.e 8
@@ -84,8 +104,8 @@ void createVulkanWindow(const int width, const int height, const char *title, GL
     } else app->currentWindow = app->windows->count - 1;
 
     glfwSetWindowUserPointer(vulkanWindow->window, vulkanWindow);
+    // Framebuffer size only, window size events duplicate it and are in screen coordinates
     glfwSetFramebufferSizeCallback(vulkanWindow->window, framebufferResizeCallback);
-    glfwSetWindowSizeCallback(vulkanWindow->window, framebufferResizeCallback);
 }
 
 #endif //LEARNING_GLFW_APP_H
@@ -35,4 +35,13 @@ void printErrLn(const char *format, ...) {
     fflush(stderr);
 }
 
+/**
+ * Verbose and per frame logging, compiled out of Release builds along with its arguments.
+ **/
+#ifdef LEARNING_RELEASE
+#define debugLn(...) ((void) 0)
+#else
+#define debugLn(...) printLn(__VA_ARGS__)
+#endif
+
 #endif //LEARNING_IO_H
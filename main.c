@@ -8,14 +8,53 @@
 #include "vulkan.h"
 #include "vulkan_window.h"
 #include "vulkan_callbacks.h"
+#include "benchmark.h"
 
 
 void cleanup(GLFWApp app);
 
 void startGLFWWindowLoop( GLFWApp *app) {
+    const InstanceData quadInstance = {
+        .translation = {0.0f, 0.0f},
+        .scale = {1.0f, 1.0f},
+        .rotation = 0.0f,
+        .color = {1.0f, 1.0f, 1.0f}
+    };
+
+    Benchmark benchmark = readBenchmarkConfig();
+    bool traceKeyDown = false;
+
     while (!glfwWindowShouldClose(getCurrentGLFWAppWindow(*app))) {
         glfwPollEvents();
 
+        // Nothing can be presented while minimized, sleep until an event instead of spinning
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(getCurrentGLFWAppWindow(*app), &width, &height);
+        if (width == 0 || height == 0) {
+            glfwWaitEvents();
+            continue;
+        }
+
+        // F12 writes what was traced so far without waiting for exit
+        const bool traceKey = glfwGetKey(getCurrentGLFWAppWindow(*app), GLFW_KEY_F12) == GLFW_PRESS;
+        if (traceKey && !traceKeyDown) writeTrace();
+        traceKeyDown = traceKey;
+
+        // Mesh 0 is the quad registered in initCommandBuffers
+        pushMeshInstance(&getCurrentVulkanWindow(*app)->instances, 0, quadInstance);
+
+        // Uploads textures decoded since the last frame, never waits on the decode threads
+        pollTextureLoads(
+            &getCurrentVulkanWindow(*app)->textures,
+            &getCurrentVulkanWindow(*app)->bindless,
+            ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+            app->logicalDevice,
+            app->graphicsQueue
+        );
+
+        if (!runBenchmarkFrame(app, getCurrentVulkanWindow(*app), &benchmark))
+            glfwSetWindowShouldClose(getCurrentGLFWAppWindow(*app), GLFW_TRUE);
+
         drawFrame(
             app,
             getCurrentVulkanWindow(*app),
@@ -36,16 +75,34 @@ int main(void) {
         .currentPhysicalDevice = -1,
         .queueFamilyIndex = -1,
         .presentFamilyIndex = -1,
+        .computeFamilyIndex = -1,
         .graphicsQueue = VK_NULL_HANDLE,
-        .presentQueue = VK_NULL_HANDLE
+        .presentQueue = VK_NULL_HANDLE,
+        .computeQueue = VK_NULL_HANDLE,
+        .drawIndirectCount = VK_FALSE,
+        .descriptorIndexing = VK_FALSE,
+        .textureCompressionBC = VK_FALSE,
+        .maxSamplerAnisotropy = 0.0f,
+        .synchronization2 = VK_FALSE,
+        .pipelineStatistics = VK_FALSE
     };
+    startStartupTrace();
+    startTrace();
+    // Before anything Vulkan, every object is created and destroyed through it
+    initHostAllocator();
+    // Read while the instance and device are created, nothing before pipeline creation needs them
+    startShaderLibrary(&app.shaders, readParticleCount() > 0 ? 1u << SHADER_PARTICLES_COMPUTE : 0);
+
+    uint32_t phase = beginStartupPhase("glfw");
     glfwInit();
     disableOpenGL();
+    endStartupPhase(phase);
     //disableResize();
 
+    // Debug utils only feeds the debug messenger, which Release compiles out
     const Uint32SizedMutableArray enabledExtensionsArray = {
         .size = sizeof(char) * 18,
-        .count = 1,
+        .count = LEARNING_DEBUG_BUILD && isValidationEnabled() ? 1 : 0,
         .items = (Any*) (
             (char *[]){
                 VK_EXT_DEBUG_UTILS_EXTENSION_NAME
@@ -67,7 +124,9 @@ int main(void) {
         )
     };
 
+    phase = beginStartupPhase("instance");
     initVulkan(&app, enabledExtensionsArray, requestLayerExtensions);
+    endStartupPhase(phase);
     prepareVulkanApp(&app);
     startGLFWWindowLoop(&app);
     cleanup(app);
@@ -77,15 +136,6 @@ int main(void) {
 
 void cleanup(const GLFWApp app) {
     printLn("Cleaning up");
-    VkAllocationCallbacks callbacks = {
-        .pUserData = "Smile More",
-        .pfnAllocation = pfnvkAllocationFunction,
-        .pfnReallocation = pfnvkReallocationFunction,
-        .pfnFree = pfnvkFreeFunction,
-        .pfnInternalAllocation = fn_vkInternalAllocationNotification,
-        .pfnInternalFree = pfn_vkInternalFreeNotification
-    };
-
     for (uint32_t i = 0; i < app.windows->count; i++) {
         VulkanWindow *vulkanWindow = getVulkanWindowAt(i, app);
 
@@ -94,39 +144,44 @@ void cleanup(const GLFWApp app) {
         printLn("Second level cleanup");
 
 
-        callbacks.pUserData = "vkDestroyRenderPass";
-        vkDestroyRenderPass(app.logicalDevice, vulkanWindow->renderPass, &callbacks);
-        callbacks.pUserData = "vkDestroyPipeline";
-        vkDestroyPipeline(app.logicalDevice, vulkanWindow->graphicsPipeline, nullptr);
-        callbacks.pUserData = "vkDestroyPipelineLayout";
-        vkDestroyPipelineLayout(app.logicalDevice, vulkanWindow->pipelineLayout, &callbacks);
+        vkDestroyRenderPass(app.logicalDevice, vulkanWindow->renderPass, hostAllocator);
+        vkDestroyPipeline(app.logicalDevice, vulkanWindow->graphicsPipeline, hostAllocator);
+        vkDestroyPipelineLayout(app.logicalDevice, vulkanWindow->pipelineLayout, hostAllocator);
 
-        vkDestroyCommandPool(app.logicalDevice, vulkanWindow->commandPool, nullptr);
+        vkDestroyCommandPool(app.logicalDevice, vulkanWindow->commandPool, hostAllocator);
 
         for (size_t k = 0; k < MAX_FRAMES_IN_FLIGHT; k++) {
             vkDestroySemaphore(
                 app.logicalDevice,
                 ((VkSemaphore *) vulkanWindow->imageAvailableSemaphores.items)[k],
-                nullptr
+                hostAllocator
             );
             vkDestroySemaphore(
                 app.logicalDevice,
                 ((VkSemaphore *) vulkanWindow->renderFinishedSemaphores.items)[k],
-                nullptr
+                hostAllocator
             );
             vkDestroyFence(
                 app.logicalDevice,
                 ((VkFence *) vulkanWindow->inFlightFences.items)[k],
-                nullptr
+                hostAllocator
             );
         }
 
 
-        vkDestroyBuffer(app.logicalDevice, vulkanWindow->indexBuffer, nullptr);
-        vkFreeMemory(app.logicalDevice,  vulkanWindow->indexBufferMemory, nullptr);
-
-        vkFreeMemory(app.logicalDevice, vulkanWindow->vertexBufferMemory, nullptr);
-        vkDestroyBuffer(app.logicalDevice, vulkanWindow->vertexBuffer, nullptr);
+        destroyBatch2D(app.logicalDevice, &vulkanWindow->batch2D);
+        destroyDrawList(&vulkanWindow->drawList);
+        destroyTextures(app.logicalDevice, &vulkanWindow->textures);
+        destroyBindlessTable(app.logicalDevice, &vulkanWindow->bindless);
+        destroyUniformRing(app.logicalDevice, &vulkanWindow->uniformRing);
+        destroyRetireQueue(app.logicalDevice, &vulkanWindow->retireQueue);
+        destroyCullingPass(app.logicalDevice, &vulkanWindow->cullingPass);
+        destroyParticleSystem(app.logicalDevice, &vulkanWindow->particles);
+        destroyMeshInstances(app.logicalDevice, &vulkanWindow->instances);
+        destroyMeshBuffer(app.logicalDevice, &vulkanWindow->meshBuffer);
+        destroyGpuTrace(app.logicalDevice, &vulkanWindow->gpuTrace);
+        destroyPipelineStatistics(app.logicalDevice, &vulkanWindow->pipelineStatistics);
+        destroyRenderGraph(app.logicalDevice, &vulkanWindow->renderGraph);
 
 
         glfwDestroyWindow(vulkanWindow->window);
@@ -0,0 +1,290 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+
+/**
+ * Index and vertex reordering run on unpacked BufferVertices before they go
+ * to the mesh buffer or into a mesh pack.
+ * Every step only depends on the input so the same mesh always comes out
+ * the same, whether optimized by the converter or at load time.
+ *
+ * Overdraw ordering is not done: every vertex of an instance is at the
+ * instance's depth, so under the LESS_OR_EQUAL depth test no triangle of a
+ * mesh can reject another whatever their order. Overdraw between instances is
+ * cut by drawing them front to back instead, see MeshInstances.
+ **/
+#define MESH_OPTIMIZER_CACHE_SIZE 32 // LRU cache modelled by the Forsyth scores
+#define MESH_OPTIMIZER_MAX_VALENCE 32 // Valence score table size, larger valences use the last entry
+#define MESH_ACMR_CACHE_SIZE 16 // FIFO cache used to report ACMR
+
+typedef struct MeshCacheStats {
+    float acmr; // Cache misses per triangle, 0.5 is ideal for large regular grids
+    float atvr; // Cache misses per vertex, 1.0 is ideal
+} MeshCacheStats;
+
+typedef struct MeshOptimizeStats {
+    MeshCacheStats before;
+    MeshCacheStats after;
+    uint32_t vertexCountBefore;
+    uint32_t vertexCountAfter; // Unreferenced vertices are dropped
+} MeshOptimizeStats;
+
+MeshCacheStats analyzeVertexCache(
+    const uint32_t *indices,
+    const uint32_t indexCount,
+    const uint32_t vertexCount,
+    const uint32_t cacheSize
+) {
+    // timestamps[v] is the miss count at which v entered the FIFO
+    uint32_t *timestamps = calloc(vertexCount == 0 ? 1 : vertexCount, sizeof(uint32_t));
+    uint32_t misses = 0;
+
+    for (uint32_t i = 0; i < indexCount; i++) {
+        const uint32_t vertex = indices[i];
+        if (timestamps[vertex] == 0 || misses + 1 - timestamps[vertex] > cacheSize) {
+            misses++;
+            timestamps[vertex] = misses;
+        }
+    }
+
+    free(timestamps);
+
+    return (MeshCacheStats){
+        .acmr = indexCount < 3 ? 0.0f : (float) misses / (float) (indexCount / 3),
+        .atvr = vertexCount == 0 ? 0.0f : (float) misses / (float) vertexCount
+    };
+}
+
+typedef struct ForsythScores {
+    float cache[MESH_OPTIMIZER_CACHE_SIZE];
+    float valence[MESH_OPTIMIZER_MAX_VALENCE + 1];
+} ForsythScores;
+
+ForsythScores createForsythScores() {
+    ForsythScores scores;
+
+    for (uint32_t i = 0; i < MESH_OPTIMIZER_CACHE_SIZE; i++) {
+        // The last triangle's vertices get a fixed score so the order within it doesn't matter
+        scores.cache[i] = i < 3
+                              ? 0.75f
+                              : powf(
+                                  1.0f - (float) (i - 3) / (float) (MESH_OPTIMIZER_CACHE_SIZE - 3),
+                                  1.5f
+                              );
+    }
+
+    scores.valence[0] = 0.0f;
+    for (uint32_t i = 1; i <= MESH_OPTIMIZER_MAX_VALENCE; i++) scores.valence[i] = 2.0f * powf((float) i, -0.5f);
+
+    return scores;
+}
+
+float getForsythVertexScore(const ForsythScores *scores, const int32_t cachePosition, const uint32_t valence) {
+    if (valence == 0) return -1.0f;
+
+    const float cacheScore = cachePosition < 0 ? 0.0f : scores->cache[cachePosition];
+    return cacheScore + scores->valence[valence < MESH_OPTIMIZER_MAX_VALENCE ? valence : MESH_OPTIMIZER_MAX_VALENCE];
+}
+
+/**
+ * Tom Forsyth's linear speed vertex cache optimization. Triangles are emitted
+ * greedily by the score of their vertices, which rewards vertices in a
+ * simulated LRU cache and vertices with few triangles left.
+ * Ties go to the lowest triangle index so the result is deterministic.
+ **/
+void optimizeVertexCache(uint32_t *indices, const uint32_t indexCount, const uint32_t vertexCount) {
+    const uint32_t triangleCount = indexCount / 3;
+    if (triangleCount == 0 || vertexCount == 0) return;
+
+    const ForsythScores scores = createForsythScores();
+
+    // Vertex to triangle adjacency, packed with a counting pass
+    uint32_t *valences = calloc(vertexCount, sizeof(uint32_t));
+    uint32_t *adjacencyOffsets = malloc(sizeof(uint32_t) * (vertexCount + 1));
+    uint32_t *adjacency = malloc(sizeof(uint32_t) * triangleCount * 3);
+
+    for (uint32_t i = 0; i < triangleCount * 3; i++) valences[indices[i]]++;
+
+    adjacencyOffsets[0] = 0;
+    for (uint32_t v = 0; v < vertexCount; v++) adjacencyOffsets[v + 1] = adjacencyOffsets[v] + valences[v];
+
+    uint32_t *fill = calloc(vertexCount, sizeof(uint32_t));
+    for (uint32_t t = 0; t < triangleCount; t++)
+        for (uint32_t k = 0; k < 3; k++) {
+            const uint32_t v = indices[t * 3 + k];
+            adjacency[adjacencyOffsets[v] + fill[v]++] = t;
+        }
+    free(fill);
+
+    int32_t *cachePositions = malloc(sizeof(int32_t) * vertexCount);
+    float *vertexScores = malloc(sizeof(float) * vertexCount);
+    for (uint32_t v = 0; v < vertexCount; v++) {
+        cachePositions[v] = -1;
+        vertexScores[v] = getForsythVertexScore(&scores, -1, valences[v]);
+    }
+
+    float *triangleScores = malloc(sizeof(float) * triangleCount);
+    bool *emitted = calloc(triangleCount, sizeof(bool));
+    for (uint32_t t = 0; t < triangleCount; t++)
+        triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] +
+                            vertexScores[indices[t * 3 + 2]];
+
+    uint32_t *output = malloc(sizeof(uint32_t) * triangleCount * 3);
+    uint32_t cache[MESH_OPTIMIZER_CACHE_SIZE + 3];
+    uint32_t cacheCount = 0;
+    uint32_t scanCursor = 0;
+
+    int64_t best = 0;
+    for (uint32_t t = 1; t < triangleCount; t++) if (triangleScores[t] > triangleScores[best]) best = t;
+
+    for (uint32_t outputTriangle = 0; outputTriangle < triangleCount; outputTriangle++) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left, continue with the next unemitted one
+            while (emitted[scanCursor]) scanCursor++;
+            best = scanCursor;
+        }
+
+        const uint32_t *triangle = &indices[best * 3];
+        memcpy(&output[outputTriangle * 3], triangle, sizeof(uint32_t) * 3);
+        emitted[best] = true;
+
+        // Drop the triangle from its vertices' adjacency
+        for (uint32_t k = 0; k < 3; k++) {
+            const uint32_t v = triangle[k];
+            uint32_t *triangles = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t i = 0; i < valences[v]; i++) {
+                if (triangles[i] == (uint32_t) best) {
+                    triangles[i] = triangles[valences[v] - 1];
+                    break;
+                }
+            }
+            valences[v]--;
+        }
+
+        // The triangle's vertices move to the front, everything else shifts back
+        uint32_t newCache[MESH_OPTIMIZER_CACHE_SIZE + 3];
+        uint32_t newCacheCount = 0;
+        for (uint32_t k = 0; k < 3; k++) newCache[newCacheCount++] = triangle[k];
+        for (uint32_t i = 0; i < cacheCount; i++) {
+            const uint32_t v = cache[i];
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2]) newCache[newCacheCount++] = v;
+        }
+
+        for (uint32_t i = 0; i < newCacheCount; i++) {
+            const uint32_t v = newCache[i];
+            cachePositions[v] = i < MESH_OPTIMIZER_CACHE_SIZE ? (int32_t) i : -1;
+            vertexScores[v] = getForsythVertexScore(&scores, cachePositions[v], valences[v]);
+        }
+
+        // Only triangles touching the cache changed score, pick the best of them
+        best = -1;
+        float bestScore = -1.0f;
+        for (uint32_t i = 0; i < newCacheCount; i++) {
+            const uint32_t v = newCache[i];
+            const uint32_t *triangles = &adjacency[adjacencyOffsets[v]];
+            for (uint32_t j = 0; j < valences[v]; j++) {
+                const uint32_t t = triangles[j];
+                const float score = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] +
+                                    vertexScores[indices[t * 3 + 2]];
+                triangleScores[t] = score;
+                if (score > bestScore || (score == bestScore && t < (uint32_t) best)) {
+                    bestScore = score;
+                    best = t;
+                }
+            }
+        }
+
+        cacheCount = newCacheCount < MESH_OPTIMIZER_CACHE_SIZE ? newCacheCount : MESH_OPTIMIZER_CACHE_SIZE;
+        memcpy(cache, newCache, sizeof(uint32_t) * cacheCount);
+    }
+
+    memcpy(indices, output, sizeof(uint32_t) * triangleCount * 3);
+
+    free(output);
+    free(emitted);
+    free(triangleScores);
+    free(vertexScores);
+    free(cachePositions);
+    free(adjacency);
+    free(adjacencyOffsets);
+    free(valences);
+}
+
+/**
+ * Renumbers vertices in the order the indices first use them so vertex
+ * fetches walk the buffer forward. Returns the new vertex count,
+ * vertices no index refers to are dropped.
+ **/
+uint32_t optimizeVertexFetch(Vertex *vertices, const uint32_t vertexCount, uint32_t *indices, const uint32_t indexCount) {
+    uint32_t *remap = malloc(sizeof(uint32_t) * (vertexCount == 0 ? 1 : vertexCount));
+    memset(remap, 0xFF, sizeof(uint32_t) * vertexCount);
+
+    Vertex *reordered = malloc(sizeof(Vertex) * (vertexCount == 0 ? 1 : vertexCount));
+    uint32_t nextVertex = 0;
+
+    for (uint32_t i = 0; i < indexCount; i++) {
+        const uint32_t vertex = indices[i];
+        if (remap[vertex] == UINT32_MAX) {
+            reordered[nextVertex] = vertices[vertex];
+            remap[vertex] = nextVertex++;
+        }
+        indices[i] = remap[vertex];
+    }
+
+    memcpy(vertices, reordered, sizeof(Vertex) * nextVertex);
+
+    free(reordered);
+    free(remap);
+    return nextVertex;
+}
+
+/**
+ * Cache order then fetch order, in place. bufferVertices has to be unpacked
+ * and own its arrays since the vertex count can shrink.
+ **/
+MeshOptimizeStats optimizeMesh(BufferVertices *bufferVertices) {
+    Vertex *vertices = (Vertex *) bufferVertices->vertices.items;
+    uint32_t *indices = (uint32_t *) bufferVertices->indices.items;
+    const uint32_t indexCount = bufferVertices->indices.count;
+
+    MeshOptimizeStats stats = {
+        .before = analyzeVertexCache(indices, indexCount, bufferVertices->vertices.count, MESH_ACMR_CACHE_SIZE),
+        .vertexCountBefore = bufferVertices->vertices.count
+    };
+
+    optimizeVertexCache(indices, indexCount, bufferVertices->vertices.count);
+    bufferVertices->vertices.count = optimizeVertexFetch(
+        vertices,
+        bufferVertices->vertices.count,
+        indices,
+        indexCount
+    );
+    bufferVertices->vertices.size = sizeof(Vertex) * bufferVertices->vertices.count;
+
+    stats.after = analyzeVertexCache(indices, indexCount, bufferVertices->vertices.count, MESH_ACMR_CACHE_SIZE);
+    stats.vertexCountAfter = bufferVertices->vertices.count;
+
+    printLn(
+        "Optimized mesh of %d triangles: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f",
+        indexCount / 3,
+        stats.before.acmr,
+        stats.after.acmr,
+        stats.before.atvr,
+        stats.after.atvr
+    );
+
+    return stats;
+}
+
+#endif //MESH_OPTIMIZER_H
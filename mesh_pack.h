@@ -0,0 +1,393 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef MESH_PACK_H
+#define MESH_PACK_H
+
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_vertex_format.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+
+/**
+ * Binary mesh pack, everything already in the mesh buffer layout so loading
+ * is a mmap and two memcpys into staging.
+ *
+ *   MeshPackHeader
+ *   MeshPackEntry[meshCount]
+ *   vertex block, PackedVertex, MESH_PACK_ALIGNMENT aligned
+ *   index block, 16 or 32 bit per mesh, MESH_PACK_ALIGNMENT aligned
+ *
+ * Mesh indices are relative to the mesh's first vertex like in the mesh buffer
+ * and each mesh's indices start on a 4 byte boundary of the index block,
+ * so keeping the block's offsets keeps every mesh addressable at its width.
+ * Everything is little endian, packs are a build artifact and not portable.
+ **/
+#define MESH_PACK_MAGIC 0x4B504D4Cu // "LMPK"
+#define MESH_PACK_VERSION 2 // 2 added texture coordinates
+#define MESH_PACK_ALIGNMENT 4096
+
+typedef struct MeshPackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t meshCount;
+    uint32_t vertexStride; // sizeof(PackedVertex) of the writer
+    uint64_t vertexBlockOffset;
+    uint64_t vertexBlockSize;
+    uint64_t indexBlockOffset;
+    uint64_t indexBlockSize;
+} MeshPackHeader;
+
+typedef struct MeshPackEntry {
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint64_t indexOffset; // Bytes into the index block
+    uint32_t indexCount;
+    uint32_t indexType; // VkIndexType
+    Vector2D center;
+    float radius;
+    uint32_t padding;
+} MeshPackEntry;
+
+typedef struct MeshPack {
+    const uint8_t *mapping;
+    size_t size;
+    const MeshPackHeader *header;
+    const MeshPackEntry *entries;
+} MeshPack;
+
+uint64_t alignMeshPackOffset(const uint64_t offset, const uint64_t alignment) {
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+/**
+ * Converts meshes, for example straight out of importObj, into a pack at path.
+ * The pack is written next to path and renamed over it so a crash never
+ * leaves a truncated pack behind.
+ **/
+bool writeMeshPack(const char *path, const BufferVertices *meshes, const uint32_t meshCount) {
+    MeshPackHeader header = {
+        .magic = MESH_PACK_MAGIC,
+        .version = MESH_PACK_VERSION,
+        .meshCount = meshCount,
+        .vertexStride = sizeof(PackedVertex)
+    };
+
+    MeshPackEntry *entries = calloc(meshCount == 0 ? 1 : meshCount, sizeof(MeshPackEntry));
+    uint64_t vertexCount = 0;
+    uint64_t indexBytes = 0;
+
+    for (uint32_t i = 0; i < meshCount; i++) {
+        if (meshes[i].packed) {
+            printLn("Mesh %d is already packed, convert the source meshes", i);
+            free(entries);
+            return false;
+        }
+
+        const VkIndexType indexType = selectIndexType(meshes[i].vertices.count);
+        indexBytes = alignMeshPackOffset(indexBytes, sizeof(uint32_t));
+
+        entries[i] = (MeshPackEntry){
+            .firstVertex = (uint32_t) vertexCount,
+            .vertexCount = meshes[i].vertices.count,
+            .indexOffset = indexBytes,
+            .indexCount = meshes[i].indices.count,
+            .indexType = (uint32_t) indexType,
+            .padding = 0
+        };
+        computeMeshBounds(meshes[i], &entries[i].center, &entries[i].radius);
+
+        vertexCount += meshes[i].vertices.count;
+        indexBytes += (uint64_t) getIndexSize(indexType) * meshes[i].indices.count;
+    }
+
+    header.vertexBlockOffset = alignMeshPackOffset(
+        sizeof(MeshPackHeader) + sizeof(MeshPackEntry) * meshCount,
+        MESH_PACK_ALIGNMENT
+    );
+    header.vertexBlockSize = sizeof(PackedVertex) * vertexCount;
+    header.indexBlockOffset = alignMeshPackOffset(
+        header.vertexBlockOffset + header.vertexBlockSize,
+        MESH_PACK_ALIGNMENT
+    );
+    header.indexBlockSize = indexBytes;
+
+    const size_t fileSize = header.indexBlockOffset + header.indexBlockSize;
+    uint8_t *contents = calloc(1, fileSize);
+    memcpy(contents, &header, sizeof(MeshPackHeader));
+    memcpy(contents + sizeof(MeshPackHeader), entries, sizeof(MeshPackEntry) * meshCount);
+
+    for (uint32_t i = 0; i < meshCount; i++) {
+        packVertices(
+            (Vertex *) meshes[i].vertices.items,
+            (PackedVertex *) (contents + header.vertexBlockOffset) + entries[i].firstVertex,
+            meshes[i].vertices.count
+        );
+        packIndices(
+            (uint32_t *) meshes[i].indices.items,
+            contents + header.indexBlockOffset + entries[i].indexOffset,
+            meshes[i].indices.count,
+            (VkIndexType) entries[i].indexType
+        );
+    }
+    free(entries);
+
+    char temporaryPath[4096];
+    snprintf(temporaryPath, sizeof(temporaryPath), "%s.tmp", path);
+
+    bool written = false;
+    FILE *file = fopen(temporaryPath, "wb");
+    if (file != nullptr) {
+        written = fwrite(contents, 1, fileSize, file) == fileSize;
+        written = fclose(file) == 0 && written;
+    }
+    free(contents);
+
+    if (!written || rename(temporaryPath, path) != 0) {
+        printLn("Failed to write mesh pack %s", path);
+        remove(temporaryPath);
+        return false;
+    }
+
+    printLn("Wrote mesh pack %s with %d meshes, %lu bytes", path, meshCount, (unsigned long) fileSize);
+    return true;
+}
+
+bool validateMeshPack(const MeshPack *pack) {
+    if (pack->size < sizeof(MeshPackHeader)) return false;
+
+    const MeshPackHeader *header = pack->header;
+    if (header->magic != MESH_PACK_MAGIC || header->version != MESH_PACK_VERSION) return false;
+    if (header->vertexStride != sizeof(PackedVertex)) return false;
+    // Sizes are checked against what's left after the offset, offset + size could wrap around
+    const uint64_t entriesEnd = sizeof(MeshPackHeader) + sizeof(MeshPackEntry) * (uint64_t) header->meshCount;
+    if (entriesEnd > pack->size) return false;
+    if (header->vertexBlockOffset < entriesEnd || header->indexBlockOffset < entriesEnd) return false;
+    if (header->vertexBlockOffset % MESH_PACK_ALIGNMENT != 0 || header->indexBlockOffset % MESH_PACK_ALIGNMENT != 0)
+        return false;
+    if (header->vertexBlockSize % sizeof(PackedVertex) != 0) return false;
+    if (header->vertexBlockOffset > pack->size || header->vertexBlockSize > pack->size - header->vertexBlockOffset)
+        return false;
+    if (header->indexBlockOffset > pack->size || header->indexBlockSize > pack->size - header->indexBlockOffset)
+        return false;
+
+    const uint64_t vertexCount = header->vertexBlockSize / sizeof(PackedVertex);
+    for (uint32_t i = 0; i < header->meshCount; i++) {
+        const MeshPackEntry entry = pack->entries[i];
+        if (entry.indexType != VK_INDEX_TYPE_UINT16 && entry.indexType != VK_INDEX_TYPE_UINT32) return false;
+        if ((uint64_t) entry.firstVertex + entry.vertexCount > vertexCount) return false;
+        if (entry.indexOffset % getIndexSize((VkIndexType) entry.indexType) != 0) return false;
+        if (entry.indexOffset > header->indexBlockSize) return false;
+        if ((uint64_t) getIndexSize((VkIndexType) entry.indexType) * entry.indexCount >
+            header->indexBlockSize - entry.indexOffset)
+            return false;
+    }
+
+    return true;
+}
+
+/**
+ * Maps the pack at path. Nothing is read until the blocks are touched,
+ * so opening a pack costs the same whatever its size.
+ **/
+bool openMeshPack(const char *path, MeshPack *pack) {
+    const int file = open(path, O_RDONLY);
+    if (file < 0) return false;
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+        close(file);
+        return false;
+    }
+
+    pack->size = (size_t) fileStat.st_size;
+    const void *mapping = mmap(nullptr, pack->size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapping == MAP_FAILED) return false;
+
+    pack->mapping = mapping;
+    pack->header = (const MeshPackHeader *) pack->mapping;
+    pack->entries = (const MeshPackEntry *) (pack->mapping + sizeof(MeshPackHeader));
+
+    if (!validateMeshPack(pack)) {
+        printLn("%s is not a valid mesh pack", path);
+        munmap((void *) pack->mapping, pack->size);
+        return false;
+    }
+
+    return true;
+}
+
+void closeMeshPack(MeshPack *pack) {
+    munmap((void *) pack->mapping, pack->size);
+    pack->mapping = nullptr;
+    pack->size = 0;
+}
+
+/**
+ * A packed BufferVertices pointing into the mapping, valid until closeMeshPack.
+ * Not to be passed to freeBufferVertices.
+ **/
+BufferVertices getMeshPackBufferVertices(const MeshPack *pack, const uint32_t meshIndex) {
+    const MeshPackEntry entry = pack->entries[meshIndex];
+    const uint32_t indexSize = getIndexSize((VkIndexType) entry.indexType);
+
+    return (BufferVertices){
+        .vertices = {
+            .items = (Any *) (pack->mapping + pack->header->vertexBlockOffset +
+                              sizeof(PackedVertex) * entry.firstVertex),
+            .size = sizeof(PackedVertex) * entry.vertexCount,
+            .count = entry.vertexCount
+        },
+        .indices = {
+            .items = (Any *) (pack->mapping + pack->header->indexBlockOffset + entry.indexOffset),
+            .size = (size_t) indexSize * entry.indexCount,
+            .count = entry.indexCount
+        },
+        .packed = true,
+        .indexType = (VkIndexType) entry.indexType,
+        .center = entry.center,
+        .radius = entry.radius
+    };
+}
+
+/**
+ * Uploads every mesh of the pack with one staging buffer and two copies:
+ * the vertex and index blocks are copied whole, the mesh ranges are offset
+ * by where the blocks landed. Returns the mesh index of the pack's first mesh.
+ **/
+uint32_t addMeshPackToMeshBuffer(
+    MeshBuffer *meshBuffer,
+    const MeshPack *pack,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    const MeshPackHeader *header = pack->header;
+    const uint32_t vertexCount = (uint32_t) (header->vertexBlockSize / sizeof(PackedVertex));
+    // The pack keeps 32 bit indices 4 byte aligned relative to its block
+    const uint32_t indexBase = (uint32_t) alignMeshPackOffset(meshBuffer->indexBytes, sizeof(uint32_t));
+
+    if (
+        meshBuffer->vertexCount + (uint64_t) vertexCount > meshBuffer->vertexCapacity ||
+        indexBase + header->indexBlockSize > sizeof(uint32_t) * (uint64_t) meshBuffer->indexCapacity
+    ) {
+        printLn("Mesh buffer is full. Can't add a mesh pack of %d vertices", vertexCount);
+        exit(MESH_BUFFER_CAPACITY_EXCEEDED);
+    }
+
+    const VkDeviceSize stagingSize = header->vertexBlockSize + header->indexBlockSize;
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    VkMemoryRequirements memRequirements;
+
+    createBuffer(
+        &stagingBuffer,
+        stagingSize == 0 ? 1 : stagingSize,
+        &stagingBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    Any data;
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, VK_WHOLE_SIZE, 0, &data);
+    memcpy(data, pack->mapping + header->vertexBlockOffset, header->vertexBlockSize);
+    memcpy((char *) data + header->vertexBlockSize, pack->mapping + header->indexBlockOffset, header->indexBlockSize);
+    vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+    const VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool, logicalDevice);
+
+    if (header->vertexBlockSize > 0) {
+        const VkBufferCopy vertexRegion = {
+            .srcOffset = 0,
+            .dstOffset = sizeof(PackedVertex) * meshBuffer->vertexCount,
+            .size = header->vertexBlockSize
+        };
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshBuffer->vertexBuffer, 1, &vertexRegion);
+    }
+    if (header->indexBlockSize > 0) {
+        const VkBufferCopy indexRegion = {
+            .srcOffset = header->vertexBlockSize,
+            .dstOffset = indexBase,
+            .size = header->indexBlockSize
+        };
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshBuffer->indexBuffer, 1, &indexRegion);
+    }
+
+    endSingleTimeCommands(commandBuffer, commandPool, logicalDevice, graphicsQueue);
+
+    vkDestroyBuffer(logicalDevice, stagingBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, stagingBufferMemory);
+
+    const uint32_t firstMesh = meshBuffer->meshes.count;
+    for (uint32_t i = 0; i < header->meshCount; i++) {
+        const MeshPackEntry entry = pack->entries[i];
+        const uint32_t indexSize = getIndexSize((VkIndexType) entry.indexType);
+        appendMeshRange(meshBuffer, (MeshRange){
+            .indexType = (VkIndexType) entry.indexType,
+            .firstIndex = (uint32_t) ((indexBase + entry.indexOffset) / indexSize),
+            .indexCount = entry.indexCount,
+            .vertexOffset = (int32_t) (meshBuffer->vertexCount + entry.firstVertex),
+            .vertexCount = entry.vertexCount,
+            .center = entry.center,
+            .radius = entry.radius
+        });
+    }
+
+    meshBuffer->vertexCount += vertexCount;
+    meshBuffer->indexBytes = indexBase + (uint32_t) header->indexBlockSize;
+
+    printLn("Added mesh pack of %d meshes to mesh buffer", header->meshCount);
+
+    return firstMesh;
+}
+
+/**
+ * Opens, uploads and closes the pack at path, exits when it can't be loaded.
+ **/
+uint32_t loadMeshPackToMeshBuffer(
+    MeshBuffer *meshBuffer,
+    const char *path,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    MeshPack pack;
+    if (!openMeshPack(path, &pack)) {
+        printLn("Failed to load mesh pack %s", path);
+        exit(FAILED_TO_LOAD_MESH_PACK);
+    }
+
+    const uint32_t firstMesh = addMeshPackToMeshBuffer(
+        meshBuffer,
+        &pack,
+        commandPool,
+        physicalDevice,
+        logicalDevice,
+        graphicsQueue
+    );
+
+    closeMeshPack(&pack);
+    return firstMesh;
+}
+
+#endif //MESH_PACK_H
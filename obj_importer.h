@@ -0,0 +1,604 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef OBJ_IMPORTER_H
+#define OBJ_IMPORTER_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_mesh_buffer.h"
+#include "mesh_optimizer.h"
+
+/**
+ * Wavefront OBJ importer for the 2D vertex layout.
+ * Only v, vt and f lines are read: x and y of each position, the optional
+ * r g b that some exporters append to v lines (white otherwise) and u v of
+ * each texture coordinate, flipped to Vulkan's top left origin.
+ * Faces are fan triangulated, negative (relative) indices are supported and
+ * normal references are skipped since Vertex has no use for them.
+ *
+ * The file is mmapped and split on line boundaries into one chunk per worker
+ * thread. Chunks are parsed in parallel, then merged and deduplicated on the
+ * calling thread: every distinct Vertex gets one slot in the output.
+ **/
+typedef struct ObjChunk {
+    const char *begin;
+    const char *end;
+    Uint32SizedMutableArray vertices; // Vertex, size is the allocated bytes
+    Uint32SizedMutableArray texcoords; // Vector2D, size is the allocated bytes
+    Uint32SizedMutableArray corners; // int32_t position and texcoord pairs, see encodeObjCorner
+    uint32_t vertexBase; // Vertices in the chunks before this one
+    uint32_t texcoordBase; // Texture coordinates in the chunks before this one
+    bool failed;
+} ObjChunk;
+
+typedef struct ObjImportStats {
+    size_t fileSize;
+    uint32_t threadCount;
+    uint32_t positionCount;
+    uint32_t triangleCount;
+    uint32_t vertexCount; // After deduplication
+    double parseSeconds;
+    double mergeSeconds;
+} ObjImportStats;
+
+#define OBJ_MAX_THREADS 64
+// Files below this are parsed on a single chunk, threads would cost more than they save
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+
+double getObjTimeInSeconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+void reserveObjArray(Uint32SizedMutableArray *array, const size_t itemSize, const uint32_t count) {
+    if (itemSize * count <= array->size) return;
+
+    size_t size = array->size == 0 ? itemSize * 1024 : array->size;
+    while (size < itemSize * count) size *= 2;
+
+    array->items = realloc(array->items, size);
+    array->size = size;
+}
+
+static const double OBJ_POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/**
+ * Decimal float parser for the subset OBJ writers emit: optional sign, digits,
+ * optional fraction and optional exponent. Up to 19 significant digits are
+ * accumulated exactly and scaled once, which is plenty for float output.
+ * Returns the position after the number or nullptr when there is none.
+ **/
+const char *parseObjFloat(const char *cursor, const char *end, float *value) {
+    bool negative = false;
+    if (cursor < end && (*cursor == '-' || *cursor == '+')) negative = *cursor++ == '-';
+
+    uint64_t mantissa = 0;
+    int32_t exponent = 0;
+    uint32_t digits = 0;
+    const char *start = cursor;
+
+    for (; cursor < end && (uint8_t) (*cursor - '0') < 10; cursor++) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (uint64_t) (*cursor - '0');
+            if (mantissa != 0) digits++;
+        } else exponent++;
+    }
+
+    if (cursor < end && *cursor == '.') {
+        cursor++;
+        for (; cursor < end && (uint8_t) (*cursor - '0') < 10; cursor++) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (uint64_t) (*cursor - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            }
+        }
+    }
+
+    if (cursor == start || (cursor == start + 1 && *start == '.')) return nullptr;
+
+    if (cursor < end && (*cursor == 'e' || *cursor == 'E')) {
+        const char *exponentStart = cursor++;
+        bool negativeExponent = false;
+        if (cursor < end && (*cursor == '-' || *cursor == '+')) negativeExponent = *cursor++ == '-';
+
+        if (cursor < end && (uint8_t) (*cursor - '0') < 10) {
+            int32_t explicitExponent = 0;
+            for (; cursor < end && (uint8_t) (*cursor - '0') < 10; cursor++)
+                if (explicitExponent < 10000) explicitExponent = explicitExponent * 10 + (*cursor - '0');
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+        } else cursor = exponentStart;
+    }
+
+    double result = (double) mantissa;
+    if (mantissa != 0) {
+        while (exponent > 22) {
+            result *= 1e22;
+            exponent -= 22;
+        }
+        while (exponent < -22) {
+            result /= 1e22;
+            exponent += 22;
+        }
+        result = exponent < 0 ? result / OBJ_POWERS_OF_TEN[-exponent] : result * OBJ_POWERS_OF_TEN[exponent];
+    }
+
+    *value = (float) (negative ? -result : result);
+    return cursor;
+}
+
+const char *parseObjInt(const char *cursor, const char *end, int64_t *value) {
+    bool negative = false;
+    if (cursor < end && (*cursor == '-' || *cursor == '+')) negative = *cursor++ == '-';
+
+    const char *start = cursor;
+    int64_t result = 0;
+    for (; cursor < end && (uint8_t) (*cursor - '0') < 10; cursor++)
+        if (result < INT32_MAX) result = result * 10 + (*cursor - '0');
+
+    if (cursor == start) return nullptr;
+
+    *value = negative ? -result : result;
+    return cursor;
+}
+
+const char *skipObjSpaces(const char *cursor, const char *end) {
+    while (cursor < end && (*cursor == ' ' || *cursor == '\t' || *cursor == '\r')) cursor++;
+    return cursor;
+}
+
+const char *skipObjLine(const char *cursor, const char *end) {
+    const char *newline = memchr(cursor, '\n', (size_t) (end - cursor));
+    return newline == nullptr ? end : newline + 1;
+}
+
+/**
+ * A chunk can't resolve relative indices on its own since it doesn't know how
+ * many positions came before it. Absolute indices are stored 0 based and
+ * relative ones as their chunk local index (negative when reaching into an
+ * earlier chunk) minus OBJ_RELATIVE_CORNER, the merge adds the chunk's
+ * vertexBase to those. Limits a file to 2^30 positions.
+ **/
+#define OBJ_RELATIVE_CORNER (1 << 30)
+#define OBJ_NO_TEXCOORD INT32_MAX // Corner without a vt reference
+
+int32_t encodeObjCorner(const int64_t index, const uint32_t chunkVertexCount, bool *failed) {
+    if (index > 0 && index <= OBJ_RELATIVE_CORNER) return (int32_t) (index - 1);
+
+    const int64_t local = (int64_t) chunkVertexCount + index;
+    if (index >= 0 || local < -OBJ_RELATIVE_CORNER) {
+        *failed = true;
+        return 0;
+    }
+    return (int32_t) (local - OBJ_RELATIVE_CORNER);
+}
+
+int64_t decodeObjCorner(const int32_t corner, const uint32_t vertexBase) {
+    return corner < 0 ? (int64_t) vertexBase + corner + OBJ_RELATIVE_CORNER : corner;
+}
+
+const char *parseObjVertex(ObjChunk *chunk, const char *cursor, const char *end) {
+    float values[6] = {0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f};
+    uint32_t count = 0;
+
+    while (count < 6) {
+        cursor = skipObjSpaces(cursor, end);
+        const char *next = parseObjFloat(cursor, end, &values[count]);
+        if (next == nullptr) break;
+        cursor = next;
+        count++;
+    }
+
+    if (count < 2) chunk->failed = true;
+    // v x y z r g b, anything else keeps the default white
+    if (count != 6) values[3] = values[4] = values[5] = 1.0f;
+
+    reserveObjArray(&chunk->vertices, sizeof(Vertex), chunk->vertices.count + 1);
+    ((Vertex *) chunk->vertices.items)[chunk->vertices.count++] = (Vertex){
+        {values[0], values[1]},
+        {values[3], values[4], values[5]},
+        {0.0f, 0.0f}
+    };
+
+    return skipObjLine(cursor, end);
+}
+
+const char *parseObjTexcoord(ObjChunk *chunk, const char *cursor, const char *end) {
+    float values[2] = {0.0f, 0.0f};
+
+    for (uint32_t i = 0; i < 2; i++) {
+        cursor = skipObjSpaces(cursor, end);
+        const char *next = parseObjFloat(cursor, end, &values[i]);
+        if (next == nullptr) {
+            // vt u alone is valid, v defaults to 0
+            if (i == 0) chunk->failed = true;
+            break;
+        }
+        cursor = next;
+    }
+
+    reserveObjArray(&chunk->texcoords, sizeof(Vector2D), chunk->texcoords.count + 1);
+    ((Vector2D *) chunk->texcoords.items)[chunk->texcoords.count++] = (Vector2D){values[0], 1.0f - values[1]};
+
+    return skipObjLine(cursor, end);
+}
+
+const char *parseObjFace(ObjChunk *chunk, const char *cursor, const char *end) {
+    int32_t first[2] = {}, previous[2] = {};
+    uint32_t count = 0;
+
+    for (;;) {
+        cursor = skipObjSpaces(cursor, end);
+
+        int64_t index;
+        const char *next = parseObjInt(cursor, end, &index);
+        if (next == nullptr) break;
+        cursor = next;
+
+        // v/vt/vn, v//vn or plain v
+        int32_t texcoord = OBJ_NO_TEXCOORD;
+        if (cursor < end && *cursor == '/') {
+            int64_t texcoordIndex;
+            next = parseObjInt(cursor + 1, end, &texcoordIndex);
+            if (next != nullptr) {
+                texcoord = encodeObjCorner(texcoordIndex, chunk->texcoords.count, &chunk->failed);
+                cursor = next;
+            }
+        }
+        // Skip the vn reference
+        while (cursor < end && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n') cursor++;
+
+        const int32_t corner[2] = {encodeObjCorner(index, chunk->vertices.count, &chunk->failed), texcoord};
+        if (count == 0) memcpy(first, corner, sizeof(corner));
+        else if (count >= 2) {
+            reserveObjArray(&chunk->corners, sizeof(int32_t), chunk->corners.count + 6);
+            int32_t *corners = &((int32_t *) chunk->corners.items)[chunk->corners.count];
+            memcpy(&corners[0], first, sizeof(corner));
+            memcpy(&corners[2], previous, sizeof(corner));
+            memcpy(&corners[4], corner, sizeof(corner));
+            chunk->corners.count += 6;
+        }
+        memcpy(previous, corner, sizeof(corner));
+        count++;
+    }
+
+    if (count < 3) chunk->failed = true;
+
+    return skipObjLine(cursor, end);
+}
+
+Any parseObjChunk(Any data) {
+    ObjChunk *chunk = data;
+    const char *cursor = chunk->begin;
+    const char *end = chunk->end;
+
+    while (cursor < end) {
+        cursor = skipObjSpaces(cursor, end);
+        if (cursor + 1 >= end) break;
+
+        if (cursor[0] == 'v' && (cursor[1] == ' ' || cursor[1] == '\t'))
+            cursor = parseObjVertex(chunk, cursor + 2, end);
+        else if (cursor[0] == 'v' && cursor[1] == 't' && cursor + 2 < end && (cursor[2] == ' ' || cursor[2] == '\t'))
+            cursor = parseObjTexcoord(chunk, cursor + 3, end);
+        else if (cursor[0] == 'f' && (cursor[1] == ' ' || cursor[1] == '\t'))
+            cursor = parseObjFace(chunk, cursor + 2, end);
+        else
+            cursor = skipObjLine(cursor, end);
+    }
+
+    return nullptr;
+}
+
+uint32_t getObjThreadCount(const size_t fileSize) {
+    const long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    uint32_t threadCount = processors < 1 ? 1 : (uint32_t) processors;
+    if (threadCount > OBJ_MAX_THREADS) threadCount = OBJ_MAX_THREADS;
+
+    const size_t chunks = fileSize / OBJ_MIN_CHUNK_SIZE;
+    if (chunks < threadCount) threadCount = chunks < 1 ? 1 : (uint32_t) chunks;
+
+    return threadCount;
+}
+
+uint32_t hashObjVertex(const Vertex *vertex) {
+    // FNV-1a over the vertex bytes
+    const uint8_t *bytes = (const uint8_t *) vertex;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(Vertex); i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * Returns the output index of vertex, adding it when it hasn't been seen.
+ * table is open addressing over output indices, UINT32_MAX marks empty slots.
+ **/
+uint32_t insertObjVertex(
+    uint32_t *table,
+    const uint32_t tableMask,
+    Vertex *vertices,
+    uint32_t *vertexCount,
+    const Vertex *vertex
+) {
+    uint32_t slot = hashObjVertex(vertex) & tableMask;
+
+    while (table[slot] != UINT32_MAX) {
+        if (memcmp(&vertices[table[slot]], vertex, sizeof(Vertex)) == 0) return table[slot];
+        slot = (slot + 1) & tableMask;
+    }
+
+    vertices[*vertexCount] = *vertex;
+    table[slot] = *vertexCount;
+    return (*vertexCount)++;
+}
+
+const ObjChunk *findObjChunk(const ObjChunk *chunks, const uint32_t chunkCount, const uint32_t position) {
+    uint32_t low = 0, high = chunkCount - 1;
+    while (low < high) {
+        const uint32_t middle = (low + high + 1) / 2;
+        if (chunks[middle].vertexBase <= position) low = middle;
+        else high = middle - 1;
+    }
+    return &chunks[low];
+}
+
+/**
+ * Texture coordinates are far fewer than positions in practice,
+ * so they are gathered into one array rather than searched by chunk.
+ **/
+Vector2D *gatherObjTexcoords(const ObjChunk *chunks, const uint32_t chunkCount, const uint32_t texcoordCount) {
+    Vector2D *texcoords = malloc(sizeof(Vector2D) * (texcoordCount == 0 ? 1 : texcoordCount));
+    for (uint32_t i = 0; i < chunkCount; i++)
+        memcpy(
+            &texcoords[chunks[i].texcoordBase],
+            chunks[i].texcoords.items,
+            sizeof(Vector2D) * chunks[i].texcoords.count
+        );
+    return texcoords;
+}
+
+/**
+ * Builds the BufferVertices from the parsed chunks. Without texture
+ * coordinates each position is hashed once and every face corner referencing
+ * it afterwards is a single array lookup. With them the same position can end
+ * up in several vertices, so every corner is hashed as position plus uv.
+ **/
+bool mergeObjChunks(ObjChunk *chunks, const uint32_t chunkCount, BufferVertices *bufferVertices, ObjImportStats *stats) {
+    uint32_t positionCount = 0;
+    uint32_t texcoordCount = 0;
+    uint32_t cornerCount = 0;
+    for (uint32_t i = 0; i < chunkCount; i++) {
+        if (chunks[i].failed) return false;
+        chunks[i].vertexBase = positionCount;
+        chunks[i].texcoordBase = texcoordCount;
+        positionCount += chunks[i].vertices.count;
+        texcoordCount += chunks[i].texcoords.count;
+        cornerCount += chunks[i].corners.count / 2;
+    }
+
+    // Every corner can be a distinct vertex once texture coordinates split positions
+    const uint32_t maxVertexCount = texcoordCount == 0 ? positionCount : cornerCount;
+    uint32_t tableSize = 1024;
+    while (tableSize < maxVertexCount * 2) tableSize *= 2;
+
+    uint32_t *table = malloc(sizeof(uint32_t) * tableSize);
+    uint32_t *remap = malloc(sizeof(uint32_t) * (positionCount == 0 ? 1 : positionCount));
+    memset(table, 0xFF, sizeof(uint32_t) * tableSize);
+    memset(remap, 0xFF, sizeof(uint32_t) * positionCount);
+
+    Vector2D *texcoords = texcoordCount == 0 ? nullptr : gatherObjTexcoords(chunks, chunkCount, texcoordCount);
+    Vertex *vertices = malloc(sizeof(Vertex) * (maxVertexCount == 0 ? 1 : maxVertexCount));
+    uint32_t *indices = malloc(sizeof(uint32_t) * (cornerCount == 0 ? 1 : cornerCount));
+    uint32_t vertexCount = 0;
+    uint32_t indexCount = 0;
+    bool valid = true;
+
+    for (uint32_t c = 0; c < chunkCount && valid; c++) {
+        const int32_t *corners = (int32_t *) chunks[c].corners.items;
+
+        for (uint32_t i = 0; i < chunks[c].corners.count; i += 2) {
+            const int64_t corner = decodeObjCorner(corners[i], chunks[c].vertexBase);
+            if (corner < 0 || corner >= positionCount) {
+                valid = false;
+                break;
+            }
+            const uint32_t position = (uint32_t) corner;
+
+            if (texcoords != nullptr) {
+                const ObjChunk *chunk = findObjChunk(chunks, chunkCount, position);
+                Vertex vertex = ((Vertex *) chunk->vertices.items)[position - chunk->vertexBase];
+
+                if (corners[i + 1] != OBJ_NO_TEXCOORD) {
+                    const int64_t texcoord = decodeObjCorner(corners[i + 1], chunks[c].texcoordBase);
+                    if (texcoord < 0 || texcoord >= texcoordCount) {
+                        valid = false;
+                        break;
+                    }
+                    vertex.uv = texcoords[texcoord];
+                }
+
+                indices[indexCount++] = insertObjVertex(table, tableSize - 1, vertices, &vertexCount, &vertex);
+                continue;
+            }
+
+            if (remap[position] == UINT32_MAX) {
+                const ObjChunk *chunk = findObjChunk(chunks, chunkCount, position);
+                const Vertex *vertex = &((Vertex *) chunk->vertices.items)[position - chunk->vertexBase];
+                remap[position] = insertObjVertex(table, tableSize - 1, vertices, &vertexCount, vertex);
+            }
+
+            indices[indexCount++] = remap[position];
+        }
+    }
+
+    free(table);
+    free(remap);
+    free(texcoords);
+
+    if (!valid) {
+        free(vertices);
+        free(indices);
+        return false;
+    }
+
+    bufferVertices->vertices = (Uint32SizedMutableArray){
+        .items = (Any *) vertices,
+        .size = sizeof(Vertex) * vertexCount,
+        .count = vertexCount
+    };
+    bufferVertices->indices = (Uint32SizedMutableArray){
+        .items = (Any *) indices,
+        .size = sizeof(uint32_t) * indexCount,
+        .count = indexCount
+    };
+
+    bufferVertices->packed = false;
+
+    stats->positionCount = positionCount;
+    stats->triangleCount = indexCount / 3;
+    stats->vertexCount = vertexCount;
+    return true;
+}
+
+/**
+ * Parses path into bufferVertices, whose arrays are then owned by the caller
+ * (freeBufferVertices). Returns false for files that can't be opened or parsed.
+ **/
+bool importObj(const char *path, BufferVertices *bufferVertices, ObjImportStats *stats) {
+    const int file = open(path, O_RDONLY);
+    if (file < 0) {
+        printLn("Failed to open mesh %s", path);
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(file, &fileStat) != 0 || fileStat.st_size == 0) {
+        printLn("Mesh %s is empty", path);
+        close(file);
+        return false;
+    }
+
+    const size_t fileSize = (size_t) fileStat.st_size;
+    const char *mapped = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (mapped == MAP_FAILED) {
+        printLn("Failed to map mesh %s", path);
+        return false;
+    }
+    // Advice values aren't flags, each one is its own call
+    madvise((void *) mapped, fileSize, MADV_SEQUENTIAL);
+    madvise((void *) mapped, fileSize, MADV_WILLNEED);
+
+    const double parseStart = getObjTimeInSeconds();
+
+    const uint32_t threadCount = getObjThreadCount(fileSize);
+    ObjChunk chunks[OBJ_MAX_THREADS] = {};
+    pthread_t threads[OBJ_MAX_THREADS];
+    bool started[OBJ_MAX_THREADS] = {}; // Chunks whose thread failed to start were parsed inline
+
+    // Chunk boundaries are moved forward to the next line start
+    const char *end = mapped + fileSize;
+    const char *cursor = mapped;
+    for (uint32_t i = 0; i < threadCount; i++) {
+        const char *chunkEnd = i == threadCount - 1 ? end : mapped + fileSize / threadCount * (i + 1);
+        if (chunkEnd < cursor) chunkEnd = cursor;
+        if (chunkEnd < end) chunkEnd = skipObjLine(chunkEnd, end);
+
+        chunks[i].begin = cursor;
+        chunks[i].end = chunkEnd;
+        cursor = chunkEnd;
+    }
+
+    for (uint32_t i = 1; i < threadCount; i++) {
+        started[i] = pthread_create(&threads[i], nullptr, parseObjChunk, &chunks[i]) == 0;
+        if (!started[i]) parseObjChunk(&chunks[i]);
+    }
+    parseObjChunk(&chunks[0]);
+    for (uint32_t i = 1; i < threadCount; i++) if (started[i]) pthread_join(threads[i], nullptr);
+
+    const double mergeStart = getObjTimeInSeconds();
+
+    *stats = (ObjImportStats){.fileSize = fileSize, .threadCount = threadCount};
+    const bool merged = mergeObjChunks(chunks, threadCount, bufferVertices, stats);
+    stats->parseSeconds = mergeStart - parseStart;
+    stats->mergeSeconds = getObjTimeInSeconds() - mergeStart;
+
+    for (uint32_t i = 0; i < threadCount; i++) {
+        free(chunks[i].vertices.items);
+        free(chunks[i].texcoords.items);
+        free(chunks[i].corners.items);
+    }
+    munmap((void *) mapped, fileSize);
+
+    if (!merged) {
+        printLn("Mesh %s has malformed vertices or faces", path);
+        return false;
+    }
+
+    printLn(
+        "Imported %s: %d triangles, %d vertices (%d positions) on %d threads",
+        path,
+        stats->triangleCount,
+        stats->vertexCount,
+        stats->positionCount,
+        threadCount
+    );
+    return true;
+}
+
+void freeBufferVertices(BufferVertices *bufferVertices) {
+    free(bufferVertices->vertices.items);
+    free(bufferVertices->indices.items);
+    bufferVertices->vertices = (Uint32SizedMutableArray){};
+    bufferVertices->indices = (Uint32SizedMutableArray){};
+}
+
+/**
+ * Imports and optimizes path, then uploads it through the mesh buffer's
+ * staging path, which packs the vertices and narrows the indices on the way.
+ * Returns the mesh index, exits when the file can't be imported.
+ **/
+uint32_t importObjToMeshBuffer(
+    MeshBuffer *meshBuffer,
+    const char *path,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    BufferVertices bufferVertices;
+    ObjImportStats stats;
+
+    if (!importObj(path, &bufferVertices, &stats)) exit(FAILED_TO_IMPORT_MESH);
+    optimizeMesh(&bufferVertices);
+
+    const uint32_t meshIndex = addMeshToMeshBuffer(
+        meshBuffer,
+        bufferVertices,
+        commandPool,
+        physicalDevice,
+        logicalDevice,
+        graphicsQueue
+    );
+
+    freeBufferVertices(&bufferVertices);
+    return meshIndex;
+}
+
+#endif //OBJ_IMPORTER_H
@@ -0,0 +1,138 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "array.h"
+#include "io.h"
+#include "vulkan_callbacks.h"
+#include "trace.h"
+
+/**
+ * One VkPipelineCache behind every graphics and compute pipeline, loaded
+ * from LEARNING_PIPELINE_CACHE (pipeline_cache.bin by default) when the
+ * file was written by the same driver and device, and saved at exit.
+ * Pipelines are built on the startup worker and the main thread at once,
+ * the cache is internally synchronized so both use it directly.
+ **/
+#define PIPELINE_CACHE_DEFAULT_PATH "pipeline_cache.bin"
+
+VkPipelineCache pipelineCache = VK_NULL_HANDLE;
+
+const char *getPipelineCachePath() {
+    const char *path = getenv("LEARNING_PIPELINE_CACHE");
+    return path == nullptr || *path == '\0' ? PIPELINE_CACHE_DEFAULT_PATH : path;
+}
+
+/**
+ * Data from another driver or device is ignored rather than handed over,
+ * drivers are only required to reject it, not to do so gracefully.
+ **/
+bool isPipelineCacheCompatible(const Uint32SizedMutableArray data, const VkPhysicalDeviceProperties *properties) {
+    if (data.size < sizeof(VkPipelineCacheHeaderVersionOne)) return false;
+
+    VkPipelineCacheHeaderVersionOne header;
+    memcpy(&header, data.items, sizeof(header));
+    return header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+           header.vendorID == properties->vendorID &&
+           header.deviceID == properties->deviceID &&
+           memcmp(header.pipelineCacheUUID, properties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+void createPipelineCache(const VkPhysicalDeviceProperties *properties, const VkDevice logicalDevice) {
+    TRACE_ZONE("load pipeline cache");
+    Uint32SizedMutableArray data = {.items = nullptr, .size = 0, .count = 0};
+
+    FILE *file = fopen(getPipelineCachePath(), "rb");
+    if (file != nullptr) {
+        fseek(file, 0, SEEK_END);
+        data.size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data.items = malloc(data.size);
+        data.size = fread(data.items, 1, data.size, file);
+        fclose(file);
+    }
+
+    const bool compatible = isPipelineCacheCompatible(data, properties);
+    const VkPipelineCacheCreateInfo cacheInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = compatible ? data.size : 0,
+        .pInitialData = compatible ? data.items : nullptr
+    };
+    if (vkCreatePipelineCache(logicalDevice, &cacheInfo, hostAllocator, &pipelineCache) != VK_SUCCESS) {
+        // Pipelines are still created without one, only slower
+        printLn("Failed to create the pipeline cache");
+        pipelineCache = VK_NULL_HANDLE;
+    } else if (compatible) printLn("Loaded %d bytes of pipeline cache from %s", data.size, getPipelineCachePath());
+    else if (file != nullptr) printLn("Ignored %s, it was written for another driver or device", getPipelineCachePath());
+
+    free(data.items);
+}
+
+/**
+ * The shader module only lives as long as the call, pipelines keep what they need.
+ **/
+VkResult createComputePipeline(
+    const VkDevice logicalDevice,
+    const Uint32SizedMutableArray computeShader,
+    const VkPipelineLayout pipelineLayout,
+    VkPipeline *pipeline
+) {
+    const VkShaderModuleCreateInfo moduleInfo = {
+        .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+        .codeSize = computeShader.size,
+        .pCode = (const uint32_t *) computeShader.items
+    };
+
+    VkShaderModule computeShaderModule;
+    VkResult result = vkCreateShaderModule(logicalDevice, &moduleInfo, hostAllocator, &computeShaderModule);
+    if (result != VK_SUCCESS) return result;
+
+    const VkComputePipelineCreateInfo pipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = computeShaderModule,
+            .pName = "main"
+        },
+        .layout = pipelineLayout
+    };
+    result = vkCreateComputePipelines(logicalDevice, pipelineCache, 1, &pipelineInfo, hostAllocator, pipeline);
+
+    vkDestroyShaderModule(logicalDevice, computeShaderModule, hostAllocator);
+    return result;
+}
+
+/**
+ * Writes the cache for the next run and destroys it, before the device goes.
+ **/
+void destroyPipelineCache(const VkDevice logicalDevice) {
+    if (pipelineCache == VK_NULL_HANDLE) return;
+
+    size_t size = 0;
+    if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &size, nullptr) == VK_SUCCESS && size > 0) {
+        void *data = malloc(size);
+        FILE *file = nullptr;
+        if (vkGetPipelineCacheData(logicalDevice, pipelineCache, &size, data) == VK_SUCCESS)
+            file = fopen(getPipelineCachePath(), "wb");
+
+        if (file != nullptr) {
+            fwrite(data, 1, size, file);
+            fclose(file);
+            printLn("Saved %zu bytes of pipeline cache to %s", size, getPipelineCachePath());
+        } else printLn("Failed to save the pipeline cache to %s", getPipelineCachePath());
+        free(data);
+    }
+
+    vkDestroyPipelineCache(logicalDevice, pipelineCache, hostAllocator);
+    pipelineCache = VK_NULL_HANDLE;
+}
+
+#endif //PIPELINE_CACHE_H
@@ -0,0 +1,949 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "build_profile.h"
+#include "vulkan_any.h"
+#include "vulkan_vertex.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "vulkan_retire_queue.h"
+#include "trace.h"
+
+/**
+ * Passes declare what they read and write, the graph works out the rest.
+ * Accesses to a resource happen in the order their passes were added in,
+ * a pass reads what passes added before it wrote and nothing written after.
+ * compileRenderGraph sorts the passes by those dependencies, drops every
+ * pass nothing exported depends on and works out how long each transient
+ * image lives.
+ * Transient images whose lifetimes don't overlap share memory, they're
+ * created at the extent executeRenderGraph is given and recreated when it
+ * changes. Imported resources are owned elsewhere and set every frame.
+ * executeRenderGraph records one batch of barriers before each pass with
+ * only the hazards its accesses need, layout transitions included.
+ * Barriers go through synchronization2 when the device has it, through
+ * vkCmdPipelineBarrier otherwise, so passes must stick to the stage and
+ * access bits both APIs share.
+ **/
+#define RENDER_GRAPH_MAX_PASSES 16
+#define RENDER_GRAPH_MAX_RESOURCES 32
+#define RENDER_GRAPH_MAX_ACCESSES 8 // Per pass, one per resource
+
+constexpr uint32_t RENDER_GRAPH_NONE = UINT32_MAX;
+
+typedef enum RenderGraphResourceType {
+    RENDER_GRAPH_BUFFER,
+    RENDER_GRAPH_IMAGE
+} RenderGraphResourceType;
+
+typedef void (*RenderGraphExecute)(VkCommandBuffer commandBuffer, Any userData);
+
+typedef struct RenderGraphAccess {
+    uint32_t resource;
+    VkPipelineStageFlags2 stages;
+    VkAccessFlags2 access;
+    VkImageLayout layout; // Images only
+    bool write;
+} RenderGraphAccess;
+
+typedef struct RenderGraphPass {
+    const char *name;
+    RenderGraphExecute execute;
+    Any userData;
+    RenderGraphAccess accesses[RENDER_GRAPH_MAX_ACCESSES];
+    uint32_t accessCount;
+} RenderGraphPass;
+
+/**
+ * Where a resource's last accesses left it within the frame being recorded.
+ **/
+typedef struct RenderGraphState {
+    VkPipelineStageFlags2 writeStages; // Last write, layout transitions included
+    VkAccessFlags2 writeAccess; // Still to be made available
+    VkPipelineStageFlags2 readStages; // Reads since the last write
+    VkPipelineStageFlags2 visibleStages; // Stages the last write was made visible to
+    VkAccessFlags2 visibleAccess;
+    VkImageLayout layout;
+} RenderGraphState;
+
+typedef struct RenderGraphResource {
+    const char *name;
+    RenderGraphResourceType type;
+    bool imported;
+    bool exported; // Read outside the graph, passes writing it are never culled
+    VkImageLayout finalLayout; // What an exported image is left in
+    VkBuffer buffer;
+    VkImage image;
+    VkImageView view;
+    VkImageAspectFlags aspect;
+    VkFormat format; // Transient images
+    VkImageUsageFlags usage;
+    VkDeviceSize offset; // Into transientMemory
+    VkDeviceSize size;
+    uint32_t aliasOf; // Transient that last used the memory before it within a frame
+    uint32_t firstPass; // Positions in order, RENDER_GRAPH_NONE when no pass left uses it
+    uint32_t lastPass;
+    RenderGraphState state;
+} RenderGraphResource;
+
+typedef struct RenderGraphStats {
+    uint32_t passes;
+    uint32_t culledPasses;
+    uint32_t barrierBatches; // Last frame
+    uint32_t imageBarriers;
+    uint32_t bufferBarriers;
+    uint32_t transientImages;
+    VkDeviceSize transientBytes; // Memory actually allocated
+    VkDeviceSize unaliasedBytes; // What the transients would take without aliasing
+} RenderGraphStats;
+
+typedef struct RenderGraph {
+    VkPhysicalDevice physicalDevice;
+    VkDevice logicalDevice;
+    PFN_vkCmdPipelineBarrier2 pipelineBarrier2; // nullptr without synchronization2
+    RenderGraphPass passes[RENDER_GRAPH_MAX_PASSES];
+    uint32_t passCount;
+    RenderGraphResource resources[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t resourceCount;
+    uint32_t order[RENDER_GRAPH_MAX_PASSES]; // Passes left after culling, in execution order
+    uint32_t orderCount;
+    bool compiled;
+    VkExtent2D extent; // Transients were created at it
+    VkDeviceMemory transientMemory;
+    RenderGraphStats stats;
+} RenderGraph;
+
+void createRenderGraph(
+    RenderGraph *graph,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const bool synchronization2
+) {
+    memset(graph, 0, sizeof(RenderGraph));
+    graph->physicalDevice = physicalDevice;
+    graph->logicalDevice = logicalDevice;
+    graph->transientMemory = VK_NULL_HANDLE;
+
+    // Loaded under the extension's name, the instance only asks for Vulkan 1.2
+    graph->pipelineBarrier2 = synchronization2
+                                  ? (PFN_vkCmdPipelineBarrier2) vkGetDeviceProcAddr(
+                                      logicalDevice,
+                                      "vkCmdPipelineBarrier2KHR"
+                                  )
+                                  : nullptr;
+    printLn("Render graph barriers use %s", graph->pipelineBarrier2 ? "synchronization2" : "vkCmdPipelineBarrier");
+}
+
+uint32_t addRenderGraphResource(RenderGraph *graph, const RenderGraphResource resource) {
+    if (graph->resourceCount == RENDER_GRAPH_MAX_RESOURCES) {
+        printLn("Render graph already has %d resources", RENDER_GRAPH_MAX_RESOURCES);
+        exit(RENDER_GRAPH_CAPACITY_EXCEEDED);
+    }
+
+    graph->resources[graph->resourceCount] = resource;
+    graph->resources[graph->resourceCount].aliasOf = RENDER_GRAPH_NONE;
+    graph->resources[graph->resourceCount].firstPass = RENDER_GRAPH_NONE;
+    graph->resources[graph->resourceCount].lastPass = RENDER_GRAPH_NONE;
+    graph->compiled = false;
+    return graph->resourceCount++;
+}
+
+/**
+ * A buffer owned outside the graph, set with setRenderGraphBuffer every frame.
+ **/
+uint32_t importRenderGraphBuffer(RenderGraph *graph, const char *name) {
+    return addRenderGraphResource(graph, (RenderGraphResource){
+        .name = name,
+        .type = RENDER_GRAPH_BUFFER,
+        .imported = true
+    });
+}
+
+/**
+ * An image owned outside the graph, set with setRenderGraphImage every frame.
+ * Images with a finalLayout other than undefined are exported and
+ * transitioned to it once the last pass is recorded.
+ **/
+uint32_t importRenderGraphImage(
+    RenderGraph *graph,
+    const char *name,
+    const VkImageAspectFlags aspect,
+    const VkImageLayout finalLayout
+) {
+    return addRenderGraphResource(graph, (RenderGraphResource){
+        .name = name,
+        .type = RENDER_GRAPH_IMAGE,
+        .imported = true,
+        .exported = finalLayout != VK_IMAGE_LAYOUT_UNDEFINED,
+        .finalLayout = finalLayout,
+        .aspect = aspect
+    });
+}
+
+/**
+ * An image that only lives within a frame, at the extent the graph is
+ * executed with. Its contents are undefined when its first pass starts.
+ **/
+uint32_t createRenderGraphImage(
+    RenderGraph *graph,
+    const char *name,
+    const VkFormat format,
+    const VkImageUsageFlags usage,
+    const VkImageAspectFlags aspect
+) {
+    return addRenderGraphResource(graph, (RenderGraphResource){
+        .name = name,
+        .type = RENDER_GRAPH_IMAGE,
+        .format = format,
+        .usage = usage,
+        .aspect = aspect,
+        .image = VK_NULL_HANDLE,
+        .view = VK_NULL_HANDLE
+    });
+}
+
+uint32_t addRenderGraphPass(RenderGraph *graph, const char *name, const RenderGraphExecute execute, Any userData) {
+    if (graph->passCount == RENDER_GRAPH_MAX_PASSES) {
+        printLn("Render graph already has %d passes", RENDER_GRAPH_MAX_PASSES);
+        exit(RENDER_GRAPH_CAPACITY_EXCEEDED);
+    }
+
+    graph->passes[graph->passCount] = (RenderGraphPass){
+        .name = name,
+        .execute = execute,
+        .userData = userData,
+        .accessCount = 0
+    };
+    graph->compiled = false;
+    return graph->passCount++;
+}
+
+/**
+ * A pass touching the same resource twice gets one access covering both,
+ * barriers within a batch aren't ordered against each other.
+ **/
+void addRenderGraphAccess(RenderGraph *graph, const uint32_t pass, const RenderGraphAccess access) {
+    RenderGraphPass *graphPass = &graph->passes[pass];
+    for (uint32_t i = 0; i < graphPass->accessCount; i++) {
+        RenderGraphAccess *existing = &graphPass->accesses[i];
+        if (existing->resource != access.resource) continue;
+
+        if (existing->layout != access.layout) {
+            printLn("Pass %s uses %s in two layouts", graphPass->name, graph->resources[access.resource].name);
+            exit(FAILED_TO_COMPILE_RENDER_GRAPH);
+        }
+        existing->stages |= access.stages;
+        existing->access |= access.access;
+        existing->write |= access.write;
+        return;
+    }
+
+    if (graphPass->accessCount == RENDER_GRAPH_MAX_ACCESSES) {
+        printLn("Pass %s already uses %d resources", graphPass->name, RENDER_GRAPH_MAX_ACCESSES);
+        exit(RENDER_GRAPH_CAPACITY_EXCEEDED);
+    }
+    graphPass->accesses[graphPass->accessCount++] = access;
+    graph->compiled = false;
+}
+
+void readRenderGraphResource(
+    RenderGraph *graph,
+    const uint32_t pass,
+    const uint32_t resource,
+    const VkPipelineStageFlags2 stages,
+    const VkAccessFlags2 access,
+    const VkImageLayout layout
+) {
+    addRenderGraphAccess(graph, pass, (RenderGraphAccess){
+        .resource = resource,
+        .stages = stages,
+        .access = access,
+        .layout = layout,
+        .write = false
+    });
+}
+
+void writeRenderGraphResource(
+    RenderGraph *graph,
+    const uint32_t pass,
+    const uint32_t resource,
+    const VkPipelineStageFlags2 stages,
+    const VkAccessFlags2 access,
+    const VkImageLayout layout
+) {
+    addRenderGraphAccess(graph, pass, (RenderGraphAccess){
+        .resource = resource,
+        .stages = stages,
+        .access = access,
+        .layout = layout,
+        .write = true
+    });
+}
+
+bool writesRenderGraphResource(const RenderGraphPass *pass, const uint32_t resource) {
+    for (uint32_t i = 0; i < pass->accessCount; i++) {
+        if (pass->accesses[i].resource == resource && pass->accesses[i].write) return true;
+    }
+    return false;
+}
+
+bool usesRenderGraphResource(const RenderGraphPass *pass, const uint32_t resource) {
+    for (uint32_t i = 0; i < pass->accessCount; i++) {
+        if (pass->accesses[i].resource == resource) return true;
+    }
+    return false;
+}
+
+/**
+ * Pass a depends on pass b when b was added first and they share a resource
+ * either of them writes. That covers a reading what b wrote, a overwriting
+ * what b wrote and a overwriting what b still has to read.
+ **/
+bool dependsOnRenderGraphPass(const RenderGraph *graph, const uint32_t a, const uint32_t b) {
+    if (b >= a) return false;
+
+    const RenderGraphPass *pass = &graph->passes[a];
+    const RenderGraphPass *other = &graph->passes[b];
+    for (uint32_t i = 0; i < pass->accessCount; i++) {
+        const RenderGraphAccess *access = &pass->accesses[i];
+        if (access->write ? usesRenderGraphResource(other, access->resource)
+                          : writesRenderGraphResource(other, access->resource)) return true;
+    }
+    return false;
+}
+
+/**
+ * Culls, orders and works out resource lifetimes. Runs again whenever a
+ * pass or resource is added, transients are created by executeRenderGraph.
+ **/
+void compileRenderGraph(RenderGraph *graph) {
+    bool needed[RENDER_GRAPH_MAX_PASSES] = {};
+
+    // Passes writing anything exported are what the frame is for
+    uint32_t stack[RENDER_GRAPH_MAX_PASSES];
+    uint32_t stackCount = 0;
+    for (uint32_t i = 0; i < graph->passCount; i++) {
+        for (uint32_t j = 0; j < graph->resourceCount; j++) {
+            if (!graph->resources[j].exported || !writesRenderGraphResource(&graph->passes[i], j)) continue;
+            needed[i] = true;
+            stack[stackCount++] = i;
+            break;
+        }
+    }
+
+    // Then whatever they depend on
+    while (stackCount > 0) {
+        const uint32_t pass = stack[--stackCount];
+        for (uint32_t i = 0; i < graph->passCount; i++) {
+            if (needed[i] || !dependsOnRenderGraphPass(graph, pass, i)) continue;
+            needed[i] = true;
+            stack[stackCount++] = i;
+        }
+    }
+
+    // Kahn's algorithm, ties go to the pass added first so the order is stable
+    bool placed[RENDER_GRAPH_MAX_PASSES] = {};
+    uint32_t neededCount = 0;
+    for (uint32_t i = 0; i < graph->passCount; i++) neededCount += needed[i];
+
+    graph->orderCount = 0;
+    while (graph->orderCount < neededCount) {
+        uint32_t next = RENDER_GRAPH_NONE;
+        for (uint32_t i = 0; i < graph->passCount && next == RENDER_GRAPH_NONE; i++) {
+            if (!needed[i] || placed[i]) continue;
+
+            bool ready = true;
+            for (uint32_t j = 0; j < graph->passCount && ready; j++) {
+                if (needed[j] && !placed[j] && dependsOnRenderGraphPass(graph, i, j)) ready = false;
+            }
+            if (ready) next = i;
+        }
+
+        if (next == RENDER_GRAPH_NONE) {
+            printLn("Render graph has a dependency cycle");
+            exit(FAILED_TO_COMPILE_RENDER_GRAPH);
+        }
+        placed[next] = true;
+        graph->order[graph->orderCount++] = next;
+    }
+
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        graph->resources[i].firstPass = RENDER_GRAPH_NONE;
+        graph->resources[i].lastPass = RENDER_GRAPH_NONE;
+    }
+    for (uint32_t i = 0; i < graph->orderCount; i++) {
+        const RenderGraphPass *pass = &graph->passes[graph->order[i]];
+        for (uint32_t j = 0; j < pass->accessCount; j++) {
+            RenderGraphResource *resource = &graph->resources[pass->accesses[j].resource];
+            if (resource->firstPass == RENDER_GRAPH_NONE) resource->firstPass = i;
+            resource->lastPass = i;
+        }
+    }
+
+    graph->stats.passes = graph->orderCount;
+    graph->stats.culledPasses = graph->passCount - graph->orderCount;
+    graph->compiled = true;
+    graph->extent = (VkExtent2D){0, 0}; // Transients are placed again with the new lifetimes
+
+    printLn("Compiled render graph, %d passes, %d culled:", graph->orderCount, graph->stats.culledPasses);
+    for (uint32_t i = 0; i < graph->orderCount; i++) printLn("  %d %s", i, graph->passes[graph->order[i]].name);
+}
+
+bool isRenderGraphTransient(const RenderGraphResource *resource) {
+    return !resource->imported && resource->firstPass != RENDER_GRAPH_NONE;
+}
+
+bool overlapsRenderGraphLifetime(const RenderGraphResource *a, const RenderGraphResource *b) {
+    return a->firstPass <= b->lastPass && b->firstPass <= a->lastPass;
+}
+
+bool overlapsRenderGraphMemory(const RenderGraphResource *a, const RenderGraphResource *b) {
+    return a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+void releaseRenderGraphTransients(RenderGraph *graph, RetireQueue *retireQueue, const uint64_t lastUse) {
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if (resource->imported) continue;
+
+        if (resource->view != VK_NULL_HANDLE)
+            retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE_VIEW, .imageView = resource->view}, lastUse);
+        if (resource->image != VK_NULL_HANDLE)
+            retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE, .image = resource->image}, lastUse);
+        resource->view = VK_NULL_HANDLE;
+        resource->image = VK_NULL_HANDLE;
+    }
+
+    if (graph->transientMemory != VK_NULL_HANDLE)
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_MEMORY, .memory = graph->transientMemory}, lastUse);
+    graph->transientMemory = VK_NULL_HANDLE;
+}
+
+/**
+ * Places every transient with its size and alignment set, the alignment kept
+ * in offset until then, and returns how much memory they take together.
+ * Largest first, each goes at the lowest offset not used by a transient
+ * alive at the same time.
+ **/
+VkDeviceSize placeRenderGraphTransients(RenderGraph *graph) {
+    uint32_t transients[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t transientCount = 0;
+
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        const RenderGraphResource *resource = &graph->resources[i];
+        if (!isRenderGraphTransient(resource)) continue;
+
+        // Sorted by size as they're added
+        uint32_t at = transientCount++;
+        while (at > 0 && graph->resources[transients[at - 1]].size < resource->size) {
+            transients[at] = transients[at - 1];
+            at--;
+        }
+        transients[at] = i;
+    }
+
+    VkDeviceSize memorySize = 0;
+    for (uint32_t i = 0; i < transientCount; i++) {
+        RenderGraphResource *resource = &graph->resources[transients[i]];
+        const VkDeviceSize alignment = resource->offset;
+        resource->offset = 0;
+
+        // Bumped past whatever placed transient it collides with until none is left
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            for (uint32_t j = 0; j < i && !moved; j++) {
+                const RenderGraphResource *placed = &graph->resources[transients[j]];
+                if (!overlapsRenderGraphLifetime(resource, placed) || !overlapsRenderGraphMemory(resource, placed))
+                    continue;
+
+                resource->offset = (placed->offset + placed->size + alignment - 1) / alignment * alignment;
+                moved = true;
+            }
+        }
+        if (resource->offset + resource->size > memorySize) memorySize = resource->offset + resource->size;
+    }
+
+    // The first use of a transient waits on whatever held its memory last
+    for (uint32_t i = 0; i < transientCount; i++) {
+        RenderGraphResource *resource = &graph->resources[transients[i]];
+        resource->aliasOf = RENDER_GRAPH_NONE;
+        resource->state = (RenderGraphState){.layout = VK_IMAGE_LAYOUT_UNDEFINED};
+
+        for (uint32_t j = 0; j < transientCount; j++) {
+            const RenderGraphResource *other = &graph->resources[transients[j]];
+            if (i == j || other->lastPass >= resource->firstPass || !overlapsRenderGraphMemory(resource, other)) continue;
+            if (resource->aliasOf == RENDER_GRAPH_NONE || other->lastPass > graph->resources[resource->aliasOf].lastPass)
+                resource->aliasOf = transients[j];
+        }
+    }
+
+    return memorySize;
+}
+
+/**
+ * Creates every transient at extent and places them in one allocation.
+ **/
+void createRenderGraphTransients(
+    RenderGraph *graph,
+    const VkExtent2D extent,
+    RetireQueue *retireQueue,
+    const uint64_t lastUse
+) {
+    releaseRenderGraphTransients(graph, retireQueue, lastUse);
+    graph->extent = extent;
+
+    uint32_t transientCount = 0;
+    uint32_t memoryTypeBits = UINT32_MAX;
+    VkDeviceSize unaliasedBytes = 0;
+
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if (!isRenderGraphTransient(resource)) continue;
+
+        const VkImageCreateInfo imageInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+            .imageType = VK_IMAGE_TYPE_2D,
+            .format = resource->format,
+            .extent = {extent.width, extent.height, 1},
+            .mipLevels = 1,
+            .arrayLayers = 1,
+            .samples = VK_SAMPLE_COUNT_1_BIT,
+            .tiling = VK_IMAGE_TILING_OPTIMAL,
+            .usage = resource->usage,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+            .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+        };
+        if (vkCreateImage(graph->logicalDevice, &imageInfo, hostAllocator, &resource->image) != VK_SUCCESS) {
+            printLn("Failed to create render graph image %s", resource->name);
+            exit(FAILED_TO_COMPILE_RENDER_GRAPH);
+        }
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(graph->logicalDevice, resource->image, &requirements);
+        resource->size = requirements.size;
+        resource->offset = requirements.alignment; // Kept here until it's placed
+        memoryTypeBits &= requirements.memoryTypeBits;
+        unaliasedBytes += requirements.size;
+        transientCount++;
+    }
+
+    const VkDeviceSize memorySize = placeRenderGraphTransients(graph);
+
+    graph->stats.transientImages = transientCount;
+    graph->stats.transientBytes = memorySize;
+    graph->stats.unaliasedBytes = unaliasedBytes;
+    if (transientCount == 0) return;
+
+    const VkMemoryAllocateInfo allocateInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memorySize,
+        .memoryTypeIndex = findMemoryType(graph->physicalDevice, memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
+    };
+    if (allocateDeviceMemory(graph->logicalDevice, &allocateInfo, &graph->transientMemory) != VK_SUCCESS) {
+        printLn("Failed to allocate %llu bytes of render graph memory", memorySize);
+        exit(FAILED_TO_COMPILE_RENDER_GRAPH);
+    }
+
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if (!isRenderGraphTransient(resource)) continue;
+
+        vkBindImageMemory(graph->logicalDevice, resource->image, graph->transientMemory, resource->offset);
+
+        const VkImageViewCreateInfo viewInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = resource->image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = resource->format,
+            .subresourceRange = {resource->aspect, 0, 1, 0, 1}
+        };
+        if (vkCreateImageView(graph->logicalDevice, &viewInfo, hostAllocator, &resource->view) != VK_SUCCESS) {
+            printLn("Failed to create render graph image view %s", resource->name);
+            exit(FAILED_TO_COMPILE_RENDER_GRAPH);
+        }
+    }
+
+    printLn(
+        "Render graph transients %dx%d: %d images in %.1f MB, %.1f MB without aliasing",
+        extent.width,
+        extent.height,
+        transientCount,
+        (double) memorySize / 1e6,
+        (double) unaliasedBytes / 1e6
+    );
+}
+
+/**
+ * Set before every executeRenderGraph. Nothing the buffer was used for
+ * before the frame needs a barrier, the frame's fence already covered it.
+ **/
+void setRenderGraphBuffer(RenderGraph *graph, const uint32_t resource, const VkBuffer buffer) {
+    graph->resources[resource].buffer = buffer;
+    graph->resources[resource].state = (RenderGraphState){};
+}
+
+/**
+ * Set before every executeRenderGraph. The image's contents are discarded,
+ * readyStages is where the submit waits for it to be usable, the color
+ * attachment stage for an acquired swap chain image.
+ **/
+void setRenderGraphImage(
+    RenderGraph *graph,
+    const uint32_t resource,
+    const VkImage image,
+    const VkImageView view,
+    const VkPipelineStageFlags2 readyStages
+) {
+    graph->resources[resource].image = image;
+    graph->resources[resource].view = view;
+    graph->resources[resource].state = (RenderGraphState){
+        .writeStages = readyStages,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+}
+
+VkImageView getRenderGraphImageView(const RenderGraph *graph, const uint32_t resource) {
+    return graph->resources[resource].view;
+}
+
+/**
+ * Moves the resource's state past access and returns whether a barrier
+ * is needed first, with what it has to wait for.
+ * Reads in the same layout only wait when the last write isn't visible
+ * to them yet, writes and layout changes wait for everything before.
+ **/
+bool updateRenderGraphState(
+    const RenderGraphResource *resource,
+    RenderGraphState *state,
+    const RenderGraphAccess *access,
+    VkPipelineStageFlags2 *srcStages,
+    VkAccessFlags2 *srcAccess
+) {
+    const bool image = resource->type == RENDER_GRAPH_IMAGE;
+    const bool transition = image && state->layout != access->layout;
+
+    if (!access->write && !transition) {
+        state->readStages |= access->stages;
+        if (state->writeStages == 0) return false;
+        if ((access->stages & ~state->visibleStages) == 0 && (access->access & ~state->visibleAccess) == 0) return false;
+
+        *srcStages = state->writeStages;
+        *srcAccess = state->writeAccess;
+        state->visibleStages |= access->stages;
+        state->visibleAccess |= access->access;
+        return true;
+    }
+
+    *srcStages = state->writeStages | state->readStages;
+    *srcAccess = state->writeAccess;
+    const bool needed = transition || *srcStages != 0;
+
+    // A layout transition is a write of its own, done and visible to access once the barrier completes
+    state->writeStages = access->stages;
+    state->writeAccess = access->write ? access->access : VK_ACCESS_2_NONE;
+    state->readStages = access->write ? VK_PIPELINE_STAGE_2_NONE : access->stages;
+    state->visibleStages = access->write ? VK_PIPELINE_STAGE_2_NONE : access->stages;
+    state->visibleAccess = access->write ? VK_ACCESS_2_NONE : access->access;
+    if (image) state->layout = access->layout;
+    return needed;
+}
+
+typedef struct RenderGraphBarriers {
+    VkImageMemoryBarrier2 images[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t imageCount;
+    VkBufferMemoryBarrier2 buffers[RENDER_GRAPH_MAX_RESOURCES];
+    uint32_t bufferCount;
+} RenderGraphBarriers;
+
+void addRenderGraphBarrier(
+    RenderGraphBarriers *barriers,
+    const RenderGraphResource *resource,
+    const RenderGraphAccess *access,
+    const VkPipelineStageFlags2 srcStages,
+    const VkAccessFlags2 srcAccess,
+    const VkImageLayout oldLayout
+) {
+    if (resource->type == RENDER_GRAPH_BUFFER) {
+        barriers->buffers[barriers->bufferCount++] = (VkBufferMemoryBarrier2){
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = srcStages,
+            .srcAccessMask = srcAccess,
+            .dstStageMask = access->stages,
+            .dstAccessMask = access->access,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = resource->buffer,
+            .offset = 0,
+            .size = VK_WHOLE_SIZE
+        };
+        return;
+    }
+
+    barriers->images[barriers->imageCount++] = (VkImageMemoryBarrier2){
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = srcStages,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = access->stages,
+        .dstAccessMask = access->access,
+        .oldLayout = oldLayout,
+        .newLayout = access->layout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = resource->image,
+        .subresourceRange = {resource->aspect, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS}
+    };
+}
+
+/**
+ * A batch as vkCmdPipelineBarrier takes it, without synchronization2.
+ **/
+typedef struct RenderGraphLegacyBarriers {
+    VkImageMemoryBarrier images[RENDER_GRAPH_MAX_RESOURCES];
+    VkBufferMemoryBarrier buffers[RENDER_GRAPH_MAX_RESOURCES];
+    VkPipelineStageFlags srcStages;
+    VkPipelineStageFlags dstStages;
+} RenderGraphLegacyBarriers;
+
+/**
+ * Access bits above 32 only exist with synchronization2, each is part of a
+ * wider legacy bit.
+ **/
+VkAccessFlags toLegacyRenderGraphAccess(const VkAccessFlags2 access) {
+    VkAccessFlags legacy = (VkAccessFlags) (access & 0xFFFFFFFFu);
+    if (access & (VK_ACCESS_2_SHADER_SAMPLED_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_READ_BIT))
+        legacy |= VK_ACCESS_SHADER_READ_BIT;
+    if (access & VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT) legacy |= VK_ACCESS_SHADER_WRITE_BIT;
+    return legacy;
+}
+
+/**
+ * Same for stages, the split transfer and vertex input stages fold back into
+ * the ones they were split from.
+ **/
+VkPipelineStageFlags toLegacyRenderGraphStages(const VkPipelineStageFlags2 stages) {
+    VkPipelineStageFlags legacy = (VkPipelineStageFlags) (stages & 0xFFFFFFFFu);
+    if (stages & (VK_PIPELINE_STAGE_2_COPY_BIT | VK_PIPELINE_STAGE_2_RESOLVE_BIT |
+                  VK_PIPELINE_STAGE_2_BLIT_BIT | VK_PIPELINE_STAGE_2_CLEAR_BIT))
+        legacy |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+    if (stages & (VK_PIPELINE_STAGE_2_INDEX_INPUT_BIT | VK_PIPELINE_STAGE_2_VERTEX_ATTRIBUTE_INPUT_BIT))
+        legacy |= VK_PIPELINE_STAGE_VERTEX_INPUT_BIT;
+    return legacy;
+}
+
+/**
+ * vkCmdPipelineBarrier takes one pair of stage masks for the whole batch,
+ * the union of every barrier's is no weaker than recording them apart.
+ **/
+void convertRenderGraphBarriers(const RenderGraphBarriers *barriers, RenderGraphLegacyBarriers *legacy) {
+    VkImageMemoryBarrier *images = legacy->images;
+    VkBufferMemoryBarrier *buffers = legacy->buffers;
+    VkPipelineStageFlags srcStages = 0, dstStages = 0;
+
+    for (uint32_t i = 0; i < barriers->imageCount; i++) {
+        const VkImageMemoryBarrier2 *barrier = &barriers->images[i];
+        srcStages |= toLegacyRenderGraphStages(barrier->srcStageMask);
+        dstStages |= toLegacyRenderGraphStages(barrier->dstStageMask);
+        images[i] = (VkImageMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+            .srcAccessMask = toLegacyRenderGraphAccess(barrier->srcAccessMask),
+            .dstAccessMask = toLegacyRenderGraphAccess(barrier->dstAccessMask),
+            .oldLayout = barrier->oldLayout,
+            .newLayout = barrier->newLayout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = barrier->image,
+            .subresourceRange = barrier->subresourceRange
+        };
+    }
+    for (uint32_t i = 0; i < barriers->bufferCount; i++) {
+        const VkBufferMemoryBarrier2 *barrier = &barriers->buffers[i];
+        srcStages |= toLegacyRenderGraphStages(barrier->srcStageMask);
+        dstStages |= toLegacyRenderGraphStages(barrier->dstStageMask);
+        buffers[i] = (VkBufferMemoryBarrier){
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+            .srcAccessMask = toLegacyRenderGraphAccess(barrier->srcAccessMask),
+            .dstAccessMask = toLegacyRenderGraphAccess(barrier->dstAccessMask),
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = barrier->buffer,
+            .offset = barrier->offset,
+            .size = barrier->size
+        };
+    }
+
+    legacy->srcStages = srcStages == 0 ? VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT : srcStages;
+    legacy->dstStages = dstStages == 0 ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : dstStages;
+}
+
+void recordLegacyRenderGraphBarriers(const VkCommandBuffer commandBuffer, const RenderGraphBarriers *barriers) {
+    RenderGraphLegacyBarriers legacy;
+    convertRenderGraphBarriers(barriers, &legacy);
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        legacy.srcStages,
+        legacy.dstStages,
+        0,
+        0, nullptr,
+        barriers->bufferCount, legacy.buffers,
+        barriers->imageCount, legacy.images
+    );
+}
+
+void recordRenderGraphBarriers(RenderGraph *graph, const VkCommandBuffer commandBuffer, const RenderGraphBarriers *barriers) {
+    if (barriers->imageCount == 0 && barriers->bufferCount == 0) return;
+
+    graph->stats.barrierBatches++;
+    graph->stats.imageBarriers += barriers->imageCount;
+    graph->stats.bufferBarriers += barriers->bufferCount;
+
+    if (graph->pipelineBarrier2 == nullptr) {
+        recordLegacyRenderGraphBarriers(commandBuffer, barriers);
+        return;
+    }
+
+    const VkDependencyInfo dependencyInfo = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .bufferMemoryBarrierCount = barriers->bufferCount,
+        .pBufferMemoryBarriers = barriers->buffers,
+        .imageMemoryBarrierCount = barriers->imageCount,
+        .pImageMemoryBarriers = barriers->images
+    };
+    graph->pipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+/**
+ * Records every pass left after culling with the barriers in front of it,
+ * then moves exported images to their final layout. Transients are
+ * (re)created first when extent changed, the old ones retire with lastUse.
+ * Each pass gets a CPU and GPU trace zone of its own.
+ **/
+void executeRenderGraph(
+    RenderGraph *graph,
+    const VkCommandBuffer commandBuffer,
+    const VkExtent2D extent,
+    RetireQueue *retireQueue,
+    const uint64_t lastUse,
+    const GpuTrace *gpuTrace,
+    const uint32_t frame
+) {
+    if (!graph->compiled) compileRenderGraph(graph);
+    if (graph->extent.width != extent.width || graph->extent.height != extent.height)
+        createRenderGraphTransients(graph, extent, retireQueue, lastUse);
+
+    graph->stats.barrierBatches = 0;
+    graph->stats.imageBarriers = 0;
+    graph->stats.bufferBarriers = 0;
+
+    // Transient contents never carry over, the stages of last frame's accesses still have to be waited on
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        if (!graph->resources[i].imported) graph->resources[i].state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    }
+
+    for (uint32_t i = 0; i < graph->orderCount; i++) {
+        const RenderGraphPass *pass = &graph->passes[graph->order[i]];
+        const TraceZone zone = beginTraceZone(pass->name);
+        const uint32_t gpuZone = beginGpuTraceZone(commandBuffer, gpuTrace, frame, pass->name);
+
+        RenderGraphBarriers barriers = {.imageCount = 0, .bufferCount = 0};
+        for (uint32_t j = 0; j < pass->accessCount; j++) {
+            const RenderGraphAccess *access = &pass->accesses[j];
+            RenderGraphResource *resource = &graph->resources[access->resource];
+
+            if (resource->firstPass == i && resource->aliasOf != RENDER_GRAPH_NONE) {
+                const RenderGraphState *previous = &graph->resources[resource->aliasOf].state;
+                resource->state.writeStages |= previous->writeStages | previous->readStages;
+                resource->state.writeAccess |= previous->writeAccess;
+            }
+
+            const VkImageLayout oldLayout = resource->state.layout;
+            VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+            VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+            if (updateRenderGraphState(resource, &resource->state, access, &srcStages, &srcAccess))
+                addRenderGraphBarrier(&barriers, resource, access, srcStages, srcAccess, oldLayout);
+        }
+        recordRenderGraphBarriers(graph, commandBuffer, &barriers);
+
+        pass->execute(commandBuffer, pass->userData);
+
+        endGpuTraceZone(commandBuffer, gpuTrace, frame, gpuZone);
+        endTraceZone(&zone);
+    }
+
+    RenderGraphBarriers barriers = {.imageCount = 0, .bufferCount = 0};
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if (!resource->exported || resource->type != RENDER_GRAPH_IMAGE || resource->firstPass == RENDER_GRAPH_NONE)
+            continue;
+
+        const RenderGraphAccess access = {
+            .resource = i,
+            .stages = VK_PIPELINE_STAGE_2_NONE,
+            .access = VK_ACCESS_2_NONE,
+            .layout = resource->finalLayout,
+            .write = false
+        };
+        const VkImageLayout oldLayout = resource->state.layout;
+        VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+        if (updateRenderGraphState(resource, &resource->state, &access, &srcStages, &srcAccess))
+            addRenderGraphBarrier(&barriers, resource, &access, srcStages, srcAccess, oldLayout);
+    }
+    recordRenderGraphBarriers(graph, commandBuffer, &barriers);
+
+    debugLn(
+        "Render graph: %d passes, %d barrier batches, %d image and %d buffer barriers, %.1f MB transient",
+        graph->orderCount,
+        graph->stats.barrierBatches,
+        graph->stats.imageBarriers,
+        graph->stats.bufferBarriers,
+        (double) graph->stats.transientBytes / 1e6
+    );
+}
+
+void printRenderGraphStats(const RenderGraph *graph) {
+    printLn(
+        "Render graph: %d passes (%d culled), last frame %d barrier batches with %d image and %d buffer barriers",
+        graph->stats.passes,
+        graph->stats.culledPasses,
+        graph->stats.barrierBatches,
+        graph->stats.imageBarriers,
+        graph->stats.bufferBarriers
+    );
+    printLn(
+        "Render graph transients: %d images in %.1f MB, %.1f MB without aliasing",
+        graph->stats.transientImages,
+        (double) graph->stats.transientBytes / 1e6,
+        (double) graph->stats.unaliasedBytes / 1e6
+    );
+}
+
+/**
+ * The device has to be idle.
+ **/
+void destroyRenderGraph(const VkDevice logicalDevice, RenderGraph *graph) {
+    for (uint32_t i = 0; i < graph->resourceCount; i++) {
+        RenderGraphResource *resource = &graph->resources[i];
+        if (resource->imported) continue;
+        if (resource->view != VK_NULL_HANDLE) vkDestroyImageView(logicalDevice, resource->view, hostAllocator);
+        if (resource->image != VK_NULL_HANDLE) vkDestroyImage(logicalDevice, resource->image, hostAllocator);
+        resource->view = VK_NULL_HANDLE;
+        resource->image = VK_NULL_HANDLE;
+    }
+
+    freeDeviceMemory(logicalDevice, graph->transientMemory);
+    graph->transientMemory = VK_NULL_HANDLE;
+}
+
+#endif //RENDER_GRAPH_H
@@ -1,8 +1,24 @@
 #version 450
+#extension GL_EXT_nonuniform_qualifier : require
 
 layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragUv;
+layout(location = 2) flat in uint fragTexture;
 layout(location = 0) out vec4 outColor;
 
+// The bindless table in vulkan_bindless.h, binding 2 holds storage buffers
+layout(set = 0, binding = 0) uniform texture2D textures[];
+layout(set = 0, binding = 1) uniform sampler samplers[];
+
 void main() {
-    outColor = vec4(fragColor, 1.0);
+    // Texture slot in the low 16 bits and sampler slot in the high 16, see getTextureIndex
+    uint textureSlot = fragTexture & 0xFFFFu;
+    uint samplerSlot = fragTexture >> 16;
+
+    // Instances of one draw can use different textures so the index is non uniform
+    vec4 texel = texture(
+        sampler2D(textures[nonuniformEXT(textureSlot)], samplers[nonuniformEXT(samplerSlot)]),
+        fragUv
+    );
+    outColor = vec4(fragColor, 1.0) * texel;
 }
@@ -3,10 +3,48 @@
 layout(location = 0) in vec2 inPosition;
 layout(location = 1) in vec3 inColor;
 
+layout(location = 2) in vec2 instanceTranslation;
+layout(location = 3) in vec2 instanceScale;
+layout(location = 4) in float instanceRotation;
+layout(location = 5) in vec3 instanceColor;
+
+layout(location = 6) in vec2 inUv;
+layout(location = 7) in uint instanceTexture;
+layout(location = 8) in float instanceDepth;
+
 layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragUv;
+layout(location = 2) flat out uint fragTexture;
 
+// FrameUniforms in vulkan_uniform_ring.h, selected with a dynamic offset
+layout(set = 1, binding = 0) uniform FrameUniforms {
+    vec2 cameraPosition;
+    vec2 cameraScale;
+    float cameraRotation;
+} frame;
+
+// DrawPushConstants in vulkan_uniform_ring.h
+layout(push_constant) uniform DrawConstants {
+    vec2 translation;
+    vec2 scale;
+    float rotation;
+    uint screenSpace;
+} draw;
+
+vec2 rotate(vec2 position, float angle) {
+    float c = cos(angle);
+    float s = sin(angle);
+    return vec2(c * position.x - s * position.y, s * position.x + c * position.y);
+}
 
 void main() {
-    gl_Position = vec4(inPosition, 0.0, 1.0);
-    fragColor = inColor;
+    vec2 world = rotate(inPosition * instanceScale, instanceRotation) + instanceTranslation;
+    world = rotate(world * draw.scale, draw.rotation) + draw.translation;
+
+    if (draw.screenSpace == 0u) world = rotate(world - frame.cameraPosition, -frame.cameraRotation) * frame.cameraScale;
+
+    gl_Position = vec4(world, instanceDepth, 1.0);
+    fragColor = inColor * instanceColor;
+    fragUv = inUv;
+    fragTexture = instanceTexture;
 }
@@ -0,0 +1,94 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <pthread.h>
+#include <stdlib.h>
+#include "array.h"
+#include "io.h"
+#include "vulkan_io.h"
+#include "startup_trace.h"
+
+/**
+ * SPIR-V for every pipeline, read on a thread started before the instance
+ * exists so the file reads overlap instance and device creation.
+ * Pipelines take their code from here once waitForShaderLibrary returns.
+ **/
+typedef enum ShaderId {
+    SHADER_TRIANGLE_VERTEX,
+    SHADER_TRIANGLE_FRAGMENT,
+    SHADER_CULL_COMPUTE,
+    SHADER_PARTICLES_COMPUTE,
+    SHADER_COUNT
+} ShaderId;
+
+static const char *SHADER_PATHS[SHADER_COUNT] = {
+    "/opt/Projects/C/Vulkan/learning/resources/shaders/out/triangle.vert.spv",
+    "/opt/Projects/C/Vulkan/learning/resources/shaders/out/triangle.frag.spv",
+    "/opt/Projects/C/Vulkan/learning/resources/shaders/out/cull.comp.spv",
+    "/opt/Projects/C/Vulkan/learning/resources/shaders/out/particles.comp.spv"
+};
+
+typedef struct ShaderLibrary {
+    pthread_t thread;
+    Uint32SizedMutableArray code[SHADER_COUNT]; // Empty for shaders that weren't requested
+    uint32_t requested; // Bit per ShaderId
+    bool loading; // The thread hasn't been joined yet
+} ShaderLibrary;
+
+Any runShaderLibrary(Any data) {
+    ShaderLibrary *library = data;
+
+    const uint32_t phase = beginStartupPhase("read shaders");
+    for (uint32_t i = 0; i < SHADER_COUNT; i++) {
+        if (library->requested & 1u << i) readFile(SHADER_PATHS[i], &library->code[i]);
+    }
+    endStartupPhase(phase);
+
+    return nullptr;
+}
+
+/**
+ * The triangle and culling shaders are always read. Optional features pass
+ * their own, so a missing .spv only stops startup when it would be used.
+ **/
+void startShaderLibrary(ShaderLibrary *library, const uint32_t optionalShaders) {
+    *library = (ShaderLibrary){
+        .requested = 1u << SHADER_TRIANGLE_VERTEX |
+                     1u << SHADER_TRIANGLE_FRAGMENT |
+                     1u << SHADER_CULL_COMPUTE |
+                     optionalShaders,
+        .loading = true
+    };
+    if (pthread_create(&library->thread, nullptr, runShaderLibrary, library) != 0) {
+        // Reading on the caller is only slower
+        runShaderLibrary(library);
+        library->loading = false;
+    }
+}
+
+void waitForShaderLibrary(ShaderLibrary *library) {
+    if (!library->loading) return;
+    pthread_join(library->thread, nullptr);
+    library->loading = false;
+}
+
+Uint32SizedMutableArray getShaderCode(const ShaderLibrary *library, const ShaderId shader) {
+    return library->code[shader];
+}
+
+/**
+ * Modules keep no reference to the code, so it's freed once every pipeline is built.
+ **/
+void destroyShaderLibrary(ShaderLibrary *library) {
+    waitForShaderLibrary(library);
+    for (uint32_t i = 0; i < SHADER_COUNT; i++) {
+        free(library->code[i].items);
+        library->code[i] = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    }
+}
+
+#endif //SHADER_LIBRARY_H
@@ -0,0 +1,100 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef STARTUP_TRACE_H
+#define STARTUP_TRACE_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include "io.h"
+
+/**
+ * Timestamps for every startup phase, from main to the first presented frame.
+ * Phases may be recorded from any thread, overlapping phases are how the
+ * parallel parts of startup show up in the report.
+ * One trace per process, startup only happens once.
+ **/
+#define STARTUP_MAX_PHASES 32
+
+typedef struct StartupPhase {
+    const char *name;
+    double start; // Seconds since the trace started
+    double end;
+    bool worker; // Recorded off the main thread
+} StartupPhase;
+
+typedef struct StartupTrace {
+    StartupPhase phases[STARTUP_MAX_PHASES];
+    atomic_uint count;
+    double origin;
+    pthread_t mainThread;
+    bool reported;
+} StartupTrace;
+
+StartupTrace startupTrace;
+
+double getStartupClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + (double) now.tv_nsec / 1e9;
+}
+
+void startStartupTrace() {
+    atomic_store(&startupTrace.count, 0);
+    startupTrace.origin = getStartupClock();
+    startupTrace.mainThread = pthread_self();
+    startupTrace.reported = false;
+}
+
+/**
+ * Returns the phase to pass to endStartupPhase, STARTUP_MAX_PHASES once full.
+ * name has to outlive the trace.
+ **/
+uint32_t beginStartupPhase(const char *name) {
+    const uint32_t phase = atomic_fetch_add(&startupTrace.count, 1);
+    if (phase >= STARTUP_MAX_PHASES) return STARTUP_MAX_PHASES;
+
+    startupTrace.phases[phase] = (StartupPhase){
+        .name = name,
+        .start = getStartupClock() - startupTrace.origin,
+        .end = -1.0,
+        .worker = !pthread_equal(pthread_self(), startupTrace.mainThread)
+    };
+    return phase;
+}
+
+void endStartupPhase(const uint32_t phase) {
+    if (phase >= STARTUP_MAX_PHASES) return;
+    startupTrace.phases[phase].end = getStartupClock() - startupTrace.origin;
+}
+
+/**
+ * Called after every present, only the first one reports.
+ **/
+void markFirstFrame() {
+    if (startupTrace.reported) return;
+    startupTrace.reported = true;
+
+    const double firstFrame = getStartupClock() - startupTrace.origin;
+    uint32_t count = atomic_load(&startupTrace.count);
+    if (count > STARTUP_MAX_PHASES) count = STARTUP_MAX_PHASES;
+
+    printLn("Startup phases (ms, start - end, duration):");
+    for (uint32_t i = 0; i < count; i++) {
+        const StartupPhase phase = startupTrace.phases[i];
+        if (phase.end < 0.0) continue;
+        printLn(
+            "  %-24s %8.2f - %8.2f %8.2f%s",
+            phase.name,
+            phase.start * 1000.0,
+            phase.end * 1000.0,
+            (phase.end - phase.start) * 1000.0,
+            phase.worker ? " (worker)" : ""
+        );
+    }
+    printLn("Time to first frame: %.2f ms", firstFrame * 1000.0);
+}
+
+#endif //STARTUP_TRACE_H
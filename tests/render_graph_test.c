@@ -0,0 +1,399 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#include <stdio.h>
+#include "../io.h"
+#include "../render_graph.h"
+
+/**
+ * Only compiles graphs, works out barriers and places transients, nothing
+ * here needs a device.
+ **/
+static uint32_t failures = 0;
+
+void expectPassOrder(const RenderGraph *graph, const char *test, const uint32_t *order, const uint32_t count) {
+    bool matches = graph->orderCount == count;
+    for (uint32_t i = 0; i < count && matches; i++) matches = graph->order[i] == order[i];
+    if (matches) return;
+
+    printLn("FAIL %s: got", test);
+    for (uint32_t i = 0; i < graph->orderCount; i++) printf(" %s", graph->passes[graph->order[i]].name);
+    failures++;
+}
+
+void addTestAccess(RenderGraph *graph, const uint32_t pass, const uint32_t resource, const bool write) {
+    addRenderGraphAccess(graph, pass, (RenderGraphAccess){
+        .resource = resource,
+        .stages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .access = write ? VK_ACCESS_2_SHADER_WRITE_BIT : VK_ACCESS_2_SHADER_READ_BIT,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .write = write
+    });
+}
+
+uint32_t addTestOutput(RenderGraph *graph, const char *name) {
+    return importRenderGraphImage(graph, name, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_GENERAL);
+}
+
+/**
+ * A pass overwriting a buffer an earlier pass reads has to wait for that read.
+ **/
+void testWriteAfterRead() {
+    RenderGraph graph;
+    createRenderGraph(&graph, VK_NULL_HANDLE, VK_NULL_HANDLE, false);
+
+    const uint32_t buffer = importRenderGraphBuffer(&graph, "buffer");
+    const uint32_t first = addTestOutput(&graph, "first output");
+    const uint32_t second = addTestOutput(&graph, "second output");
+
+    const uint32_t reader = addRenderGraphPass(&graph, "reader", nullptr, nullptr);
+    addTestAccess(&graph, reader, buffer, false);
+    addTestAccess(&graph, reader, first, true);
+
+    const uint32_t writer = addRenderGraphPass(&graph, "writer", nullptr, nullptr);
+    addTestAccess(&graph, writer, buffer, true);
+    addTestAccess(&graph, writer, second, true);
+
+    compileRenderGraph(&graph);
+    expectPassOrder(&graph, "write after read", (uint32_t[]){reader, writer}, 2);
+}
+
+/**
+ * Readers see what was written before them, a producer nothing needs is culled.
+ **/
+void testReadAfterWriteAndCulling() {
+    RenderGraph graph;
+    createRenderGraph(&graph, VK_NULL_HANDLE, VK_NULL_HANDLE, false);
+
+    const uint32_t buffer = importRenderGraphBuffer(&graph, "buffer");
+    const uint32_t unused = importRenderGraphBuffer(&graph, "unused");
+    const uint32_t output = addTestOutput(&graph, "output");
+
+    const uint32_t producer = addRenderGraphPass(&graph, "producer", nullptr, nullptr);
+    addTestAccess(&graph, producer, buffer, true);
+
+    const uint32_t culled = addRenderGraphPass(&graph, "culled", nullptr, nullptr);
+    addTestAccess(&graph, culled, unused, true);
+
+    const uint32_t consumer = addRenderGraphPass(&graph, "consumer", nullptr, nullptr);
+    addTestAccess(&graph, consumer, buffer, false);
+    addTestAccess(&graph, consumer, output, true);
+
+    compileRenderGraph(&graph);
+    expectPassOrder(&graph, "read after write", (uint32_t[]){producer, consumer}, 2);
+}
+
+/**
+ * What one access should produce, in both the synchronization2 and the
+ * vkCmdPipelineBarrier form. Layouts only apply to images.
+ **/
+typedef struct ExpectedBarrier {
+    VkPipelineStageFlags2 srcStages;
+    VkAccessFlags2 srcAccess;
+    VkPipelineStageFlags2 dstStages;
+    VkAccessFlags2 dstAccess;
+    VkImageLayout oldLayout;
+    VkImageLayout newLayout;
+    VkPipelineStageFlags legacySrcStages;
+    VkPipelineStageFlags legacyDstStages;
+    VkAccessFlags legacySrcAccess;
+    VkAccessFlags legacyDstAccess;
+} ExpectedBarrier;
+
+void failBarrier(const char *test, const char *field, const uint64_t got, const uint64_t expected) {
+    printLn("FAIL %s: %s is 0x%llx, expected 0x%llx", test, field, got, expected);
+    failures++;
+}
+
+/**
+ * Runs access through updateRenderGraphState like executeRenderGraph does.
+ * expected is nullptr when no barrier should be recorded.
+ **/
+void expectBarrier(
+    const char *test,
+    RenderGraphResource *resource,
+    const RenderGraphAccess access,
+    const ExpectedBarrier *expected
+) {
+    RenderGraphBarriers barriers = {.imageCount = 0, .bufferCount = 0};
+    const VkImageLayout oldLayout = resource->state.layout;
+    VkPipelineStageFlags2 srcStages = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 srcAccess = VK_ACCESS_2_NONE;
+    if (updateRenderGraphState(resource, &resource->state, &access, &srcStages, &srcAccess))
+        addRenderGraphBarrier(&barriers, resource, &access, srcStages, srcAccess, oldLayout);
+
+    const uint32_t count = barriers.imageCount + barriers.bufferCount;
+    if (count != (expected == nullptr ? 0 : 1)) {
+        failBarrier(test, "barrier count", count, expected == nullptr ? 0 : 1);
+        return;
+    }
+    if (expected == nullptr) return;
+
+    RenderGraphLegacyBarriers legacy;
+    convertRenderGraphBarriers(&barriers, &legacy);
+    if (legacy.srcStages != expected->legacySrcStages)
+        failBarrier(test, "legacy srcStageMask", legacy.srcStages, expected->legacySrcStages);
+    if (legacy.dstStages != expected->legacyDstStages)
+        failBarrier(test, "legacy dstStageMask", legacy.dstStages, expected->legacyDstStages);
+
+    VkPipelineStageFlags2 gotSrcStages, gotDstStages;
+    VkAccessFlags2 gotSrcAccess, gotDstAccess;
+    VkAccessFlags legacySrcAccess, legacyDstAccess;
+    if (barriers.imageCount == 1) {
+        const VkImageMemoryBarrier2 *barrier = &barriers.images[0];
+        gotSrcStages = barrier->srcStageMask;
+        gotSrcAccess = barrier->srcAccessMask;
+        gotDstStages = barrier->dstStageMask;
+        gotDstAccess = barrier->dstAccessMask;
+        legacySrcAccess = legacy.images[0].srcAccessMask;
+        legacyDstAccess = legacy.images[0].dstAccessMask;
+
+        if (barrier->oldLayout != expected->oldLayout) failBarrier(test, "oldLayout", barrier->oldLayout, expected->oldLayout);
+        if (barrier->newLayout != expected->newLayout) failBarrier(test, "newLayout", barrier->newLayout, expected->newLayout);
+        if (legacy.images[0].oldLayout != expected->oldLayout)
+            failBarrier(test, "legacy oldLayout", legacy.images[0].oldLayout, expected->oldLayout);
+        if (legacy.images[0].newLayout != expected->newLayout)
+            failBarrier(test, "legacy newLayout", legacy.images[0].newLayout, expected->newLayout);
+    } else {
+        const VkBufferMemoryBarrier2 *barrier = &barriers.buffers[0];
+        gotSrcStages = barrier->srcStageMask;
+        gotSrcAccess = barrier->srcAccessMask;
+        gotDstStages = barrier->dstStageMask;
+        gotDstAccess = barrier->dstAccessMask;
+        legacySrcAccess = legacy.buffers[0].srcAccessMask;
+        legacyDstAccess = legacy.buffers[0].dstAccessMask;
+    }
+
+    if (gotSrcStages != expected->srcStages) failBarrier(test, "srcStageMask", gotSrcStages, expected->srcStages);
+    if (gotSrcAccess != expected->srcAccess) failBarrier(test, "srcAccessMask", gotSrcAccess, expected->srcAccess);
+    if (gotDstStages != expected->dstStages) failBarrier(test, "dstStageMask", gotDstStages, expected->dstStages);
+    if (gotDstAccess != expected->dstAccess) failBarrier(test, "dstAccessMask", gotDstAccess, expected->dstAccess);
+    if (legacySrcAccess != expected->legacySrcAccess)
+        failBarrier(test, "legacy srcAccessMask", legacySrcAccess, expected->legacySrcAccess);
+    if (legacyDstAccess != expected->legacyDstAccess)
+        failBarrier(test, "legacy dstAccessMask", legacyDstAccess, expected->legacyDstAccess);
+}
+
+RenderGraphAccess testAccess(
+    const VkPipelineStageFlags2 stages,
+    const VkAccessFlags2 access,
+    const VkImageLayout layout,
+    const bool write
+) {
+    return (RenderGraphAccess){.resource = 0, .stages = stages, .access = access, .layout = layout, .write = write};
+}
+
+/**
+ * A read waits for the write before it and only the first read of a stage does.
+ **/
+void testReadAfterWriteBarrier() {
+    RenderGraphResource buffer = {.type = RENDER_GRAPH_BUFFER};
+    const RenderGraphAccess write = testAccess(
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, true
+    );
+    const RenderGraphAccess read = testAccess(
+        VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT, VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false
+    );
+
+    // Nothing to wait for before the first write of the frame
+    expectBarrier("read after write, first write", &buffer, write, nullptr);
+    expectBarrier("read after write", &buffer, read, &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .srcAccess = VK_ACCESS_2_SHADER_WRITE_BIT,
+        .dstStages = VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+        .dstAccess = VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+        .legacySrcStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        .legacySrcAccess = VK_ACCESS_SHADER_WRITE_BIT,
+        .legacyDstAccess = VK_ACCESS_INDIRECT_COMMAND_READ_BIT
+    });
+    expectBarrier("read after write, second read", &buffer, read, nullptr);
+}
+
+/**
+ * Overwriting what was only read needs an execution dependency, nothing to make available.
+ **/
+void testWriteAfterReadBarrier() {
+    RenderGraphResource buffer = {.type = RENDER_GRAPH_BUFFER};
+
+    expectBarrier("write after read, first read", &buffer, testAccess(
+        VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT, VK_ACCESS_2_SHADER_READ_BIT, VK_IMAGE_LAYOUT_UNDEFINED, false
+    ), nullptr);
+    expectBarrier("write after read", &buffer, testAccess(
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, true
+    ), &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT,
+        .srcAccess = VK_ACCESS_2_NONE,
+        .dstStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccess = VK_ACCESS_2_SHADER_WRITE_BIT,
+        .legacySrcStages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        .legacySrcAccess = 0,
+        .legacyDstAccess = VK_ACCESS_SHADER_WRITE_BIT
+    });
+}
+
+void testWriteAfterWriteBarrier() {
+    RenderGraphResource buffer = {.type = RENDER_GRAPH_BUFFER};
+
+    expectBarrier("write after write, first write", &buffer, testAccess(
+        VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, true
+    ), nullptr);
+    expectBarrier("write after write", &buffer, testAccess(
+        VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, true
+    ), &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .srcAccess = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStages = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccess = VK_ACCESS_2_SHADER_WRITE_BIT,
+        .legacySrcStages = VK_PIPELINE_STAGE_TRANSFER_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        .legacySrcAccess = VK_ACCESS_TRANSFER_WRITE_BIT,
+        .legacyDstAccess = VK_ACCESS_SHADER_WRITE_BIT
+    });
+}
+
+/**
+ * Every layout change is a barrier, even into the first write and even for a read.
+ **/
+void testLayoutTransitionBarriers() {
+    RenderGraphResource image = {.type = RENDER_GRAPH_IMAGE, .aspect = VK_IMAGE_ASPECT_COLOR_BIT};
+    image.state.layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    expectBarrier("transition into the first write", &image, testAccess(
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        true
+    ), &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_NONE,
+        .srcAccess = VK_ACCESS_2_NONE,
+        .dstStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .dstAccess = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .legacySrcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .legacySrcAccess = 0,
+        .legacyDstAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+    });
+
+    const RenderGraphAccess sample = testAccess(
+        VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        false
+    );
+    expectBarrier("transition into a read", &image, sample, &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .srcAccess = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        .dstStages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstAccess = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .legacySrcStages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        .legacySrcAccess = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+        .legacyDstAccess = VK_ACCESS_SHADER_READ_BIT
+    });
+    expectBarrier("read in the same layout", &image, sample, nullptr);
+
+    // Into the exported layout the way executeRenderGraph ends a frame
+    expectBarrier("transition to the final layout", &image, testAccess(
+        VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, false
+    ), &(ExpectedBarrier){
+        .srcStages = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .srcAccess = VK_ACCESS_2_NONE,
+        .dstStages = VK_PIPELINE_STAGE_2_NONE,
+        .dstAccess = VK_ACCESS_2_NONE,
+        .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+        .legacySrcStages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+        .legacyDstStages = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        .legacySrcAccess = 0,
+        .legacyDstAccess = 0
+    });
+}
+
+void setTestTransientSize(RenderGraph *graph, const uint32_t resource, const VkDeviceSize size) {
+    graph->resources[resource].size = size;
+    graph->resources[resource].offset = 256; // The alignment, as createRenderGraphTransients leaves it
+}
+
+/**
+ * Transients alive at different times share memory, ones alive together don't.
+ **/
+void testTransientAliasing() {
+    RenderGraph graph;
+    createRenderGraph(&graph, VK_NULL_HANDLE, VK_NULL_HANDLE, false);
+
+    const uint32_t early = createRenderGraphImage(
+        &graph, "early", VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT
+    );
+    const uint32_t late = createRenderGraphImage(
+        &graph, "late", VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT
+    );
+    const uint32_t whole = createRenderGraphImage(
+        &graph, "whole", VK_FORMAT_R8G8B8A8_UNORM, VK_IMAGE_USAGE_STORAGE_BIT, VK_IMAGE_ASPECT_COLOR_BIT
+    );
+    const uint32_t buffer = importRenderGraphBuffer(&graph, "buffer");
+    const uint32_t output = addTestOutput(&graph, "output");
+
+    // early lives through passes 0 and 1, late through 2 and 3, whole through all of them
+    const uint32_t first = addRenderGraphPass(&graph, "first", nullptr, nullptr);
+    addTestAccess(&graph, first, early, true);
+    addTestAccess(&graph, first, whole, true);
+    const uint32_t second = addRenderGraphPass(&graph, "second", nullptr, nullptr);
+    addTestAccess(&graph, second, early, false);
+    addTestAccess(&graph, second, buffer, true);
+    const uint32_t third = addRenderGraphPass(&graph, "third", nullptr, nullptr);
+    addTestAccess(&graph, third, buffer, false);
+    addTestAccess(&graph, third, late, true);
+    const uint32_t fourth = addRenderGraphPass(&graph, "fourth", nullptr, nullptr);
+    addTestAccess(&graph, fourth, late, false);
+    addTestAccess(&graph, fourth, whole, false);
+    addTestAccess(&graph, fourth, output, true);
+
+    compileRenderGraph(&graph);
+    expectPassOrder(&graph, "aliasing", (uint32_t[]){first, second, third, fourth}, 4);
+
+    setTestTransientSize(&graph, early, 1000);
+    setTestTransientSize(&graph, late, 1000);
+    setTestTransientSize(&graph, whole, 2000);
+    const VkDeviceSize memorySize = placeRenderGraphTransients(&graph);
+
+    const RenderGraphResource *resources = graph.resources;
+    if (resources[early].offset != resources[late].offset) {
+        printLn("FAIL aliasing: early at %llu and late at %llu don't share memory", resources[early].offset, resources[late].offset);
+        failures++;
+    }
+    if (overlapsRenderGraphMemory(&resources[whole], &resources[early]) ||
+        overlapsRenderGraphMemory(&resources[whole], &resources[late])) {
+        printLn("FAIL aliasing: whole overlaps a transient alive at the same time");
+        failures++;
+    }
+    if (resources[late].aliasOf != early || resources[early].aliasOf != RENDER_GRAPH_NONE) {
+        printLn("FAIL aliasing: late should wait on early, got %d and %d", resources[late].aliasOf, resources[early].aliasOf);
+        failures++;
+    }
+    // whole at 0, early and late after it at the next 256 byte boundary
+    if (memorySize != 2048 + 1000) {
+        printLn("FAIL aliasing: %llu bytes, expected %d", memorySize, 2048 + 1000);
+        failures++;
+    }
+}
+
+int main() {
+    testWriteAfterRead();
+    testReadAfterWriteAndCulling();
+    testReadAfterWriteBarrier();
+    testWriteAfterReadBarrier();
+    testWriteAfterWriteBarrier();
+    testLayoutTransitionBarriers();
+    testTransientAliasing();
+
+    if (failures > 0) return 1;
+    printLn("Render graph tests passed");
+    return 0;
+}
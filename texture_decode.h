@@ -0,0 +1,278 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef TEXTURE_DECODE_H
+#define TEXTURE_DECODE_H
+
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "io.h"
+
+/**
+ * CPU side image decoding for the texture loader, safe to call from any thread.
+ * There is no image library in the tree so two formats are read directly:
+ * binary PPM (P6) for plain RGB8 art, expanded to RGBA8 with mips generated on
+ * the GPU, and DDS for block compressed images whose mips come from the file.
+ **/
+#define TEXTURE_MAX_MIP_LEVELS 16
+
+typedef struct DecodedImage {
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels; // Levels present in data
+    uint32_t blockSize; // Bytes per 4x4 block, 0 for uncompressed formats
+    bool generateMips; // Only level 0 is in data, the rest are blitted on upload
+    uint8_t *data;
+    size_t size;
+    size_t mipOffsets[TEXTURE_MAX_MIP_LEVELS];
+} DecodedImage;
+
+uint32_t getFullMipLevelCount(const uint32_t width, const uint32_t height) {
+    uint32_t levels = 1;
+    uint32_t size = width > height ? width : height;
+    while (size > 1 && levels < TEXTURE_MAX_MIP_LEVELS) {
+        size /= 2;
+        levels++;
+    }
+    return levels;
+}
+
+uint32_t getMipDimension(const uint32_t size, const uint32_t level) {
+    const uint32_t dimension = size >> level;
+    return dimension == 0 ? 1 : dimension;
+}
+
+size_t getMipSize(const uint32_t width, const uint32_t height, const uint32_t blockSize) {
+    if (blockSize == 0) return (size_t) width * height * 4;
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * blockSize;
+}
+
+void freeDecodedImage(DecodedImage *image) {
+    free(image->data);
+    image->data = nullptr;
+    image->size = 0;
+}
+
+uint8_t *readImageFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        printLn("Failed to open image %s", path);
+        return nullptr;
+    }
+
+    fseek(file, 0, SEEK_END);
+    const long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *bytes = length > 0 ? malloc((size_t) length) : nullptr;
+    if (bytes == nullptr || fread(bytes, 1, (size_t) length, file) != (size_t) length) {
+        printLn("Failed to read image %s", path);
+        free(bytes);
+        fclose(file);
+        return nullptr;
+    }
+
+    fclose(file);
+    *size = (size_t) length;
+    return bytes;
+}
+
+const uint8_t *readPpmNumber(const uint8_t *cursor, const uint8_t *end, uint32_t *value) {
+    // Whitespace and # comments may appear between any two header fields
+    while (cursor < end) {
+        if (*cursor == '#') while (cursor < end && *cursor != '\n') cursor++;
+        else if (*cursor == ' ' || *cursor == '\t' || *cursor == '\r' || *cursor == '\n') cursor++;
+        else break;
+    }
+
+    const uint8_t *start = cursor;
+    uint32_t result = 0;
+    for (; cursor < end && *cursor >= '0' && *cursor <= '9'; cursor++)
+        if (result < 1u << 24) result = result * 10 + (*cursor - '0');
+
+    if (cursor == start) return nullptr;
+    *value = result;
+    return cursor;
+}
+
+bool decodePpm(const uint8_t *bytes, const size_t size, DecodedImage *image) {
+    const uint8_t *end = bytes + size;
+    uint32_t width, height, maxValue;
+
+    const uint8_t *cursor = readPpmNumber(bytes + 2, end, &width);
+    if (cursor != nullptr) cursor = readPpmNumber(cursor, end, &height);
+    if (cursor != nullptr) cursor = readPpmNumber(cursor, end, &maxValue);
+    // A single whitespace byte separates the header from the pixels
+    if (cursor == nullptr || cursor >= end || maxValue != 255 || width == 0 || height == 0) return false;
+    cursor++;
+
+    const size_t pixelCount = (size_t) width * height;
+    if ((size_t) (end - cursor) < pixelCount * 3) return false;
+
+    *image = (DecodedImage){
+        .format = VK_FORMAT_R8G8B8A8_SRGB,
+        .width = width,
+        .height = height,
+        .mipLevels = 1,
+        .blockSize = 0,
+        .generateMips = true,
+        .size = pixelCount * 4,
+        .mipOffsets = {0}
+    };
+    image->data = malloc(image->size);
+
+    for (size_t i = 0; i < pixelCount; i++) {
+        image->data[i * 4] = cursor[i * 3];
+        image->data[i * 4 + 1] = cursor[i * 3 + 1];
+        image->data[i * 4 + 2] = cursor[i * 3 + 2];
+        image->data[i * 4 + 3] = 255;
+    }
+
+    return true;
+}
+
+#define DDS_MAGIC 0x20534444 // "DDS "
+#define DDS_HEADER_SIZE 124
+#define DDS_DX10_HEADER_SIZE 20
+#define DDS_FOURCC(a, b, c, d) ((uint32_t) (a) | (uint32_t) (b) << 8 | (uint32_t) (c) << 16 | (uint32_t) (d) << 24)
+
+uint32_t readDdsUint(const uint8_t *bytes, const size_t offset) {
+    uint32_t value;
+    memcpy(&value, bytes + offset, sizeof(uint32_t));
+    return value;
+}
+
+/**
+ * Maps a legacy fourCC or a DXGI_FORMAT to the Vulkan format and its block size.
+ * Returns VK_FORMAT_UNDEFINED for anything the loader doesn't handle.
+ **/
+VkFormat getDdsFormat(const uint32_t fourCC, const uint32_t dxgiFormat, uint32_t *blockSize) {
+    *blockSize = 16;
+
+    // Legacy fourCCs carry no color space, DXT1 to DXT5 are treated as color maps
+    switch (fourCC) {
+        case DDS_FOURCC('D', 'X', 'T', '1'):
+            *blockSize = 8;
+            return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        case DDS_FOURCC('D', 'X', 'T', '3'):
+            return VK_FORMAT_BC2_SRGB_BLOCK;
+        case DDS_FOURCC('D', 'X', 'T', '5'):
+            return VK_FORMAT_BC3_SRGB_BLOCK;
+        case DDS_FOURCC('A', 'T', 'I', '2'):
+        case DDS_FOURCC('B', 'C', '5', 'U'):
+            return VK_FORMAT_BC5_UNORM_BLOCK;
+        case DDS_FOURCC('D', 'X', '1', '0'):
+            break;
+        default:
+            return VK_FORMAT_UNDEFINED;
+    }
+
+    switch (dxgiFormat) {
+        case 28: // DXGI_FORMAT_R8G8B8A8_UNORM
+            *blockSize = 0;
+            return VK_FORMAT_R8G8B8A8_UNORM;
+        case 29: // DXGI_FORMAT_R8G8B8A8_UNORM_SRGB
+            *blockSize = 0;
+            return VK_FORMAT_R8G8B8A8_SRGB;
+        case 71:
+            *blockSize = 8;
+            return VK_FORMAT_BC1_RGBA_UNORM_BLOCK;
+        case 72:
+            *blockSize = 8;
+            return VK_FORMAT_BC1_RGBA_SRGB_BLOCK;
+        case 74:
+            return VK_FORMAT_BC2_UNORM_BLOCK;
+        case 75:
+            return VK_FORMAT_BC2_SRGB_BLOCK;
+        case 77:
+            return VK_FORMAT_BC3_UNORM_BLOCK;
+        case 78:
+            return VK_FORMAT_BC3_SRGB_BLOCK;
+        case 83:
+            return VK_FORMAT_BC5_UNORM_BLOCK;
+        case 98:
+            return VK_FORMAT_BC7_UNORM_BLOCK;
+        case 99:
+            return VK_FORMAT_BC7_SRGB_BLOCK;
+        default:
+            return VK_FORMAT_UNDEFINED;
+    }
+}
+
+bool decodeDds(const uint8_t *bytes, const size_t size, DecodedImage *image) {
+    if (size < 4 + DDS_HEADER_SIZE || readDdsUint(bytes, 4) != DDS_HEADER_SIZE) return false;
+
+    const uint32_t height = readDdsUint(bytes, 12);
+    const uint32_t width = readDdsUint(bytes, 16);
+    const uint32_t mipMapCount = readDdsUint(bytes, 28);
+    const uint32_t fourCC = readDdsUint(bytes, 84);
+
+    size_t dataOffset = 4 + DDS_HEADER_SIZE;
+    uint32_t dxgiFormat = 0;
+    if (fourCC == DDS_FOURCC('D', 'X', '1', '0')) {
+        if (size < dataOffset + DDS_DX10_HEADER_SIZE) return false;
+        dxgiFormat = readDdsUint(bytes, dataOffset);
+        // Only plain 2D textures, arrays and cube maps have a different layout
+        if (
+            readDdsUint(bytes, dataOffset + 4) != 3 ||
+            (readDdsUint(bytes, dataOffset + 8) & 0x4) != 0 ||
+            readDdsUint(bytes, dataOffset + 12) > 1
+        ) return false;
+        dataOffset += DDS_DX10_HEADER_SIZE;
+    }
+
+    uint32_t blockSize;
+    const VkFormat format = getDdsFormat(fourCC, dxgiFormat, &blockSize);
+    if (format == VK_FORMAT_UNDEFINED || width == 0 || height == 0) return false;
+
+    uint32_t mipLevels = mipMapCount == 0 ? 1 : mipMapCount;
+    if (mipLevels > TEXTURE_MAX_MIP_LEVELS) mipLevels = TEXTURE_MAX_MIP_LEVELS;
+
+    *image = (DecodedImage){
+        .format = format,
+        .width = width,
+        .height = height,
+        .mipLevels = mipLevels,
+        .blockSize = blockSize,
+        // Compressed formats can't be blit targets, a single level file stays a single level
+        .generateMips = blockSize == 0 && mipLevels == 1
+    };
+
+    size_t total = 0;
+    for (uint32_t level = 0; level < mipLevels; level++) {
+        image->mipOffsets[level] = total;
+        total += getMipSize(getMipDimension(width, level), getMipDimension(height, level), blockSize);
+    }
+    if (size - dataOffset < total) return false;
+
+    image->size = total;
+    image->data = malloc(total);
+    memcpy(image->data, bytes + dataOffset, total);
+    return true;
+}
+
+/**
+ * Decodes the PPM or DDS at path, picked by the file's magic rather than its name.
+ * Returns false with image untouched when the file can't be read or isn't supported.
+ **/
+bool decodeImage(const char *path, DecodedImage *image) {
+    size_t size;
+    uint8_t *bytes = readImageFile(path, &size);
+    if (bytes == nullptr) return false;
+
+    bool decoded = false;
+    if (size >= 4 && readDdsUint(bytes, 0) == DDS_MAGIC) decoded = decodeDds(bytes, size, image);
+    else if (size >= 2 && bytes[0] == 'P' && bytes[1] == '6') decoded = decodePpm(bytes, size, image);
+
+    if (!decoded) printLn("Image %s isn't a supported PPM (P6, 8 bit) or DDS", path);
+
+    free(bytes);
+    return decoded;
+}
+
+#endif //TEXTURE_DECODE_H
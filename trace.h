@@ -0,0 +1,417 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <vulkan/vulkan.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "array.h"
+#include "io.h"
+#include "constants.h"
+#include "vulkan_callbacks.h"
+
+/**
+ * CPU and GPU zones written out as Chrome trace event JSON, which Perfetto
+ * and chrome://tracing load.
+ *   LEARNING_TRACE         file the trace is written to, tracing is off without it
+ *   LEARNING_TRACE_FRAMES  first-last frame to record, e.g. 100-200, every frame by default
+ * The trace is written once the last frame of the range was recorded, when
+ * writeTrace is asked for (F12) or at exit.
+ * Every thread appends to its own buffer so recording takes no lock, a
+ * buffer is only published with an atomic count and linked into the thread
+ * list once. While tracing is off a zone costs one relaxed load.
+ * GPU zones are timestamp queries read back once the frame's fence signalled.
+ * Without calibrated timestamps they're placed on the CPU timeline by lining
+ * the frame's first timestamp up with its submit, so GPU zones show up
+ * slightly early by however long the queue took to start the work.
+ **/
+#define TRACE_EVENTS_PER_THREAD 65536
+#define TRACE_GPU_ZONES_PER_FRAME 32
+
+typedef struct TraceEvent {
+    const char *name; // Has to outlive the trace, string literals in practice
+    uint64_t start; // Nanoseconds since the trace started
+    uint64_t duration;
+} TraceEvent;
+
+typedef struct TraceThreadBuffer {
+    TraceEvent events[TRACE_EVENTS_PER_THREAD];
+    atomic_uint count; // Events below it are complete
+    uint32_t dropped; // Events that didn't fit
+    uint32_t tid;
+    const char *name;
+    struct TraceThreadBuffer *next;
+} TraceThreadBuffer;
+
+typedef struct Trace {
+    atomic_bool recording;
+    bool configured; // LEARNING_TRACE was set, recording may start later in the frame range
+    bool written;
+    const char *path;
+    uint64_t origin; // CLOCK_MONOTONIC nanoseconds
+    uint64_t firstFrame;
+    uint64_t lastFrame;
+    _Atomic(TraceThreadBuffer *) threads;
+    atomic_uint nextTid;
+    TraceThreadBuffer *gpu; // Only appended to by the main thread
+} Trace;
+
+typedef struct TraceZone {
+    const char *name;
+    uint64_t start;
+    bool active; // Tracing was recording when the zone began
+} TraceZone;
+
+Trace trace;
+static _Thread_local TraceThreadBuffer *traceThreadBuffer;
+static _Thread_local const char *traceThreadName;
+
+uint64_t getTraceClock() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ull + (uint64_t) now.tv_nsec;
+}
+
+TraceThreadBuffer *createTraceThreadBuffer(const char *name) {
+    TraceThreadBuffer *buffer = malloc(sizeof(TraceThreadBuffer));
+    buffer->count = 0;
+    buffer->dropped = 0;
+    buffer->tid = atomic_fetch_add(&trace.nextTid, 1);
+    buffer->name = name;
+
+    // Lock free push, buffers are never unlinked until the process exits
+    TraceThreadBuffer *head = atomic_load(&trace.threads);
+    do {
+        buffer->next = head;
+    } while (!atomic_compare_exchange_weak(&trace.threads, &head, buffer));
+
+    return buffer;
+}
+
+/**
+ * Names the calling thread's track, call before its first zone.
+ **/
+void setTraceThreadName(const char *name) {
+    traceThreadName = name;
+}
+
+void appendTraceEvent(TraceThreadBuffer *buffer, const TraceEvent event) {
+    const uint32_t count = atomic_load_explicit(&buffer->count, memory_order_relaxed);
+    if (count == TRACE_EVENTS_PER_THREAD) {
+        buffer->dropped++;
+        return;
+    }
+
+    buffer->events[count] = event;
+    atomic_store_explicit(&buffer->count, count + 1, memory_order_release);
+}
+
+static inline bool isTraceRecording() {
+    return atomic_load_explicit(&trace.recording, memory_order_relaxed);
+}
+
+static inline TraceZone beginTraceZone(const char *name) {
+    if (!isTraceRecording()) return (TraceZone){.active = false};
+    return (TraceZone){.name = name, .start = getTraceClock(), .active = true};
+}
+
+static inline void endTraceZone(const TraceZone *zone) {
+    if (!zone->active) return;
+
+    const uint64_t end = getTraceClock();
+    if (traceThreadBuffer == nullptr)
+        traceThreadBuffer = createTraceThreadBuffer(traceThreadName == nullptr ? "worker" : traceThreadName);
+
+    appendTraceEvent(traceThreadBuffer, (TraceEvent){
+        .name = zone->name,
+        .start = zone->start - trace.origin,
+        .duration = end - zone->start
+    });
+}
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+/**
+ * Times the rest of the enclosing scope.
+ **/
+#define TRACE_ZONE(name) \
+    const TraceZone TRACE_CONCAT(traceZone, __LINE__) __attribute__((cleanup(endTraceZone))) = beginTraceZone(name)
+
+/**
+ * Reads LEARNING_TRACE and LEARNING_TRACE_FRAMES, on the main thread before
+ * any other thread starts.
+ **/
+void startTrace() {
+    trace = (Trace){.configured = false, .written = false, .path = getenv("LEARNING_TRACE")};
+    atomic_store(&trace.recording, false);
+    atomic_store(&trace.threads, nullptr);
+    atomic_store(&trace.nextTid, 1);
+    if (trace.path == nullptr || *trace.path == '\0') return;
+
+    trace.configured = true;
+    trace.origin = getTraceClock();
+    trace.firstFrame = 0;
+    trace.lastFrame = UINT64_MAX;
+
+    const char *frames = getenv("LEARNING_TRACE_FRAMES");
+    if (frames != nullptr && *frames != '\0') {
+        char *end;
+        trace.firstFrame = strtoull(frames, &end, 10);
+        if (*end == '-') trace.lastFrame = strtoull(end + 1, nullptr, 10);
+    }
+
+    setTraceThreadName("main");
+    trace.gpu = createTraceThreadBuffer("GPU");
+    atomic_store(&trace.recording, trace.firstFrame == 0);
+
+    printLn("Tracing frames %llu to %llu into %s", trace.firstFrame, trace.lastFrame, trace.path);
+}
+
+void writeTraceBuffer(FILE *file, const TraceThreadBuffer *buffer, bool *first) {
+    fprintf(
+        file,
+        "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+        *first ? "" : ",",
+        buffer->tid,
+        buffer->name
+    );
+    *first = false;
+
+    const uint32_t count = atomic_load_explicit(&buffer->count, memory_order_acquire);
+    for (uint32_t i = 0; i < count; i++) {
+        const TraceEvent *event = &buffer->events[i];
+        fprintf(
+            file,
+            ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            event->name,
+            buffer->tid,
+            (double) event->start / 1000.0,
+            (double) event->duration / 1000.0
+        );
+    }
+}
+
+/**
+ * Writes everything recorded so far. Threads may keep appending while it
+ * runs, their newest events are just left out.
+ **/
+void writeTrace() {
+    if (!trace.configured) return;
+
+    FILE *file = fopen(trace.path, "w");
+    if (file == nullptr) {
+        printLn("Failed to write trace %s", trace.path);
+        return;
+    }
+
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    bool first = true;
+    uint32_t events = 0, dropped = 0;
+    for (TraceThreadBuffer *buffer = atomic_load(&trace.threads); buffer != nullptr; buffer = buffer->next) {
+        writeTraceBuffer(file, buffer, &first);
+        events += atomic_load(&buffer->count);
+        dropped += buffer->dropped;
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    trace.written = true;
+    printLn("Wrote %d trace events to %s, %d dropped", events, trace.path, dropped);
+}
+
+/**
+ * Called by drawFrame with the number of the frame it's about to record.
+ **/
+void setTraceFrame(const uint64_t frame) {
+    if (!trace.configured || trace.written) return;
+
+    if (frame > trace.lastFrame) {
+        atomic_store(&trace.recording, false);
+        writeTrace();
+    } else if (frame >= trace.firstFrame) atomic_store(&trace.recording, true);
+}
+
+/**
+ * Writes the trace if nothing asked for it yet.
+ **/
+void finishTrace() {
+    atomic_store(&trace.recording, false);
+    if (trace.configured && !trace.written) writeTrace();
+}
+
+typedef struct GpuTraceFrame {
+    const char *names[TRACE_GPU_ZONES_PER_FRAME];
+    uint32_t count; // Zones written this frame, two queries each
+    uint64_t submitTime; // Trace clock at submit
+} GpuTraceFrame;
+
+/**
+ * Timestamp queries for every frame in flight. queryPool is VK_NULL_HANDLE
+ * when tracing isn't configured or the queue has no timestamps, every call is
+ * then a no op.
+ **/
+typedef struct GpuTrace {
+    VkQueryPool queryPool; // TRACE_GPU_ZONES_PER_FRAME * 2 queries per frame in flight
+    Uint32SizedMutableArray frames; // GpuTraceFrame
+    double timestampPeriod; // Nanoseconds per tick
+    uint64_t timestampMask;
+} GpuTrace;
+
+void createGpuTrace(
+    GpuTrace *gpuTrace,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const uint32_t queueFamilyIndex
+) {
+    *gpuTrace = (GpuTrace){.queryPool = VK_NULL_HANDLE, .frames = {.items = nullptr, .size = 0, .count = 0}};
+    if (!trace.configured) return;
+
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+    uint32_t familyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, nullptr);
+    VkQueueFamilyProperties *families = malloc(sizeof(VkQueueFamilyProperties) * familyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &familyCount, families);
+    const uint32_t validBits = families[queueFamilyIndex].timestampValidBits;
+    free(families);
+
+    if (validBits == 0 || properties.limits.timestampPeriod == 0.0f) {
+        printLn("Queue family %d has no timestamps, GPU zones are left out of the trace", queueFamilyIndex);
+        return;
+    }
+
+    const VkQueryPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = TRACE_GPU_ZONES_PER_FRAME * 2 * MAX_FRAMES_IN_FLIGHT
+    };
+    if (vkCreateQueryPool(logicalDevice, &poolInfo, hostAllocator, &gpuTrace->queryPool) != VK_SUCCESS) {
+        printLn("Failed to create the trace query pool, GPU zones are left out of the trace");
+        gpuTrace->queryPool = VK_NULL_HANDLE;
+        return;
+    }
+
+    gpuTrace->frames.count = MAX_FRAMES_IN_FLIGHT;
+    gpuTrace->frames.size = sizeof(GpuTraceFrame) * MAX_FRAMES_IN_FLIGHT;
+    gpuTrace->frames.items = calloc(MAX_FRAMES_IN_FLIGHT, sizeof(GpuTraceFrame));
+    gpuTrace->timestampPeriod = properties.limits.timestampPeriod;
+    gpuTrace->timestampMask = validBits == 64 ? UINT64_MAX : (1ull << validBits) - 1;
+}
+
+GpuTraceFrame *getGpuTraceFrame(const GpuTrace *gpuTrace, const uint32_t frame) {
+    return &((GpuTraceFrame *) gpuTrace->frames.items)[frame];
+}
+
+/**
+ * Reads back the zones of frame's previous submission, its fence has to have
+ * signalled.
+ **/
+void collectGpuTrace(const GpuTrace *gpuTrace, const VkDevice logicalDevice, const uint32_t frame) {
+    if (gpuTrace->queryPool == VK_NULL_HANDLE) return;
+
+    GpuTraceFrame *traceFrame = getGpuTraceFrame(gpuTrace, frame);
+    if (traceFrame->count == 0) return;
+
+    uint64_t timestamps[TRACE_GPU_ZONES_PER_FRAME * 2];
+    const VkResult result = vkGetQueryPoolResults(
+        logicalDevice,
+        gpuTrace->queryPool,
+        frame * TRACE_GPU_ZONES_PER_FRAME * 2,
+        traceFrame->count * 2,
+        sizeof(timestamps),
+        timestamps,
+        sizeof(uint64_t),
+        VK_QUERY_RESULT_64_BIT
+    );
+    const uint32_t count = traceFrame->count;
+    traceFrame->count = 0;
+    if (result != VK_SUCCESS) return;
+
+    const uint64_t base = timestamps[0] & gpuTrace->timestampMask;
+    for (uint32_t i = 0; i < count; i++) {
+        const uint64_t begin = (timestamps[i * 2] & gpuTrace->timestampMask) - base;
+        const uint64_t end = (timestamps[i * 2 + 1] & gpuTrace->timestampMask) - base;
+        appendTraceEvent(trace.gpu, (TraceEvent){
+            .name = traceFrame->names[i],
+            .start = traceFrame->submitTime + (uint64_t) ((double) begin * gpuTrace->timestampPeriod),
+            .duration = (uint64_t) ((double) (end - begin) * gpuTrace->timestampPeriod)
+        });
+    }
+}
+
+/**
+ * Recorded first in frame's command buffer, outside any render pass.
+ **/
+void resetGpuTrace(const VkCommandBuffer commandBuffer, const GpuTrace *gpuTrace, const uint32_t frame) {
+    if (gpuTrace->queryPool == VK_NULL_HANDLE) return;
+
+    getGpuTraceFrame(gpuTrace, frame)->count = 0;
+    vkCmdResetQueryPool(
+        commandBuffer,
+        gpuTrace->queryPool,
+        frame * TRACE_GPU_ZONES_PER_FRAME * 2,
+        TRACE_GPU_ZONES_PER_FRAME * 2
+    );
+}
+
+/**
+ * Returns the zone to pass to endGpuTraceZone, TRACE_GPU_ZONES_PER_FRAME when
+ * nothing was written.
+ **/
+uint32_t beginGpuTraceZone(
+    const VkCommandBuffer commandBuffer,
+    const GpuTrace *gpuTrace,
+    const uint32_t frame,
+    const char *name
+) {
+    if (gpuTrace->queryPool == VK_NULL_HANDLE || !isTraceRecording()) return TRACE_GPU_ZONES_PER_FRAME;
+
+    GpuTraceFrame *traceFrame = getGpuTraceFrame(gpuTrace, frame);
+    if (traceFrame->count == TRACE_GPU_ZONES_PER_FRAME) return TRACE_GPU_ZONES_PER_FRAME;
+
+    const uint32_t zone = traceFrame->count++;
+    traceFrame->names[zone] = name;
+    vkCmdWriteTimestamp(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+        gpuTrace->queryPool,
+        (frame * TRACE_GPU_ZONES_PER_FRAME + zone) * 2
+    );
+    return zone;
+}
+
+void endGpuTraceZone(
+    const VkCommandBuffer commandBuffer,
+    const GpuTrace *gpuTrace,
+    const uint32_t frame,
+    const uint32_t zone
+) {
+    if (zone >= TRACE_GPU_ZONES_PER_FRAME) return;
+    vkCmdWriteTimestamp(
+        commandBuffer,
+        VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+        gpuTrace->queryPool,
+        (frame * TRACE_GPU_ZONES_PER_FRAME + zone) * 2 + 1
+    );
+}
+
+void markGpuTraceSubmit(const GpuTrace *gpuTrace, const uint32_t frame) {
+    if (gpuTrace->queryPool == VK_NULL_HANDLE) return;
+    getGpuTraceFrame(gpuTrace, frame)->submitTime = getTraceClock() - trace.origin;
+}
+
+void destroyGpuTrace(const VkDevice logicalDevice, GpuTrace *gpuTrace) {
+    if (gpuTrace->queryPool != VK_NULL_HANDLE) vkDestroyQueryPool(logicalDevice, gpuTrace->queryPool, hostAllocator);
+    free(gpuTrace->frames.items);
+    *gpuTrace = (GpuTrace){.queryPool = VK_NULL_HANDLE, .frames = {.items = nullptr, .size = 0, .count = 0}};
+}
+
+#endif //TRACE_H
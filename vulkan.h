@@ -12,19 +12,19 @@
 #include <stdlib.h>
 #include <string.h>
 #include "io.h"
+#include "build_profile.h"
 #include "glfw_app.h"
 #include "array.h"
 #include "vulkan_callbacks.h"
 #include "vulkan_extensions.h"
 #include "vulkan_swap_chain.h"
+#include "vulkan_physical_device.h"
+#include "startup_trace.h"
+#include "shader_library.h"
 #include "vulkan_graphics_pipeline.h"
 #include "vulkan_frame_buffers.h"
 #include "vulkan_command_buffers.h"
 
-typedef bool (*VkDeviceSelectionCriteria)(VkPhysicalDevice, VkPhysicalDeviceProperties, VkPhysicalDeviceFeatures,
-                                          Uint32SizedMutableArray);
-
-
 VkInstanceCreateInfo *createVkInstanceCreateInfo(
     //const void *pNext,
     // VkInstanceCreateFlags flags,
@@ -105,7 +105,7 @@ void buildVulkanInstance(
     vkCreateInfo->pNext = debugCreateInfo;
     app->vkInstance = malloc(sizeof(VkInstance));
 
-    if (vkCreateInstance(vkCreateInfo, NULL, app->vkInstance) != VK_SUCCESS) {
+    if (vkCreateInstance(vkCreateInfo, hostAllocator, app->vkInstance) != VK_SUCCESS) {
         printErrLn("Failed to create Vulkan Instance");
         exit(-1);
     } else printLn("CREATED VULKAN INSTANCE CORRECTLY");
@@ -130,6 +130,7 @@ bool compareVkLayerNames(Any first, const Uint32SizedMutableArray array, const u
     return false;
 }
 
+#if LEARNING_DEBUG_BUILD
 /**#Documentation
  * @param messageSeverity VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_INFO_BIT_EXT
  *                        VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT | VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT
@@ -156,6 +157,7 @@ static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
 
     return VK_FALSE;
 }
+#endif
 
 void addSupportedVulkanLayerExtensions(
     Uint32SizedMutableArray *enabledLayerExtensions,
@@ -215,6 +217,7 @@ void addSupportedVulkanExtensions(
     free(properties);
 }
 
+#if LEARNING_DEBUG_BUILD
 VkResult CreateDebugUtilsMessengerEXT(
     VkInstance instance,
     const VkDebugUtilsMessengerCreateInfoEXT *pCreateInfo,
@@ -230,14 +233,14 @@ VkResult CreateDebugUtilsMessengerEXT(
     }
 }
 
-void setUpDebug(GLFWApp app, VkDebugUtilsMessengerCreateInfoEXT *createInfo) {
-    app.debugMessenger = malloc(sizeof(VkDebugUtilsMessengerEXT));
+void setUpDebug(GLFWApp *app, VkDebugUtilsMessengerCreateInfoEXT *createInfo) {
+    app->debugMessenger = malloc(sizeof(VkDebugUtilsMessengerEXT));
 
     if (VK_SUCCESS != CreateDebugUtilsMessengerEXT(
-            *app.vkInstance,
+            *app->vkInstance,
             createInfo,
-            NULL,
-            app.debugMessenger
+            hostAllocator,
+            app->debugMessenger
         )) {
         printErrLn("Failed to create error message handler");
         exit(39);
@@ -256,6 +259,7 @@ void populateDebugMessenger(VkDebugUtilsMessengerCreateInfoEXT *createInfo) {
     createInfo->pfnUserCallback = debugCallback;
     createInfo->pUserData = NULL; // Optional
 }
+#endif
 
 // Should be internal not for use externally
 void initVulkan(
@@ -270,223 +274,139 @@ void initVulkan(
         VK_MAKE_VERSION(1, 0, 0),
         "KUI ENGINE",
         VK_MAKE_VERSION(1, 0, 0),
-        VK_API_VERSION_1_0
+        VK_API_VERSION_1_2
     );
 
     Uint32SizedMutableArray *glfwExtensions = getGLFWExtensions();
     Uint32SizedMutableArray enabledValidationLayers = {.size = 0, .count = 0};
+    const bool validation = isValidationEnabled();
 
     // VkExtensionProperties
     addSupportedVulkanExtensions(glfwExtensions, enabledExtensions);
-    addSupportedVulkanLayerExtensions(&enabledValidationLayers, requestedValidationLayers);
+    if (validation) addSupportedVulkanLayerExtensions(&enabledValidationLayers, requestedValidationLayers);
 
+#if LEARNING_DEBUG_BUILD
     VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = {};
 
     populateDebugMessenger(&debugCreateInfo);
-    buildVulkanInstance(app, appInfo, glfwExtensions, enabledValidationLayers, &debugCreateInfo);
-    setUpDebug(*app, &debugCreateInfo);
+    buildVulkanInstance(app, appInfo, glfwExtensions, enabledValidationLayers, validation ? &debugCreateInfo : nullptr);
+    if (validation) setUpDebug(app, &debugCreateInfo);
+#else
+    // Layers loaded through LEARNING_VALIDATION report through their own default output
+    buildVulkanInstance(app, appInfo, glfwExtensions, enabledValidationLayers, nullptr);
+#endif
+    printLn("Validation layers %s", validation ? "enabled" : "disabled");
     // Required for clean up
     free(appInfo);
     clearGLFWExtensions(glfwExtensions);
 }
 
-void populateQueueFamilies(const VkPhysicalDevice device, Uint32SizedMutableArray *queueFamilies) {
-    if (queueFamilies->count > 0) {
-        queueFamilies->count = 0;
-        queueFamilies->size = 0;
-        free(queueFamilies->items);
-    }
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilies->count, NULL);
-
-    if (queueFamilies->count == 0) return;
-
-    queueFamilies->items = malloc(sizeof(VkQueueFamilyProperties) * queueFamilies->count);
-
-    vkGetPhysicalDeviceQueueFamilyProperties(
-        device,
-        &queueFamilies->count,
-        (VkQueueFamilyProperties *) queueFamilies->items
-    );
-}
-
-void enumeratePhysicalDevices(GLFWApp *app, const VkInstance *vkInstance) {
-    vkEnumeratePhysicalDevices(*vkInstance, &app->physicalDevices->count, NULL);
-
-    if (app->physicalDevices->count == 0) {
-        printLn("Failed to get usable GPU physical devices");
-        exit(29);
-    } else printLn("Found %d physical devices", app->physicalDevices->count);
-
-    vkEnumeratePhysicalDevices(
-        *vkInstance,
-        &app->physicalDevices->count,
-        (VkPhysicalDevice *) app->physicalDevices->items
-    );
-
-    printLn("Done enumerating physical devices");
-}
-
-void selectPresentMode(
+/**
+ * Descriptor indexing is a hard requirement, scorePhysicalDevice rejects
+ * devices below Vulkan 1.2 or without it. The checks here only keep a device
+ * that slipped through from being given features it lacks, prepareVulkanApp
+ * exits on it.
+ **/
+void populateVulkan12Features(
     GLFWApp *app,
-    const Uint32SizedMutableArray queueFamilies,
     const VkPhysicalDevice physicalDevice,
-    const VkSurfaceKHR surface
+    VkPhysicalDeviceVulkan12Features *enabledFeatures
 ) {
-    for (uint32_t j = 0; j < queueFamilies.count; j++) {
-        printLn("At Queue family  %d", j);
-
-        const auto queueFamilyProperties = ((VkQueueFamilyProperties *) queueFamilies.items)[j];
-
-        VkBool32 presentSupport = false;
-        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, j, surface, &presentSupport);
-
-        /**
-         * Nevertheless, you could add logic to explicitly prefer a physical device
-         * that supports drawing and presentation in the same queue for improved performance.
-         **/
-        if (presentSupport) {
-            app->presentFamilyIndex = j;
-            printLn("Selecting present mode %d", j);
-        }
-
-        if (queueFamilyProperties.queueFlags & VK_QUEUE_GRAPHICS_BIT) app->queueFamilyIndex = j;
+    enabledFeatures->sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+
+    const VkPhysicalDeviceProperties deviceProperties = app->physicalDeviceProperties;
+    if (deviceProperties.apiVersion < VK_API_VERSION_1_2) {
+        printLn("Device only supports Vulkan %d.%d", VK_API_VERSION_MAJOR(deviceProperties.apiVersion),
+                VK_API_VERSION_MINOR(deviceProperties.apiVersion));
+        app->drawIndirectCount = VK_FALSE;
+        app->descriptorIndexing = VK_FALSE;
+        return;
+    }
 
-        if (app->presentFamilyIndex != -1 && app->queueFamilyIndex != -1) break;
+    // Queried once during device selection
+    const VkPhysicalDeviceVulkan12Features supportedFeatures12 = app->physicalDeviceFeatures12;
+
+    enabledFeatures->drawIndirectCount = supportedFeatures12.drawIndirectCount;
+    app->drawIndirectCount = supportedFeatures12.drawIndirectCount;
+
+    // What the bindless table needs, all or nothing
+    app->descriptorIndexing = supportsDescriptorIndexing(&supportedFeatures12);
+    if (app->descriptorIndexing) {
+        enabledFeatures->descriptorIndexing = supportedFeatures12.descriptorIndexing;
+        enabledFeatures->runtimeDescriptorArray = VK_TRUE;
+        enabledFeatures->descriptorBindingPartiallyBound = VK_TRUE;
+        enabledFeatures->descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+        enabledFeatures->descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        enabledFeatures->descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        enabledFeatures->shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
     }
 
-    printLn("Present Family Index %d, queueFamilyIndex %d", app->presentFamilyIndex, app->queueFamilyIndex);
+    printLn("drawIndirectCount supported: %d", app->drawIndirectCount);
+    printLn("descriptor indexing supported: %d", app->descriptorIndexing);
 }
 
-void selectPhysicalDevice(
+/**
+ * Core features the texture subsystem uses when the device has them.
+ **/
+void populateTextureFeatures(
     GLFWApp *app,
-    const VkSurfaceKHR surface,
-    const VkDeviceSelectionCriteria checkDevice,
-    const Uint32SizedMutableArray physicalDevices,
-    VkSwapChainSupportDetails *swapChainSupportDetails,
-    const Uint32SizedMutableArray expectedDeviceExtensions,
-    Uint32SizedMutableArray *queueFamilies
+    const VkPhysicalDevice physicalDevice,
+    VkPhysicalDeviceFeatures *enabledFeatures
 ) {
-    VkPhysicalDeviceFeatures deviceFeatures = {};
-    VkPhysicalDeviceProperties deviceProperties = {};
+    const VkPhysicalDeviceFeatures supportedFeatures = app->physicalDeviceFeatures;
+    const VkPhysicalDeviceProperties deviceProperties = app->physicalDeviceProperties;
 
-    for (uint32_t i = 0; i < physicalDevices.count; i++) {
-        const VkPhysicalDevice physicalDevice = ((VkPhysicalDevice *) physicalDevices.items)[i];
+    enabledFeatures->samplerAnisotropy = supportedFeatures.samplerAnisotropy;
+    enabledFeatures->textureCompressionBC = supportedFeatures.textureCompressionBC;
 
-        vkGetPhysicalDeviceFeatures(physicalDevice, &deviceFeatures);
-        vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    app->textureCompressionBC = supportedFeatures.textureCompressionBC;
+    app->maxSamplerAnisotropy = supportedFeatures.samplerAnisotropy ? deviceProperties.limits.maxSamplerAnisotropy : 0.0f;
 
-        populateQueueFamilies(physicalDevice, queueFamilies);
-
-        printLn("Found %d queue families for device %s", queueFamilies->count, deviceProperties.deviceName);
-        selectPresentMode(
-            app,
-            *queueFamilies,
-            physicalDevice,
-            surface
-        );
-
-        printLn("Queue family index is %d and present family %d", app->queueFamilyIndex, app->presentFamilyIndex);
-
-        if (checkDevice(physicalDevice, deviceProperties, deviceFeatures, expectedDeviceExtensions)) {
-            if (app->queueFamilyIndex == -1 || app->presentFamilyIndex == -1) {
-                printLn(
-                    "Present family %d or queue family %d is invalid. Neither can be -1",
-                    app->queueFamilyIndex,
-                    app->presentFamilyIndex
-                );
-                exit(1);
-            }
-
-            // It's important to query swap chain details after device extensions support is done.
-            querySwapChainSupport(physicalDevice, surface, swapChainSupportDetails);
-            if (uInt32SizedArrayIsEmpty(swapChainSupportDetails->formats)) {
-                printLn("Swap chain support formats is empty for device %d: %s", i, deviceProperties.deviceName);
-                continue;
-            }
-            if (uInt32SizedArrayIsEmpty(swapChainSupportDetails->presentModes)) {
-                printLn("Swap chain support presentModes is empty for device %d: %s", i, deviceProperties.deviceName);
-                continue;
-            }
-
-            app->currentPhysicalDevice = i;
-            break;
-        }
-    }
-
-    if (app->currentPhysicalDevice == -1) {
-        printLn("Failed to select a physical device");
-        exit(FAILED_TO_SELECT_PHYSICAL_DEVICE);
-    }
-
-    printLn("Selected physical device %d: %s", app->currentPhysicalDevice, deviceProperties.deviceName);
+    printLn(
+        "samplerAnisotropy supported: %d (max %.1f), textureCompressionBC supported: %d",
+        supportedFeatures.samplerAnisotropy,
+        app->maxSamplerAnisotropy,
+        app->textureCompressionBC
+    );
 }
 
-bool checkSwapChainSupport(
-    const VkPhysicalDevice physicalDevice,
-    const Uint32SizedMutableArray expectedDeviceExtensions
-) {
-    Uint32SizedMutableArray deviceExtensions = {
-        .count = -1,
-        .size = 0
+/**
+ * VK_KHR_synchronization2 with its feature, only looked for on Vulkan 1.1
+ * devices since the feature is queried through vkGetPhysicalDeviceFeatures2.
+ **/
+bool supportsSynchronization2(const GLFWApp *app, const VkPhysicalDevice physicalDevice) {
+    const Uint32SizedMutableArray extension = {
+        .count = 1,
+        .items = (Any*) (char *[]){VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME}
     };
-
-    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &deviceExtensions.count, NULL);
-    if (deviceExtensions.count <= 0) {
-        // This is just here for the IDE
-        printLn("Device does not support required device extensions");
+    if (app->physicalDeviceProperties.apiVersion < VK_API_VERSION_1_1 ||
+        !supportsDeviceExtensions(physicalDevice, extension))
         return false;
-    }
-    printLn("Found %d device extensions", deviceExtensions.count);
 
-    deviceExtensions.items = malloc(sizeof(VkExtensionProperties) * deviceExtensions.count);
-    vkEnumerateDeviceExtensionProperties(
-        physicalDevice,
-        NULL,
-        &deviceExtensions.count,
-        (VkExtensionProperties *) deviceExtensions.items
-    );
-
-    uint32_t i = 0;
-    while (i < expectedDeviceExtensions.count) {
-        bool found = false;
-        for (uint32_t j = 0; j < deviceExtensions.count; j++) {
-            VkExtensionProperties existingExtension = ((VkExtensionProperties *) deviceExtensions.items)[j];
-            char *requestedExtensionName = ((char **) expectedDeviceExtensions.items)[i];
-            int match = strcmp(requestedExtensionName, existingExtension.extensionName);
-            //printLn("Comparing existing extension (%s) to %s = %d", existingExtension.extensionName, requestedExtensionName, match);
-            if (match == 0) found = true;
-        }
-
-        if (found) {
-            i++;
-        } else break;
-    }
-
-    return i == expectedDeviceExtensions.count;
-}
-
-bool isDisplayEnabledDevice(
-    const VkPhysicalDevice physicalDevice, // Might be need to remove this
-    const VkPhysicalDeviceProperties deviceProperties,
-    const VkPhysicalDeviceFeatures deviceFeatures,
-    const Uint32SizedMutableArray expectedDeviceExtensions
-) {
-    const bool result = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU && deviceFeatures.
-                        geometryShader;
-
-    return result && checkSwapChainSupport(physicalDevice, expectedDeviceExtensions);;
+    VkPhysicalDeviceSynchronization2Features synchronization2Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &synchronization2Features
+    };
+    vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+    return synchronization2Features.synchronization2;
 }
 
-
 void createLogicalDevice(GLFWApp *app, const Uint32SizedMutableArray expectedDeviceExtensions) {
     VkPhysicalDeviceFeatures deviceFeatures = {};
 
+    // A family may only be listed once, graphics, present and compute often share one
+    uint32_t uniqueFamilies[3] = {app->queueFamilyIndex};
+    uint32_t uniqueFamilyCount = 1;
+    if (app->presentFamilyIndex != app->queueFamilyIndex) uniqueFamilies[uniqueFamilyCount++] = app->presentFamilyIndex;
+    if (app->computeFamilyIndex != app->queueFamilyIndex && app->computeFamilyIndex != app->presentFamilyIndex)
+        uniqueFamilies[uniqueFamilyCount++] = app->computeFamilyIndex;
+
     Uint32SizedMutableArray indices = {
-        .count = 2,
-        .items = (Any*) (uint32_t []){
-            app->queueFamilyIndex,
-            app->presentFamilyIndex
-        }
+        .count = uniqueFamilyCount,
+        .items = (Any*) uniqueFamilies
     };
 
     Uint32SizedMutableArray queueCreateInfos = {
@@ -495,8 +415,9 @@ void createLogicalDevice(GLFWApp *app, const Uint32SizedMutableArray expectedDev
 
     resizeUint32SizedMutableArray(&queueCreateInfos, indices.count, sizeof(VkDeviceQueueCreateInfo));
 
+    // Outlives the loop, vkCreateDevice reads it through every create info
+    const float queuePriority = 1.0f;
     for (uint32_t i = 0; i < queueCreateInfos.count; i++) {
-        float queuePriority = 1.0f;
         uint32_t queueFamilyIndex = ((uint32_t *) indices.items)[i];
         printLn("Adding index %d, %d", queueFamilyIndex, i);
         ((VkDeviceQueueCreateInfo *) queueCreateInfos.items)[i] = (VkDeviceQueueCreateInfo){
@@ -509,19 +430,38 @@ void createLogicalDevice(GLFWApp *app, const Uint32SizedMutableArray expectedDev
 
     printLn("Done adding VkDeviceQueueCreateInfo create info");
 
+    const VkPhysicalDevice physicalDevice = ((VkPhysicalDevice *) app->physicalDevices->items)[app->
+        currentPhysicalDevice];
+
+    VkPhysicalDeviceVulkan12Features features12 = {};
+    populateVulkan12Features(app, physicalDevice, &features12);
+    populateTextureFeatures(app, physicalDevice, &deviceFeatures);
+    // Only costs anything while a query is active
+    deviceFeatures.pipelineStatisticsQuery = app->physicalDeviceFeatures.pipelineStatisticsQuery;
+    app->pipelineStatistics = deviceFeatures.pipelineStatisticsQuery;
+
+    VkPhysicalDeviceSynchronization2Features synchronization2Features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES,
+        .synchronization2 = VK_TRUE
+    };
+    void *features = app->synchronization2 ? &synchronization2Features : nullptr;
+    if (app->drawIndirectCount || app->descriptorIndexing) {
+        features12.pNext = features;
+        features = &features12;
+    }
+
     const VkDeviceCreateInfo createInfo = {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+        .pNext = features,
         .pQueueCreateInfos = ((VkDeviceQueueCreateInfo *) queueCreateInfos.items),
-        .queueCreateInfoCount = 1,
+        .queueCreateInfoCount = queueCreateInfos.count,
         .pEnabledFeatures = &deviceFeatures,
         //.enabledLayerCount = 0,
         .enabledExtensionCount = expectedDeviceExtensions.count,
         .ppEnabledExtensionNames = (char **) expectedDeviceExtensions.items
     };
 
-    const VkPhysicalDevice physicalDevice = ((VkPhysicalDevice *) app->physicalDevices->items)[app->
-        currentPhysicalDevice];
-    if (vkCreateDevice(physicalDevice, &createInfo,NULL, &app->logicalDevice) != VK_SUCCESS) {
+    if (vkCreateDevice(physicalDevice, &createInfo, hostAllocator, &app->logicalDevice) != VK_SUCCESS) {
         printLn("Failed to create logical device");
         exit(LOGICAL_DEVICE_CREATION_FAILED);
     }
@@ -556,6 +496,15 @@ void createLogicalDevice(GLFWApp *app, const Uint32SizedMutableArray expectedDev
         exit(1);
     } else printLn("Created presentation queue");
 
+    vkGetDeviceQueue(app->logicalDevice, app->computeFamilyIndex, 0, &app->computeQueue);
+
+    if (app->computeQueue == VK_NULL_HANDLE) {
+        printLn("Compute queue not found in family %d", app->computeFamilyIndex);
+        exit(1);
+    } else printLn(
+        app->computeQueue == app->graphicsQueue ? "Compute shares the graphics queue" : "Created async compute queue"
+    );
+
     printLn("Created Logical Device for device %d and graphics queue", app->currentPhysicalDevice);
 }
 
@@ -564,13 +513,17 @@ void createSurface(VkSurfaceKHR *ppSurface, GLFWwindow *window, const VkInstance
         printLn("Window is null");
         exit(GLFW_WINDOW_SURFACE_CREATION_FAILED);
     }
-    if (glfwCreateWindowSurface(vkInstance, window, NULL, ppSurface) != VK_SUCCESS) {
+    if (glfwCreateWindowSurface(vkInstance, window, hostAllocator, ppSurface) != VK_SUCCESS) {
         printLn("Failed to create window surface");
         exit(GLFW_WINDOW_SURFACE_CREATION_FAILED);
     }
 }
 
-void prepareDevices(GLFWApp *app, VkSwapChainSupportDetails *swapChainSupportDetails) {
+void prepareDevices(
+    GLFWApp *app,
+    PhysicalDeviceQuery *deviceQuery,
+    VkSwapChainSupportDetails *swapChainSupportDetails
+) {
     const Uint32SizedMutableArray expectedDeviceExtensions = {
         .count = 1,
         .items = (Any*) (char *[]){
@@ -581,22 +534,93 @@ void prepareDevices(GLFWApp *app, VkSwapChainSupportDetails *swapChainSupportDet
 
     if (app->vkInstance == NULL) return;
 
-    enumeratePhysicalDevices(app, app->vkInstance);
-    Uint32SizedMutableArray queueFamilies = {
-        .count = 0,
-        .size = 0,
-        .items = nullptr
+    uint32_t phase = beginStartupPhase("select physical device");
+    selectPhysicalDevice(app, deviceQuery, getCurrentSurface(*app), expectedDeviceExtensions, swapChainSupportDetails);
+    endStartupPhase(phase);
+
+    const VkPhysicalDevice physicalDevice = ((VkPhysicalDevice *) app->physicalDevices->items)[app->
+        currentPhysicalDevice];
+    const Uint32SizedMutableArray memoryBudgetExtension = {
+        .count = 1,
+        .items = (Any*) (char *[]){VK_EXT_MEMORY_BUDGET_EXTENSION_NAME}
+    };
+    // Queried through vkGetPhysicalDeviceMemoryProperties2, core since 1.1
+    const bool memoryBudgetSupported = app->physicalDeviceProperties.apiVersion >= VK_API_VERSION_1_1 &&
+                                       supportsDeviceExtensions(physicalDevice, memoryBudgetExtension);
+    app->synchronization2 = supportsSynchronization2(app, physicalDevice);
+
+    char *deviceExtensions[3] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    uint32_t deviceExtensionCount = 1;
+    if (memoryBudgetSupported) deviceExtensions[deviceExtensionCount++] = VK_EXT_MEMORY_BUDGET_EXTENSION_NAME;
+    if (app->synchronization2) deviceExtensions[deviceExtensionCount++] = VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME;
+    const Uint32SizedMutableArray enabledDeviceExtensions = {
+        .count = deviceExtensionCount,
+        .items = (Any*) deviceExtensions
     };
-    selectPhysicalDevice(
-        app,
-        getCurrentSurface(*app),
-        isDisplayEnabledDevice,
-        *app->physicalDevices,
-        swapChainSupportDetails,
-        expectedDeviceExtensions,
-        &queueFamilies
+
+    phase = beginStartupPhase("logical device");
+    createLogicalDevice(app, enabledDeviceExtensions);
+    endStartupPhase(phase);
+
+    createPipelineCache(&app->physicalDeviceProperties, app->logicalDevice);
+
+    createMemoryBudget(&memoryBudget, physicalDevice, memoryBudgetSupported);
+    addMemoryBudgetListener(&memoryBudget, 0.9, logMemoryBudgetCrossing, nullptr);
+}
+
+/**
+ * Pipeline work for prepareVulkanApp's worker. Only creates objects on the
+ * device, nothing is submitted, so it runs beside the uploads on the main thread.
+ **/
+typedef struct PipelineBuild {
+    pthread_t thread;
+    GLFWApp *app;
+    VulkanWindow *window;
+} PipelineBuild;
+
+Any runPipelineBuild(Any data) {
+    const PipelineBuild *build = data;
+    GLFWApp *app = build->app;
+    setTraceThreadName("pipeline build");
+
+    waitForShaderLibrary(&app->shaders);
+
+    uint32_t phase = beginStartupPhase("graphics pipeline");
+    initVulkanGraphicsPipeline(
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+        app->logicalDevice,
+        build->window,
+        &app->shaders
+    );
+    endStartupPhase(phase);
+
+    if (app->drawIndirectCount) {
+        phase = beginStartupPhase("culling pass");
+        createCullingPass(
+            &build->window->cullingPass,
+            MAX_CULLING_OBJECTS,
+            MAX_CULLING_MESHES,
+            getShaderCode(&app->shaders, SHADER_CULL_COMPUTE),
+            ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+            app->logicalDevice
+        );
+        endStartupPhase(phase);
+    } else printLn("drawIndirectCount isn't supported. GPU culling is disabled");
+
+    phase = beginStartupPhase("particles");
+    createParticleSystem(
+        &build->window->particles,
+        readParticleCount(),
+        getShaderCode(&app->shaders, SHADER_PARTICLES_COMPUTE),
+        app->queueFamilyIndex,
+        app->computeFamilyIndex,
+        app->computeQueue,
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+        app->logicalDevice
     );
-    createLogicalDevice(app, expectedDeviceExtensions);
+    endStartupPhase(phase);
+
+    return nullptr;
 }
 
 /*
@@ -604,10 +628,18 @@ void prepareDevices(GLFWApp *app, VkSwapChainSupportDetails *swapChainSupportDet
  */
 void prepareVulkanApp(GLFWApp *app) {
     if (app->vkInstance == NULL) return;
+
+    // Devices only need the instance, they're queried while the window opens
+    PhysicalDeviceQuery deviceQuery;
+    startPhysicalDeviceQuery(&deviceQuery, app);
+
+    uint32_t phase = beginStartupPhase("window and surface");
     createVulkanWindow(600, 800, "Testing Window Drawing", nullptr, app);
 
     VulkanWindow *currentVulkanWindow = getCurrentVulkanWindow(*app);
     createSurface(&currentVulkanWindow->surface, (GLFWwindow *) currentVulkanWindow->window, *app->vkInstance);
+    endStartupPhase(phase);
+
     VkSwapChainSupportDetails swapChainSupportDetails = {
         .presentModes = {
             .count = 0
@@ -616,14 +648,55 @@ void prepareVulkanApp(GLFWApp *app) {
             .count = 0
         }
     };
-    prepareDevices(app, &swapChainSupportDetails);
-    prepareSwapChain(app, &swapChainSupportDetails);
+    prepareDevices(app, &deviceQuery, &swapChainSupportDetails);
+
+    phase = beginStartupPhase("swap chain");
+    prepareSwapChain(app, &swapChainSupportDetails, VK_NULL_HANDLE);
+    free(swapChainSupportDetails.formats.items);
+    free(swapChainSupportDetails.presentModes.items);
+    endStartupPhase(phase);
+
+    // There is no path without the bindless table
+    if (!app->descriptorIndexing) {
+        printLn("Descriptor indexing isn't supported, textures can't be bound bindless");
+        exit(DESCRIPTOR_INDEXING_NOT_SUPPORTED);
+    }
 
-    initVulkanGraphicsPipeline(
+    phase = beginStartupPhase("descriptor sets");
+    // The graphics pipeline layout is built from the bindless descriptor set layout
+    createBindlessTable(
+        &getCurrentVulkanWindow(*app)->bindless,
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+        app->logicalDevice
+    );
+    createUniformRing(
+        &getCurrentVulkanWindow(*app)->uniformRing,
+        UNIFORM_RING_FRAME_SIZE,
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+        app->logicalDevice
+    );
+    endStartupPhase(phase);
+
+    // Pipelines are built on a worker while this thread does everything that
+    // submits to the graphics queue, which only one thread may use at a time
+    PipelineBuild pipelineBuild = {.app = app, .window = getCurrentVulkanWindow(*app)};
+    const bool pipelineWorker = pthread_create(&pipelineBuild.thread, nullptr, runPipelineBuild, &pipelineBuild) == 0;
+    if (!pipelineWorker) runPipelineBuild(&pipelineBuild);
+
+    phase = beginStartupPhase("textures");
+    createTextures(
+        &getCurrentVulkanWindow(*app)->textures,
+        &getCurrentVulkanWindow(*app)->bindless,
+        app->maxSamplerAnisotropy,
+        app->textureCompressionBC,
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
         app->logicalDevice,
-        getCurrentVulkanWindow(*app)
+        app->queueFamilyIndex,
+        app->graphicsQueue
     );
+    endStartupPhase(phase);
 
+    phase = beginStartupPhase("geometry and frames");
     initCommandBuffers(
         ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
         app->logicalDevice,
@@ -631,30 +704,44 @@ void prepareVulkanApp(GLFWApp *app) {
         app->queueFamilyIndex,
         app->graphicsQueue
     );
+    createPipelineStatistics(&getCurrentVulkanWindow(*app)->pipelineStatistics, app->logicalDevice, app->pipelineStatistics);
+    endStartupPhase(phase);
+
+    if (pipelineWorker) pthread_join(pipelineBuild.thread, nullptr);
+    destroyShaderLibrary(&app->shaders);
+
+    // After the join, whether there are culling and particle passes decides the graph's passes
+    createFrameGraph(
+        getCurrentVulkanWindow(*app),
+        ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+        app->logicalDevice,
+        app->synchronization2
+    );
 }
 
-// issue when pAllocator is passed. Even if it's null the code will throw a 139
 void destroyDebugUtilsMessageExt(const GLFWApp app) {
-    return;
+#if LEARNING_DEBUG_BUILD
+    // Only set up with validation enabled
+    if (app.debugMessenger == NULL) return;
+
     const auto func = (PFN_vkDestroyDebugUtilsMessengerEXT) vkGetInstanceProcAddr(
         *app.vkInstance,
         "vkDestroyDebugUtilsMessengerEXT");
 
-    VkAllocationCallbacks pAllocator = {};
-    populateDeallocationCallbacks(&pAllocator, "destroyDebugUtilsMessageExt");
     if (func != NULL && *app.vkInstance != NULL && *app.debugMessenger != NULL)
-        func(*app.vkInstance, *app.debugMessenger, &pAllocator);
+        func(*app.vkInstance, *app.debugMessenger, hostAllocator);
+    free(app.debugMessenger);
+#endif
 }
 
 void cleanUpVulkan(const GLFWApp app) {
     destroyDebugUtilsMessageExt(app);
-    VkAllocationCallbacks pAllocator = {};
-    populateDeallocationCallbacks(&pAllocator, "vkDestroyDevice");
-    vkDestroyDevice(app.logicalDevice, &pAllocator);
-
-    VkAllocationCallbacks pAllocatorDestroyInstance = {};
-    populateDeallocationCallbacks(&pAllocatorDestroyInstance, "vkDestroyInstance");
-    vkDestroyInstance(*app.vkInstance, &pAllocatorDestroyInstance);
+    destroyPipelineCache(app.logicalDevice);
+    destroyMemoryBudget(&memoryBudget);
+    vkDestroyDevice(app.logicalDevice, hostAllocator);
+    vkDestroyInstance(*app.vkInstance, hostAllocator);
+    printHostAllocatorStats();
+    finishTrace();
 }
 
 
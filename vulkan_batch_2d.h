@@ -0,0 +1,443 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_BATCH_2D_H
+#define VULKAN_BATCH_2D_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_vertex_format.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "vulkan_draw_list.h"
+
+typedef struct Batch2DFrame {
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexBufferMemory;
+    PackedVertex *mapped; // Stays mapped for the lifetime of the buffer
+    VkBuffer instanceBuffer; // One identity InstanceData per draw carrying its texture
+    VkDeviceMemory instanceBufferMemory;
+    InstanceData *mappedInstances;
+    VkDeviceMemory separateMemory; // With separateBuffers every quad's buffer is bound into it
+    uint8_t *separateMapped;
+    Uint32SizedMutableArray quadBuffers; // VkBuffer, one per quad with separateBuffers
+} Batch2DFrame;
+
+typedef struct Batch2DDraw {
+    uint32_t firstQuad;
+    uint32_t quadCount;
+} Batch2DDraw;
+
+/**
+ * Immediate mode quad batcher. Quads are written straight into the persistently
+ * mapped vertex buffer of the current frame in flight and drawn with a shared
+ * quad index buffer, one vkCmdDrawIndexed per batch. Draw i reads instance i
+ * of the frame's instance buffer, which only differs from the others by its
+ * texture, so switching textures never rebinds anything.
+ * A batch is closed when it reaches BATCH_2D_QUADS_PER_DRAW quads
+ * (the most a 16 bit index buffer can address), when the texture changes
+ * or when flushBatch2D is called because the caller is about to change state.
+ **/
+typedef struct Batch2D {
+    Uint32SizedMutableArray frames; // Batch2DFrame
+    Uint32SizedMutableArray draws; // Batch2DDraw, size is the allocated bytes
+    VkBuffer indexBuffer; // uint16_t, 0 1 2 2 3 0 repeated for every quad of a draw
+    VkDeviceMemory indexBufferMemory;
+    uint32_t quadCapacity; // Per frame in flight
+    uint32_t quadCount;
+    uint32_t batchStart;
+    uint32_t frame;
+    uint32_t droppedQuads;
+    uint32_t texture; // getTextureIndex of the open batch, 0 for the default texture
+    bool active;
+    bool separateBuffers; // See enableBatch2DSeparateBuffers
+    VkDevice logicalDevice; // Quads create their own buffers with separateBuffers
+    VkDeviceSize separateStride; // Bytes between two quads' buffers in separateMemory
+} Batch2D;
+
+constexpr uint32_t BATCH_2D_QUADS_PER_DRAW = 16384;
+
+void createBatch2DIndexBuffer(
+    Batch2D *batch,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    const VkDeviceSize indicesSize = sizeof(uint16_t) * 6 * BATCH_2D_QUADS_PER_DRAW;
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    VkMemoryRequirements memRequirements;
+
+    createBuffer(
+        &stagingBuffer,
+        indicesSize,
+        &stagingBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    uint16_t *indices;
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, indicesSize, 0, (Any *) &indices);
+    for (uint32_t quad = 0; quad < BATCH_2D_QUADS_PER_DRAW; quad++) {
+        const uint16_t first = (uint16_t) (quad * 4);
+        uint16_t *quadIndices = &indices[quad * 6];
+        quadIndices[0] = first;
+        quadIndices[1] = first + 1;
+        quadIndices[2] = first + 2;
+        quadIndices[3] = first + 2;
+        quadIndices[4] = first + 3;
+        quadIndices[5] = first;
+    }
+    vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+    createBuffer(
+        &batch->indexBuffer,
+        indicesSize,
+        &batch->indexBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    copyBuffer(stagingBuffer, batch->indexBuffer, indicesSize, commandPool, logicalDevice, graphicsQueue);
+
+    vkDestroyBuffer(logicalDevice, stagingBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, stagingBufferMemory);
+}
+
+void createBatch2D(
+    Batch2D *batch,
+    const uint32_t quadCapacity,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    VkMemoryRequirements memRequirements;
+
+    batch->quadCapacity = quadCapacity;
+    batch->quadCount = 0;
+    batch->batchStart = 0;
+    batch->frame = 0;
+    batch->droppedQuads = 0;
+    batch->texture = 0;
+    batch->active = false;
+    batch->separateBuffers = false;
+    batch->logicalDevice = logicalDevice;
+    batch->separateStride = 0;
+    batch->draws = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+
+    batch->frames.count = MAX_FRAMES_IN_FLIGHT;
+    batch->frames.size = sizeof(Batch2DFrame) * MAX_FRAMES_IN_FLIGHT;
+    batch->frames.items = malloc(batch->frames.size);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        Batch2DFrame *frame = &((Batch2DFrame *) batch->frames.items)[i];
+        frame->separateMemory = VK_NULL_HANDLE;
+        frame->separateMapped = nullptr;
+        frame->quadBuffers = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+        createBuffer(
+            &frame->vertexBuffer,
+            sizeof(PackedVertex) * 4 * quadCapacity,
+            &frame->vertexBufferMemory,
+            &memRequirements,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+        vkMapMemory(
+            logicalDevice,
+            frame->vertexBufferMemory,
+            0,
+            sizeof(PackedVertex) * 4 * quadCapacity,
+            0,
+            (Any *) &frame->mapped
+        );
+
+        // Every draw has at least one quad so there can't be more draws than quads
+        createBuffer(
+            &frame->instanceBuffer,
+            sizeof(InstanceData) * quadCapacity,
+            &frame->instanceBufferMemory,
+            &memRequirements,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+        vkMapMemory(
+            logicalDevice,
+            frame->instanceBufferMemory,
+            0,
+            sizeof(InstanceData) * quadCapacity,
+            0,
+            (Any *) &frame->mappedInstances
+        );
+    }
+
+    createBatch2DIndexBuffer(batch, commandPool, physicalDevice, logicalDevice, graphicsQueue);
+
+    printLn("Created 2D batch for %d quads per frame", quadCapacity);
+}
+
+/**
+ * Gives every quad batched from here on a vertex buffer of its own, the way
+ * meshes were uploaded before the mesh buffer, and draws each one on its own.
+ * The quad throughput benchmark's baseline, so the only thing it changes is
+ * the buffer layout. The buffers are bound into one allocation per frame in
+ * flight, an allocation per quad would run into maxMemoryAllocationCount.
+ **/
+void enableBatch2DSeparateBuffers(Batch2D *batch, const VkPhysicalDevice physicalDevice) {
+    if (batch->separateBuffers) return;
+
+    const VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof(PackedVertex) * 4,
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    VkBuffer probe;
+    if (vkCreateBuffer(batch->logicalDevice, &bufferInfo, hostAllocator, &probe) != VK_SUCCESS) {
+        printLn("failed to create vertex buffer!");
+        exit(4);
+    }
+    VkMemoryRequirements memRequirements;
+    vkGetBufferMemoryRequirements(batch->logicalDevice, probe, &memRequirements);
+    vkDestroyBuffer(batch->logicalDevice, probe, hostAllocator);
+
+    // Every quad's buffer starts at a multiple of its alignment
+    batch->separateStride = (memRequirements.size + memRequirements.alignment - 1) /
+                            memRequirements.alignment * memRequirements.alignment;
+
+    const VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = batch->separateStride * batch->quadCapacity,
+        .memoryTypeIndex = findMemoryType(
+            physicalDevice,
+            memRequirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+        )
+    };
+    for (uint32_t i = 0; i < batch->frames.count; i++) {
+        Batch2DFrame *frame = &((Batch2DFrame *) batch->frames.items)[i];
+        if (allocateDeviceMemory(batch->logicalDevice, &allocInfo, &frame->separateMemory) != VK_SUCCESS) {
+            printLn("failed to allocate vertex buffer memory!");
+            exit(1);
+        }
+        vkMapMemory(batch->logicalDevice, frame->separateMemory, 0, allocInfo.allocationSize, 0,
+                    (Any *) &frame->separateMapped);
+    }
+
+    batch->separateBuffers = true;
+    printLn("2D batch gives every quad its own vertex buffer");
+}
+
+/**
+ * Quad buffers of the frame's last use, its fence has to have signalled.
+ **/
+void destroyBatch2DQuadBuffers(const VkDevice logicalDevice, Batch2DFrame *frame) {
+    for (uint32_t i = 0; i < frame->quadBuffers.count; i++)
+        vkDestroyBuffer(logicalDevice, ((VkBuffer *) frame->quadBuffers.items)[i], hostAllocator);
+    frame->quadBuffers.count = 0;
+}
+
+/**
+ * Waits for the frame's fence so its vertex buffer can be overwritten.
+ * drawFrame's own wait on the same fence then returns straight away.
+ **/
+void beginBatch2D(Batch2D *batch, const VkDevice logicalDevice, const VkFence inFlightFence, const uint32_t frame) {
+    vkWaitForFences(logicalDevice, 1, &inFlightFence, VK_TRUE, UINT64_MAX);
+    destroyBatch2DQuadBuffers(logicalDevice, &((Batch2DFrame *) batch->frames.items)[frame]);
+
+    batch->frame = frame;
+    batch->quadCount = 0;
+    batch->batchStart = 0;
+    batch->draws.count = 0;
+    batch->texture = 0;
+    batch->active = true;
+}
+
+void flushBatch2D(Batch2D *batch) {
+    if (batch->quadCount == batch->batchStart) return;
+
+    if (sizeof(Batch2DDraw) * (batch->draws.count + 1) > batch->draws.size) {
+        batch->draws.size = batch->draws.size == 0 ? sizeof(Batch2DDraw) * 8 : batch->draws.size * 2;
+        batch->draws.items = realloc(batch->draws.items, batch->draws.size);
+    }
+
+    ((Batch2DFrame *) batch->frames.items)[batch->frame].mappedInstances[batch->draws.count] = (InstanceData){
+        .translation = {0.0f, 0.0f},
+        .scale = {1.0f, 1.0f},
+        .rotation = 0.0f,
+        .color = {1.0f, 1.0f, 1.0f},
+        .texture = batch->texture
+    };
+    ((Batch2DDraw *) batch->draws.items)[batch->draws.count++] = (Batch2DDraw){
+        .firstQuad = batch->batchStart,
+        .quadCount = batch->quadCount - batch->batchStart
+    };
+    batch->batchStart = batch->quadCount;
+}
+
+/**
+ * Quads batched from here on sample texture (getTextureIndex), 0 goes back
+ * to the default texture. Only closes the open batch when the texture
+ * actually changes.
+ **/
+void setBatch2DTexture(Batch2D *batch, const uint32_t texture) {
+    if (batch->texture == texture) return;
+
+    flushBatch2D(batch);
+    batch->texture = texture;
+}
+
+void batchQuad2D(Batch2D *batch, const Vector2D min, const Vector2D max, const Vector3D color) {
+    if (!batch->active) return;
+
+    if (batch->quadCount >= batch->quadCapacity) {
+        batch->droppedQuads++;
+        return;
+    }
+
+    // Each corner reuses two of the four packed coordinates and the one packed color
+    const uint16_t minX = packHalf(min.x), minY = packHalf(min.y);
+    const uint16_t maxX = packHalf(max.x), maxY = packHalf(max.y);
+    const uint8_t r = packUnorm8(color.x), g = packUnorm8(color.y), b = packUnorm8(color.z);
+
+    Batch2DFrame *frame = &((Batch2DFrame *) batch->frames.items)[batch->frame];
+    PackedVertex *vertices = batch->separateBuffers
+                                 ? (PackedVertex *) (frame->separateMapped + batch->separateStride * batch->quadCount)
+                                 : &frame->mapped[batch->quadCount * 4];
+    // The whole texture is mapped to the quad, 0x3C00 is 1.0 as a half
+    vertices[0] = (PackedVertex){{minX, minY}, {r, g, b, 255}, {0, 0}};
+    vertices[1] = (PackedVertex){{maxX, minY}, {r, g, b, 255}, {0x3C00, 0}};
+    vertices[2] = (PackedVertex){{maxX, maxY}, {r, g, b, 255}, {0x3C00, 0x3C00}};
+    vertices[3] = (PackedVertex){{minX, maxY}, {r, g, b, 255}, {0, 0x3C00}};
+
+    if (batch->separateBuffers) {
+        const VkBufferCreateInfo bufferInfo = {
+            .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+            .size = sizeof(PackedVertex) * 4,
+            .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+        };
+        VkBuffer buffer;
+        if (vkCreateBuffer(batch->logicalDevice, &bufferInfo, hostAllocator, &buffer) != VK_SUCCESS) {
+            printLn("failed to create vertex buffer!");
+            exit(4);
+        }
+        vkBindBufferMemory(batch->logicalDevice, buffer, frame->separateMemory, batch->separateStride * batch->quadCount);
+
+        if (sizeof(VkBuffer) * (frame->quadBuffers.count + 1) > frame->quadBuffers.size) {
+            frame->quadBuffers.size = frame->quadBuffers.size == 0
+                                          ? sizeof(VkBuffer) * 64
+                                          : frame->quadBuffers.size * 2;
+            frame->quadBuffers.items = realloc(frame->quadBuffers.items, frame->quadBuffers.size);
+        }
+        ((VkBuffer *) frame->quadBuffers.items)[frame->quadBuffers.count++] = buffer;
+    }
+
+    batch->quadCount++;
+    if (batch->quadCount - batch->batchStart == BATCH_2D_QUADS_PER_DRAW) flushBatch2D(batch);
+}
+
+/**
+ * Pushes every closed batch, so flushBatch2D has to be called before.
+ * They're in the screen pass after the world and share one key, the
+ * draw list's stable sort keeps them in the order they were batched.
+ * With separateBuffers every quad is a draw with its own vertex buffer instead.
+ * Batched quads are in normalized device coordinates so they ignore the camera.
+ **/
+void pushBatch2DDraws(DrawList *list, const Batch2D *batch, const VkPipeline pipeline) {
+    if (!batch->active || batch->draws.count == 0) return;
+
+    const Batch2DFrame *frame = &((Batch2DFrame *) batch->frames.items)[batch->frame];
+    DrawPushConstants screenSpace = IDENTITY_DRAW;
+    screenSpace.screenSpace = 1;
+    const DrawState batchState = {
+        .pipeline = pipeline,
+        .vertexBuffer = frame->vertexBuffer,
+        .instanceBuffer = frame->instanceBuffer,
+        .indexBuffer = batch->indexBuffer,
+        .indexType = VK_INDEX_TYPE_UINT16,
+        .constants = screenSpace
+    };
+    const uint32_t state = batch->separateBuffers ? 0 : addDrawState(list, batchState);
+
+    for (uint32_t i = 0; i < batch->draws.count; i++) {
+        const Batch2DDraw draw = ((Batch2DDraw *) batch->draws.items)[i];
+        if (batch->separateBuffers) {
+            for (uint32_t quad = draw.firstQuad; quad < draw.firstQuad + draw.quadCount; quad++) {
+                DrawState quadState = batchState;
+                quadState.vertexBuffer = ((VkBuffer *) frame->quadBuffers.items)[quad];
+                pushDraw(list, DRAW_PASS_SCREEN, 0, 0.0f, (DrawCommand){
+                    .type = DRAW_INDEXED,
+                    .state = addUniqueDrawState(list, quadState),
+                    .indexCount = 6,
+                    .instanceCount = 1,
+                    .firstIndex = 0,
+                    .vertexOffset = 0,
+                    .firstInstance = i
+                });
+            }
+            continue;
+        }
+
+        pushDraw(list, DRAW_PASS_SCREEN, 0, 0.0f, (DrawCommand){
+            .type = DRAW_INDEXED,
+            .state = state,
+            .indexCount = draw.quadCount * 6,
+            .instanceCount = 1,
+            .firstIndex = 0,
+            .vertexOffset = (int32_t) (draw.firstQuad * 4),
+            .firstInstance = i
+        });
+    }
+}
+
+void endBatch2D(Batch2D *batch) {
+    if (batch->droppedQuads > 0) {
+        printLn("2D batch dropped %d quads above the capacity of %d", batch->droppedQuads, batch->quadCapacity);
+        batch->droppedQuads = 0;
+    }
+    batch->active = false;
+}
+
+void destroyBatch2D(const VkDevice logicalDevice, Batch2D *batch) {
+    for (uint32_t i = 0; i < batch->frames.count; i++) {
+        const Batch2DFrame frame = ((Batch2DFrame *) batch->frames.items)[i];
+        vkUnmapMemory(logicalDevice, frame.vertexBufferMemory);
+        vkDestroyBuffer(logicalDevice, frame.vertexBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, frame.vertexBufferMemory);
+        vkUnmapMemory(logicalDevice, frame.instanceBufferMemory);
+        vkDestroyBuffer(logicalDevice, frame.instanceBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, frame.instanceBufferMemory);
+
+        destroyBatch2DQuadBuffers(logicalDevice, &((Batch2DFrame *) batch->frames.items)[i]);
+        free(frame.quadBuffers.items);
+        if (frame.separateMemory != VK_NULL_HANDLE) {
+            vkUnmapMemory(logicalDevice, frame.separateMemory);
+            freeDeviceMemory(logicalDevice, frame.separateMemory);
+        }
+    }
+    free(batch->frames.items);
+    free(batch->draws.items);
+
+    vkDestroyBuffer(logicalDevice, batch->indexBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, batch->indexBufferMemory);
+}
+
+#endif //VULKAN_BATCH_2D_H
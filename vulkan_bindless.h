@@ -0,0 +1,308 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_BINDLESS_H
+#define VULKAN_BINDLESS_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_callbacks.h"
+
+/**
+ * One descriptor set holding every sampled image, sampler and storage buffer,
+ * bound once per frame at set 0. Shaders index into it with slots carried in
+ * InstanceData, so changing texture between draws costs nothing on the CPU.
+ *
+ * Bindings are UPDATE_AFTER_BIND and PARTIALLY_BOUND (descriptor indexing,
+ * core in Vulkan 1.2) so slots are written while the set is bound by frames in
+ * flight, as long as those frames don't use the slot being written.
+ * A released slot therefore only returns to the free list once the last frame
+ * that could use it has completed, counted by frame number like the retire queue.
+ **/
+typedef enum BindlessBinding {
+    BINDLESS_TEXTURES, // VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE
+    BINDLESS_SAMPLERS, // VK_DESCRIPTOR_TYPE_SAMPLER
+    BINDLESS_BUFFERS, // VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+    BINDLESS_BINDING_COUNT
+} BindlessBinding;
+
+typedef struct BindlessRelease {
+    uint32_t slot;
+    uint64_t lastUse; // Frame number of the last frame recorded with the slot
+} BindlessRelease;
+
+typedef struct BindlessSlots {
+    uint32_t capacity;
+    uint32_t next; // Slots from here on have never been handed out
+    Uint32SizedMutableArray free; // uint32_t, size is the allocated bytes
+    Uint32SizedMutableArray released; // BindlessRelease waiting on lastUse, size is the allocated bytes
+} BindlessSlots;
+
+typedef struct BindlessTable {
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    BindlessSlots slots[BINDLESS_BINDING_COUNT];
+} BindlessTable;
+
+static const VkDescriptorType BINDLESS_DESCRIPTOR_TYPES[BINDLESS_BINDING_COUNT] = {
+    VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+    VK_DESCRIPTOR_TYPE_SAMPLER,
+    VK_DESCRIPTOR_TYPE_STORAGE_BUFFER
+};
+
+void reserveBindlessArray(Uint32SizedMutableArray *array, const size_t itemSize, const uint32_t count) {
+    if (itemSize * count <= array->size) return;
+
+    array->size = array->size == 0 ? itemSize * 64 : array->size * 2;
+    while (array->size < itemSize * count) array->size *= 2;
+    array->items = realloc(array->items, array->size);
+}
+
+/**
+ * Capacities are the requested counts clamped to the device's update after
+ * bind limits, both per set and per stage.
+ **/
+void getBindlessCapacities(const VkPhysicalDevice physicalDevice, uint32_t capacities[BINDLESS_BINDING_COUNT]) {
+    VkPhysicalDeviceVulkan12Properties properties12 = {};
+    properties12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_PROPERTIES;
+
+    VkPhysicalDeviceProperties2 properties = {};
+    properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties.pNext = &properties12;
+    vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+
+    const uint32_t limits[BINDLESS_BINDING_COUNT] = {
+        properties12.maxDescriptorSetUpdateAfterBindSampledImages <
+        properties12.maxPerStageDescriptorUpdateAfterBindSampledImages
+            ? properties12.maxDescriptorSetUpdateAfterBindSampledImages
+            : properties12.maxPerStageDescriptorUpdateAfterBindSampledImages,
+        properties12.maxDescriptorSetUpdateAfterBindSamplers <
+        properties12.maxPerStageDescriptorUpdateAfterBindSamplers
+            ? properties12.maxDescriptorSetUpdateAfterBindSamplers
+            : properties12.maxPerStageDescriptorUpdateAfterBindSamplers,
+        properties12.maxDescriptorSetUpdateAfterBindStorageBuffers <
+        properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers
+            ? properties12.maxDescriptorSetUpdateAfterBindStorageBuffers
+            : properties12.maxPerStageDescriptorUpdateAfterBindStorageBuffers
+    };
+    const uint32_t requested[BINDLESS_BINDING_COUNT] = {MAX_TEXTURES, MAX_SAMPLERS, MAX_BINDLESS_BUFFERS};
+
+    for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; i++)
+        capacities[i] = requested[i] < limits[i] ? requested[i] : limits[i];
+}
+
+void createBindlessTable(BindlessTable *table, const VkPhysicalDevice physicalDevice, const VkDevice logicalDevice) {
+    *table = (BindlessTable){};
+
+    uint32_t capacities[BINDLESS_BINDING_COUNT];
+    getBindlessCapacities(physicalDevice, capacities);
+
+    VkDescriptorSetLayoutBinding bindings[BINDLESS_BINDING_COUNT] = {};
+    VkDescriptorBindingFlags bindingFlags[BINDLESS_BINDING_COUNT] = {};
+    VkDescriptorPoolSize poolSizes[BINDLESS_BINDING_COUNT] = {};
+
+    for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; i++) {
+        table->slots[i].capacity = capacities[i];
+
+        bindings[i].binding = i;
+        bindings[i].descriptorType = BINDLESS_DESCRIPTOR_TYPES[i];
+        bindings[i].descriptorCount = capacities[i];
+        bindings[i].stageFlags = VK_SHADER_STAGE_ALL_GRAPHICS | VK_SHADER_STAGE_COMPUTE_BIT;
+
+        bindingFlags[i] = VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT |
+                          VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT;
+
+        poolSizes[i].type = BINDLESS_DESCRIPTOR_TYPES[i];
+        poolSizes[i].descriptorCount = capacities[i];
+    }
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo = {};
+    bindingFlagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+    bindingFlagsInfo.bindingCount = BINDLESS_BINDING_COUNT;
+    bindingFlagsInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.pNext = &bindingFlagsInfo;
+    layoutInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+    layoutInfo.bindingCount = BINDLESS_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, hostAllocator, &table->descriptorSetLayout) != VK_SUCCESS) {
+        printLn("Failed to create bindless descriptor set layout");
+        exit(FAILED_TO_CREATE_BINDLESS_TABLE);
+    }
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    poolInfo.poolSizeCount = BINDLESS_BINDING_COUNT;
+    poolInfo.pPoolSizes = poolSizes;
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, hostAllocator, &table->descriptorPool) != VK_SUCCESS) {
+        printLn("Failed to create bindless descriptor pool");
+        exit(FAILED_TO_CREATE_BINDLESS_TABLE);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = table->descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &table->descriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &table->descriptorSet) != VK_SUCCESS) {
+        printLn("Failed to allocate the bindless descriptor set");
+        exit(FAILED_TO_CREATE_BINDLESS_TABLE);
+    }
+
+    printLn(
+        "Created bindless table with %d textures, %d samplers and %d storage buffers",
+        capacities[BINDLESS_TEXTURES],
+        capacities[BINDLESS_SAMPLERS],
+        capacities[BINDLESS_BUFFERS]
+    );
+}
+
+/**
+ * Lowest numbered slots are handed out first so slot 0 of every binding
+ * belongs to whatever is allocated first, the default texture and sampler.
+ **/
+uint32_t allocateBindlessSlot(BindlessTable *table, const BindlessBinding binding) {
+    BindlessSlots *slots = &table->slots[binding];
+
+    if (slots->free.count > 0) return ((uint32_t *) slots->free.items)[--slots->free.count];
+
+    if (slots->next == slots->capacity) {
+        printLn("Bindless binding %d is full at %d slots", binding, slots->capacity);
+        exit(BINDLESS_TABLE_CAPACITY_EXCEEDED);
+    }
+    return slots->next++;
+}
+
+/**
+ * The slot can still be read by frames up to lastUse, it is only reused once
+ * retireBindlessSlots is told lastUse has completed.
+ **/
+void releaseBindlessSlot(BindlessTable *table, const BindlessBinding binding, const uint32_t slot, const uint64_t lastUse) {
+    BindlessSlots *slots = &table->slots[binding];
+    reserveBindlessArray(&slots->released, sizeof(BindlessRelease), slots->released.count + 1);
+    ((BindlessRelease *) slots->released.items)[slots->released.count++] = (BindlessRelease){slot, lastUse};
+}
+
+/**
+ * Frees every slot whose lastUse is below completed, the count of frames
+ * finished on the GPU as passed to collectRetiredResources.
+ **/
+void retireBindlessSlots(BindlessTable *table, const uint64_t completed) {
+    for (uint32_t b = 0; b < BINDLESS_BINDING_COUNT; b++) {
+        BindlessSlots *slots = &table->slots[b];
+        BindlessRelease *released = (BindlessRelease *) slots->released.items;
+
+        for (uint32_t i = 0; i < slots->released.count;) {
+            if (released[i].lastUse >= completed) {
+                i++;
+                continue;
+            }
+            reserveBindlessArray(&slots->free, sizeof(uint32_t), slots->free.count + 1);
+            ((uint32_t *) slots->free.items)[slots->free.count++] = released[i].slot;
+            released[i] = released[--slots->released.count];
+        }
+    }
+}
+
+void writeBindlessTexture(
+    const BindlessTable *table,
+    const VkDevice logicalDevice,
+    const uint32_t slot,
+    const VkImageView view,
+    const VkImageLayout layout
+) {
+    const VkDescriptorImageInfo imageInfo = {.imageView = view, .imageLayout = layout};
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = table->descriptorSet,
+        .dstBinding = BINDLESS_TEXTURES,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+        .pImageInfo = &imageInfo
+    };
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void writeBindlessSampler(
+    const BindlessTable *table,
+    const VkDevice logicalDevice,
+    const uint32_t slot,
+    const VkSampler sampler
+) {
+    const VkDescriptorImageInfo imageInfo = {.sampler = sampler};
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = table->descriptorSet,
+        .dstBinding = BINDLESS_SAMPLERS,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+        .pImageInfo = &imageInfo
+    };
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+/**
+ * Registers a storage buffer range and returns the slot shaders read it from.
+ * The buffer stays owned by the caller and has to outlive the slot's release.
+ **/
+uint32_t registerBindlessBuffer(
+    BindlessTable *table,
+    const VkDevice logicalDevice,
+    const VkBuffer buffer,
+    const VkDeviceSize offset,
+    const VkDeviceSize range
+) {
+    const uint32_t slot = allocateBindlessSlot(table, BINDLESS_BUFFERS);
+
+    const VkDescriptorBufferInfo bufferInfo = {.buffer = buffer, .offset = offset, .range = range};
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = table->descriptorSet,
+        .dstBinding = BINDLESS_BUFFERS,
+        .dstArrayElement = slot,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .pBufferInfo = &bufferInfo
+    };
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+
+    return slot;
+}
+
+void bindBindlessTable(
+    const VkCommandBuffer commandBuffer,
+    const BindlessTable *table,
+    const VkPipelineBindPoint bindPoint,
+    const VkPipelineLayout pipelineLayout
+) {
+    vkCmdBindDescriptorSets(commandBuffer, bindPoint, pipelineLayout, 0, 1, &table->descriptorSet, 0, nullptr);
+}
+
+void destroyBindlessTable(const VkDevice logicalDevice, BindlessTable *table) {
+    for (uint32_t i = 0; i < BINDLESS_BINDING_COUNT; i++) {
+        free(table->slots[i].free.items);
+        free(table->slots[i].released.items);
+    }
+
+    // Frees the set with it
+    vkDestroyDescriptorPool(logicalDevice, table->descriptorPool, hostAllocator);
+    vkDestroyDescriptorSetLayout(logicalDevice, table->descriptorSetLayout, hostAllocator);
+}
+
+#endif //VULKAN_BINDLESS_H
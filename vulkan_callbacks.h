@@ -6,31 +6,214 @@
 #define VULKAN_CALLBACKS_H
 
 #include <vulkan/vulkan.h>
+#include <stdatomic.h>
+#include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
+#include "io.h"
+
+/**
+ * Host allocator behind every create and destroy call, passed as hostAllocator.
+ * Small allocations come from per thread free lists of power of two size
+ * classes, everything else goes to aligned_alloc. Each allocation keeps a
+ * header right before the pointer handed to the driver, so frees and
+ * reallocations know the size, class and scope without a lookup.
+ * LEARNING_HOST_ALLOCATOR=0 hands allocation back to the driver for comparison,
+ * hostAllocator is then nullptr. Objects must be destroyed with the allocator
+ * they were created with, so it's only chosen once, before the instance.
+ **/
+#define HOST_ALLOCATION_SCOPE_COUNT (VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1)
+#define HOST_POOL_CLASS_COUNT 8 // 16 to 2048 bytes
+
+constexpr size_t HOST_POOL_MIN_SIZE = 16;
+constexpr size_t HOST_POOL_ALIGNMENT = 16; // Larger alignments aren't pooled
+constexpr uint32_t HOST_POOL_MAX_CACHED = 256; // Free blocks a thread keeps per class
+
+typedef struct HostAllocationHeader {
+    void *block; // What aligned_alloc returned
+    size_t size; // Requested bytes
+    uint32_t sizeClass; // HOST_POOL_CLASS_COUNT when not pooled
+    uint32_t scope;
+} HostAllocationHeader;
+
+typedef struct HostScopeStats {
+    atomic_size_t allocations;
+    atomic_size_t frees;
+    atomic_size_t liveBytes;
+    atomic_size_t peakBytes;
+} HostScopeStats;
+
+typedef struct HostAllocatorStats {
+    HostScopeStats scopes[HOST_ALLOCATION_SCOPE_COUNT];
+    atomic_size_t reallocations;
+    atomic_size_t poolHits; // Served from a thread's free list
+    atomic_size_t poolMisses; // Pooled size but the free list was empty
+    atomic_size_t internalBytes; // Driver allocations reported through the notifications
+    atomic_size_t internalPeakBytes;
+} HostAllocatorStats;
+
+typedef struct HostPoolBlock {
+    struct HostPoolBlock *next;
+} HostPoolBlock;
+
+typedef struct HostPool {
+    HostPoolBlock *blocks[HOST_POOL_CLASS_COUNT];
+    uint32_t cached[HOST_POOL_CLASS_COUNT];
+    bool registered; // The thread exit destructor knows about this pool
+} HostPool;
+
+HostAllocatorStats hostAllocatorStats;
+static _Thread_local HostPool hostPool;
+static pthread_key_t hostPoolKey;
+
+void raiseHostPeak(atomic_size_t *peak, const size_t value) {
+    size_t current = atomic_load(peak);
+    while (value > current && !atomic_compare_exchange_weak(peak, &current, value)) {}
+}
+
+uint32_t getHostPoolClass(const size_t size, const size_t alignment) {
+    if (alignment > HOST_POOL_ALIGNMENT) return HOST_POOL_CLASS_COUNT;
+
+    size_t classSize = HOST_POOL_MIN_SIZE;
+    for (uint32_t sizeClass = 0; sizeClass < HOST_POOL_CLASS_COUNT; sizeClass++, classSize <<= 1) {
+        if (size <= classSize) return sizeClass;
+    }
+    return HOST_POOL_CLASS_COUNT;
+}
+
+size_t alignHostSize(const size_t size, const size_t alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+HostAllocationHeader *getHostAllocationHeader(void *memory) {
+    return (HostAllocationHeader *) ((char *) memory - sizeof(HostAllocationHeader));
+}
+
+/**
+ * Threads that exit give their cached blocks back, the pipeline and device
+ * workers would otherwise leak whatever they freed.
+ **/
+void drainHostPool(void *data) {
+    HostPool *pool = data;
+    for (uint32_t i = 0; i < HOST_POOL_CLASS_COUNT; i++) {
+        while (pool->blocks[i] != nullptr) {
+            HostPoolBlock *block = pool->blocks[i];
+            pool->blocks[i] = block->next;
+            free(getHostAllocationHeader(block)->block);
+        }
+        pool->cached[i] = 0;
+    }
+}
+
+void *allocateHostMemory(const size_t size, size_t alignment, const VkSystemAllocationScope scope) {
+    if (alignment < HOST_POOL_ALIGNMENT) alignment = HOST_POOL_ALIGNMENT;
+    const uint32_t sizeClass = getHostPoolClass(size, alignment);
+
+    void *memory = nullptr;
+    if (sizeClass < HOST_POOL_CLASS_COUNT && hostPool.blocks[sizeClass] != nullptr) {
+        HostPoolBlock *block = hostPool.blocks[sizeClass];
+        hostPool.blocks[sizeClass] = block->next;
+        hostPool.cached[sizeClass]--;
+        memory = block;
+        atomic_fetch_add(&hostAllocatorStats.poolHits, 1);
+    } else {
+        if (sizeClass < HOST_POOL_CLASS_COUNT) atomic_fetch_add(&hostAllocatorStats.poolMisses, 1);
+
+        // Pooled blocks are sized for their class so any later request of the class fits
+        const size_t payload = sizeClass < HOST_POOL_CLASS_COUNT ? HOST_POOL_MIN_SIZE << sizeClass : size;
+        const size_t offset = alignHostSize(sizeof(HostAllocationHeader), alignment);
+        void *block = aligned_alloc(alignment, alignHostSize(offset + payload, alignment));
+        if (block == nullptr) return nullptr;
+
+        memory = (char *) block + offset;
+        getHostAllocationHeader(memory)->block = block;
+        getHostAllocationHeader(memory)->sizeClass = sizeClass;
+    }
+
+    HostAllocationHeader *header = getHostAllocationHeader(memory);
+    header->size = size;
+    header->scope = scope;
+
+    HostScopeStats *stats = &hostAllocatorStats.scopes[scope];
+    atomic_fetch_add(&stats->allocations, 1);
+    raiseHostPeak(&stats->peakBytes, atomic_fetch_add(&stats->liveBytes, size) + size);
+
+    return memory;
+}
+
+void freeHostMemory(void *memory) {
+    if (memory == nullptr) return;
+
+    const HostAllocationHeader *header = getHostAllocationHeader(memory);
+    HostScopeStats *stats = &hostAllocatorStats.scopes[header->scope];
+    atomic_fetch_add(&stats->frees, 1);
+    atomic_fetch_sub(&stats->liveBytes, header->size);
+
+    const uint32_t sizeClass = header->sizeClass;
+    if (sizeClass < HOST_POOL_CLASS_COUNT && hostPool.cached[sizeClass] < HOST_POOL_MAX_CACHED) {
+        if (!hostPool.registered) {
+            hostPool.registered = true;
+            pthread_setspecific(hostPoolKey, &hostPool);
+        }
+
+        HostPoolBlock *block = memory;
+        block->next = hostPool.blocks[sizeClass];
+        hostPool.blocks[sizeClass] = block;
+        hostPool.cached[sizeClass]++;
+    } else free(header->block);
+}
 
 void *pfnvkAllocationFunction(
     void *pUserData,
     size_t size,
     size_t alignment,
     VkSystemAllocationScope allocationScope) {
-    return malloc(size);
+    return allocateHostMemory(size, alignment, allocationScope);
 }
 
+/**
+ * Grows in place while the new size still fits the pooled block, the driver
+ * has to pass the alignment of the original allocation.
+ **/
 void *pfnvkReallocationFunction(
     void *pUserData,
     void *pOriginal,
     size_t size,
     size_t alignment,
     VkSystemAllocationScope allocationScope) {
-    return realloc(pOriginal, size);
+    if (pOriginal == nullptr) return allocateHostMemory(size, alignment, allocationScope);
+    if (size == 0) {
+        freeHostMemory(pOriginal);
+        return nullptr;
+    }
+
+    atomic_fetch_add(&hostAllocatorStats.reallocations, 1);
+
+    HostAllocationHeader *header = getHostAllocationHeader(pOriginal);
+    const uint32_t sizeClass = header->sizeClass;
+    if (sizeClass < HOST_POOL_CLASS_COUNT && sizeClass == getHostPoolClass(size, alignment)
+        && header->scope == allocationScope) {
+        HostScopeStats *stats = &hostAllocatorStats.scopes[header->scope];
+        if (size > header->size) {
+            const size_t grown = size - header->size;
+            raiseHostPeak(&stats->peakBytes, atomic_fetch_add(&stats->liveBytes, grown) + grown);
+        } else atomic_fetch_sub(&stats->liveBytes, header->size - size);
+        header->size = size;
+        return pOriginal;
+    }
+
+    void *memory = allocateHostMemory(size, alignment, allocationScope);
+    if (memory == nullptr) return nullptr; // The original stays valid
+
+    memcpy(memory, pOriginal, header->size < size ? header->size : size);
+    freeHostMemory(pOriginal);
+    return memory;
 }
 
 void pfnvkFreeFunction(
     void *pUserData,
     void *pMemory) {
-    printLn("VK_INFO: %s", pUserData);
-    if (pMemory == nullptr) return;
-    free(pMemory);
+    freeHostMemory(pMemory);
 }
 
 void fn_vkInternalAllocationNotification(
@@ -38,7 +221,10 @@ void fn_vkInternalAllocationNotification(
     size_t size,
     VkInternalAllocationType allocationType,
     VkSystemAllocationScope allocationScope) {
-
+    raiseHostPeak(
+        &hostAllocatorStats.internalPeakBytes,
+        atomic_fetch_add(&hostAllocatorStats.internalBytes, size) + size
+    );
 }
 
 void pfn_vkInternalFreeNotification(
@@ -46,15 +232,64 @@ void pfn_vkInternalFreeNotification(
     size_t size,
     VkInternalAllocationType allocationType,
     VkSystemAllocationScope allocationScope) {
+    atomic_fetch_sub(&hostAllocatorStats.internalBytes, size);
 }
 
-void populateDeallocationCallbacks(VkAllocationCallbacks *callbacks, Any label) {
-    callbacks->pUserData = label;
-    callbacks->pfnAllocation = pfnvkAllocationFunction;
-    callbacks->pfnReallocation = pfnvkReallocationFunction;
-    callbacks->pfnFree = pfnvkFreeFunction;
-    callbacks->pfnInternalAllocation = fn_vkInternalAllocationNotification;
-    callbacks->pfnInternalFree = pfn_vkInternalFreeNotification;
+VkAllocationCallbacks hostAllocationCallbacks = {
+    .pUserData = &hostAllocatorStats,
+    .pfnAllocation = pfnvkAllocationFunction,
+    .pfnReallocation = pfnvkReallocationFunction,
+    .pfnFree = pfnvkFreeFunction,
+    .pfnInternalAllocation = fn_vkInternalAllocationNotification,
+    .pfnInternalFree = pfn_vkInternalFreeNotification
+};
+
+const VkAllocationCallbacks *hostAllocator = nullptr;
+
+/**
+ * Has to run before the instance is created.
+ **/
+void initHostAllocator() {
+    const char *enabled = getenv("LEARNING_HOST_ALLOCATOR");
+    if (enabled != nullptr && strcmp(enabled, "0") == 0) {
+        printLn("Using the driver's host allocator");
+        return;
+    }
+
+    pthread_key_create(&hostPoolKey, drainHostPool);
+    hostAllocator = &hostAllocationCallbacks;
+}
+
+void printHostAllocatorStats() {
+    if (hostAllocator == nullptr) return;
+
+    static const char *scopeNames[HOST_ALLOCATION_SCOPE_COUNT] = {
+        "command", "object", "cache", "device", "instance"
+    };
+
+    printLn("Host allocations by scope (count, frees, live bytes, peak bytes):");
+    for (uint32_t i = 0; i < HOST_ALLOCATION_SCOPE_COUNT; i++) {
+        HostScopeStats *stats = &hostAllocatorStats.scopes[i];
+        printLn(
+            "  %-8s %8zu %8zu %10zu %10zu",
+            scopeNames[i],
+            atomic_load(&stats->allocations),
+            atomic_load(&stats->frees),
+            atomic_load(&stats->liveBytes),
+            atomic_load(&stats->peakBytes)
+        );
+    }
+
+    const size_t hits = atomic_load(&hostAllocatorStats.poolHits);
+    const size_t misses = atomic_load(&hostAllocatorStats.poolMisses);
+    printLn(
+        "Host pool hits %zu misses %zu (%.1f%%), reallocations %zu, driver internal peak %zu bytes",
+        hits,
+        misses,
+        hits + misses == 0 ? 0.0 : 100.0 * (double) hits / (double) (hits + misses),
+        atomic_load(&hostAllocatorStats.reallocations),
+        atomic_load(&hostAllocatorStats.internalPeakBytes)
+    );
 }
 
 #endif //VULKAN_CALLBACKS_H
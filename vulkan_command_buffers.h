@@ -10,7 +10,22 @@
 #include "vulkan_io.h"
 #include <stdlib.h>
 #include "constants.h"
+#include "build_profile.h"
 #include "vulkan_vertex.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_instances.h"
+#include "vulkan_culling.h"
+#include "vulkan_particles.h"
+#include "vulkan_batch_2d.h"
+#include "vulkan_texture.h"
+#include "vulkan_bindless.h"
+#include "vulkan_uniform_ring.h"
+#include "vulkan_resize.h"
+#include "startup_trace.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "trace.h"
+#include "render_graph.h"
 
 void createCommandPool(const VkDevice logicalDevice, VkCommandPool *commandPool, const uint32_t queueFamilyIndex) {
     VkCommandPoolCreateInfo poolInfo = {};
@@ -18,7 +33,7 @@ void createCommandPool(const VkDevice logicalDevice, VkCommandPool *commandPool,
     poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
     poolInfo.queueFamilyIndex = queueFamilyIndex;
 
-    if (vkCreateCommandPool(logicalDevice, &poolInfo, nullptr, commandPool) != VK_SUCCESS) {
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, hostAllocator, commandPool) != VK_SUCCESS) {
         printLn("failed to create command pool");
         exit(1);
     } else printLn("created command pool");
@@ -84,9 +99,12 @@ void vulkanSubmitRenderPass(const VulkanWindow *window, const uint32_t imageInde
     renderPassInfo.renderArea.offset = offset;
     renderPassInfo.renderArea.extent = window->extent;
 
-    const VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 0.0f}}};
-    renderPassInfo.clearValueCount = 1;
-    renderPassInfo.pClearValues = &clearColor;
+    const VkClearValue clearValues[] = {
+        {.color = {{0.0f, 0.0f, 0.0f, 0.0f}}},
+        {.depthStencil = {1.0f, 0}}
+    };
+    renderPassInfo.clearValueCount = 2;
+    renderPassInfo.pClearValues = clearValues;
 
     vkCmdBeginRenderPass(
         ((VkCommandBuffer *) window->commandBuffers.items)[window->currentFrame],
@@ -94,43 +112,203 @@ void vulkanSubmitRenderPass(const VulkanWindow *window, const uint32_t imageInde
         VK_SUBPASS_CONTENTS_INLINE
     );
 
-    printLn("Submitted render pass");
+    debugLn("Submitted render pass");
 }
 
-void beginRenderPass(const VulkanWindow *window, const uint32_t imageIndex) {
+void beginRenderPass(VulkanWindow *window, const uint32_t imageIndex) {
     vulkanSubmitRenderPass(window, imageIndex);
     const VkCommandBuffer commandBuffer = ((VkCommandBuffer *) window->commandBuffers.items)[window->currentFrame];
-    vkCmdBindPipeline(
-        commandBuffer,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        window->graphicsPipeline
-    );
-
-    const VkBuffer vertexBuffers[] = {window->vertexBuffer};
-    constexpr VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
-    vkCmdBindIndexBuffer(commandBuffer, window->indexBuffer, 0, VK_INDEX_TYPE_UINT32); // this section needs to be the same as the index buffer index types
 
     vulkanCmdSetScissor(window);
     vulkanCmdSetViewport(window);
 
-    vkCmdDrawIndexed(commandBuffer, 6, 1, 0, 0, 0);
+    // The only descriptor set binds of the frame, textures are picked per instance
+    // and the camera moves with the dynamic offset alone. Every pipeline shares the layout
+    bindBindlessTable(commandBuffer, &window->bindless, VK_PIPELINE_BIND_POINT_GRAPHICS, window->pipelineLayout);
+    bindUniformRing(commandBuffer, &window->uniformRing, window->pipelineLayout, window->frameUniformOffset);
+
+    DrawList *drawList = &window->drawList;
+    beginDrawList(drawList);
+
+    // One instanced draw per mesh that had instances pushed this frame
+    pushMeshInstanceDraws(drawList, &window->instances, &window->meshBuffer, window->currentFrame, window->graphicsPipeline);
+
+    // Objects that survived the GPU culling dispatch recorded before the render pass
+    pushCulledDraws(drawList, &window->cullingPass, &window->meshBuffer, window->currentFrame, window->graphicsPipeline);
+
+    // Instances written by this frame's particle step, on whichever queue it ran
+    pushParticleDraws(drawList, &window->particles, &window->meshBuffer, window->currentFrame, window->graphicsPipeline);
+
+    pushBatch2DDraws(drawList, &window->batch2D, window->graphicsPipeline);
+
+    // Sorted by key, binding only what changes between neighbouring draws
+    recordDrawList(commandBuffer, drawList, window->pipelineLayout);
 
     vkCmdEndRenderPass(commandBuffer);
+}
 
-    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
-        printLn("failed to record command buffer!");
-        exit(VULKAN_FAILED_TO_END_COMMAND_BUFFER);
-    } else printLn("Ended command buffer %d", window->currentFrame);
+void executeCullingGraphPass(const VkCommandBuffer commandBuffer, Any userData) {
+    const VulkanWindow *window = userData;
+    recordCullingPass(commandBuffer, &window->cullingPass, &window->camera, window->currentFrame);
+}
+
+void executeParticlesGraphPass(const VkCommandBuffer commandBuffer, Any userData) {
+    VulkanWindow *window = userData;
+    recordParticles(commandBuffer, &window->particles, window->currentFrame);
+}
+
+void executeMainGraphPass(const VkCommandBuffer commandBuffer, Any userData) {
+    VulkanWindow *window = userData;
+    beginPipelineStatistics(commandBuffer, &window->pipelineStatistics, window->currentFrame);
+    beginRenderPass(window, window->imageIndex);
+    endPipelineStatistics(commandBuffer, &window->pipelineStatistics, window->currentFrame);
 }
 
-void recordCommandBuffer(const VulkanWindow *window, const uint32_t imageIndex) {
+/**
+ * Passes see each other's writes in the order they're added, so the
+ * compute passes go before the main pass drawing what they write.
+ * The culling buffers stay out of it when there's no culling pass to write
+ * them, the particle instances when there are no particles or they are
+ * simulated on the async compute queue.
+ **/
+void createFrameGraph(
+    VulkanWindow *window,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const bool synchronization2
+) {
+    RenderGraph *graph = &window->renderGraph;
+    createRenderGraph(graph, physicalDevice, logicalDevice, synchronization2);
+
+    const bool culling = window->cullingPass.enabled;
+    if (culling) {
+        window->culledInstancesResource = importRenderGraphBuffer(graph, "culled instances");
+        window->culledCommandsResource = importRenderGraphBuffer(graph, "culled draw commands");
+        window->culledCountsResource = importRenderGraphBuffer(graph, "culled draw counts");
+
+        const uint32_t cullingPass = addRenderGraphPass(graph, "culling", executeCullingGraphPass, window);
+        writeRenderGraphResource(
+            graph,
+            cullingPass,
+            window->culledInstancesResource,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+        writeRenderGraphResource(
+            graph,
+            cullingPass,
+            window->culledCommandsResource,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+        // Cleared with a fill first, recordCullingPass orders the fill and the dispatch itself
+        writeRenderGraphResource(
+            graph,
+            cullingPass,
+            window->culledCountsResource,
+            VK_PIPELINE_STAGE_2_TRANSFER_BIT | VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+    }
+
+    const bool particles = window->particles.enabled && !window->particles.async;
+    if (particles) {
+        window->particleInstancesResource = importRenderGraphBuffer(graph, "particle instances");
+
+        const uint32_t particlesPass = addRenderGraphPass(graph, "particles", executeParticlesGraphPass, window);
+        writeRenderGraphResource(
+            graph,
+            particlesPass,
+            window->particleInstancesResource,
+            VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            VK_ACCESS_2_SHADER_WRITE_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+    }
+
+    window->swapChainImageResource = importRenderGraphImage(
+        graph,
+        "swap chain image",
+        VK_IMAGE_ASPECT_COLOR_BIT,
+        VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+    );
+    const uint32_t mainPass = addRenderGraphPass(graph, "main pass", executeMainGraphPass, window);
+    writeRenderGraphResource(
+        graph,
+        mainPass,
+        window->swapChainImageResource,
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    );
+    // Cleared by the pass and dropped after it, so it's not exported
+    window->depthImageResource = importRenderGraphImage(
+        graph,
+        "depth image",
+        getDepthAspect(window->depthFormat),
+        VK_IMAGE_LAYOUT_UNDEFINED
+    );
+    writeRenderGraphResource(
+        graph,
+        mainPass,
+        window->depthImageResource,
+        VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT,
+        VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+        VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    );
+
+    if (culling) {
+        readRenderGraphResource(
+            graph,
+            mainPass,
+            window->culledInstancesResource,
+            VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT,
+            VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+        readRenderGraphResource(
+            graph,
+            mainPass,
+            window->culledCommandsResource,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+        readRenderGraphResource(
+            graph,
+            mainPass,
+            window->culledCountsResource,
+            VK_PIPELINE_STAGE_2_DRAW_INDIRECT_BIT,
+            VK_ACCESS_2_INDIRECT_COMMAND_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+    }
+
+    if (particles) {
+        readRenderGraphResource(
+            graph,
+            mainPass,
+            window->particleInstancesResource,
+            VK_PIPELINE_STAGE_2_VERTEX_INPUT_BIT,
+            VK_ACCESS_2_VERTEX_ATTRIBUTE_READ_BIT,
+            VK_IMAGE_LAYOUT_UNDEFINED
+        );
+    }
+
+    compileRenderGraph(graph);
+}
+
+void recordCommandBuffer(VulkanWindow *window, const uint32_t imageIndex) {
+    TRACE_ZONE("record");
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
     beginInfo.flags = 0; // Optional
     beginInfo.pInheritanceInfo = nullptr; // Optional
 
-    printLn("Recording command buffer %d", window->currentFrame);
+    debugLn("Recording command buffer %d", window->currentFrame);
     const VkResult res = vkBeginCommandBuffer(
         ((VkCommandBuffer *) window->commandBuffers.items)[window->currentFrame],
         &beginInfo
@@ -141,7 +319,56 @@ void recordCommandBuffer(const VulkanWindow *window, const uint32_t imageIndex)
         exit(3);
     }
 
-    beginRenderPass(window, imageIndex);
+    const VkCommandBuffer commandBuffer = ((VkCommandBuffer *) window->commandBuffers.items)[window->currentFrame];
+    resetGpuTrace(commandBuffer, &window->gpuTrace, window->currentFrame);
+
+    window->imageIndex = imageIndex;
+    // The submit waits for the acquire at the color attachment stage
+    setRenderGraphImage(
+        &window->renderGraph,
+        window->swapChainImageResource,
+        ((VkImage *) window->swapChainImages.items)[imageIndex],
+        ((VkImageView *) window->swapChainImagesViews.items)[imageIndex],
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT
+    );
+    // The swap chain image's acquire is what orders it after the last frame drawn
+    // to the same image, its transition waits at the same stage to chain onto it
+    const DepthImage depthImage = ((DepthImage *) window->depthImages.items)[imageIndex];
+    setRenderGraphImage(
+        &window->renderGraph,
+        window->depthImageResource,
+        depthImage.image,
+        depthImage.view,
+        VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT
+    );
+    if (window->cullingPass.enabled) {
+        const CullingFrame frame = ((CullingFrame *) window->cullingPass.frames.items)[window->currentFrame];
+        setRenderGraphBuffer(&window->renderGraph, window->culledInstancesResource, frame.instanceBuffer);
+        setRenderGraphBuffer(&window->renderGraph, window->culledCommandsResource, frame.commandBuffer);
+        setRenderGraphBuffer(&window->renderGraph, window->culledCountsResource, frame.countBuffer);
+    }
+    if (window->particles.enabled && !window->particles.async)
+        setRenderGraphBuffer(
+            &window->renderGraph,
+            window->particleInstancesResource,
+            getParticleInstanceBuffer(&window->particles, window->currentFrame)
+        );
+
+    // Old transients retire with this frame, it's the first that won't use them
+    executeRenderGraph(
+        &window->renderGraph,
+        commandBuffer,
+        window->extent,
+        &window->retireQueue,
+        window->frameNumber,
+        &window->gpuTrace,
+        window->currentFrame
+    );
+
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printLn("failed to record command buffer!");
+        exit(VULKAN_FAILED_TO_END_COMMAND_BUFFER);
+    } else debugLn("Ended command buffer %d", window->currentFrame);
 }
 
 void createSyncObjects(
@@ -153,19 +380,19 @@ void createSyncObjects(
     window->inFlightFences.count = MAX_FRAMES_IN_FLIGHT;
     window->inFlightFences.size = sizeof(VkFence) * MAX_FRAMES_IN_FLIGHT;
     window->inFlightFences.items = malloc(window->inFlightFences.size);
-    printLn("Sized inFlightSemaphores");
+    debugLn("Sized inFlightSemaphores");
 
     size_t semaphoresSize = sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT;
 
     window->imageAvailableSemaphores.count = MAX_FRAMES_IN_FLIGHT;
     window->imageAvailableSemaphores.size = semaphoresSize;
     window->imageAvailableSemaphores.items = malloc(semaphoresSize);
-    printLn("Sized imageAvailableSemaphores");
+    debugLn("Sized imageAvailableSemaphores");
 
     window->renderFinishedSemaphores.count = MAX_FRAMES_IN_FLIGHT;
     window->renderFinishedSemaphores.size = semaphoresSize;
     window->renderFinishedSemaphores.items = malloc(semaphoresSize);
-    printLn("Sized renderFinishedSemaphores");
+    debugLn("Sized renderFinishedSemaphores");
 
     VkSemaphoreCreateInfo semaphoreInfo = {};
     semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
@@ -175,26 +402,26 @@ void createSyncObjects(
     fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
 
     for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
-        printLn("Assigning sync objects %d", i);
+        debugLn("Assigning sync objects %d", i);
 
         const VkResult availableSemaphoreResult = vkCreateSemaphore(
             logicalDevice,
             &semaphoreInfo,
-            nullptr,
+            hostAllocator,
             &((VkSemaphore *) window->imageAvailableSemaphores.items)[i]
         );
 
         const VkResult renderFinishedSemaphoreResult = vkCreateSemaphore(
             logicalDevice,
             &semaphoreInfo,
-            nullptr,
+            hostAllocator,
             &((VkSemaphore *) window->renderFinishedSemaphores.items)[i]
         );
 
         const VkResult inFlightFenceResult = vkCreateFence(
             logicalDevice,
             &fenceInfo,
-            nullptr,
+            hostAllocator,
             &((VkFence *) window->inFlightFences.items)[i]
         );
 
@@ -209,18 +436,42 @@ void createSyncObjects(
     }
 }
 
+/**
+ * How many frames are known to have finished on the GPU, valid right after
+ * waiting on the current frame's fence. That fence was last submitted with frame
+ * frameNumber - MAX_FRAMES_IN_FLIGHT and the queue completes frames in order.
+ **/
+uint64_t getCompletedFrameCount(const VulkanWindow *window) {
+    return window->frameNumber >= MAX_FRAMES_IN_FLIGHT ? window->frameNumber - MAX_FRAMES_IN_FLIGHT + 1 : 0;
+}
+
 void drawFrame(
     GLFWApp *app,
     VulkanWindow *window,
     const VkQueue presentQueue,
     const VkQueue graphicsQueue
 ) {
+    setTraceFrame(window->frameNumber);
+    TRACE_ZONE("drawFrame");
+
     // const VkDevice logicalDevice,const VkFence *inFlightFence
     const VkFence *vulkanFence = &((VkFence *) window->inFlightFences.items)[window->currentFrame];
+    const TraceZone waitZone = beginTraceZone("wait for frame");
     vkWaitForFences(app->logicalDevice, 1, vulkanFence, VK_TRUE, UINT64_MAX);
-    vkResetFences(app->logicalDevice, 1, vulkanFence);
+    endTraceZone(&waitZone);
+    collectGpuTrace(&window->gpuTrace, app->logicalDevice, window->currentFrame);
+    collectPipelineStatistics(&window->pipelineStatistics, app->logicalDevice, window->currentFrame);
+
+    const uint64_t completedFrames = getCompletedFrameCount(window);
+    collectRetiredResources(&window->retireQueue, app->logicalDevice, completedFrames);
+    // After the frees above so a heap that just dropped under its threshold is reported now
+    updateMemoryBudget(&memoryBudget);
+    // Bindless slots whose last frame has finished can be written again
+    retireBindlessSlots(&window->bindless, completedFrames);
+    beginUniformRing(&window->uniformRing, window->currentFrame);
 
     uint32_t imageIndex;
+    const TraceZone acquireZone = beginTraceZone("acquire");
     VkResult acquireNextImageResult = vkAcquireNextImageKHR(
         app->logicalDevice,
         window->swapChain,
@@ -229,30 +480,49 @@ void drawFrame(
         VK_NULL_HANDLE,
         &imageIndex
     );
-    if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR || acquireNextImageResult == VK_SUBOPTIMAL_KHR || window->
-        resized) {
-        window->resized = false;
-        printLn("Failed to acquire swap chain image!");
+    endTraceZone(&acquireZone);
+    if (acquireNextImageResult == VK_ERROR_OUT_OF_DATE_KHR) {
+        // Nothing was acquired and the fence is still signaled, so the frame is just skipped.
+        // Its submissions are dropped like the 2D batch's, instances are pushed again every frame
+        // and keeping them would draw them twice and overrun the instance buffer.
         recreateSwapChain(app);
+        endBatch2D(&window->batch2D);
+        window->instances.pending.count = 0;
         return;
     } else if (acquireNextImageResult != VK_SUCCESS && acquireNextImageResult != VK_SUBOPTIMAL_KHR) {
         printLn("failed to acquire swap chain image!");
         exit(1);
     }
 
+    // Reset only once a submit is certain, an early return after it would leave the fence unsignaled for good
+    vkResetFences(app->logicalDevice, 1, vulkanFence);
 
     const VkCommandBuffer commandBuffer = ((VkCommandBuffer *) window->commandBuffers.items)[window->currentFrame];
     vkResetCommandBuffer(commandBuffer, 0);
+    flushBatch2D(&window->batch2D);
+    // The fence guarantees the GPU is done reading this frame's instance buffer.
+    // Only once an image is acquired, a skipped frame drops its instances above
+    prepareMeshInstances(&window->instances, window->currentFrame, window->meshBuffer.meshes.count);
+    window->frameUniformOffset = pushFrameUniforms(&window->uniformRing, &window->camera);
+    updateParticles(&window->particles);
     recordCommandBuffer(window, imageIndex);
+    // Runs on the compute queue while the graphics queue is still on earlier work
+    submitParticles(&window->particles, window->currentFrame);
 
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
+    // Particle instances are only read from vertex input on, everything before overlaps the step
+    const VkSemaphore particleSemaphore = getParticleSemaphore(&window->particles, window->currentFrame);
     const VkSemaphore waitSemaphores[] = {
-        ((VkSemaphore *) window->imageAvailableSemaphores.items)[window->currentFrame]
+        ((VkSemaphore *) window->imageAvailableSemaphores.items)[window->currentFrame],
+        particleSemaphore
+    };
+    constexpr VkPipelineStageFlags waitStages[] = {
+        VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT
     };
-    constexpr VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.waitSemaphoreCount = particleSemaphore == VK_NULL_HANDLE ? 1 : 2;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
     submitInfo.commandBufferCount = 1;
@@ -264,19 +534,18 @@ void drawFrame(
     submitInfo.signalSemaphoreCount = 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    printLn("Presentation queue found %d, %d", sizeof(graphicsQueue), sizeof(int));
-
-    if (graphicsQueue == VK_NULL_HANDLE) {
-        printLn("Present queue isn't available");
-        exit(1);
-    } else printLn("Presentation queue is created");
+    debugCheck(graphicsQueue != VK_NULL_HANDLE, 1, "Present queue isn't available");
 
     const VkFence vkFence = ((VkFence *) window->inFlightFences.items)[window->currentFrame];
 
+    const TraceZone submitZone = beginTraceZone("submit");
+    markGpuTraceSubmit(&window->gpuTrace, window->currentFrame);
     if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, vkFence) != VK_SUCCESS) {
         printLn("failed to submit draw command buffer!");
         exit(1);
-    } else printLn("Created inflight fence from graphics queue");
+    }
+    endTraceZone(&submitZone);
+    window->frameNumber++;
 
     VkPresentInfoKHR presentInfo = {};
     presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -291,59 +560,19 @@ void drawFrame(
 
     presentInfo.pResults = nullptr; // Optional
 
-    vkQueuePresentKHR(presentQueue, &presentInfo);
-
-    window->currentFrame = (window->currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
-}
-
-void createIndexBuffer(
-    VulkanWindow *window,
-    BufferVertices buffserVertices,
-    VkQueue graphicsQueue,
-    VkDevice logicalDevice,
-    VkPhysicalDevice physicalDevice
-) {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(
-        &stagingBuffer,
-        buffserVertices.indices.size,
-        &stagingBufferMemory,
-        &window->memRequirements,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        physicalDevice,
-        logicalDevice
-    );
+    const TraceZone presentZone = beginTraceZone("present");
+    const VkResult presentResult = vkQueuePresentKHR(presentQueue, &presentInfo);
+    endTraceZone(&presentZone);
+    markFirstFrame();
 
-    Any data;
-    vkMapMemory(logicalDevice, stagingBufferMemory, 0, buffserVertices.indices.size, 0, &data);
-    memcpy(data, (uint32_t *) buffserVertices.indices.items, buffserVertices.indices.size);
-    vkUnmapMemory(logicalDevice, stagingBufferMemory);
-
-    createBuffer(
-        &window->indexBuffer,
-        buffserVertices.indices.size,
-        &window->indexBufferMemory,
-        &window->memRequirements,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        physicalDevice,
-        logicalDevice
-    );
+    endBatch2D(&window->batch2D);
 
-    copyBuffer(
-        stagingBuffer,
-        window->indexBuffer,
-        buffserVertices.indices.size,
-        window->commandPool,
-        logicalDevice,
-        graphicsQueue
-    );
+    // Recreated after presenting so an image acquired as suboptimal still reaches the screen.
+    // At most once per frame however many size events arrived since the last one
+    if (shouldRecreateSwapChain(&window->resize, acquireNextImageResult, presentResult, glfwGetTime()))
+        recreateSwapChain(app);
 
-    vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    window->currentFrame = (window->currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
 }
 
 void initCommandBuffers(
@@ -360,10 +589,10 @@ void initCommandBuffers(
             .count = 4,
             .size = sizeof(Vertex) * 4,
             .items = (Any *) (Vertex []){
-                {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}},
-                {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}},
-                {{0.5f, 0.5f}, {0.0f, 0.0f, 0.0f}},
-                {{-0.5f, 0.5f}, {1.0f, 1.0f, 0.0f}}
+                {{-0.5f, -0.5f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f}},
+                {{0.5f, -0.5f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f}},
+                {{0.5f, 0.5f}, {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f}},
+                {{-0.5f, 0.5f}, {1.0f, 1.0f, 0.0f}, {0.0f, 1.0f}}
             }
         },
         .indices = {
@@ -376,8 +605,25 @@ void initCommandBuffers(
 
     };
 
-    createVertexBuffer(physicalDevice, logicalDevice, bufferVertices, window, graphicsQueue);
-    createIndexBuffer(window, bufferVertices, graphicsQueue, logicalDevice, physicalDevice);
+    createMeshBuffer(
+        &window->meshBuffer,
+        MESH_BUFFER_VERTEX_CAPACITY,
+        MESH_BUFFER_INDEX_CAPACITY,
+        physicalDevice,
+        logicalDevice
+    );
+    addMeshToMeshBuffer(
+        &window->meshBuffer,
+        bufferVertices,
+        window->commandPool,
+        physicalDevice,
+        logicalDevice,
+        graphicsQueue
+    );
+    createMeshInstances(&window->instances, MAX_INSTANCES_PER_FRAME, physicalDevice, logicalDevice);
+    createBatch2D(&window->batch2D, MAX_BATCH_2D_QUADS, window->commandPool, physicalDevice, logicalDevice, graphicsQueue);
+    createDrawList(&window->drawList);
+    createGpuTrace(&window->gpuTrace, physicalDevice, logicalDevice, queueFamilyIndex);
     createCommandBuffers(logicalDevice, window);
     createSyncObjects(logicalDevice, window);
 
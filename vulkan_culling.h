@@ -0,0 +1,492 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_CULLING_H
+#define VULKAN_CULLING_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "trace.h"
+#include "pipeline_cache.h"
+#include "vulkan_draw_list.h"
+#include "vulkan_uniform_ring.h"
+
+/**
+ * An object the GPU culls and draws. Layout matches CullObject in cull.comp (std430).
+ **/
+typedef struct CullObject {
+    InstanceData instance;
+    uint32_t meshIndex;
+} CullObject;
+
+/**
+ * The part of a MeshRange the culling shader needs. Matches CullMesh in cull.comp.
+ * wideIndices is 1 for meshes with 32 bit indices.
+ **/
+typedef struct CullMesh {
+    uint32_t indexCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    float radius;
+    Vector2D center;
+    uint32_t wideIndices;
+    uint32_t padding;
+} CullMesh;
+
+typedef struct CullPushConstants {
+    Vector2D viewMin;
+    Vector2D viewMax;
+    uint32_t objectCount;
+    uint32_t objectCapacity;
+} CullPushConstants;
+
+/**
+ * What the culling shader writes for one frame in flight.
+ * Kept per frame so the next frame's dispatch never overwrites
+ * commands a previous frame is still drawing from.
+ * An indirect draw can only use one index type so commands of meshes with
+ * 16 bit indices fill the first objectCapacity commands and those with
+ * 32 bit indices the second, each with its own draw count.
+ **/
+typedef struct CullingFrame {
+    VkBuffer instanceBuffer; // InstanceData of the visible objects
+    VkDeviceMemory instanceBufferMemory;
+    VkBuffer commandBuffer; // VkDrawIndexedIndirectCommand, 2 * objectCapacity
+    VkDeviceMemory commandBufferMemory;
+    VkBuffer countBuffer; // uint32_t 16 bit draws, 32 bit draws, visible instances
+    VkDeviceMemory countBufferMemory;
+    VkDescriptorSet descriptorSet;
+} CullingFrame;
+
+typedef struct CullingPass {
+    bool enabled;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    VkBuffer objectBuffer; // CullObject
+    VkDeviceMemory objectBufferMemory;
+    VkBuffer meshBuffer; // CullMesh
+    VkDeviceMemory meshBufferMemory;
+    Uint32SizedMutableArray frames; // CullingFrame
+    uint32_t objectCapacity;
+    uint32_t objectCount;
+} CullingPass;
+
+#define CULLING_WORKGROUP_SIZE 64
+#define CULLING_BINDING_COUNT 5
+#define CULLING_COUNT_SIZE (sizeof(uint32_t) * 3)
+
+void createCullingDescriptorSetLayout(const VkDevice logicalDevice, CullingPass *pass) {
+    VkDescriptorSetLayoutBinding bindings[CULLING_BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < CULLING_BINDING_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = CULLING_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, hostAllocator, &pass->descriptorSetLayout) != VK_SUCCESS) {
+        printLn("Failed to create culling descriptor set layout");
+        exit(FAILED_TO_CREATE_CULLING_PASS);
+    }
+
+    const VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(CullPushConstants)
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &pass->descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, hostAllocator, &pass->pipelineLayout) != VK_SUCCESS) {
+        printLn("Failed to create culling pipeline layout");
+        exit(FAILED_TO_CREATE_CULLING_PASS);
+    }
+}
+
+void createCullingPipeline(const VkDevice logicalDevice, CullingPass *pass, const Uint32SizedMutableArray computeShader) {
+    if (createComputePipeline(logicalDevice, computeShader, pass->pipelineLayout, &pass->pipeline) != VK_SUCCESS) {
+        printLn("Failed to create culling pipeline");
+        exit(FAILED_TO_CREATE_CULLING_PASS);
+    }
+}
+
+void createCullingFrames(
+    CullingPass *pass,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    VkMemoryRequirements memRequirements;
+
+    const VkDescriptorPoolSize poolSize = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = CULLING_BINDING_COUNT * MAX_FRAMES_IN_FLIGHT
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, hostAllocator, &pass->descriptorPool) != VK_SUCCESS) {
+        printLn("Failed to create culling descriptor pool");
+        exit(FAILED_TO_CREATE_CULLING_PASS);
+    }
+
+    pass->frames.count = MAX_FRAMES_IN_FLIGHT;
+    pass->frames.size = sizeof(CullingFrame) * MAX_FRAMES_IN_FLIGHT;
+    pass->frames.items = malloc(pass->frames.size);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        CullingFrame *frame = &((CullingFrame *) pass->frames.items)[i];
+
+        createBuffer(
+            &frame->instanceBuffer,
+            sizeof(InstanceData) * pass->objectCapacity,
+            &frame->instanceBufferMemory,
+            &memRequirements,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+        createBuffer(
+            &frame->commandBuffer,
+            sizeof(VkDrawIndexedIndirectCommand) * 2 * pass->objectCapacity,
+            &frame->commandBufferMemory,
+            &memRequirements,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+        createBuffer(
+            &frame->countBuffer,
+            CULLING_COUNT_SIZE,
+            &frame->countBufferMemory,
+            &memRequirements,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = pass->descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &pass->descriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &frame->descriptorSet) != VK_SUCCESS) {
+            printLn("Failed to allocate culling descriptor set %d", i);
+            exit(FAILED_TO_CREATE_CULLING_PASS);
+        }
+
+        const VkDescriptorBufferInfo bufferInfos[CULLING_BINDING_COUNT] = {
+            {pass->objectBuffer, 0, VK_WHOLE_SIZE},
+            {pass->meshBuffer, 0, VK_WHOLE_SIZE},
+            {frame->instanceBuffer, 0, VK_WHOLE_SIZE},
+            {frame->commandBuffer, 0, VK_WHOLE_SIZE},
+            {frame->countBuffer, 0, VK_WHOLE_SIZE}
+        };
+
+        VkWriteDescriptorSet writes[CULLING_BINDING_COUNT] = {};
+        for (uint32_t binding = 0; binding < CULLING_BINDING_COUNT; binding++) {
+            writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[binding].dstSet = frame->descriptorSet;
+            writes[binding].dstBinding = binding;
+            writes[binding].descriptorCount = 1;
+            writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(logicalDevice, CULLING_BINDING_COUNT, writes, 0, nullptr);
+    }
+}
+
+/**
+ * Needs drawIndirectCount (Vulkan 1.2). Objects are uploaded once with setCullingObjects,
+ * after that each frame costs one dispatch and one indirect draw no matter the object count.
+ **/
+void createCullingPass(
+    CullingPass *pass,
+    const uint32_t objectCapacity,
+    const uint32_t meshCapacity,
+    const Uint32SizedMutableArray computeShader, // cull.comp SPIR-V
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    TRACE_ZONE("culling pipeline");
+    VkMemoryRequirements memRequirements;
+
+    pass->objectCapacity = objectCapacity;
+    pass->objectCount = 0;
+
+    createBuffer(
+        &pass->objectBuffer,
+        sizeof(CullObject) * objectCapacity,
+        &pass->objectBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+    createBuffer(
+        &pass->meshBuffer,
+        sizeof(CullMesh) * meshCapacity,
+        &pass->meshBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    createCullingDescriptorSetLayout(logicalDevice, pass);
+    createCullingPipeline(logicalDevice, pass, computeShader);
+    createCullingFrames(pass, physicalDevice, logicalDevice);
+
+    pass->enabled = true;
+    printLn("Created culling pass for %d objects", objectCapacity);
+}
+
+/**
+ * Replaces the culled objects and refreshes the mesh table from the mesh buffer.
+ * Goes through the staging path, which waits for the queue to idle,
+ * so it is meant for scene loads and not for per frame updates.
+ **/
+void setCullingObjects(
+    CullingPass *pass,
+    const MeshBuffer *meshBuffer,
+    const CullObject *objects,
+    const uint32_t objectCount,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    if (objectCount > pass->objectCapacity || meshBuffer->meshes.count > MAX_CULLING_MESHES) {
+        printLn("Culling pass can't hold %d objects of %d meshes", objectCount, meshBuffer->meshes.count);
+        exit(CULLING_PASS_CAPACITY_EXCEEDED);
+    }
+
+    const VkDeviceSize objectsSize = sizeof(CullObject) * objectCount;
+    const VkDeviceSize meshesSize = sizeof(CullMesh) * meshBuffer->meshes.count;
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    VkMemoryRequirements memRequirements;
+
+    createBuffer(
+        &stagingBuffer,
+        objectsSize + meshesSize,
+        &stagingBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    Any data;
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, objectsSize + meshesSize, 0, &data);
+    memcpy(data, objects, objectsSize);
+
+    CullMesh *meshes = (CullMesh *) ((char *) data + objectsSize);
+    for (uint32_t i = 0; i < meshBuffer->meshes.count; i++) {
+        const MeshRange range = getMeshRange(meshBuffer, i);
+        meshes[i] = (CullMesh){
+            .indexCount = range.indexCount,
+            .firstIndex = range.firstIndex,
+            .vertexOffset = range.vertexOffset,
+            .radius = range.radius,
+            .center = range.center,
+            .wideIndices = range.indexType == VK_INDEX_TYPE_UINT32 ? 1 : 0,
+            .padding = 0
+        };
+    }
+    vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+    const VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool, logicalDevice);
+
+    if (objectsSize > 0) {
+        const VkBufferCopy objectRegion = {.srcOffset = 0, .dstOffset = 0, .size = objectsSize};
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, pass->objectBuffer, 1, &objectRegion);
+    }
+    if (meshesSize > 0) {
+        const VkBufferCopy meshRegion = {.srcOffset = objectsSize, .dstOffset = 0, .size = meshesSize};
+        vkCmdCopyBuffer(commandBuffer, stagingBuffer, pass->meshBuffer, 1, &meshRegion);
+    }
+
+    endSingleTimeCommands(commandBuffer, commandPool, logicalDevice, graphicsQueue);
+
+    vkDestroyBuffer(logicalDevice, stagingBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, stagingBufferMemory);
+
+    pass->objectCount = objectCount;
+    printLn("Uploaded %d culling objects", objectCount);
+}
+
+/**
+ * The world space rect camera shows: clip space [-1, 1] through the inverse of
+ * the camera transform in triangle.vert. A rotated camera sees a rotated
+ * square, its bounding rect is what gets culled against.
+ **/
+void getCameraViewRect(const Camera2D *camera, Vector2D *viewMin, Vector2D *viewMax) {
+    const float halfExtent = (fabsf(cosf(camera->rotation)) + fabsf(sinf(camera->rotation))) / fabsf(camera->zoom);
+    *viewMin = (Vector2D){camera->position.x - halfExtent, camera->position.y - halfExtent};
+    *viewMax = (Vector2D){camera->position.x + halfExtent, camera->position.y + halfExtent};
+}
+
+/**
+ * Records the culling dispatch against what camera shows this frame. Has to be
+ * recorded outside of a render pass, the render graph makes what it writes
+ * visible to the draws.
+ **/
+void recordCullingPass(
+    const VkCommandBuffer commandBuffer,
+    const CullingPass *pass,
+    const Camera2D *camera,
+    const uint32_t frameIndex
+) {
+    if (!pass->enabled || pass->objectCount == 0) return;
+
+    const CullingFrame frame = ((CullingFrame *) pass->frames.items)[frameIndex];
+
+    vkCmdFillBuffer(commandBuffer, frame.countBuffer, 0, CULLING_COUNT_SIZE, 0);
+
+    VkMemoryBarrier clearBarrier = {};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        VK_PIPELINE_STAGE_TRANSFER_BIT,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1, &clearBarrier,
+        0, nullptr,
+        0, nullptr
+    );
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pass->pipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        pass->pipelineLayout,
+        0,
+        1,
+        &frame.descriptorSet,
+        0,
+        nullptr
+    );
+
+    CullPushConstants pushConstants = {
+        .objectCount = pass->objectCount,
+        .objectCapacity = pass->objectCapacity
+    };
+    getCameraViewRect(camera, &pushConstants.viewMin, &pushConstants.viewMax);
+    vkCmdPushConstants(
+        commandBuffer,
+        pass->pipelineLayout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof(CullPushConstants),
+        &pushConstants
+    );
+
+    vkCmdDispatch(commandBuffer, (pass->objectCount + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE, 1, 1);
+}
+
+/**
+ * Pushes whatever survived culling, one indirect draw per index width
+ * reading the culled instances as the instance stream (binding 1).
+ * Which meshes they draw is only known on the GPU so they share mesh 0 in the key.
+ **/
+void pushCulledDraws(
+    DrawList *list,
+    const CullingPass *pass,
+    const MeshBuffer *meshBuffer,
+    const uint32_t frameIndex,
+    const VkPipeline pipeline
+) {
+    if (!pass->enabled || pass->objectCount == 0) return;
+
+    const CullingFrame frame = ((CullingFrame *) pass->frames.items)[frameIndex];
+
+    const VkIndexType indexTypes[] = {VK_INDEX_TYPE_UINT16, VK_INDEX_TYPE_UINT32};
+    for (uint32_t i = 0; i < 2; i++) {
+        const uint32_t state = addDrawState(list, (DrawState){
+            .pipeline = pipeline,
+            .vertexBuffer = meshBuffer->vertexBuffer,
+            .instanceBuffer = frame.instanceBuffer,
+            .indexBuffer = meshBuffer->indexBuffer,
+            .indexType = indexTypes[i],
+            .constants = IDENTITY_DRAW
+        });
+
+        pushDraw(list, DRAW_PASS_WORLD, 0, 0.0f, (DrawCommand){
+            .type = DRAW_INDEXED_INDIRECT_COUNT,
+            .state = state,
+            .indirectBuffer = frame.commandBuffer,
+            .indirectOffset = sizeof(VkDrawIndexedIndirectCommand) * i * pass->objectCapacity,
+            .countBuffer = frame.countBuffer,
+            .countOffset = sizeof(uint32_t) * i,
+            .maxDrawCount = pass->objectCount
+        });
+    }
+}
+
+void destroyCullingPass(const VkDevice logicalDevice, CullingPass *pass) {
+    if (!pass->enabled) return;
+
+    for (uint32_t i = 0; i < pass->frames.count; i++) {
+        const CullingFrame frame = ((CullingFrame *) pass->frames.items)[i];
+        vkDestroyBuffer(logicalDevice, frame.instanceBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, frame.instanceBufferMemory);
+        vkDestroyBuffer(logicalDevice, frame.commandBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, frame.commandBufferMemory);
+        vkDestroyBuffer(logicalDevice, frame.countBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, frame.countBufferMemory);
+    }
+    free(pass->frames.items);
+
+    vkDestroyBuffer(logicalDevice, pass->objectBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, pass->objectBufferMemory);
+    vkDestroyBuffer(logicalDevice, pass->meshBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, pass->meshBufferMemory);
+
+    vkDestroyDescriptorPool(logicalDevice, pass->descriptorPool, hostAllocator);
+    vkDestroyPipeline(logicalDevice, pass->pipeline, hostAllocator);
+    vkDestroyPipelineLayout(logicalDevice, pass->pipelineLayout, hostAllocator);
+    vkDestroyDescriptorSetLayout(logicalDevice, pass->descriptorSetLayout, hostAllocator);
+
+    pass->enabled = false;
+}
+
+#endif //VULKAN_CULLING_H
@@ -0,0 +1,167 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_DEPTH_H
+#define VULKAN_DEPTH_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "vulkan_retire_queue.h"
+
+/**
+ * The depth attachment of one swap chain image, recreated with it.
+ **/
+typedef struct DepthImage {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+} DepthImage;
+
+/**
+ * The first of the formats every implementation supports in some combination,
+ * 32 bit float first since nothing here needs stencil.
+ **/
+VkFormat selectDepthFormat(const VkPhysicalDevice physicalDevice) {
+    const VkFormat candidates[] = {
+        VK_FORMAT_D32_SFLOAT,
+        VK_FORMAT_D32_SFLOAT_S8_UINT,
+        VK_FORMAT_D24_UNORM_S8_UINT
+    };
+
+    for (uint32_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, candidates[i], &properties);
+        if (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT) return candidates[i];
+    }
+
+    printLn("No depth attachment format is supported");
+    exit(FAILED_TO_CREATE_DEPTH_IMAGE);
+}
+
+VkImageAspectFlags getDepthAspect(const VkFormat format) {
+    return format == VK_FORMAT_D32_SFLOAT
+               ? VK_IMAGE_ASPECT_DEPTH_BIT
+               : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+}
+
+void createDepthImage(
+    DepthImage *depthImage,
+    const VkFormat format,
+    const VkExtent2D extent,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = {extent.width, extent.height, 1},
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+
+    if (vkCreateImage(logicalDevice, &imageInfo, hostAllocator, &depthImage->image) != VK_SUCCESS) {
+        printLn("Failed to create %dx%d depth image", extent.width, extent.height);
+        exit(FAILED_TO_CREATE_DEPTH_IMAGE);
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, depthImage->image, &memRequirements);
+
+    const VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = findMemoryType(
+            physicalDevice,
+            memRequirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        )
+    };
+
+    if (allocateDeviceMemory(logicalDevice, &allocInfo, &depthImage->memory) != VK_SUCCESS) {
+        printLn("Failed to allocate depth image memory");
+        exit(FAILED_TO_CREATE_DEPTH_IMAGE);
+    }
+    vkBindImageMemory(logicalDevice, depthImage->image, depthImage->memory, 0);
+
+    const VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = depthImage->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, hostAllocator, &depthImage->view) != VK_SUCCESS) {
+        printLn("Failed to create depth image view");
+        exit(FAILED_TO_CREATE_DEPTH_IMAGE);
+    }
+}
+
+/**
+ * One per swap chain image so a frame never clears depth another frame is still testing against.
+ **/
+void createDepthImages(
+    Uint32SizedMutableArray *depthImages, // DepthImage
+    const uint32_t count,
+    const VkFormat format,
+    const VkExtent2D extent,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    depthImages->count = count;
+    depthImages->size = sizeof(DepthImage) * count;
+    depthImages->items = malloc(depthImages->size);
+
+    for (uint32_t i = 0; i < count; i++)
+        createDepthImage(&((DepthImage *) depthImages->items)[i], format, extent, physicalDevice, logicalDevice);
+
+    printLn("Created %d %dx%d depth images", count, extent.width, extent.height);
+}
+
+/**
+ * Hands the images to the retire queue, for a swap chain recreated while frames still use them.
+ **/
+void retireDepthImages(Uint32SizedMutableArray *depthImages, RetireQueue *retireQueue, const uint64_t lastUse) {
+    for (uint32_t i = 0; i < depthImages->count; i++) {
+        const DepthImage depthImage = ((DepthImage *) depthImages->items)[i];
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE_VIEW, .imageView = depthImage.view}, lastUse);
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE, .image = depthImage.image}, lastUse);
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_MEMORY, .memory = depthImage.memory}, lastUse);
+    }
+
+    free(depthImages->items);
+    *depthImages = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+}
+
+void destroyDepthImages(const VkDevice logicalDevice, Uint32SizedMutableArray *depthImages) {
+    for (uint32_t i = 0; i < depthImages->count; i++) {
+        const DepthImage depthImage = ((DepthImage *) depthImages->items)[i];
+        vkDestroyImageView(logicalDevice, depthImage.view, hostAllocator);
+        vkDestroyImage(logicalDevice, depthImage.image, hostAllocator);
+        freeDeviceMemory(logicalDevice, depthImage.memory);
+    }
+
+    free(depthImages->items);
+    *depthImages = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+}
+
+#endif //VULKAN_DEPTH_H
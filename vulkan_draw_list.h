@@ -0,0 +1,366 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_DRAW_LIST_H
+#define VULKAN_DRAW_LIST_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_uniform_ring.h"
+#include "trace.h"
+
+/**
+ * Passes are the top of the sort key, everything in the world pass is drawn
+ * before anything in the screen space pass.
+ **/
+typedef enum DrawPass {
+    DRAW_PASS_WORLD,
+    DRAW_PASS_SCREEN
+} DrawPass;
+
+typedef enum DrawType {
+    DRAW_INDEXED,
+    DRAW_INDEXED_INDIRECT_COUNT
+} DrawType;
+
+/**
+ * Everything a draw needs bound. Textures are picked per instance from the
+ * bindless table, so this is what a material amounts to here: the streams
+ * and constants the draw reads. Draws with the same state share its id.
+ **/
+typedef struct DrawState {
+    VkPipeline pipeline;
+    VkBuffer vertexBuffer; // Binding 0
+    VkBuffer instanceBuffer; // Binding 1
+    VkBuffer indexBuffer;
+    VkIndexType indexType;
+    DrawPushConstants constants;
+} DrawState;
+
+typedef struct DrawCommand {
+    DrawType type;
+    uint32_t state; // From addDrawState
+    uint32_t indexCount;
+    uint32_t instanceCount;
+    uint32_t firstIndex;
+    int32_t vertexOffset;
+    uint32_t firstInstance;
+    VkBuffer indirectBuffer; // DRAW_INDEXED_INDIRECT_COUNT only
+    VkDeviceSize indirectOffset;
+    VkBuffer countBuffer;
+    VkDeviceSize countOffset;
+    uint32_t maxDrawCount;
+} DrawCommand;
+
+typedef struct DrawSortEntry {
+    uint64_t key;
+    uint32_t command;
+} DrawSortEntry;
+
+/**
+ * Totals since the list was created or the stats were last reset.
+ **/
+typedef struct DrawListStats {
+    uint64_t frames;
+    uint64_t draws;
+    uint64_t pipelineBinds;
+    uint64_t vertexBufferBinds; // Calls, one may cover both bindings
+    uint64_t indexBufferBinds;
+    uint64_t pushConstantUpdates;
+    uint64_t sortNanoseconds;
+    uint64_t recordNanoseconds;
+} DrawListStats;
+
+#define DRAW_LIST_MAX_STATES (1u << 20)
+#define DRAW_LIST_MAX_PIPELINES 16
+
+/**
+ * The frame's draws, gathered from every module and sorted by a 64 bit key
+ *   pass 4 bits | pipeline 4 | material (state) 20 | mesh 16 | depth 20
+ * so the recorder only binds what changes from one draw to the next.
+ * The sort is stable, draws with equal keys keep the order they were pushed in.
+ * states, commands and the sort arrays are growable, their size is the allocated bytes.
+ **/
+typedef struct DrawList {
+    Uint32SizedMutableArray states; // DrawState
+    VkPipeline pipelines[DRAW_LIST_MAX_PIPELINES];
+    uint32_t pipelineCount;
+    Uint32SizedMutableArray commands; // DrawCommand
+    Uint32SizedMutableArray entries; // DrawSortEntry
+    Uint32SizedMutableArray sorted; // DrawSortEntry, scratch of the radix sort
+    DrawListStats stats;
+} DrawList;
+
+void createDrawList(DrawList *list) {
+    list->states = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    list->pipelineCount = 0;
+    list->commands = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    list->entries = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    list->sorted = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    list->stats = (DrawListStats){};
+}
+
+/**
+ * State ids and pipeline ids only hold for the frame, every frame starts over.
+ **/
+void beginDrawList(DrawList *list) {
+    list->states.count = 0;
+    list->pipelineCount = 0;
+    list->commands.count = 0;
+    list->entries.count = 0;
+}
+
+uint32_t getDrawPipelineId(DrawList *list, const VkPipeline pipeline) {
+    for (uint32_t i = 0; i < list->pipelineCount; i++) if (list->pipelines[i] == pipeline) return i;
+
+    if (list->pipelineCount == DRAW_LIST_MAX_PIPELINES) {
+        printLn("Draw list already has %d pipelines", DRAW_LIST_MAX_PIPELINES);
+        exit(DRAW_LIST_CAPACITY_EXCEEDED);
+    }
+    list->pipelines[list->pipelineCount] = pipeline;
+    return list->pipelineCount++;
+}
+
+void reserveDrawList(Uint32SizedMutableArray *array, const size_t itemSize, const uint32_t count) {
+    if (itemSize * count <= array->size) return;
+    array->size = array->size == 0 ? itemSize * 64 : array->size * 2;
+    if (array->size < itemSize * count) array->size = itemSize * count;
+    array->items = realloc(array->items, array->size);
+}
+
+/**
+ * For a state no other draw this frame shares, skips the search for an equal one.
+ **/
+uint32_t addUniqueDrawState(DrawList *list, const DrawState state) {
+    if (list->states.count == DRAW_LIST_MAX_STATES) {
+        printLn("Draw list already has %d states", DRAW_LIST_MAX_STATES);
+        exit(DRAW_LIST_CAPACITY_EXCEEDED);
+    }
+
+    reserveDrawList(&list->states, sizeof(DrawState), list->states.count + 1);
+    ((DrawState *) list->states.items)[list->states.count] = state;
+    return list->states.count++;
+}
+
+/**
+ * Returns the id of the state, the same one for every draw with an equal state.
+ * Shared states are only a handful a frame so a linear search is enough,
+ * as long as draws with states of their own go through addUniqueDrawState.
+ **/
+uint32_t addDrawState(DrawList *list, const DrawState state) {
+    for (uint32_t i = 0; i < list->states.count; i++) {
+        const DrawState *existing = &((DrawState *) list->states.items)[i];
+        if (
+            existing->pipeline == state.pipeline &&
+            existing->vertexBuffer == state.vertexBuffer &&
+            existing->instanceBuffer == state.instanceBuffer &&
+            existing->indexBuffer == state.indexBuffer &&
+            existing->indexType == state.indexType &&
+            memcmp(&existing->constants, &state.constants, sizeof(DrawPushConstants)) == 0
+        ) return i;
+    }
+
+    return addUniqueDrawState(list, state);
+}
+
+/**
+ * 0 nearest, depths outside 0..1 are clamped.
+ **/
+uint64_t quantizeDrawDepth(const float depth) {
+    const float clamped = depth < 0.0f ? 0.0f : depth > 1.0f ? 1.0f : depth;
+    return (uint64_t) (clamped * (float) 0xFFFFF);
+}
+
+uint64_t makeDrawKey(
+    const DrawPass pass,
+    const uint32_t pipeline,
+    const uint32_t material,
+    const uint32_t mesh,
+    const float depth
+) {
+    return (uint64_t) (pass & 0xFu) << 60 |
+           (uint64_t) (pipeline & 0xFu) << 56 |
+           (uint64_t) (material & 0xFFFFFu) << 36 |
+           (uint64_t) (mesh & 0xFFFFu) << 20 |
+           quantizeDrawDepth(depth);
+}
+
+/**
+ * command.state has to come from addDrawState on the same list this frame.
+ **/
+void pushDraw(DrawList *list, const DrawPass pass, const uint32_t mesh, const float depth, const DrawCommand command) {
+    reserveDrawList(&list->commands, sizeof(DrawCommand), list->commands.count + 1);
+    reserveDrawList(&list->entries, sizeof(DrawSortEntry), list->entries.count + 1);
+
+    const uint32_t pipeline = getDrawPipelineId(list, ((DrawState *) list->states.items)[command.state].pipeline);
+    ((DrawCommand *) list->commands.items)[list->commands.count] = command;
+    ((DrawSortEntry *) list->entries.items)[list->entries.count++] = (DrawSortEntry){
+        .key = makeDrawKey(pass, pipeline, command.state, mesh, depth),
+        .command = list->commands.count++
+    };
+}
+
+/**
+ * Stable LSD radix sort of the entries, 8 bits a pass. Digits every key
+ * shares are skipped, so the unused high bits of pass and pipeline cost
+ * nothing beyond the histogram.
+ **/
+void sortDrawList(DrawList *list) {
+    const uint32_t count = list->entries.count;
+    if (count < 2) return;
+
+    reserveDrawList(&list->sorted, sizeof(DrawSortEntry), count);
+    DrawSortEntry *source = (DrawSortEntry *) list->entries.items;
+    DrawSortEntry *target = (DrawSortEntry *) list->sorted.items;
+
+    uint32_t histograms[8][256] = {};
+    for (uint32_t i = 0; i < count; i++) {
+        for (uint32_t digit = 0; digit < 8; digit++) histograms[digit][source[i].key >> digit * 8 & 0xFFu]++;
+    }
+
+    for (uint32_t digit = 0; digit < 8; digit++) {
+        uint32_t *histogram = histograms[digit];
+        const uint32_t shift = digit * 8;
+        if (histogram[source[0].key >> shift & 0xFFu] == count) continue;
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; bucket++) {
+            const uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (uint32_t i = 0; i < count; i++) target[histogram[source[i].key >> shift & 0xFFu]++] = source[i];
+
+        DrawSortEntry *swap = source;
+        source = target;
+        target = swap;
+    }
+
+    // An odd number of passes left the result in the scratch array
+    if (source != (DrawSortEntry *) list->entries.items) {
+        const Uint32SizedMutableArray scratch = list->sorted;
+        list->sorted.items = list->entries.items;
+        list->sorted.size = list->entries.size;
+        list->entries.items = scratch.items;
+        list->entries.size = scratch.size;
+    }
+}
+
+/**
+ * Sorts and records the list into a command buffer inside the render pass.
+ * Only state that differs from the previous draw is bound, the first draw
+ * binds everything. Descriptor sets are the caller's, they're per frame.
+ **/
+void recordDrawList(const VkCommandBuffer commandBuffer, DrawList *list, const VkPipelineLayout pipelineLayout) {
+    TRACE_ZONE("record draw list");
+    DrawListStats *stats = &list->stats;
+
+    const uint64_t sortStart = getTraceClock();
+    sortDrawList(list);
+    const uint64_t recordStart = getTraceClock();
+
+    const DrawSortEntry *entries = (DrawSortEntry *) list->entries.items;
+    const DrawCommand *commands = (DrawCommand *) list->commands.items;
+    const DrawState *bound = nullptr;
+
+    for (uint32_t i = 0; i < list->entries.count; i++) {
+        const DrawCommand *command = &commands[entries[i].command];
+        const DrawState *state = &((DrawState *) list->states.items)[command->state];
+
+        if (state != bound) {
+            if (bound == nullptr || state->pipeline != bound->pipeline) {
+                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, state->pipeline);
+                stats->pipelineBinds++;
+            }
+
+            const bool vertexChanged = bound == nullptr || state->vertexBuffer != bound->vertexBuffer;
+            const bool instanceChanged = bound == nullptr || state->instanceBuffer != bound->instanceBuffer;
+            if (vertexChanged || instanceChanged) {
+                const VkBuffer vertexBuffers[] = {state->vertexBuffer, state->instanceBuffer};
+                constexpr VkDeviceSize offsets[] = {0, 0};
+                // One call for a contiguous range of the bindings that changed
+                const uint32_t first = vertexChanged ? 0 : 1;
+                const uint32_t count = vertexChanged && instanceChanged ? 2 : 1;
+                vkCmdBindVertexBuffers(commandBuffer, first, count, &vertexBuffers[first], &offsets[first]);
+                stats->vertexBufferBinds++;
+            }
+
+            if (bound == nullptr || state->indexBuffer != bound->indexBuffer || state->indexType != bound->indexType) {
+                vkCmdBindIndexBuffer(commandBuffer, state->indexBuffer, 0, state->indexType);
+                stats->indexBufferBinds++;
+            }
+
+            if (bound == nullptr || memcmp(&state->constants, &bound->constants, sizeof(DrawPushConstants)) != 0) {
+                pushDrawConstants(commandBuffer, pipelineLayout, &state->constants);
+                stats->pushConstantUpdates++;
+            }
+
+            bound = state;
+        }
+
+        if (command->type == DRAW_INDEXED_INDIRECT_COUNT) {
+            vkCmdDrawIndexedIndirectCount(
+                commandBuffer,
+                command->indirectBuffer,
+                command->indirectOffset,
+                command->countBuffer,
+                command->countOffset,
+                command->maxDrawCount,
+                sizeof(VkDrawIndexedIndirectCommand)
+            );
+        } else {
+            vkCmdDrawIndexed(
+                commandBuffer,
+                command->indexCount,
+                command->instanceCount,
+                command->firstIndex,
+                command->vertexOffset,
+                command->firstInstance
+            );
+        }
+    }
+
+    const uint64_t recordEnd = getTraceClock();
+    stats->frames++;
+    stats->draws += list->entries.count;
+    stats->sortNanoseconds += recordStart - sortStart;
+    stats->recordNanoseconds += recordEnd - recordStart;
+}
+
+void resetDrawListStats(DrawList *list) {
+    list->stats = (DrawListStats){};
+}
+
+void printDrawListStats(const DrawList *list) {
+    const DrawListStats *stats = &list->stats;
+    if (stats->frames == 0) return;
+
+    const double frames = (double) stats->frames;
+    printLn(
+        "Draw list: %.1f draws/frame, %.1f pipeline binds, %.1f vertex buffer binds, %.1f index buffer binds, "
+        "%.1f push constant updates, %.3f ms sort, %.3f ms record per frame",
+        (double) stats->draws / frames,
+        (double) stats->pipelineBinds / frames,
+        (double) stats->vertexBufferBinds / frames,
+        (double) stats->indexBufferBinds / frames,
+        (double) stats->pushConstantUpdates / frames,
+        (double) stats->sortNanoseconds / 1e6 / frames,
+        (double) stats->recordNanoseconds / 1e6 / frames
+    );
+}
+
+void destroyDrawList(DrawList *list) {
+    free(list->states.items);
+    free(list->commands.items);
+    free(list->entries.items);
+    free(list->sorted.items);
+    createDrawList(list);
+}
+
+#endif //VULKAN_DRAW_LIST_H
@@ -7,28 +7,43 @@
 
 #include <vulkan/vulkan.h>
 #include "vulkan_window.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_depth.h"
+
+/**
+ * Also creates the depth images the framebuffers attach, they share the swap chain's extent.
+ **/
+void createFrameBuffers(const VkPhysicalDevice physicalDevice, const VkDevice logicalDevice, VulkanWindow *vulkanWindow) {
+    createDepthImages(
+        &vulkanWindow->depthImages,
+        vulkanWindow->swapChainImagesViews.count,
+        vulkanWindow->depthFormat,
+        vulkanWindow->extent,
+        physicalDevice,
+        logicalDevice
+    );
 
-void createFrameBuffers(const VkDevice logicalDevice, VulkanWindow *vulkanWindow) {
     vulkanWindow->swapChainFrameBuffers.count = vulkanWindow->swapChainImagesViews.count;
     vulkanWindow->swapChainFrameBuffers.size = sizeof(VkFramebuffer) * vulkanWindow->swapChainFrameBuffers.count;
     vulkanWindow->swapChainFrameBuffers.items = malloc(vulkanWindow->swapChainFrameBuffers.size);
 
     for (int i = 0; i < vulkanWindow->swapChainFrameBuffers.count; i++) {
         const VkImageView attachments[] = {
-            ((VkImageView *) vulkanWindow->swapChainImagesViews.items)[i]
+            ((VkImageView *) vulkanWindow->swapChainImagesViews.items)[i],
+            ((DepthImage *) vulkanWindow->depthImages.items)[i].view
         };
 
         VkFramebufferCreateInfo framebufferInfo = {};
         framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
         framebufferInfo.renderPass = vulkanWindow->renderPass;
-        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.attachmentCount = 2;
         framebufferInfo.pAttachments = attachments;
         framebufferInfo.width = vulkanWindow->extent.width;
         framebufferInfo.height = vulkanWindow->extent.height;
         framebufferInfo.layers = 1;
 
         VkFramebuffer *frameBuffer = &((VkFramebuffer *) vulkanWindow->swapChainFrameBuffers.items)[i];
-        if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, frameBuffer) != VK_SUCCESS) {
+        if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, hostAllocator, frameBuffer) != VK_SUCCESS) {
             printLn("Failed to create framebuffer! %d", i);
             exit(1);
         } else printLn("Successfully created frame buffer %d", i);
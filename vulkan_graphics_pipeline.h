@@ -13,11 +13,20 @@
 #include "glfw_app.h"
 #include "array.h"
 #include "vulkan_io.h"
-#include "vulkan_vertex.h"
-
-void createTriangleShaders(Uint32SizedMutableArray *vertexShader, Uint32SizedMutableArray *fragmentShader) {
-    readFile("/opt/Projects/C/Vulkan/learning/resources/shaders/out/triangle.vert.spv", vertexShader);
-    readFile("/opt/Projects/C/Vulkan/learning/resources/shaders/out/triangle.frag.spv", fragmentShader);
+#include "vulkan_vertex_format.h"
+#include "vulkan_frame_buffers.h"
+#include "shader_library.h"
+#include "vulkan_callbacks.h"
+#include "trace.h"
+#include "pipeline_cache.h"
+
+void createTriangleShaders(
+    const ShaderLibrary *shaders,
+    Uint32SizedMutableArray *vertexShader,
+    Uint32SizedMutableArray *fragmentShader
+) {
+    *vertexShader = getShaderCode(shaders, SHADER_TRIANGLE_VERTEX);
+    *fragmentShader = getShaderCode(shaders, SHADER_TRIANGLE_FRAGMENT);
 }
 
 void createShaderModule(
@@ -31,7 +40,7 @@ void createShaderModule(
         .pCode = (const uint32_t *) shader.items
     };
 
-    if (vkCreateShaderModule(logicalDevice, &createInfo, nullptr, shaderModule) != VK_SUCCESS) {
+    if (vkCreateShaderModule(logicalDevice, &createInfo, hostAllocator, shaderModule) != VK_SUCCESS) {
         printLn("failed to create shader module!");
         exit(1);
     }
@@ -54,37 +63,32 @@ void populateVkAttachmentReference(VkAttachmentReference *colorAttachmentRef) {
     colorAttachmentRef->layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 }
 
-void populateVkSubpassDescription(VkSubpassDescription *subPassDescription, VkAttachmentReference *colorAttachmentRef) {
+void populateVkSubpassDescription(
+    VkSubpassDescription *subPassDescription,
+    VkAttachmentReference *colorAttachmentRef,
+    VkAttachmentReference *depthAttachmentRef
+) {
     subPassDescription->pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
     subPassDescription->colorAttachmentCount = 1;
     // This count comes from the shader directly. You might want to check on this when drawing many triangles
     subPassDescription->pColorAttachments = colorAttachmentRef;
+    subPassDescription->pDepthStencilAttachment = depthAttachmentRef;
 }
 
 void populateVkRenderPassCreateInfo(
     VkRenderPassCreateInfo *renderPassInfo,
-    const VkAttachmentDescription *colorAttachment,
+    const VkAttachmentDescription *attachments, // Color then depth
     const VkSubpassDescription *subPassDescription
 ) {
     renderPassInfo->sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassInfo->attachmentCount = 1;
-    renderPassInfo->pAttachments = colorAttachment;
+    renderPassInfo->attachmentCount = 2;
+    renderPassInfo->pAttachments = attachments;
     renderPassInfo->subpassCount = 1;
     renderPassInfo->pSubpasses = subPassDescription;
 
-
-    VkSubpassDependency dependency = {};
-    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-    dependency.dstSubpass = 0;
-
-    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.srcAccessMask = 0;
-
-    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
-    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
-
-    renderPassInfo->dependencyCount = 1;
-    renderPassInfo->pDependencies = &dependency;
+    // The render graph's barriers order the pass against everything around it
+    renderPassInfo->dependencyCount = 0;
+    renderPassInfo->pDependencies = nullptr;
 }
 
 void populateVkAttachmentDescription(VkAttachmentDescription *colorAttachment, const VulkanWindow *window) {
@@ -94,24 +98,45 @@ void populateVkAttachmentDescription(VkAttachmentDescription *colorAttachment, c
     colorAttachment->storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     colorAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     colorAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment->finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // The render graph transitions the image in and out of the pass
+    colorAttachment->initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment->finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+}
+
+/**
+ * Cleared every frame and never read after the pass, so it's never stored.
+ **/
+void populateDepthAttachmentDescription(VkAttachmentDescription *depthAttachment, const VulkanWindow *window) {
+    depthAttachment->format = window->depthFormat;
+    depthAttachment->samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment->loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment->storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment->stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment->stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment->initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment->finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 }
 
 void createRenderPass(VulkanWindow *window, const VkDevice logicalDevice, VkRenderPass *renderPass) {
-    VkAttachmentDescription colorAttachment = {};
-    populateVkAttachmentDescription(&colorAttachment, window);
+    VkAttachmentDescription attachments[2] = {};
+    populateVkAttachmentDescription(&attachments[0], window);
+    populateDepthAttachmentDescription(&attachments[1], window);
 
     VkAttachmentReference colorAttachmentRef = {};
     populateVkAttachmentReference(&colorAttachmentRef);
 
+    VkAttachmentReference depthAttachmentRef = {
+        .attachment = 1,
+        .layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL
+    };
+
     VkSubpassDescription subPassDescription = {};
-    populateVkSubpassDescription(&subPassDescription, &colorAttachmentRef);
+    populateVkSubpassDescription(&subPassDescription, &colorAttachmentRef, &depthAttachmentRef);
 
     VkRenderPassCreateInfo renderPassInfo = {};
-    populateVkRenderPassCreateInfo(&renderPassInfo, &colorAttachment, &subPassDescription);
+    populateVkRenderPassCreateInfo(&renderPassInfo, attachments, &subPassDescription);
 
-    if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, renderPass) != VK_SUCCESS) {
+    if (vkCreateRenderPass(logicalDevice, &renderPassInfo, hostAllocator, renderPass) != VK_SUCCESS) {
         printLn("Failed to create render pass!");
         exit(FAILED_TO_CREATE_RENDER_PASS);
     } else printLn("Created a render pass");
@@ -119,16 +144,16 @@ void createRenderPass(VulkanWindow *window, const VkDevice logicalDevice, VkRend
 
 void createVulkanGraphicsPipeline(
     const VkDevice logicalDevice,
-    VulkanWindow *vulkanWindow
+    VulkanWindow *vulkanWindow,
+    const ShaderLibrary *shaders
 ) {
     Uint32SizedMutableArray vertexShader = {};
     Uint32SizedMutableArray fragmentShader = {};
     VkShaderModule vertShaderModule = {};
     VkShaderModule fragShaderModule = {};
 
-    createTriangleShaders(&vertexShader, &fragmentShader);
+    createTriangleShaders(shaders, &vertexShader, &fragmentShader);
 
-    // TODO Memory might be getting lost here and I can't predict it.
     createShaderModule(logicalDevice, &vertShaderModule, vertexShader);
     createShaderModule(logicalDevice, &fragShaderModule, fragmentShader);
 
@@ -156,21 +181,21 @@ void createVulkanGraphicsPipeline(
     dynamicState.dynamicStateCount = 2;
     dynamicState.pDynamicStates = dynamicStates;
 
-    VkVertexInputBindingDescription bindingDescription = {};
-    getBindingDescription(&bindingDescription);
+    VkVertexInputBindingDescription bindingDescriptions[VERTEX_BINDING_COUNT] = {};
+    getBindingDescription(bindingDescriptions);
 
     Uint32SizedMutableArray attributeDescriptions = {
-        .count = 2,
-        .size = sizeof(VkVertexInputAttributeDescription) * 2,
-        .items = malloc(sizeof(VkVertexInputAttributeDescription) * 2),
+        .count = VERTEX_ATTRIBUTE_COUNT,
+        .size = sizeof(VkVertexInputAttributeDescription) * VERTEX_ATTRIBUTE_COUNT,
+        .items = malloc(sizeof(VkVertexInputAttributeDescription) * VERTEX_ATTRIBUTE_COUNT),
     };
 
     getAttributeDescriptions((VkVertexInputAttributeDescription *)attributeDescriptions.items);
 
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription; // Optional
+    vertexInputInfo.vertexBindingDescriptionCount = VERTEX_BINDING_COUNT;
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions; // Optional
     vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.count; //
     vertexInputInfo.pVertexAttributeDescriptions = (VkVertexInputAttributeDescription *)attributeDescriptions.items; // Optional
 
@@ -239,6 +264,15 @@ void createVulkanGraphicsPipeline(
     colorBlending.blendConstants[2] = 0.0f; // Optional
     colorBlending.blendConstants[3] = 0.0f; // Optional
 
+    // Less or equal keeps the draw order deciding between instances at the same depth
+    VkPipelineDepthStencilStateCreateInfo depthStencil = {};
+    depthStencil.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO;
+    depthStencil.depthTestEnable = VK_TRUE;
+    depthStencil.depthWriteEnable = VK_TRUE;
+    depthStencil.depthCompareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    depthStencil.depthBoundsTestEnable = VK_FALSE;
+    depthStencil.stencilTestEnable = VK_FALSE;
+
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
     pipelineInfo.stageCount = 2;
@@ -249,7 +283,7 @@ void createVulkanGraphicsPipeline(
     pipelineInfo.pViewportState = &viewportState;
     pipelineInfo.pRasterizationState = &rasterizer;
     pipelineInfo.pMultisampleState = &multisampling;
-    pipelineInfo.pDepthStencilState = nullptr; // Optional
+    pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = vulkanWindow->pipelineLayout;
@@ -258,37 +292,54 @@ void createVulkanGraphicsPipeline(
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
     pipelineInfo.basePipelineIndex = -1; // Optional
 
-    if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr,
+    if (vkCreateGraphicsPipelines(logicalDevice, pipelineCache, 1, &pipelineInfo, hostAllocator,
                                   &(vulkanWindow->graphicsPipeline)) != VK_SUCCESS) {
         printLn("Failed to create graphics pipeline!");
         exit(1);
     } else printLn("Created the graphis pipeline sucessfully");
 
     // not sure when to clean this part up
-    vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
-    vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
+    vkDestroyShaderModule(logicalDevice, fragShaderModule, hostAllocator);
+    vkDestroyShaderModule(logicalDevice, vertShaderModule, hostAllocator);
 }
 
 void initVulkanGraphicsPipeline(
+    const VkPhysicalDevice physicalDevice,
     const VkDevice logicalDevice,
-    VulkanWindow *vulkanWindow
+    VulkanWindow *vulkanWindow,
+    const ShaderLibrary *shaders
 ) {
+    TRACE_ZONE("graphics pipeline");
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = 0; // Optional
-    pipelineLayoutInfo.pSetLayouts = nullptr; // Optional
-    pipelineLayoutInfo.pushConstantRangeCount = 0; // Optional
-    pipelineLayoutInfo.pPushConstantRanges = nullptr; // Optional
+    // Set 0 is the bindless table triangle.frag samples textures from,
+    // set 1 the uniform ring holding the frame's camera
+    const VkDescriptorSetLayout setLayouts[] = {
+        vulkanWindow->bindless.descriptorSetLayout,
+        vulkanWindow->uniformRing.descriptorSetLayout
+    };
+    const VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof(DrawPushConstants)
+    };
+    pipelineLayoutInfo.setLayoutCount = 2;
+    pipelineLayoutInfo.pSetLayouts = setLayouts;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
 
-    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &(vulkanWindow->pipelineLayout)) !=
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, hostAllocator, &(vulkanWindow->pipelineLayout)) !=
         VK_SUCCESS) {
         printLn("Failed to create Vulkan Pipeline Layout");
         exit(1);
     }
 
+    vulkanWindow->depthFormat = selectDepthFormat(physicalDevice);
     createRenderPass(vulkanWindow, logicalDevice, &(vulkanWindow->renderPass));
+    // prepareSwapChain skipped them while there was no render pass
+    createFrameBuffers(physicalDevice, logicalDevice, vulkanWindow);
 
-    createVulkanGraphicsPipeline(logicalDevice, vulkanWindow);
+    createVulkanGraphicsPipeline(logicalDevice, vulkanWindow, shaders);
 
     printLn("Crated Vulkan Pipeline Layout fine");
 }
@@ -0,0 +1,319 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_INSTANCES_H
+#define VULKAN_INSTANCES_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "vulkan_draw_list.h"
+
+typedef struct MeshInstance {
+    uint32_t meshIndex;
+    InstanceData data;
+} MeshInstance;
+
+/**
+ * One instanced draw. The instances of a mesh are written next to each other
+ * in the frame's instance buffer starting at firstInstance.
+ **/
+typedef struct MeshDraw {
+    uint32_t meshIndex;
+    uint32_t instanceCount;
+    uint32_t firstInstance;
+    float depth; // Of the mesh's nearest instance, for the draw list's sort key
+} MeshDraw;
+
+typedef struct InstanceBuffer {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    InstanceData *mapped; // Stays mapped for the lifetime of the buffer
+} InstanceBuffer;
+
+/**
+ * Instances pushed by the application for the next frame and the
+ * per frame in flight buffers they get written to.
+ * The pending array's size is its allocated bytes not count * item size.
+ **/
+typedef struct MeshInstances {
+    Uint32SizedMutableArray pending; // MeshInstance
+    Uint32SizedMutableArray sorted; // MeshInstance, scratch of the depth sort, same size as pending
+    Uint32SizedMutableArray draws; // MeshDraw
+    Uint32SizedMutableArray meshCounts; // uint32_t
+    Uint32SizedMutableArray meshDepths; // float, nearest instance of each mesh
+    Uint32SizedMutableArray buffers; // InstanceBuffer
+    uint32_t capacity;
+    bool sortByDepth; // Front to back within each draw, LEARNING_DEPTH_SORT=0 keeps push order
+} MeshInstances;
+
+void createMeshInstances(
+    MeshInstances *instances,
+    const uint32_t capacity,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    VkMemoryRequirements memRequirements;
+
+    instances->capacity = capacity;
+    instances->pending = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+    instances->sorted = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+    instances->draws = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+    instances->meshCounts = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+    instances->meshDepths = (Uint32SizedMutableArray){.count = 0, .size = 0, .items = nullptr};
+
+    instances->buffers.count = MAX_FRAMES_IN_FLIGHT;
+    instances->buffers.size = sizeof(InstanceBuffer) * MAX_FRAMES_IN_FLIGHT;
+    instances->buffers.items = malloc(instances->buffers.size);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        InstanceBuffer *instanceBuffer = &((InstanceBuffer *) instances->buffers.items)[i];
+
+        createBuffer(
+            &instanceBuffer->buffer,
+            sizeof(InstanceData) * capacity,
+            &instanceBuffer->memory,
+            &memRequirements,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+            physicalDevice,
+            logicalDevice
+        );
+
+        vkMapMemory(
+            logicalDevice,
+            instanceBuffer->memory,
+            0,
+            sizeof(InstanceData) * capacity,
+            0,
+            (Any *) &instanceBuffer->mapped
+        );
+    }
+
+    const char *depthSort = getenv("LEARNING_DEPTH_SORT");
+    instances->sortByDepth = depthSort == nullptr || strcmp(depthSort, "0") != 0;
+
+    printLn(
+        "Created %d instance buffers for %d instances, %s",
+        MAX_FRAMES_IN_FLIGHT,
+        capacity,
+        instances->sortByDepth ? "sorted front to back" : "in push order"
+    );
+}
+
+void pushMeshInstance(MeshInstances *instances, const uint32_t meshIndex, const InstanceData data) {
+    if (sizeof(MeshInstance) * (instances->pending.count + 1) > instances->pending.size) {
+        instances->pending.size = instances->pending.size == 0
+                                      ? sizeof(MeshInstance) * 64
+                                      : instances->pending.size * 2;
+        instances->pending.items = realloc(instances->pending.items, instances->pending.size);
+    }
+
+    ((MeshInstance *) instances->pending.items)[instances->pending.count] = (MeshInstance){
+        .meshIndex = meshIndex,
+        .data = data
+    };
+    instances->pending.count++;
+}
+
+/**
+ * Maps a float to an unsigned key with the same order, negatives included.
+ **/
+uint32_t getDepthSortKey(const float depth) {
+    uint32_t bits;
+    memcpy(&bits, &depth, sizeof(bits));
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+/**
+ * Stable LSD radix sort of the pending instances by depth, 8 bits a pass.
+ * Stable so instances at the same depth keep their push order, which the
+ * less or equal depth test resolves overlaps with. Passes where every key
+ * has the same digit are skipped, a scene at one depth costs one histogram.
+ **/
+void sortMeshInstancesByDepth(MeshInstances *instances, const uint32_t count) {
+    if (count < 2) return;
+
+    if (instances->sorted.size < instances->pending.size) {
+        instances->sorted.size = instances->pending.size;
+        instances->sorted.items = realloc(instances->sorted.items, instances->sorted.size);
+    }
+
+    MeshInstance *source = (MeshInstance *) instances->pending.items;
+    MeshInstance *target = (MeshInstance *) instances->sorted.items;
+
+    uint32_t histograms[4][256] = {};
+    for (uint32_t i = 0; i < count; i++) {
+        const uint32_t key = getDepthSortKey(source[i].data.depth);
+        for (uint32_t digit = 0; digit < 4; digit++) histograms[digit][key >> digit * 8 & 0xFFu]++;
+    }
+
+    for (uint32_t digit = 0; digit < 4; digit++) {
+        uint32_t *histogram = histograms[digit];
+        const uint32_t shift = digit * 8;
+        if (histogram[getDepthSortKey(source[0].data.depth) >> shift & 0xFFu] == count) continue;
+
+        uint32_t offset = 0;
+        for (uint32_t bucket = 0; bucket < 256; bucket++) {
+            const uint32_t bucketCount = histogram[bucket];
+            histogram[bucket] = offset;
+            offset += bucketCount;
+        }
+
+        for (uint32_t i = 0; i < count; i++)
+            target[histogram[getDepthSortKey(source[i].data.depth) >> shift & 0xFFu]++] = source[i];
+
+        MeshInstance *swap = source;
+        source = target;
+        target = swap;
+    }
+
+    // An odd number of passes left the result in the scratch array
+    if (source != (MeshInstance *) instances->pending.items) {
+        const Uint32SizedMutableArray scratch = instances->sorted;
+        instances->sorted.items = instances->pending.items;
+        instances->sorted.size = instances->pending.size;
+        instances->pending.items = scratch.items;
+        instances->pending.size = scratch.size;
+    }
+}
+
+void resizeMeshInstanceCounts(MeshInstances *instances, const uint32_t meshCount) {
+    if (instances->meshCounts.count >= meshCount) return;
+
+    instances->meshCounts.count = meshCount;
+    instances->meshCounts.size = sizeof(uint32_t) * meshCount;
+    instances->meshCounts.items = realloc(instances->meshCounts.items, instances->meshCounts.size);
+
+    instances->meshDepths.count = meshCount;
+    instances->meshDepths.size = sizeof(float) * meshCount;
+    instances->meshDepths.items = realloc(instances->meshDepths.items, instances->meshDepths.size);
+
+    instances->draws.count = 0;
+    instances->draws.size = sizeof(MeshDraw) * meshCount;
+    instances->draws.items = realloc(instances->draws.items, instances->draws.size);
+}
+
+/**
+ * Sorts the pending instances by mesh straight into the frame's mapped
+ * instance buffer (a counting sort, so two passes over the instances)
+ * and builds one MeshDraw per mesh that has instances.
+ * With sortByDepth they're sorted front to back first and the counting sort
+ * keeps that order within each draw, so early depth testing rejects what's
+ * hidden before it's shaded.
+ * Must only be called once the frame's fence has been waited on.
+ **/
+void prepareMeshInstances(MeshInstances *instances, const uint32_t frame, const uint32_t meshCount) {
+    resizeMeshInstanceCounts(instances, meshCount);
+
+    uint32_t *meshCounts = (uint32_t *) instances->meshCounts.items;
+    float *meshDepths = (float *) instances->meshDepths.items;
+    const MeshInstance *pending = (MeshInstance *) instances->pending.items;
+    MeshDraw *draws = (MeshDraw *) instances->draws.items;
+    InstanceData *mapped = ((InstanceBuffer *) instances->buffers.items)[frame].mapped;
+
+    uint32_t instanceCount = instances->pending.count;
+    if (instanceCount > instances->capacity) {
+        printLn("Dropping %d instances above the capacity of %d", instanceCount - instances->capacity, instances->capacity);
+        instanceCount = instances->capacity;
+    }
+
+    if (instances->sortByDepth) {
+        sortMeshInstancesByDepth(instances, instanceCount);
+        pending = (MeshInstance *) instances->pending.items;
+    }
+
+    memset(meshCounts, 0, sizeof(uint32_t) * meshCount);
+    for (uint32_t mesh = 0; mesh < meshCount; mesh++) meshDepths[mesh] = 1.0f;
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        const uint32_t mesh = pending[i].meshIndex;
+        if (mesh >= meshCount) continue;
+        meshCounts[mesh]++;
+        if (pending[i].data.depth < meshDepths[mesh]) meshDepths[mesh] = pending[i].data.depth;
+    }
+
+    instances->draws.count = 0;
+    uint32_t firstInstance = 0;
+    for (uint32_t mesh = 0; mesh < meshCount; mesh++) {
+        if (meshCounts[mesh] == 0) continue;
+
+        draws[instances->draws.count++] = (MeshDraw){
+            .meshIndex = mesh,
+            .instanceCount = meshCounts[mesh],
+            .firstInstance = firstInstance,
+            .depth = meshDepths[mesh]
+        };
+
+        const uint32_t count = meshCounts[mesh];
+        meshCounts[mesh] = firstInstance; // Reused as the write cursor for this mesh
+        firstInstance += count;
+    }
+
+    for (uint32_t i = 0; i < instanceCount; i++) {
+        if (pending[i].meshIndex >= meshCount) continue;
+        mapped[meshCounts[pending[i].meshIndex]++] = pending[i].data;
+    }
+
+    instances->pending.count = 0;
+}
+
+/**
+ * One draw per MeshDraw into the draw list. Every mesh shares the vertex
+ * and instance buffers so the only state that differs is the index width.
+ **/
+void pushMeshInstanceDraws(
+    DrawList *list,
+    const MeshInstances *instances,
+    const MeshBuffer *meshBuffer,
+    const uint32_t frame,
+    const VkPipeline pipeline
+) {
+    for (uint32_t i = 0; i < instances->draws.count; i++) {
+        const MeshDraw draw = ((MeshDraw *) instances->draws.items)[i];
+        const MeshRange range = getMeshRange(meshBuffer, draw.meshIndex);
+        const uint32_t state = addDrawState(list, (DrawState){
+            .pipeline = pipeline,
+            .vertexBuffer = meshBuffer->vertexBuffer,
+            .instanceBuffer = ((InstanceBuffer *) instances->buffers.items)[frame].buffer,
+            .indexBuffer = meshBuffer->indexBuffer,
+            .indexType = range.indexType,
+            .constants = IDENTITY_DRAW
+        });
+
+        pushDraw(list, DRAW_PASS_WORLD, draw.meshIndex, draw.depth, (DrawCommand){
+            .type = DRAW_INDEXED,
+            .state = state,
+            .indexCount = range.indexCount,
+            .instanceCount = draw.instanceCount,
+            .firstIndex = range.firstIndex,
+            .vertexOffset = range.vertexOffset,
+            .firstInstance = draw.firstInstance
+        });
+    }
+}
+
+void destroyMeshInstances(const VkDevice logicalDevice, MeshInstances *instances) {
+    for (uint32_t i = 0; i < instances->buffers.count; i++) {
+        const InstanceBuffer instanceBuffer = ((InstanceBuffer *) instances->buffers.items)[i];
+        vkUnmapMemory(logicalDevice, instanceBuffer.memory);
+        vkDestroyBuffer(logicalDevice, instanceBuffer.buffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, instanceBuffer.memory);
+    }
+
+    free(instances->buffers.items);
+    free(instances->pending.items);
+    free(instances->sorted.items);
+    free(instances->draws.items);
+    free(instances->meshDepths.items);
+    free(instances->meshCounts.items);
+}
+
+#endif //VULKAN_INSTANCES_H
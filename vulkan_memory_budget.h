@@ -0,0 +1,251 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_MEMORY_BUDGET_H
+#define VULKAN_MEMORY_BUDGET_H
+
+#include <vulkan/vulkan.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include "array.h"
+#include "io.h"
+#include "vulkan_any.h"
+#include "vulkan_callbacks.h"
+
+/**
+ * Device memory usage against budget, per heap.
+ * With VK_EXT_memory_budget the driver reports usage and budget for the whole
+ * process, everything else counts what went through allocateDeviceMemory and
+ * uses MEMORY_BUDGET_FALLBACK_FRACTION of the heap as the budget.
+ * updateMemoryBudget runs once a frame and tells the listeners when a heap
+ * crosses their threshold, in either direction, so streaming can evict
+ * before the driver starts paging.
+ * One budget per process, device memory is allocated from modules that only
+ * see the logical device.
+ **/
+#define MEMORY_BUDGET_MAX_LISTENERS 8
+
+constexpr double MEMORY_BUDGET_FALLBACK_FRACTION = 0.8;
+constexpr double MEMORY_BUDGET_HYSTERESIS = 0.05; // Below threshold by this much before a heap is back under
+
+typedef struct MemoryHeapBudget {
+    VkDeviceSize size;
+    VkDeviceSize budget; // What the process can use before the driver pages
+    VkDeviceSize usage; // The whole process according to the driver, tracked without the extension
+    VkDeviceSize tracked; // Live allocations made through allocateDeviceMemory
+    VkDeviceSize peakTracked;
+    VkMemoryHeapFlags flags;
+} MemoryHeapBudget;
+
+/**
+ * over is true when heap went above threshold, false when it came back under.
+ **/
+typedef void (*MemoryBudgetCallback)(uint32_t heap, const MemoryHeapBudget *budget, bool over, Any userData);
+
+typedef struct MemoryBudgetListener {
+    double threshold; // Fraction of the budget
+    MemoryBudgetCallback callback;
+    Any userData;
+    bool over[VK_MAX_MEMORY_HEAPS];
+} MemoryBudgetListener;
+
+typedef struct TrackedDeviceMemory {
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    uint32_t heap;
+} TrackedDeviceMemory;
+
+typedef struct MemoryBudget {
+    VkPhysicalDevice physicalDevice;
+    bool extension; // VK_EXT_memory_budget is enabled on the device
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    MemoryHeapBudget heaps[VK_MAX_MEMORY_HEAPS];
+    Uint32SizedMutableArray allocations; // TrackedDeviceMemory, size is the allocated bytes
+    pthread_mutex_t lock; // Startup allocates from the pipeline worker too
+    MemoryBudgetListener listeners[MEMORY_BUDGET_MAX_LISTENERS];
+    uint32_t listenerCount;
+} MemoryBudget;
+
+MemoryBudget memoryBudget;
+
+void createMemoryBudget(MemoryBudget *budget, const VkPhysicalDevice physicalDevice, const bool extension) {
+    *budget = (MemoryBudget){
+        .physicalDevice = physicalDevice,
+        .extension = extension,
+        .allocations = {.items = nullptr, .size = 0, .count = 0},
+        .listenerCount = 0
+    };
+    pthread_mutex_init(&budget->lock, nullptr);
+
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &budget->memoryProperties);
+    for (uint32_t i = 0; i < budget->memoryProperties.memoryHeapCount; i++) {
+        const VkMemoryHeap heap = budget->memoryProperties.memoryHeaps[i];
+        budget->heaps[i] = (MemoryHeapBudget){
+            .size = heap.size,
+            .budget = (VkDeviceSize) ((double) heap.size * MEMORY_BUDGET_FALLBACK_FRACTION),
+            .flags = heap.flags
+        };
+    }
+
+    printLn(
+        "Tracking device memory of %d heaps %s",
+        budget->memoryProperties.memoryHeapCount,
+        extension ? "with VK_EXT_memory_budget" : "from our own allocations"
+    );
+}
+
+void addMemoryBudgetListener(
+    MemoryBudget *budget,
+    const double threshold,
+    const MemoryBudgetCallback callback,
+    Any userData
+) {
+    if (budget->listenerCount == MEMORY_BUDGET_MAX_LISTENERS) {
+        printLn("Memory budget already has %d listeners", MEMORY_BUDGET_MAX_LISTENERS);
+        return;
+    }
+
+    budget->listeners[budget->listenerCount++] = (MemoryBudgetListener){
+        .threshold = threshold,
+        .callback = callback,
+        .userData = userData
+    };
+}
+
+/**
+ * vkAllocateMemory that counts the allocation against its heap.
+ **/
+VkResult allocateDeviceMemory(
+    const VkDevice logicalDevice,
+    const VkMemoryAllocateInfo *allocateInfo,
+    VkDeviceMemory *memory
+) {
+    const VkResult result = vkAllocateMemory(logicalDevice, allocateInfo, hostAllocator, memory);
+    if (result != VK_SUCCESS) return result;
+
+    MemoryBudget *budget = &memoryBudget;
+    const uint32_t heap = budget->memoryProperties.memoryTypes[allocateInfo->memoryTypeIndex].heapIndex;
+
+    pthread_mutex_lock(&budget->lock);
+    if (sizeof(TrackedDeviceMemory) * (budget->allocations.count + 1) > budget->allocations.size) {
+        budget->allocations.size = budget->allocations.size == 0
+                                       ? sizeof(TrackedDeviceMemory) * 64
+                                       : budget->allocations.size * 2;
+        budget->allocations.items = realloc(budget->allocations.items, budget->allocations.size);
+    }
+    ((TrackedDeviceMemory *) budget->allocations.items)[budget->allocations.count++] = (TrackedDeviceMemory){
+        .memory = *memory,
+        .size = allocateInfo->allocationSize,
+        .heap = heap
+    };
+
+    MemoryHeapBudget *heapBudget = &budget->heaps[heap];
+    heapBudget->tracked += allocateInfo->allocationSize;
+    if (heapBudget->tracked > heapBudget->peakTracked) heapBudget->peakTracked = heapBudget->tracked;
+    pthread_mutex_unlock(&budget->lock);
+
+    return result;
+}
+
+void freeDeviceMemory(const VkDevice logicalDevice, const VkDeviceMemory memory) {
+    if (memory == VK_NULL_HANDLE) return;
+    vkFreeMemory(logicalDevice, memory, hostAllocator);
+
+    MemoryBudget *budget = &memoryBudget;
+    pthread_mutex_lock(&budget->lock);
+    TrackedDeviceMemory *allocations = (TrackedDeviceMemory *) budget->allocations.items;
+    for (uint32_t i = 0; i < budget->allocations.count; i++) {
+        if (allocations[i].memory != memory) continue;
+
+        budget->heaps[allocations[i].heap].tracked -= allocations[i].size;
+        allocations[i] = allocations[--budget->allocations.count];
+        break;
+    }
+    pthread_mutex_unlock(&budget->lock);
+}
+
+/**
+ * Refreshes usage and budget and calls the listeners of every heap that
+ * crossed a threshold since the last update.
+ **/
+void updateMemoryBudget(MemoryBudget *budget) {
+    const uint32_t heapCount = budget->memoryProperties.memoryHeapCount;
+
+    if (budget->extension) {
+        VkPhysicalDeviceMemoryBudgetPropertiesEXT budgetProperties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_BUDGET_PROPERTIES_EXT
+        };
+        VkPhysicalDeviceMemoryProperties2 properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PROPERTIES_2,
+            .pNext = &budgetProperties
+        };
+        vkGetPhysicalDeviceMemoryProperties2(budget->physicalDevice, &properties);
+
+        for (uint32_t i = 0; i < heapCount; i++) {
+            budget->heaps[i].budget = budgetProperties.heapBudget[i];
+            budget->heaps[i].usage = budgetProperties.heapUsage[i];
+        }
+    } else {
+        pthread_mutex_lock(&budget->lock);
+        for (uint32_t i = 0; i < heapCount; i++) budget->heaps[i].usage = budget->heaps[i].tracked;
+        pthread_mutex_unlock(&budget->lock);
+    }
+
+    for (uint32_t i = 0; i < heapCount; i++) {
+        const MemoryHeapBudget *heap = &budget->heaps[i];
+        if (heap->budget == 0) continue;
+        const double used = (double) heap->usage / (double) heap->budget;
+
+        for (uint32_t j = 0; j < budget->listenerCount; j++) {
+            MemoryBudgetListener *listener = &budget->listeners[j];
+            if (!listener->over[i] && used >= listener->threshold) {
+                listener->over[i] = true;
+                listener->callback(i, heap, true, listener->userData);
+            } else if (listener->over[i] && used < listener->threshold - MEMORY_BUDGET_HYSTERESIS) {
+                listener->over[i] = false;
+                listener->callback(i, heap, false, listener->userData);
+            }
+        }
+    }
+}
+
+void printMemoryBudget(const MemoryBudget *budget) {
+    printLn("Device memory by heap (MB, usage / budget, ours, our peak):");
+    for (uint32_t i = 0; i < budget->memoryProperties.memoryHeapCount; i++) {
+        const MemoryHeapBudget *heap = &budget->heaps[i];
+        printLn(
+            "  heap %d%s %10.1f / %10.1f %10.1f %10.1f",
+            i,
+            heap->flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ? " (device local)" : "",
+            (double) heap->usage / 1e6,
+            (double) heap->budget / 1e6,
+            (double) heap->tracked / 1e6,
+            (double) heap->peakTracked / 1e6
+        );
+    }
+}
+
+void logMemoryBudgetCrossing(const uint32_t heap, const MemoryHeapBudget *budget, const bool over, Any userData) {
+    printLn(
+        "Heap %d is %s its budget: %.1f of %.1f MB",
+        heap,
+        over ? "close to" : "back under",
+        (double) budget->usage / 1e6,
+        (double) budget->budget / 1e6
+    );
+}
+
+/**
+ * Anything still tracked here was never freed.
+ **/
+void destroyMemoryBudget(MemoryBudget *budget) {
+    if (budget->allocations.count > 0)
+        printLn("%d device memory allocations were never freed", budget->allocations.count);
+
+    free(budget->allocations.items);
+    budget->allocations = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+    pthread_mutex_destroy(&budget->lock);
+}
+
+#endif //VULKAN_MEMORY_BUDGET_H
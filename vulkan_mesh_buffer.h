@@ -0,0 +1,280 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_MESH_BUFFER_H
+#define VULKAN_MESH_BUFFER_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "build_profile.h"
+#include "vulkan_vertex.h"
+#include "vulkan_vertex_format.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "trace.h"
+
+/**
+ * Where a single mesh lives inside the shared mesh buffer.
+ * firstIndex and vertexOffset are passed straight to vkCmdDrawIndexed
+ * so the mesh indices stay relative to the mesh's own first vertex.
+ * firstIndex counts in indexType sized elements since the index buffer
+ * is always bound at offset 0.
+ * center and radius are a bounding circle of the mesh positions.
+ **/
+typedef struct MeshRange {
+    VkIndexType indexType;
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    int32_t vertexOffset;
+    uint32_t vertexCount;
+    Vector2D center;
+    float radius;
+} MeshRange;
+
+/**
+ * One device local vertex buffer and one device local index buffer
+ * shared by every mesh of a window. Meshes are appended and handed
+ * a MeshRange so the render pass can bind once and draw many meshes.
+ * Vertices are stored as PackedVertex and each mesh gets 16 or 32 bit
+ * indices depending on its vertex count, so the index buffer is filled
+ * by bytes and indexCapacity is in 32 bit indices.
+ **/
+typedef struct MeshBuffer {
+    VkBuffer vertexBuffer;
+    VkDeviceMemory vertexBufferMemory;
+    VkBuffer indexBuffer;
+    VkDeviceMemory indexBufferMemory;
+    uint32_t vertexCapacity;
+    uint32_t indexCapacity;
+    uint32_t vertexCount;
+    uint32_t indexBytes;
+    Uint32SizedMutableArray meshes; // MeshRange
+} MeshBuffer;
+
+void createMeshBuffer(
+    MeshBuffer *meshBuffer,
+    const uint32_t vertexCapacity,
+    const uint32_t indexCapacity,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    VkMemoryRequirements memRequirements;
+
+    meshBuffer->vertexCapacity = vertexCapacity;
+    meshBuffer->indexCapacity = indexCapacity;
+    meshBuffer->vertexCount = 0;
+    meshBuffer->indexBytes = 0;
+    meshBuffer->meshes.count = 0;
+    meshBuffer->meshes.size = 0;
+    meshBuffer->meshes.items = nullptr;
+
+    createBuffer(
+        &meshBuffer->vertexBuffer,
+        sizeof(PackedVertex) * vertexCapacity,
+        &meshBuffer->vertexBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    createBuffer(
+        &meshBuffer->indexBuffer,
+        sizeof(uint32_t) * indexCapacity,
+        &meshBuffer->indexBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    printLn("Created mesh buffer for %d vertices and %d indices", vertexCapacity, indexCapacity);
+}
+
+void computeMeshBounds(const BufferVertices bufferVertices, Vector2D *center, float *radius) {
+    const Vertex *vertices = (Vertex *) bufferVertices.vertices.items;
+    Vector2D min = {0.0f, 0.0f};
+    Vector2D max = {0.0f, 0.0f};
+
+    for (uint32_t i = 0; i < bufferVertices.vertices.count; i++) {
+        const Vector2D position = vertices[i].position;
+        if (i == 0 || position.x < min.x) min.x = position.x;
+        if (i == 0 || position.y < min.y) min.y = position.y;
+        if (i == 0 || position.x > max.x) max.x = position.x;
+        if (i == 0 || position.y > max.y) max.y = position.y;
+    }
+
+    center->x = (min.x + max.x) * 0.5f;
+    center->y = (min.y + max.y) * 0.5f;
+
+    float radiusSquared = 0.0f;
+    for (uint32_t i = 0; i < bufferVertices.vertices.count; i++) {
+        const float dx = vertices[i].position.x - center->x;
+        const float dy = vertices[i].position.y - center->y;
+        if (dx * dx + dy * dy > radiusSquared) radiusSquared = dx * dx + dy * dy;
+    }
+
+    *radius = sqrtf(radiusSquared);
+}
+
+uint32_t appendMeshRange(MeshBuffer *meshBuffer, const MeshRange range) {
+    meshBuffer->meshes.size = sizeof(MeshRange) * (meshBuffer->meshes.count + 1);
+    meshBuffer->meshes.items = realloc(meshBuffer->meshes.items, meshBuffer->meshes.size);
+    ((MeshRange *) meshBuffer->meshes.items)[meshBuffer->meshes.count] = range;
+    return meshBuffer->meshes.count++;
+}
+
+/**
+ * Uploads the mesh through a single staging buffer holding both the vertices
+ * and the indices, then copies each part to the end of the shared buffers.
+ * Vertices and indices are packed straight into the staging memory.
+ * Returns the mesh index to be used with getMeshRange.
+ * A mesh without vertices or indices is rejected, it would need a zero sized
+ * staging buffer and draw nothing.
+ **/
+uint32_t addMeshToMeshBuffer(
+    MeshBuffer *meshBuffer,
+    const BufferVertices bufferVertices,
+    const VkCommandPool commandPool,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    TRACE_ZONE("mesh upload");
+    if (bufferVertices.vertices.count == 0 || bufferVertices.indices.count == 0) {
+        printLn(
+            "Can't add a mesh with %d vertices and %d indices",
+            bufferVertices.vertices.count,
+            bufferVertices.indices.count
+        );
+        exit(EMPTY_MESH);
+    }
+
+    const VkIndexType indexType = bufferVertices.packed
+                                      ? bufferVertices.indexType
+                                      : selectIndexType(bufferVertices.vertices.count);
+    const uint32_t indexSize = getIndexSize(indexType);
+    // 32 bit indices have to start on a 4 byte boundary to be addressable from offset 0
+    const uint32_t indexOffset = (meshBuffer->indexBytes + indexSize - 1) / indexSize * indexSize;
+
+    const VkDeviceSize verticesSize = sizeof(PackedVertex) * bufferVertices.vertices.count;
+    const VkDeviceSize indicesSize = (VkDeviceSize) indexSize * bufferVertices.indices.count;
+
+    if (
+        meshBuffer->vertexCount + bufferVertices.vertices.count > meshBuffer->vertexCapacity ||
+        indexOffset + indicesSize > sizeof(uint32_t) * (VkDeviceSize) meshBuffer->indexCapacity
+    ) {
+        printLn(
+            "Mesh buffer is full. Can't add %d vertices and %d indices",
+            bufferVertices.vertices.count,
+            bufferVertices.indices.count
+        );
+        exit(MESH_BUFFER_CAPACITY_EXCEEDED);
+    }
+
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    VkMemoryRequirements memRequirements;
+
+    createBuffer(
+        &stagingBuffer,
+        verticesSize + indicesSize,
+        &stagingBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    Any data;
+    vkMapMemory(logicalDevice, stagingBufferMemory, 0, verticesSize + indicesSize, 0, &data);
+    if (bufferVertices.packed) {
+        memcpy(data, bufferVertices.vertices.items, verticesSize);
+        memcpy((char *) data + verticesSize, bufferVertices.indices.items, indicesSize);
+    } else {
+        packVertices((Vertex *) bufferVertices.vertices.items, (PackedVertex *) data, bufferVertices.vertices.count);
+        packIndices(
+            (uint32_t *) bufferVertices.indices.items,
+            (char *) data + verticesSize,
+            bufferVertices.indices.count,
+            indexType
+        );
+    }
+    vkUnmapMemory(logicalDevice, stagingBufferMemory);
+
+    const VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool, logicalDevice);
+
+    const VkBufferCopy vertexRegion = {
+        .srcOffset = 0,
+        .dstOffset = sizeof(PackedVertex) * meshBuffer->vertexCount,
+        .size = verticesSize
+    };
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshBuffer->vertexBuffer, 1, &vertexRegion);
+
+    const VkBufferCopy indexRegion = {
+        .srcOffset = verticesSize,
+        .dstOffset = indexOffset,
+        .size = indicesSize
+    };
+    vkCmdCopyBuffer(commandBuffer, stagingBuffer, meshBuffer->indexBuffer, 1, &indexRegion);
+
+    endSingleTimeCommands(commandBuffer, commandPool, logicalDevice, graphicsQueue);
+
+    vkDestroyBuffer(logicalDevice, stagingBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, stagingBufferMemory);
+
+    MeshRange range = {
+        .indexType = indexType,
+        .firstIndex = indexOffset / indexSize,
+        .indexCount = bufferVertices.indices.count,
+        .vertexOffset = (int32_t) meshBuffer->vertexCount,
+        .vertexCount = bufferVertices.vertices.count
+    };
+    if (bufferVertices.packed) {
+        range.center = bufferVertices.center;
+        range.radius = bufferVertices.radius;
+    } else computeMeshBounds(bufferVertices, &range.center, &range.radius);
+
+    appendMeshRange(meshBuffer, range);
+
+    meshBuffer->vertexCount += bufferVertices.vertices.count;
+    meshBuffer->indexBytes = indexOffset + (uint32_t) indicesSize;
+
+    printLn(
+        "Added mesh %d to mesh buffer with %d bit indices",
+        meshBuffer->meshes.count - 1,
+        indexType == VK_INDEX_TYPE_UINT16 ? 16 : 32
+    );
+
+    return meshBuffer->meshes.count - 1;
+}
+
+MeshRange getMeshRange(const MeshBuffer *meshBuffer, const uint32_t meshIndex) {
+    debugCheck(meshIndex < meshBuffer->meshes.count, MESH_NOT_FOUND, "Mesh %d is not in the mesh buffer", meshIndex);
+
+    return ((MeshRange *) meshBuffer->meshes.items)[meshIndex];
+}
+
+void destroyMeshBuffer(const VkDevice logicalDevice, MeshBuffer *meshBuffer) {
+    vkDestroyBuffer(logicalDevice, meshBuffer->indexBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, meshBuffer->indexBufferMemory);
+
+    vkDestroyBuffer(logicalDevice, meshBuffer->vertexBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, meshBuffer->vertexBufferMemory);
+
+    free(meshBuffer->meshes.items);
+    meshBuffer->meshes.items = nullptr;
+    meshBuffer->meshes.count = 0;
+    meshBuffer->meshes.size = 0;
+}
+
+#endif //VULKAN_MESH_BUFFER_H
@@ -0,0 +1,509 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_PARTICLES_H
+#define VULKAN_PARTICLES_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "build_profile.h"
+#include "vulkan_vertex.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "trace.h"
+#include "pipeline_cache.h"
+#include "vulkan_draw_list.h"
+
+/**
+ * A simulated particle. Layout matches Particle in particles.comp (std430).
+ **/
+typedef struct Particle {
+    Vector2D position;
+    Vector2D velocity;
+    Vector3D color;
+    float life; // Seconds left, respawned at 0
+} Particle;
+
+typedef struct ParticlePushConstants {
+    float deltaTime;
+    float time;
+    uint32_t particleCount;
+    float size;
+} ParticlePushConstants;
+
+/**
+ * GPU particles simulated by particles.comp and drawn as instances of mesh 0.
+ * The dispatch writes InstanceData straight into a per frame instance buffer,
+ * so drawing costs one instanced draw and no CPU work per particle.
+ * With a compute family of its own the dispatch is submitted to the compute
+ * queue and the graphics submit waits on computeFinished, otherwise it is
+ * recorded into the frame's command buffer as a render graph pass.
+ **/
+typedef struct ParticleSystem {
+    bool enabled;
+    bool async; // Submitted to the compute queue
+    bool seeded; // The particle buffer has been cleared
+    uint32_t particleCount;
+    float size;
+    VkQueue computeQueue;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkPipelineLayout pipelineLayout;
+    VkPipeline pipeline;
+    VkBuffer particleBuffer; // Particle, shared by every frame
+    VkDeviceMemory particleBufferMemory;
+    Uint32SizedMutableArray instanceBuffers; // VkBuffer, InstanceData per frame in flight
+    Uint32SizedMutableArray instanceBufferMemories; // VkDeviceMemory
+    Uint32SizedMutableArray descriptorSets; // VkDescriptorSet
+    VkCommandPool commandPool; // On the compute family, only when async
+    Uint32SizedMutableArray commandBuffers; // VkCommandBuffer
+    Uint32SizedMutableArray computeFinishedSemaphores; // VkSemaphore
+    uint64_t startClock;
+    uint64_t lastClock;
+    float deltaTime;
+    float time;
+} ParticleSystem;
+
+#define PARTICLE_WORKGROUP_SIZE 64
+#define PARTICLE_BINDING_COUNT 2
+#define PARTICLE_DEFAULT_SIZE 0.01f
+#define PARTICLE_MAX_STEP 0.1f
+
+/**
+ * LEARNING_PARTICLES particles, none by default.
+ **/
+uint32_t readParticleCount() {
+    const char *value = getenv("LEARNING_PARTICLES");
+    if (value == nullptr || *value == '\0') return 0;
+
+    const uint32_t count = (uint32_t) strtoul(value, nullptr, 10);
+    return count > MAX_PARTICLES ? MAX_PARTICLES : count;
+}
+
+void createParticleDescriptorSetLayout(const VkDevice logicalDevice, ParticleSystem *system) {
+    VkDescriptorSetLayoutBinding bindings[PARTICLE_BINDING_COUNT] = {};
+    for (uint32_t i = 0; i < PARTICLE_BINDING_COUNT; i++) {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = PARTICLE_BINDING_COUNT;
+    layoutInfo.pBindings = bindings;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, hostAllocator, &system->descriptorSetLayout) != VK_SUCCESS) {
+        printLn("Failed to create particle descriptor set layout");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+
+    const VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .offset = 0,
+        .size = sizeof(ParticlePushConstants)
+    };
+
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &system->descriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 1;
+    pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, hostAllocator, &system->pipelineLayout) != VK_SUCCESS) {
+        printLn("Failed to create particle pipeline layout");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+}
+
+void createParticleFrames(
+    ParticleSystem *system,
+    const Uint32SizedMutableArray queueFamilies,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    VkMemoryRequirements memRequirements;
+
+    const VkDescriptorPoolSize poolSize = {
+        .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+        .descriptorCount = PARTICLE_BINDING_COUNT * MAX_FRAMES_IN_FLIGHT
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = MAX_FRAMES_IN_FLIGHT;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, hostAllocator, &system->descriptorPool) != VK_SUCCESS) {
+        printLn("Failed to create particle descriptor pool");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+
+    system->instanceBuffers.count = MAX_FRAMES_IN_FLIGHT;
+    system->instanceBuffers.size = sizeof(VkBuffer) * MAX_FRAMES_IN_FLIGHT;
+    system->instanceBuffers.items = malloc(system->instanceBuffers.size);
+    system->instanceBufferMemories.count = MAX_FRAMES_IN_FLIGHT;
+    system->instanceBufferMemories.size = sizeof(VkDeviceMemory) * MAX_FRAMES_IN_FLIGHT;
+    system->instanceBufferMemories.items = malloc(system->instanceBufferMemories.size);
+    system->descriptorSets.count = MAX_FRAMES_IN_FLIGHT;
+    system->descriptorSets.size = sizeof(VkDescriptorSet) * MAX_FRAMES_IN_FLIGHT;
+    system->descriptorSets.items = malloc(system->descriptorSets.size);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        VkBuffer *instanceBuffer = &((VkBuffer *) system->instanceBuffers.items)[i];
+        VkDescriptorSet *descriptorSet = &((VkDescriptorSet *) system->descriptorSets.items)[i];
+
+        createSharedBuffer(
+            instanceBuffer,
+            sizeof(InstanceData) * system->particleCount,
+            &((VkDeviceMemory *) system->instanceBufferMemories.items)[i],
+            &memRequirements,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+            queueFamilies,
+            physicalDevice,
+            logicalDevice
+        );
+
+        VkDescriptorSetAllocateInfo allocInfo = {};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorPool = system->descriptorPool;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &system->descriptorSetLayout;
+
+        if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, descriptorSet) != VK_SUCCESS) {
+            printLn("Failed to allocate particle descriptor set %d", i);
+            exit(FAILED_TO_CREATE_PARTICLES);
+        }
+
+        const VkDescriptorBufferInfo bufferInfos[PARTICLE_BINDING_COUNT] = {
+            {system->particleBuffer, 0, VK_WHOLE_SIZE},
+            {*instanceBuffer, 0, VK_WHOLE_SIZE}
+        };
+
+        VkWriteDescriptorSet writes[PARTICLE_BINDING_COUNT] = {};
+        for (uint32_t binding = 0; binding < PARTICLE_BINDING_COUNT; binding++) {
+            writes[binding].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            writes[binding].dstSet = *descriptorSet;
+            writes[binding].dstBinding = binding;
+            writes[binding].descriptorCount = 1;
+            writes[binding].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            writes[binding].pBufferInfo = &bufferInfos[binding];
+        }
+
+        vkUpdateDescriptorSets(logicalDevice, PARTICLE_BINDING_COUNT, writes, 0, nullptr);
+    }
+}
+
+/**
+ * Command buffers and semaphores for submitting on the compute queue,
+ * one of each per frame in flight like the graphics side.
+ **/
+void createParticleSubmission(ParticleSystem *system, const uint32_t computeFamily, const VkDevice logicalDevice) {
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = computeFamily;
+
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, hostAllocator, &system->commandPool) != VK_SUCCESS) {
+        printLn("Failed to create particle command pool");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+
+    system->commandBuffers.count = MAX_FRAMES_IN_FLIGHT;
+    system->commandBuffers.size = sizeof(VkCommandBuffer) * MAX_FRAMES_IN_FLIGHT;
+    system->commandBuffers.items = malloc(system->commandBuffers.size);
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = system->commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = MAX_FRAMES_IN_FLIGHT;
+
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, (VkCommandBuffer *) system->commandBuffers.items) != VK_SUCCESS) {
+        printLn("Failed to allocate particle command buffers");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+
+    system->computeFinishedSemaphores.count = MAX_FRAMES_IN_FLIGHT;
+    system->computeFinishedSemaphores.size = sizeof(VkSemaphore) * MAX_FRAMES_IN_FLIGHT;
+    system->computeFinishedSemaphores.items = malloc(system->computeFinishedSemaphores.size);
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        if (
+            vkCreateSemaphore(
+                logicalDevice,
+                &semaphoreInfo,
+                hostAllocator,
+                &((VkSemaphore *) system->computeFinishedSemaphores.items)[i]
+            ) != VK_SUCCESS
+        ) {
+            printLn("Failed to create particle semaphore %d", i);
+            exit(FAILED_TO_CREATE_PARTICLES);
+        }
+    }
+}
+
+/**
+ * Async when computeFamily differs from graphicsFamily, see selectPhysicalDevice.
+ * Buffers are concurrent between the two families then, so they change
+ * queues without ownership transfers.
+ **/
+void createParticleSystem(
+    ParticleSystem *system,
+    const uint32_t particleCount,
+    const Uint32SizedMutableArray computeShader, // particles.comp SPIR-V
+    const uint32_t graphicsFamily,
+    const uint32_t computeFamily,
+    const VkQueue computeQueue,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    *system = (ParticleSystem){.enabled = false};
+    if (particleCount == 0) return;
+
+    TRACE_ZONE("particles pipeline");
+    VkMemoryRequirements memRequirements;
+
+    system->particleCount = particleCount;
+    system->size = PARTICLE_DEFAULT_SIZE;
+    system->async = computeFamily != graphicsFamily;
+    system->computeQueue = computeQueue;
+
+    const Uint32SizedMutableArray queueFamilies = {
+        .count = system->async ? 2 : 1,
+        .items = (Any*) (uint32_t []){graphicsFamily, computeFamily}
+    };
+
+    createSharedBuffer(
+        &system->particleBuffer,
+        sizeof(Particle) * particleCount,
+        &system->particleBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+        queueFamilies,
+        physicalDevice,
+        logicalDevice
+    );
+
+    createParticleDescriptorSetLayout(logicalDevice, system);
+    if (createComputePipeline(logicalDevice, computeShader, system->pipelineLayout, &system->pipeline) != VK_SUCCESS) {
+        printLn("Failed to create particle pipeline");
+        exit(FAILED_TO_CREATE_PARTICLES);
+    }
+    createParticleFrames(system, queueFamilies, physicalDevice, logicalDevice);
+    if (system->async) createParticleSubmission(system, computeFamily, logicalDevice);
+
+    system->startClock = getTraceClock();
+    system->lastClock = system->startClock;
+    system->enabled = true;
+    printLn(
+        "Created %d particles simulated on the %s queue",
+        particleCount,
+        system->async ? "async compute" : "graphics"
+    );
+}
+
+/**
+ * Advances the simulation clock, once per frame before the dispatch is recorded.
+ * Steps are capped so a stall doesn't fling every particle out at once.
+ **/
+void updateParticles(ParticleSystem *system) {
+    if (!system->enabled) return;
+
+    const uint64_t now = getTraceClock();
+    system->deltaTime = (float) ((double) (now - system->lastClock) / 1e9);
+    if (system->deltaTime > PARTICLE_MAX_STEP) system->deltaTime = PARTICLE_MAX_STEP;
+    system->time = (float) ((double) (now - system->startClock) / 1e9);
+    system->lastClock = now;
+}
+
+/**
+ * Records the simulation step. The particle buffer is shared by every frame
+ * so the step waits on the previous one itself, the instance buffer is made
+ * visible to the draw by the render graph or by the cross queue semaphore.
+ **/
+void recordParticles(const VkCommandBuffer commandBuffer, ParticleSystem *system, const uint32_t frameIndex) {
+    if (!system->enabled) return;
+
+    VkMemoryBarrier stepBarrier = {};
+    stepBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    stepBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    stepBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    VkPipelineStageFlags srcStage = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+
+    // Zeroed particles have no life left, the first step respawns all of them
+    if (!system->seeded) {
+        vkCmdFillBuffer(commandBuffer, system->particleBuffer, 0, VK_WHOLE_SIZE, 0);
+        stepBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        srcStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        system->seeded = true;
+    }
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        srcStage,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        0,
+        1, &stepBarrier,
+        0, nullptr,
+        0, nullptr
+    );
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, system->pipeline);
+    vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        system->pipelineLayout,
+        0,
+        1,
+        &((VkDescriptorSet *) system->descriptorSets.items)[frameIndex],
+        0,
+        nullptr
+    );
+
+    const ParticlePushConstants pushConstants = {
+        .deltaTime = system->deltaTime,
+        .time = system->time,
+        .particleCount = system->particleCount,
+        .size = system->size
+    };
+    vkCmdPushConstants(
+        commandBuffer,
+        system->pipelineLayout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        sizeof(ParticlePushConstants),
+        &pushConstants
+    );
+
+    vkCmdDispatch(commandBuffer, (system->particleCount + PARTICLE_WORKGROUP_SIZE - 1) / PARTICLE_WORKGROUP_SIZE, 1, 1);
+}
+
+/**
+ * Submits the step to the compute queue, signaling the semaphore the frame's
+ * graphics submit waits on. Only once the frame is certain to be submitted,
+ * a signaled semaphore nobody waits on can't be signaled again.
+ * The frame's fence covers the command buffer, the graphics submit that
+ * waited on its last use has finished.
+ **/
+void submitParticles(ParticleSystem *system, const uint32_t frameIndex) {
+    if (!system->enabled || !system->async) return;
+
+    TRACE_ZONE("submit particles");
+    const VkCommandBuffer commandBuffer = ((VkCommandBuffer *) system->commandBuffers.items)[frameIndex];
+    vkResetCommandBuffer(commandBuffer, 0);
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    recordParticles(commandBuffer, system, frameIndex);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        printLn("Failed to record particle command buffer");
+        exit(FAILED_TO_SUBMIT_PARTICLES);
+    }
+
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &((VkSemaphore *) system->computeFinishedSemaphores.items)[frameIndex];
+
+    if (vkQueueSubmit(system->computeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+        printLn("Failed to submit particles");
+        exit(FAILED_TO_SUBMIT_PARTICLES);
+    }
+}
+
+/**
+ * What the graphics submit has to wait on before reading this frame's
+ * instances, VK_NULL_HANDLE when the step is in its own command buffer.
+ **/
+VkSemaphore getParticleSemaphore(const ParticleSystem *system, const uint32_t frameIndex) {
+    if (!system->enabled || !system->async) return VK_NULL_HANDLE;
+    return ((VkSemaphore *) system->computeFinishedSemaphores.items)[frameIndex];
+}
+
+VkBuffer getParticleInstanceBuffer(const ParticleSystem *system, const uint32_t frameIndex) {
+    return ((VkBuffer *) system->instanceBuffers.items)[frameIndex];
+}
+
+/**
+ * One instanced draw of mesh 0 over the simulated instances.
+ **/
+void pushParticleDraws(
+    DrawList *list,
+    const ParticleSystem *system,
+    const MeshBuffer *meshBuffer,
+    const uint32_t frameIndex,
+    const VkPipeline pipeline
+) {
+    if (!system->enabled) return;
+
+    const MeshRange range = getMeshRange(meshBuffer, 0);
+    const uint32_t state = addDrawState(list, (DrawState){
+        .pipeline = pipeline,
+        .vertexBuffer = meshBuffer->vertexBuffer,
+        .instanceBuffer = getParticleInstanceBuffer(system, frameIndex),
+        .indexBuffer = meshBuffer->indexBuffer,
+        .indexType = range.indexType,
+        .constants = IDENTITY_DRAW
+    });
+
+    pushDraw(list, DRAW_PASS_WORLD, 0, 0.0f, (DrawCommand){
+        .type = DRAW_INDEXED,
+        .state = state,
+        .indexCount = range.indexCount,
+        .instanceCount = system->particleCount,
+        .firstIndex = range.firstIndex,
+        .vertexOffset = range.vertexOffset,
+        .firstInstance = 0
+    });
+}
+
+void destroyParticleSystem(const VkDevice logicalDevice, ParticleSystem *system) {
+    if (!system->enabled) return;
+
+    if (system->async) {
+        for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++)
+            vkDestroySemaphore(logicalDevice, ((VkSemaphore *) system->computeFinishedSemaphores.items)[i], hostAllocator);
+        free(system->computeFinishedSemaphores.items);
+        free(system->commandBuffers.items);
+        vkDestroyCommandPool(logicalDevice, system->commandPool, hostAllocator);
+    }
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        vkDestroyBuffer(logicalDevice, ((VkBuffer *) system->instanceBuffers.items)[i], hostAllocator);
+        freeDeviceMemory(logicalDevice, ((VkDeviceMemory *) system->instanceBufferMemories.items)[i]);
+    }
+    free(system->instanceBuffers.items);
+    free(system->instanceBufferMemories.items);
+    free(system->descriptorSets.items);
+
+    vkDestroyBuffer(logicalDevice, system->particleBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, system->particleBufferMemory);
+
+    vkDestroyDescriptorPool(logicalDevice, system->descriptorPool, hostAllocator);
+    vkDestroyPipeline(logicalDevice, system->pipeline, hostAllocator);
+    vkDestroyPipelineLayout(logicalDevice, system->pipelineLayout, hostAllocator);
+    vkDestroyDescriptorSetLayout(logicalDevice, system->descriptorSetLayout, hostAllocator);
+
+    system->enabled = false;
+}
+
+#endif //VULKAN_PARTICLES_H
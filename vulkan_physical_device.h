@@ -0,0 +1,420 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_PHYSICAL_DEVICE_H
+#define VULKAN_PHYSICAL_DEVICE_H
+
+#include <vulkan/vulkan.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "glfw_app.h"
+#include "vulkan_swap_chain.h"
+#include "startup_trace.h"
+
+/**
+ * Physical device selection by score rather than by first match.
+ * Every device is queried once. Queue families, surface support and swap chain
+ * support are kept in a PhysicalDeviceInfo so nothing is queried twice, and the
+ * selected device's results are handed to the rest of startup.
+ * Everything but surface support is queried on a thread while the window is
+ * created, see startPhysicalDeviceQuery.
+ * Devices missing something the renderer can't run without are rejected, the
+ * rest are scored on type, device local memory, queues and optional features.
+ * LEARNING_DEVICE pins a device by a case insensitive part of its name or by
+ * its UUID (32 hex digits, dashes ignored). A pinned device that can't be used
+ * is reported and scoring decides instead.
+ **/
+typedef struct PhysicalDeviceInfo {
+    VkPhysicalDevice device;
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    VkPhysicalDeviceVulkan12Features features12; // Zeroed below Vulkan 1.2
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    uint8_t uuid[VK_UUID_SIZE];
+    Uint32SizedMutableArray queueFamilies; // VkQueueFamilyProperties
+    Uint32SizedMutableArray presentSupport; // VkBool32 per queue family for the window's surface
+    VkSwapChainSupportDetails swapChainSupport;
+    int32_t graphicsFamily; // -1 when there is none
+    int32_t presentFamily;
+    int32_t computeFamily; // Compute without graphics, -1 when every compute family also does graphics
+    VkDeviceSize deviceLocalMemory; // Largest device local heap
+    int32_t score; // -1 when rejected
+    char reason[256]; // How score was reached, or why the device was rejected
+} PhysicalDeviceInfo;
+
+bool supportsDeviceExtensions(const VkPhysicalDevice physicalDevice, const Uint32SizedMutableArray expectedExtensions) {
+    uint32_t count = 0;
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, NULL);
+    if (count == 0) return expectedExtensions.count == 0;
+
+    VkExtensionProperties *extensions = malloc(sizeof(VkExtensionProperties) * count);
+    vkEnumerateDeviceExtensionProperties(physicalDevice, NULL, &count, extensions);
+
+    uint32_t found = 0;
+    for (uint32_t i = 0; i < expectedExtensions.count; i++) {
+        const char *expected = ((char **) expectedExtensions.items)[i];
+        for (uint32_t j = 0; j < count; j++) {
+            if (strcmp(expected, extensions[j].extensionName) == 0) {
+                found++;
+                break;
+            }
+        }
+    }
+
+    free(extensions);
+    return found == expectedExtensions.count;
+}
+
+bool supportsDescriptorIndexing(const VkPhysicalDeviceVulkan12Features *features12) {
+    return features12->runtimeDescriptorArray &&
+           features12->descriptorBindingPartiallyBound &&
+           features12->descriptorBindingUpdateUnusedWhilePending &&
+           features12->descriptorBindingSampledImageUpdateAfterBind &&
+           features12->descriptorBindingStorageBufferUpdateAfterBind &&
+           features12->shaderSampledImageArrayNonUniformIndexing;
+}
+
+/**
+ * Picks the graphics and present families, one family doing both wins over two.
+ * Any family with compute but no graphics is taken for async compute.
+ **/
+void selectDeviceQueueFamilies(PhysicalDeviceInfo *info) {
+    const VkQueueFamilyProperties *families = (VkQueueFamilyProperties *) info->queueFamilies.items;
+    const VkBool32 *presentSupport = (VkBool32 *) info->presentSupport.items;
+
+    info->computeFamily = -1;
+    for (uint32_t i = 0; i < info->queueFamilies.count && info->computeFamily == -1; i++) {
+        if ((families[i].queueFlags & VK_QUEUE_COMPUTE_BIT) && !(families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+            info->computeFamily = (int32_t) i;
+    }
+
+    info->graphicsFamily = -1;
+    info->presentFamily = -1;
+    for (uint32_t i = 0; i < info->queueFamilies.count; i++) {
+        const bool graphics = (families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+        if (graphics && presentSupport[i]) {
+            info->graphicsFamily = (int32_t) i;
+            info->presentFamily = (int32_t) i;
+            return;
+        }
+        if (graphics && info->graphicsFamily == -1) info->graphicsFamily = (int32_t) i;
+        if (presentSupport[i] && info->presentFamily == -1) info->presentFamily = (int32_t) i;
+    }
+}
+
+/**
+ * Everything that doesn't need a surface.
+ **/
+void queryPhysicalDeviceInfo(PhysicalDeviceInfo *info, const VkPhysicalDevice physicalDevice) {
+    *info = (PhysicalDeviceInfo){
+        .device = physicalDevice,
+        .swapChainSupport = {.formats = {.count = 0}, .presentModes = {.count = 0}}
+    };
+
+    vkGetPhysicalDeviceProperties(physicalDevice, &info->properties);
+    vkGetPhysicalDeviceFeatures(physicalDevice, &info->features);
+    vkGetPhysicalDeviceMemoryProperties(physicalDevice, &info->memoryProperties);
+
+    info->features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    if (info->properties.apiVersion >= VK_API_VERSION_1_2) {
+        VkPhysicalDeviceFeatures2 features = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+            .pNext = &info->features12
+        };
+        vkGetPhysicalDeviceFeatures2(physicalDevice, &features);
+    }
+    if (info->properties.apiVersion >= VK_API_VERSION_1_1) {
+        VkPhysicalDeviceIDProperties idProperties = {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+        VkPhysicalDeviceProperties2 properties = {
+            .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+            .pNext = &idProperties
+        };
+        vkGetPhysicalDeviceProperties2(physicalDevice, &properties);
+        memcpy(info->uuid, idProperties.deviceUUID, VK_UUID_SIZE);
+    }
+
+    for (uint32_t i = 0; i < info->memoryProperties.memoryHeapCount; i++) {
+        const VkMemoryHeap heap = info->memoryProperties.memoryHeaps[i];
+        if ((heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) && heap.size > info->deviceLocalMemory)
+            info->deviceLocalMemory = heap.size;
+    }
+
+    vkGetPhysicalDeviceQueueFamilyProperties(physicalDevice, &info->queueFamilies.count, NULL);
+    info->queueFamilies.size = sizeof(VkQueueFamilyProperties) * info->queueFamilies.count;
+    info->queueFamilies.items = malloc(info->queueFamilies.size);
+    vkGetPhysicalDeviceQueueFamilyProperties(
+        physicalDevice,
+        &info->queueFamilies.count,
+        (VkQueueFamilyProperties *) info->queueFamilies.items
+    );
+}
+
+void queryPresentSupport(PhysicalDeviceInfo *info, const VkSurfaceKHR surface) {
+    const VkPhysicalDevice physicalDevice = info->device;
+    info->presentSupport.count = info->queueFamilies.count;
+    info->presentSupport.size = sizeof(VkBool32) * info->queueFamilies.count;
+    info->presentSupport.items = malloc(info->presentSupport.size);
+    for (uint32_t i = 0; i < info->queueFamilies.count; i++)
+        vkGetPhysicalDeviceSurfaceSupportKHR(physicalDevice, i, surface, &((VkBool32 *) info->presentSupport.items)[i]);
+
+    selectDeviceQueueFamilies(info);
+}
+
+const char *getPhysicalDeviceTypeName(const VkPhysicalDeviceType type) {
+    switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU: return "cpu";
+        default: return "other";
+    }
+}
+
+int32_t rejectPhysicalDevice(PhysicalDeviceInfo *info, const char *reason) {
+    snprintf(info->reason, sizeof(info->reason), "rejected, %s", reason);
+    info->score = -1;
+    return info->score;
+}
+
+/**
+ * Scores info, swap chain support is only queried for devices that pass
+ * everything before it.
+ **/
+int32_t scorePhysicalDevice(
+    PhysicalDeviceInfo *info,
+    const VkSurfaceKHR surface,
+    const Uint32SizedMutableArray expectedExtensions
+) {
+    if (info->graphicsFamily == -1) return rejectPhysicalDevice(info, "no graphics queue");
+    if (info->presentFamily == -1) return rejectPhysicalDevice(info, "no queue can present to the surface");
+    if (!supportsDeviceExtensions(info->device, expectedExtensions))
+        return rejectPhysicalDevice(info, "missing required device extensions");
+    if (info->properties.apiVersion < VK_API_VERSION_1_2 || !supportsDescriptorIndexing(&info->features12))
+        return rejectPhysicalDevice(info, "no Vulkan 1.2 descriptor indexing for the bindless table");
+
+    querySwapChainSupport(info->device, surface, &info->swapChainSupport);
+    if (uInt32SizedArrayIsEmpty(info->swapChainSupport.formats) ||
+        uInt32SizedArrayIsEmpty(info->swapChainSupport.presentModes))
+        return rejectPhysicalDevice(info, "no surface formats or present modes");
+
+    int32_t typeScore;
+    switch (info->properties.deviceType) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            typeScore = 1000;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            typeScore = 500;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            typeScore = 250;
+            break;
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            typeScore = 100;
+            break;
+        default:
+            typeScore = 50;
+    }
+
+    // A point per 256MB of the largest device local heap, capped below a device type step
+    VkDeviceSize memoryScore = info->deviceLocalMemory >> 28;
+    if (memoryScore > 200) memoryScore = 200;
+
+    int32_t queueScore = info->graphicsFamily == info->presentFamily ? 50 : 0;
+    // Compute without graphics can run beside the frame
+    if (info->computeFamily != -1) queueScore += 25;
+
+    const int32_t featureScore = (info->features12.drawIndirectCount ? 20 : 0) +
+                                 (info->features.samplerAnisotropy ? 10 : 0) +
+                                 (info->features.textureCompressionBC ? 10 : 0);
+
+    info->score = typeScore + (int32_t) memoryScore + queueScore + featureScore;
+    snprintf(
+        info->reason,
+        sizeof(info->reason),
+        "%s %d + memory %d + queues %d + features %d",
+        getPhysicalDeviceTypeName(info->properties.deviceType),
+        typeScore,
+        (int32_t) memoryScore,
+        queueScore,
+        featureScore
+    );
+    return info->score;
+}
+
+bool containsIgnoringCase(const char *text, const char *part) {
+    const size_t partLength = strlen(part);
+    for (; *text != '\0'; text++) {
+        size_t i = 0;
+        while (i < partLength && text[i] != '\0' && tolower((unsigned char) text[i]) == tolower((unsigned char) part[i])) i++;
+        if (i == partLength) return true;
+    }
+    return partLength == 0;
+}
+
+/**
+ * Whether pin, LEARNING_DEVICE, names info: 32 hex digits match the UUID,
+ * anything else a part of the device name.
+ **/
+bool matchesPinnedDevice(const PhysicalDeviceInfo *info, const char *pin) {
+    uint8_t uuid[VK_UUID_SIZE];
+    uint32_t digits = 0;
+    bool hex = true;
+    for (const char *c = pin; *c != '\0' && hex; c++) {
+        if (*c == '-') continue;
+        if (!isxdigit((unsigned char) *c) || digits == VK_UUID_SIZE * 2) {
+            hex = false;
+            break;
+        }
+        const uint8_t value = isdigit((unsigned char) *c) ? *c - '0' : tolower((unsigned char) *c) - 'a' + 10;
+        if (digits % 2 == 0) uuid[digits / 2] = value << 4;
+        else uuid[digits / 2] |= value;
+        digits++;
+    }
+
+    if (hex && digits == VK_UUID_SIZE * 2) return memcmp(uuid, info->uuid, VK_UUID_SIZE) == 0;
+    return containsIgnoringCase(info->properties.deviceName, pin);
+}
+
+typedef struct PhysicalDeviceQuery {
+    pthread_t thread;
+    GLFWApp *app;
+    PhysicalDeviceInfo *infos; // One per app->physicalDevices
+    bool running; // The thread hasn't been joined yet
+} PhysicalDeviceQuery;
+
+void enumeratePhysicalDevices(GLFWApp *app, const VkInstance *vkInstance) {
+    vkEnumeratePhysicalDevices(*vkInstance, &app->physicalDevices->count, NULL);
+
+    if (app->physicalDevices->count == 0) {
+        printLn("Failed to get usable GPU physical devices");
+        exit(29);
+    } else printLn("Found %d physical devices", app->physicalDevices->count);
+
+    app->physicalDevices->size = sizeof(VkPhysicalDevice) * app->physicalDevices->count;
+    app->physicalDevices->items = realloc(app->physicalDevices->items, app->physicalDevices->size);
+    vkEnumeratePhysicalDevices(
+        *vkInstance,
+        &app->physicalDevices->count,
+        (VkPhysicalDevice *) app->physicalDevices->items
+    );
+
+    printLn("Done enumerating physical devices");
+}
+
+Any runPhysicalDeviceQuery(Any data) {
+    PhysicalDeviceQuery *query = data;
+    const uint32_t phase = beginStartupPhase("query physical devices");
+
+    enumeratePhysicalDevices(query->app, query->app->vkInstance);
+    query->infos = malloc(sizeof(PhysicalDeviceInfo) * query->app->physicalDevices->count);
+    for (uint32_t i = 0; i < query->app->physicalDevices->count; i++)
+        queryPhysicalDeviceInfo(&query->infos[i], ((VkPhysicalDevice *) query->app->physicalDevices->items)[i]);
+
+    endStartupPhase(phase);
+    return nullptr;
+}
+
+/**
+ * Enumerates and queries the devices on a thread. Only the instance is needed,
+ * app->physicalDevices belongs to the thread until selectPhysicalDevice.
+ **/
+void startPhysicalDeviceQuery(PhysicalDeviceQuery *query, GLFWApp *app) {
+    *query = (PhysicalDeviceQuery){.app = app, .infos = nullptr, .running = true};
+    if (pthread_create(&query->thread, nullptr, runPhysicalDeviceQuery, query) != 0) {
+        runPhysicalDeviceQuery(query);
+        query->running = false;
+    }
+}
+
+void freePhysicalDeviceInfo(PhysicalDeviceInfo *info) {
+    free(info->queueFamilies.items);
+    free(info->presentSupport.items);
+    free(info->swapChainSupport.formats.items);
+    free(info->swapChainSupport.presentModes.items);
+}
+
+/**
+ * Sets app's physical device, queue families and the selected device's cached
+ * properties and features. The selected device's swap chain support is moved
+ * into swapChainSupportDetails for prepareSwapChain.
+ **/
+void selectPhysicalDevice(
+    GLFWApp *app,
+    PhysicalDeviceQuery *query,
+    const VkSurfaceKHR surface,
+    const Uint32SizedMutableArray expectedExtensions,
+    VkSwapChainSupportDetails *swapChainSupportDetails
+) {
+    if (query->running) pthread_join(query->thread, nullptr);
+    query->running = false;
+
+    const uint32_t deviceCount = app->physicalDevices->count;
+    PhysicalDeviceInfo *infos = query->infos;
+    const char *pin = getenv("LEARNING_DEVICE");
+    if (pin != nullptr && *pin == '\0') pin = nullptr;
+
+    int32_t best = -1;
+    int32_t pinned = -1;
+    for (uint32_t i = 0; i < deviceCount; i++) {
+        PhysicalDeviceInfo *info = &infos[i];
+        queryPresentSupport(info, surface);
+        scorePhysicalDevice(info, surface, expectedExtensions);
+
+        printLn("Device %d %s: score %d, %s", i, info->properties.deviceName, info->score, info->reason);
+
+        if (info->score < 0) continue;
+        if (best == -1 || info->score > infos[best].score) best = (int32_t) i;
+        if (pin != nullptr && pinned == -1 && matchesPinnedDevice(info, pin)) pinned = (int32_t) i;
+    }
+
+    if (pin != nullptr) {
+        if (pinned != -1) best = pinned;
+        else printLn("LEARNING_DEVICE=%s matches no usable device, using the highest score", pin);
+    }
+
+    if (best == -1) {
+        printLn("Failed to select a physical device");
+        exit(FAILED_TO_SELECT_PHYSICAL_DEVICE);
+    }
+
+    PhysicalDeviceInfo *selected = &infos[best];
+    app->currentPhysicalDevice = best;
+    app->queueFamilyIndex = (uint32_t) selected->graphicsFamily;
+    app->presentFamilyIndex = (uint32_t) selected->presentFamily;
+    // Compute work goes to the graphics queue without a family of its own, or with LEARNING_ASYNC_COMPUTE=0
+    const char *asyncCompute = getenv("LEARNING_ASYNC_COMPUTE");
+    const bool asyncComputeAllowed = asyncCompute == nullptr || strcmp(asyncCompute, "0") != 0;
+    app->computeFamilyIndex = selected->computeFamily != -1 && asyncComputeAllowed
+                                  ? (uint32_t) selected->computeFamily
+                                  : app->queueFamilyIndex;
+    app->physicalDeviceProperties = selected->properties;
+    app->physicalDeviceFeatures = selected->features;
+    app->physicalDeviceFeatures12 = selected->features12;
+
+    *swapChainSupportDetails = selected->swapChainSupport;
+    selected->swapChainSupport = (VkSwapChainSupportDetails){.formats = {.count = 0}, .presentModes = {.count = 0}};
+
+    printLn(
+        "Selected physical device %d: %s%s, graphics family %d, present family %d, compute family %d%s",
+        best,
+        selected->properties.deviceName,
+        pinned == best ? " (pinned)" : "",
+        selected->graphicsFamily,
+        selected->presentFamily,
+        app->computeFamilyIndex,
+        app->computeFamilyIndex == app->queueFamilyIndex ? " (shared with graphics)" : " (async)"
+    );
+
+    for (uint32_t i = 0; i < deviceCount; i++) freePhysicalDeviceInfo(&infos[i]);
+    free(infos);
+    query->infos = nullptr;
+}
+
+#endif //VULKAN_PHYSICAL_DEVICE_H
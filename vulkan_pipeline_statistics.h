@@ -0,0 +1,117 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_PIPELINE_STATISTICS_H
+#define VULKAN_PIPELINE_STATISTICS_H
+
+#include <vulkan/vulkan.h>
+#include "constants.h"
+#include "io.h"
+#include "vulkan_callbacks.h"
+
+/**
+ * Fragment shader invocations of the main pass, one pipeline statistics query
+ * per frame in flight. queryPool is VK_NULL_HANDLE without the
+ * pipelineStatisticsQuery feature, every call is then a no op.
+ * Invocations count what passed the early depth test, so they show how much
+ * shading the depth buffer saved.
+ **/
+typedef struct PipelineStatistics {
+    VkQueryPool queryPool;
+    uint32_t pendingFrames; // Bit per frame in flight with a query to read back
+    uint64_t lastFragmentInvocations;
+    uint64_t totalFragmentInvocations;
+    uint64_t collectedFrames;
+} PipelineStatistics;
+
+void createPipelineStatistics(PipelineStatistics *statistics, const VkDevice logicalDevice, const bool supported) {
+    *statistics = (PipelineStatistics){.queryPool = VK_NULL_HANDLE};
+    if (!supported) {
+        printLn("pipelineStatisticsQuery isn't supported, fragment invocations aren't counted");
+        return;
+    }
+
+    const VkQueryPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS,
+        .queryCount = MAX_FRAMES_IN_FLIGHT,
+        .pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT
+    };
+    if (vkCreateQueryPool(logicalDevice, &poolInfo, hostAllocator, &statistics->queryPool) != VK_SUCCESS) {
+        printLn("Failed to create the pipeline statistics query pool");
+        statistics->queryPool = VK_NULL_HANDLE;
+    }
+}
+
+/**
+ * Reads back frame's previous query, its fence has to have signalled.
+ **/
+void collectPipelineStatistics(PipelineStatistics *statistics, const VkDevice logicalDevice, const uint32_t frame) {
+    if (statistics->queryPool == VK_NULL_HANDLE || !(statistics->pendingFrames & 1u << frame)) return;
+    statistics->pendingFrames &= ~(1u << frame);
+
+    uint64_t fragmentInvocations = 0;
+    if (
+        vkGetQueryPoolResults(
+            logicalDevice,
+            statistics->queryPool,
+            frame,
+            1,
+            sizeof(fragmentInvocations),
+            &fragmentInvocations,
+            sizeof(uint64_t),
+            VK_QUERY_RESULT_64_BIT
+        ) != VK_SUCCESS
+    ) return;
+
+    statistics->lastFragmentInvocations = fragmentInvocations;
+    statistics->totalFragmentInvocations += fragmentInvocations;
+    statistics->collectedFrames++;
+}
+
+/**
+ * Has to be recorded outside of a render pass, the query itself may span one.
+ **/
+void beginPipelineStatistics(
+    const VkCommandBuffer commandBuffer,
+    PipelineStatistics *statistics,
+    const uint32_t frame
+) {
+    if (statistics->queryPool == VK_NULL_HANDLE) return;
+
+    vkCmdResetQueryPool(commandBuffer, statistics->queryPool, frame, 1);
+    vkCmdBeginQuery(commandBuffer, statistics->queryPool, frame, 0);
+    statistics->pendingFrames |= 1u << frame;
+}
+
+void endPipelineStatistics(
+    const VkCommandBuffer commandBuffer,
+    const PipelineStatistics *statistics,
+    const uint32_t frame
+) {
+    if (statistics->queryPool == VK_NULL_HANDLE) return;
+    vkCmdEndQuery(commandBuffer, statistics->queryPool, frame);
+}
+
+/**
+ * Starts a new average, for benchmarks that only count their own frames.
+ **/
+void resetPipelineStatisticsTotals(PipelineStatistics *statistics) {
+    statistics->totalFragmentInvocations = 0;
+    statistics->collectedFrames = 0;
+}
+
+double getAverageFragmentInvocations(const PipelineStatistics *statistics) {
+    return statistics->collectedFrames == 0
+               ? 0.0
+               : (double) statistics->totalFragmentInvocations / (double) statistics->collectedFrames;
+}
+
+void destroyPipelineStatistics(const VkDevice logicalDevice, PipelineStatistics *statistics) {
+    if (statistics->queryPool == VK_NULL_HANDLE) return;
+    vkDestroyQueryPool(logicalDevice, statistics->queryPool, hostAllocator);
+    statistics->queryPool = VK_NULL_HANDLE;
+}
+
+#endif //VULKAN_PIPELINE_STATISTICS_H
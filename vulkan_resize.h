@@ -0,0 +1,76 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_RESIZE_H
+#define VULKAN_RESIZE_H
+
+#include <vulkan/vulkan.h>
+#include "io.h"
+
+/**
+ * Decides when a resize rebuilds the swap chain. Size events only mark the
+ * window as pending, drawFrame asks once per frame, so a burst of events
+ * costs at most one recreation.
+ * While a drag is still producing events the old swap chain keeps presenting
+ * (suboptimal, scaled by the presentation engine) and is only rebuilt every
+ * RESIZE_LIVE_REBUILD_SECONDS. The exact size is built once no event arrived
+ * for RESIZE_SETTLE_SECONDS. An out of date swap chain can't present at all and
+ * is always rebuilt.
+ **/
+constexpr double RESIZE_SETTLE_SECONDS = 0.1;
+constexpr double RESIZE_LIVE_REBUILD_SECONDS = 0.25;
+
+typedef struct ResizeController {
+    bool pending; // A size event arrived since the swap chain was built
+    double lastEvent; // Seconds, glfwGetTime of the latest size event
+    double lastRebuild;
+    uint32_t coalescedEvents; // Events folded into the next rebuild
+    uint32_t rebuilds;
+} ResizeController;
+
+void createResizeController(ResizeController *resize) {
+    *resize = (ResizeController){
+        .pending = false,
+        .lastEvent = 0.0,
+        .lastRebuild = 0.0,
+        .coalescedEvents = 0,
+        .rebuilds = 0
+    };
+}
+
+void noteResizeEvent(ResizeController *resize, const double now) {
+    resize->pending = true;
+    resize->lastEvent = now;
+    resize->coalescedEvents++;
+}
+
+/**
+ * Whether to recreate after this frame's acquire and present results.
+ **/
+bool shouldRecreateSwapChain(
+    const ResizeController *resize,
+    const VkResult acquireResult,
+    const VkResult presentResult,
+    const double now
+) {
+    if (acquireResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_ERROR_OUT_OF_DATE_KHR) return true;
+
+    const bool suboptimal = acquireResult == VK_SUBOPTIMAL_KHR || presentResult == VK_SUBOPTIMAL_KHR;
+    // Suboptimal with no size change (a rotation or a moved monitor) is rebuilt straight away
+    if (!resize->pending) return suboptimal;
+
+    if (now - resize->lastEvent >= RESIZE_SETTLE_SECONDS) return true;
+    return now - resize->lastRebuild >= RESIZE_LIVE_REBUILD_SECONDS;
+}
+
+void completeResize(ResizeController *resize, const double now) {
+    if (resize->coalescedEvents > 1) printLn("Coalesced %d resize events into one rebuild", resize->coalescedEvents);
+
+    resize->pending = false;
+    resize->lastRebuild = now;
+    resize->coalescedEvents = 0;
+    resize->rebuilds++;
+}
+
+#endif //VULKAN_RESIZE_H
@@ -0,0 +1,146 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_RETIRE_QUEUE_H
+#define VULKAN_RETIRE_QUEUE_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include "array.h"
+#include "io.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+
+/**
+ * Deferred destruction for anything the GPU may still be using.
+ * Resources are queued with the last point that used them, a frame number or
+ * a timeline value, and destroyed once that point is reported complete.
+ * The queue has no idea what the values mean, the owner only has to pass
+ * completed values from the same counter it queued with.
+ **/
+typedef enum RetiredResourceType {
+    RETIRED_BUFFER,
+    RETIRED_IMAGE,
+    RETIRED_IMAGE_VIEW,
+    RETIRED_SAMPLER,
+    RETIRED_FRAMEBUFFER,
+    RETIRED_MEMORY,
+    RETIRED_PIPELINE,
+    RETIRED_PIPELINE_LAYOUT,
+    RETIRED_DESCRIPTOR_POOL,
+    RETIRED_SWAP_CHAIN
+} RetiredResourceType;
+
+typedef struct RetiredResource {
+    RetiredResourceType type;
+    union {
+        VkBuffer buffer;
+        VkImage image;
+        VkImageView imageView;
+        VkSampler sampler;
+        VkFramebuffer framebuffer;
+        VkDeviceMemory memory;
+        VkPipeline pipeline;
+        VkPipelineLayout pipelineLayout;
+        VkDescriptorPool descriptorPool;
+        VkSwapchainKHR swapChain;
+    };
+    uint64_t lastUse;
+} RetiredResource;
+
+typedef struct RetireQueue {
+    Uint32SizedMutableArray resources; // RetiredResource, size is the allocated bytes
+    uint64_t completed; // Every lastUse below it has finished on the GPU
+    uint32_t destroyed; // Over the queue's lifetime
+} RetireQueue;
+
+void createRetireQueue(RetireQueue *queue) {
+    *queue = (RetireQueue){
+        .resources = {.items = nullptr, .size = 0, .count = 0},
+        .completed = 0,
+        .destroyed = 0
+    };
+}
+
+/**
+ * Queues resource for destruction once lastUse completes. Memory is queued
+ * after what is bound to it so it is freed last when both retire together.
+ **/
+void retireResource(RetireQueue *queue, RetiredResource resource, const uint64_t lastUse) {
+    if (sizeof(RetiredResource) * (queue->resources.count + 1) > queue->resources.size) {
+        queue->resources.size = queue->resources.size == 0
+                                    ? sizeof(RetiredResource) * 32
+                                    : queue->resources.size * 2;
+        queue->resources.items = realloc(queue->resources.items, queue->resources.size);
+    }
+
+    resource.lastUse = lastUse;
+    ((RetiredResource *) queue->resources.items)[queue->resources.count++] = resource;
+}
+
+void destroyRetiredResource(const VkDevice logicalDevice, const RetiredResource *resource) {
+    switch (resource->type) {
+        case RETIRED_BUFFER:
+            vkDestroyBuffer(logicalDevice, resource->buffer, hostAllocator);
+            break;
+        case RETIRED_IMAGE:
+            vkDestroyImage(logicalDevice, resource->image, hostAllocator);
+            break;
+        case RETIRED_IMAGE_VIEW:
+            vkDestroyImageView(logicalDevice, resource->imageView, hostAllocator);
+            break;
+        case RETIRED_SAMPLER:
+            vkDestroySampler(logicalDevice, resource->sampler, hostAllocator);
+            break;
+        case RETIRED_FRAMEBUFFER:
+            vkDestroyFramebuffer(logicalDevice, resource->framebuffer, hostAllocator);
+            break;
+        case RETIRED_MEMORY:
+            freeDeviceMemory(logicalDevice, resource->memory);
+            break;
+        case RETIRED_PIPELINE:
+            vkDestroyPipeline(logicalDevice, resource->pipeline, hostAllocator);
+            break;
+        case RETIRED_PIPELINE_LAYOUT:
+            vkDestroyPipelineLayout(logicalDevice, resource->pipelineLayout, hostAllocator);
+            break;
+        case RETIRED_DESCRIPTOR_POOL:
+            vkDestroyDescriptorPool(logicalDevice, resource->descriptorPool, hostAllocator);
+            break;
+        case RETIRED_SWAP_CHAIN:
+            vkDestroySwapchainKHR(logicalDevice, resource->swapChain, hostAllocator);
+            break;
+    }
+}
+
+/**
+ * Destroys every resource whose lastUse is below completed, keeping the order
+ * of the rest. completed never moves backwards.
+ **/
+void collectRetiredResources(RetireQueue *queue, const VkDevice logicalDevice, const uint64_t completed) {
+    if (completed > queue->completed) queue->completed = completed;
+
+    RetiredResource *resources = (RetiredResource *) queue->resources.items;
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < queue->resources.count; i++) {
+        if (resources[i].lastUse < queue->completed) {
+            destroyRetiredResource(logicalDevice, &resources[i]);
+            queue->destroyed++;
+        } else resources[kept++] = resources[i];
+    }
+    queue->resources.count = kept;
+}
+
+/**
+ * Destroys everything left, the device has to be idle.
+ **/
+void destroyRetireQueue(const VkDevice logicalDevice, RetireQueue *queue) {
+    collectRetiredResources(queue, logicalDevice, UINT64_MAX);
+    printLn("Retire queue destroyed %d resources", queue->destroyed);
+
+    free(queue->resources.items);
+    queue->resources = (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0};
+}
+
+#endif //VULKAN_RETIRE_QUEUE_H
@@ -9,6 +9,8 @@
 
 #include "vulkan.h"
 #include "vulkan_frame_buffers.h"
+#include "vulkan_callbacks.h"
+#include "trace.h"
 
 typedef struct VkSwapChainSupportDetails {
     VkSurfaceCapabilitiesKHR capabilities;
@@ -59,6 +61,9 @@ void querySwapChainSupport(
     } else printLn("Surface presentModes don't exit");
 }
 
+/**
+ * createInfo's oldSwapchain is left as the caller set it.
+ **/
 void populateVkSwapchainCreateInfoKHR(
     VkSwapchainCreateInfoKHR *createInfo,
     const VkSurfaceFormatKHR surfaceFormat,
@@ -77,7 +82,6 @@ void populateVkSwapchainCreateInfoKHR(
     createInfo->imageExtent = extent;
     createInfo->imageArrayLayers = 1;
     createInfo->imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    createInfo->oldSwapchain = VK_NULL_HANDLE;
     createInfo->presentMode = presentMode;
     createInfo->clipped = VK_TRUE;
     createInfo->compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
@@ -222,7 +226,7 @@ void createSwapChain(
         familyIndices
     );
 
-    if (vkCreateSwapchainKHR(logicalDevice, &createInfo, NULL, &vkWindow->swapChain) != VK_SUCCESS) {
+    if (vkCreateSwapchainKHR(logicalDevice, &createInfo, hostAllocator, &vkWindow->swapChain) != VK_SUCCESS) {
         printLn("Failed to create swap chain!");
         exit(FAILED_TO_CREATE_SWAP_CHAIN);
     }
@@ -267,7 +271,7 @@ void createImageViews(VulkanWindow *vkWindow, const VkDevice logicalDevice) {
         createInfo.subresourceRange.layerCount = 1;
 
         VkImageView *imageView = &((VkImageView *) vkWindow->swapChainImagesViews.items)[i];
-        if (vkCreateImageView(logicalDevice, &createInfo, nullptr, imageView) != VK_SUCCESS) {
+        if (vkCreateImageView(logicalDevice, &createInfo, hostAllocator, imageView) != VK_SUCCESS) {
             printLn("Failed to create image view!");
             exit(FAILED_TO_CREATE_SWAP_CHAIN_IMAGE_VIEWS);
         }
@@ -277,15 +281,6 @@ void createImageViews(VulkanWindow *vkWindow, const VkDevice logicalDevice) {
 }
 
 void cleanUpSwapChain(VkDevice logicalDevice, VulkanWindow *vulkanWindow) {
-    VkAllocationCallbacks callbacks = {
-        .pUserData = "Smile More",
-        .pfnAllocation = pfnvkAllocationFunction,
-        .pfnReallocation = pfnvkReallocationFunction,
-        .pfnFree = pfnvkFreeFunction,
-        .pfnInternalAllocation = fn_vkInternalAllocationNotification,
-        .pfnInternalFree = pfn_vkInternalFreeNotification
-    };
-
     for (uint32_t j = 0; j < vulkanWindow->swapChainImagesViews.count; j++) {
         if (vulkanWindow->swapChainImagesViews.items == nullptr) continue;
         else printLn("Image views aren't empty");
@@ -293,21 +288,24 @@ void cleanUpSwapChain(VkDevice logicalDevice, VulkanWindow *vulkanWindow) {
         if (&imageView == nullptr) continue;
         else printLn("Current image view isn't empty");
 
-        callbacks.pUserData = "vkDestroyImageVies";
-
-        vkDestroyImageView(logicalDevice, imageView, &callbacks);
+        vkDestroyImageView(logicalDevice, imageView, hostAllocator);
 
         const VkFramebuffer frameBuffer = ((VkFramebuffer *) vulkanWindow->swapChainFrameBuffers.items)[j];
-        callbacks.pUserData = "vkDestroyFramebuffer";
-        vkDestroyFramebuffer(logicalDevice, frameBuffer, &callbacks);
+        vkDestroyFramebuffer(logicalDevice, frameBuffer, hostAllocator);
     }
+    destroyDepthImages(logicalDevice, &vulkanWindow->depthImages);
 
-    callbacks.pUserData = "vkDestroySwapchainKHR";
-    vkDestroySwapchainKHR(logicalDevice, vulkanWindow->swapChain, &callbacks);
+    vkDestroySwapchainKHR(logicalDevice, vulkanWindow->swapChain, hostAllocator);
 }
 
-void prepareSwapChain(GLFWApp *app, VkSwapChainSupportDetails *swapChainSupportDetails) {
-    const VkSwapchainCreateInfoKHR createInfo = {};
+void prepareSwapChain(
+    GLFWApp *app,
+    VkSwapChainSupportDetails *swapChainSupportDetails,
+    const VkSwapchainKHR oldSwapChain
+) {
+    const VkSwapchainCreateInfoKHR createInfo = {
+        .oldSwapchain = oldSwapChain
+    };
 
     createSwapChain(
         getCurrentVulkanWindow(*app),
@@ -318,22 +316,67 @@ void prepareSwapChain(GLFWApp *app, VkSwapChainSupportDetails *swapChainSupportD
         app->presentFamilyIndex
     );
     createImageViews(getCurrentVulkanWindow(*app), app->logicalDevice);
-    createFrameBuffers(app->logicalDevice, getCurrentVulkanWindow(*app));
+    if (getCurrentVulkanWindow(*app)->renderPass != VK_NULL_HANDLE)
+        createFrameBuffers(
+            ((VkPhysicalDevice *) app->physicalDevices->items)[app->currentPhysicalDevice],
+            app->logicalDevice,
+            getCurrentVulkanWindow(*app)
+        );
 }
 
-void recreateSwapChain(GLFWApp *app) {
+/**
+ * Replaces the swap chain without waiting for the device. The current one is
+ * handed to the new one as oldSwapchain, so frames already queued on it still
+ * present, and goes to the window's retire queue with its views and framebuffers.
+ * They're kept one frame past the last one submitted with them for the present
+ * of its image, which no fence covers.
+ * Returns false without touching anything while the window has no area,
+ * the caller tries again once it's restored.
+ **/
+bool recreateSwapChain(GLFWApp *app) {
+    TRACE_ZONE("recreateSwapChain");
     VulkanWindow *vulkanWindow = getCurrentVulkanWindow(*app);
 
     int width = 0, height = 0;
     glfwGetFramebufferSize(vulkanWindow->window, &width, &height);
-    while (width == 0 || height == 0) {
-        glfwGetFramebufferSize(vulkanWindow->window, &width, &height);
-        glfwWaitEvents();
+    if (width == 0 || height == 0) {
+        // Stays pending so the first frame after it's restored rebuilds
+        vulkanWindow->resize.pending = true;
+        return false;
     }
 
-    vkDeviceWaitIdle(app->logicalDevice);
+    RetireQueue *retireQueue = &vulkanWindow->retireQueue;
+    for (uint32_t i = 0; i < vulkanWindow->swapChainImagesViews.count; i++) {
+        retireResource(
+            retireQueue,
+            (RetiredResource){
+                .type = RETIRED_FRAMEBUFFER,
+                .framebuffer = ((VkFramebuffer *) vulkanWindow->swapChainFrameBuffers.items)[i]
+            },
+            vulkanWindow->frameNumber
+        );
+        retireResource(
+            retireQueue,
+            (RetiredResource){
+                .type = RETIRED_IMAGE_VIEW,
+                .imageView = ((VkImageView *) vulkanWindow->swapChainImagesViews.items)[i]
+            },
+            vulkanWindow->frameNumber
+        );
+    }
+    retireDepthImages(&vulkanWindow->depthImages, retireQueue, vulkanWindow->frameNumber);
+    // Destroyed after its views, the images belong to it
+    const VkSwapchainKHR oldSwapChain = vulkanWindow->swapChain;
+    retireResource(
+        retireQueue,
+        (RetiredResource){.type = RETIRED_SWAP_CHAIN, .swapChain = oldSwapChain},
+        vulkanWindow->frameNumber
+    );
+
+    free(vulkanWindow->swapChainImages.items);
+    free(vulkanWindow->swapChainImagesViews.items);
+    free(vulkanWindow->swapChainFrameBuffers.items);
 
-    cleanUpSwapChain(app->logicalDevice, getCurrentVulkanWindow(*app));
     VkSwapChainSupportDetails swapChainSupportDetails = {
         .presentModes = {
             .count = 0
@@ -347,7 +390,14 @@ void recreateSwapChain(GLFWApp *app) {
         vulkanWindow->surface,
         &swapChainSupportDetails
     );
-    prepareSwapChain(app, &swapChainSupportDetails);
+    prepareSwapChain(app, &swapChainSupportDetails, oldSwapChain);
+
+    free(swapChainSupportDetails.formats.items);
+    free(swapChainSupportDetails.presentModes.items);
+
+    completeResize(&vulkanWindow->resize, glfwGetTime());
+    printLn("Recreated swap chain at %d x %d", vulkanWindow->extent.width, vulkanWindow->extent.height);
+    return true;
 }
 
 #endif //VULKAN_SWAP_CHAIN_H
@@ -0,0 +1,932 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_TEXTURE_H
+#define VULKAN_TEXTURE_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "texture_decode.h"
+#include "vulkan_retire_queue.h"
+#include "vulkan_bindless.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+#include "trace.h"
+
+/**
+ * Sampled 2D textures. Images are decoded on worker threads, uploaded through a
+ * staging buffer on the main thread from pollTextureLoads and finished with
+ * mips blitted on the GPU. Uploads are fenced individually so the frame loop
+ * never waits on them, the staging memory is freed once the fence signals.
+ *
+ * Images and samplers live in the bindless table and shaders find them
+ * through getTextureIndex. A texture handle is valid as soon as it is
+ * requested and resolves to the default white texture until its upload has
+ * completed.
+ **/
+typedef enum TextureState {
+    TEXTURE_LOADING,
+    TEXTURE_READY,
+    TEXTURE_FAILED, // Keeps resolving to the default texture
+    TEXTURE_RELEASED // Handle is free for allocateTexture to hand out again
+} TextureState;
+
+typedef struct Texture {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    VkSampler sampler; // Owned by the sampler cache
+    uint32_t samplerSlot; // Bindless sampler slot of sampler
+    uint32_t slot; // Bindless texture slot, assigned when the upload is retired
+    VkFormat format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipLevels;
+    VkImageLayout layout; // Layout of every mip level between uploads
+    TextureState state;
+} Texture;
+
+/**
+ * Everything a sampler is created from. Compared and hashed as raw bytes so it
+ * has no padding and is always built with every field set.
+ **/
+typedef struct SamplerDescription {
+    VkFilter filter;
+    VkSamplerMipmapMode mipmapMode;
+    VkSamplerAddressMode addressMode;
+    float maxAnisotropy; // 1 or less disables anisotropic filtering
+} SamplerDescription;
+
+typedef struct SamplerCacheEntry {
+    SamplerDescription description;
+    VkSampler sampler; // VK_NULL_HANDLE marks an empty slot
+    uint32_t slot; // Bindless sampler slot
+} SamplerCacheEntry;
+
+// Power of two, open addressing. Twice MAX_SAMPLERS so probes stay short
+#define SAMPLER_CACHE_CAPACITY 64
+
+typedef struct SamplerCache {
+    SamplerCacheEntry entries[SAMPLER_CACHE_CAPACITY];
+    uint32_t count;
+    uint32_t hits;
+    uint32_t misses;
+} SamplerCache;
+
+typedef struct TextureRequest {
+    uint32_t handle;
+    char *path; // Owned by the request
+} TextureRequest;
+
+typedef struct TextureDecodeResult {
+    uint32_t handle;
+    bool decoded;
+    DecodedImage image;
+} TextureDecodeResult;
+
+#define TEXTURE_LOADER_THREADS 2
+
+/**
+ * Decode workers. Requests are taken first in first out from requestHead,
+ * results are appended and drained by the main thread.
+ **/
+typedef struct TextureLoader {
+    pthread_t threads[TEXTURE_LOADER_THREADS];
+    uint32_t threadCount;
+    pthread_mutex_t mutex;
+    pthread_cond_t requestsAvailable;
+    Uint32SizedMutableArray requests; // TextureRequest, size is the allocated bytes
+    uint32_t requestHead;
+    Uint32SizedMutableArray results; // TextureDecodeResult, size is the allocated bytes
+    bool stopping;
+} TextureLoader;
+
+typedef struct TextureUpload {
+    uint32_t handle;
+    VkBuffer stagingBuffer;
+    VkDeviceMemory stagingBufferMemory;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+} TextureUpload;
+
+typedef struct Textures {
+    VkCommandPool commandPool; // Upload command buffers, on the graphics family since mips are blitted
+    SamplerCache samplers;
+    Uint32SizedMutableArray textures; // Texture indexed by handle, size is the allocated bytes
+    Uint32SizedMutableArray uploads; // TextureUpload still in flight, size is the allocated bytes
+    Uint32SizedMutableArray freeHandles; // uint32_t released by releaseTexture, size is the allocated bytes
+    TextureLoader loader;
+    float maxAnisotropy; // 0 when samplerAnisotropy isn't enabled on the device
+    bool compressionBC; // textureCompressionBC is enabled on the device
+} Textures;
+
+constexpr uint32_t DEFAULT_TEXTURE = 0; // 1x1 white, what every unready handle resolves to
+constexpr uint32_t TEXTURE_UPLOADS_PER_POLL = 4; // Bounds the staging copies recorded in one frame
+
+const SamplerDescription DEFAULT_SAMPLER = {
+    .filter = VK_FILTER_LINEAR,
+    .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+    .addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT,
+    .maxAnisotropy = 16.0f
+};
+
+void reserveTextureArray(Uint32SizedMutableArray *array, const size_t itemSize, const uint32_t count) {
+    if (itemSize * count <= array->size) return;
+
+    array->size = array->size == 0 ? itemSize * 16 : array->size * 2;
+    while (array->size < itemSize * count) array->size *= 2;
+    array->items = realloc(array->items, array->size);
+}
+
+Texture *getTexture(const Textures *textures, const uint32_t handle) {
+    return &((Texture *) textures->textures.items)[handle];
+}
+
+/**
+ * What shaders index the bindless table with, InstanceData.texture:
+ * the texture slot in the low 16 bits and its sampler slot in the high 16.
+ * Resolves to the default texture until handle is ready.
+ **/
+uint32_t getTextureIndex(const Textures *textures, const uint32_t handle) {
+    const Texture *texture = handle < textures->textures.count ? getTexture(textures, handle) : nullptr;
+    if (texture == nullptr || texture->state != TEXTURE_READY) texture = getTexture(textures, DEFAULT_TEXTURE);
+    return texture->slot | texture->samplerSlot << 16;
+}
+
+uint32_t hashSamplerDescription(const SamplerDescription *description) {
+    // FNV-1a over the description bytes
+    const uint8_t *bytes = (const uint8_t *) description;
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(SamplerDescription); i++) hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * Returns the sampler for description, creating it on first use.
+ * Anisotropy is clamped to what the device allows before lookup so requests
+ * that end up with the same sampler share the same entry.
+ **/
+SamplerCacheEntry *getCachedSampler(
+    Textures *textures,
+    BindlessTable *table,
+    const VkDevice logicalDevice,
+    SamplerDescription description
+) {
+    if (description.maxAnisotropy > textures->maxAnisotropy) description.maxAnisotropy = textures->maxAnisotropy;
+    if (description.maxAnisotropy <= 1.0f) description.maxAnisotropy = 0.0f;
+
+    SamplerCache *cache = &textures->samplers;
+    uint32_t slot = hashSamplerDescription(&description) & (SAMPLER_CACHE_CAPACITY - 1);
+
+    while (cache->entries[slot].sampler != VK_NULL_HANDLE) {
+        if (memcmp(&cache->entries[slot].description, &description, sizeof(SamplerDescription)) == 0) {
+            cache->hits++;
+            return &cache->entries[slot];
+        }
+        slot = (slot + 1) & (SAMPLER_CACHE_CAPACITY - 1);
+    }
+
+    const VkSamplerCreateInfo samplerInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = description.filter,
+        .minFilter = description.filter,
+        .mipmapMode = description.mipmapMode,
+        .addressModeU = description.addressMode,
+        .addressModeV = description.addressMode,
+        .addressModeW = description.addressMode,
+        .anisotropyEnable = description.maxAnisotropy > 1.0f ? VK_TRUE : VK_FALSE,
+        .maxAnisotropy = description.maxAnisotropy > 1.0f ? description.maxAnisotropy : 1.0f,
+        .borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK,
+        .compareOp = VK_COMPARE_OP_ALWAYS,
+        .minLod = 0.0f,
+        .maxLod = VK_LOD_CLAMP_NONE
+    };
+
+    SamplerCacheEntry *entry = &cache->entries[slot];
+    if (vkCreateSampler(logicalDevice, &samplerInfo, hostAllocator, &entry->sampler) != VK_SUCCESS) {
+        printLn("Failed to create texture sampler");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+
+    // Exits before the cache can fill up since MAX_SAMPLERS is half its capacity
+    entry->slot = allocateBindlessSlot(table, BINDLESS_SAMPLERS);
+    writeBindlessSampler(table, logicalDevice, entry->slot, entry->sampler);
+
+    entry->description = description;
+    cache->count++;
+    cache->misses++;
+    return entry;
+}
+
+Any runTextureLoader(Any data) {
+    TextureLoader *loader = data;
+    setTraceThreadName("texture decode");
+
+    pthread_mutex_lock(&loader->mutex);
+    for (;;) {
+        while (!loader->stopping && loader->requestHead == loader->requests.count)
+            pthread_cond_wait(&loader->requestsAvailable, &loader->mutex);
+        if (loader->stopping) break;
+
+        const TextureRequest request = ((TextureRequest *) loader->requests.items)[loader->requestHead++];
+        if (loader->requestHead == loader->requests.count) loader->requestHead = loader->requests.count = 0;
+        pthread_mutex_unlock(&loader->mutex);
+
+        const TraceZone zone = beginTraceZone("decode texture");
+        TextureDecodeResult result = {.handle = request.handle};
+        result.decoded = decodeImage(request.path, &result.image);
+        free(request.path);
+        endTraceZone(&zone);
+
+        pthread_mutex_lock(&loader->mutex);
+        reserveTextureArray(&loader->results, sizeof(TextureDecodeResult), loader->results.count + 1);
+        ((TextureDecodeResult *) loader->results.items)[loader->results.count++] = result;
+    }
+    pthread_mutex_unlock(&loader->mutex);
+
+    return nullptr;
+}
+
+void startTextureLoader(TextureLoader *loader) {
+    *loader = (TextureLoader){};
+    pthread_mutex_init(&loader->mutex, nullptr);
+    pthread_cond_init(&loader->requestsAvailable, nullptr);
+
+    for (uint32_t i = 0; i < TEXTURE_LOADER_THREADS; i++) {
+        if (pthread_create(&loader->threads[loader->threadCount], nullptr, runTextureLoader, loader) != 0) {
+            printLn("Failed to start texture loader thread %d", i);
+            continue;
+        }
+        loader->threadCount++;
+    }
+
+    if (loader->threadCount == 0) {
+        printLn("No texture loader threads could be started");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+}
+
+void stopTextureLoader(TextureLoader *loader) {
+    pthread_mutex_lock(&loader->mutex);
+    loader->stopping = true;
+    pthread_cond_broadcast(&loader->requestsAvailable);
+    pthread_mutex_unlock(&loader->mutex);
+
+    for (uint32_t i = 0; i < loader->threadCount; i++) pthread_join(loader->threads[i], nullptr);
+
+    for (uint32_t i = loader->requestHead; i < loader->requests.count; i++)
+        free(((TextureRequest *) loader->requests.items)[i].path);
+    for (uint32_t i = 0; i < loader->results.count; i++)
+        freeDecodedImage(&((TextureDecodeResult *) loader->results.items)[i].image);
+
+    free(loader->requests.items);
+    free(loader->results.items);
+    pthread_cond_destroy(&loader->requestsAvailable);
+    pthread_mutex_destroy(&loader->mutex);
+}
+
+VkAccessFlags getLayoutAccessMask(const VkImageLayout layout) {
+    switch (layout) {
+        case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+            return VK_ACCESS_TRANSFER_WRITE_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+            return VK_ACCESS_TRANSFER_READ_BIT;
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+            return VK_ACCESS_SHADER_READ_BIT;
+        default:
+            return 0;
+    }
+}
+
+VkPipelineStageFlags getLayoutStageMask(const VkImageLayout layout) {
+    switch (layout) {
+        case VK_IMAGE_LAYOUT_UNDEFINED:
+            return VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+        case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+            return VK_PIPELINE_STAGE_TRANSFER_BIT;
+        case VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL:
+            return VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        default:
+            return VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    }
+}
+
+/**
+ * Moves mip levels [baseMipLevel, baseMipLevel + levelCount) between layouts,
+ * with the stages and accesses implied by each layout.
+ **/
+void transitionImageLayout(
+    const VkCommandBuffer commandBuffer,
+    const VkImage image,
+    const uint32_t baseMipLevel,
+    const uint32_t levelCount,
+    const VkImageLayout oldLayout,
+    const VkImageLayout newLayout
+) {
+    const VkImageMemoryBarrier barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+        .srcAccessMask = getLayoutAccessMask(oldLayout),
+        .dstAccessMask = getLayoutAccessMask(newLayout),
+        .oldLayout = oldLayout,
+        .newLayout = newLayout,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = image,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = baseMipLevel,
+            .levelCount = levelCount,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+
+    vkCmdPipelineBarrier(
+        commandBuffer,
+        getLayoutStageMask(oldLayout),
+        getLayoutStageMask(newLayout),
+        0,
+        0,
+        nullptr,
+        0,
+        nullptr,
+        1,
+        &barrier
+    );
+}
+
+/**
+ * Whether the device can sample format at all, and can blit it with linear
+ * filtering for mip generation.
+ **/
+bool isTextureFormatSupported(
+    const Textures *textures,
+    const VkPhysicalDevice physicalDevice,
+    const DecodedImage *image,
+    bool *canBlit
+) {
+    VkFormatProperties properties;
+    vkGetPhysicalDeviceFormatProperties(physicalDevice, image->format, &properties);
+
+    constexpr VkFormatFeatureFlags blitFeatures = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                                 VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    *canBlit = (properties.optimalTilingFeatures & blitFeatures) == blitFeatures;
+
+    if (image->blockSize != 0 && !textures->compressionBC) return false;
+    return (properties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT) != 0;
+}
+
+void createTextureImage(Texture *texture, const VkPhysicalDevice physicalDevice, const VkDevice logicalDevice) {
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = texture->format,
+        .extent = {texture->width, texture->height, 1},
+        .mipLevels = texture->mipLevels,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        // Every level is a blit source while the next one is generated
+        .usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+
+    if (vkCreateImage(logicalDevice, &imageInfo, hostAllocator, &texture->image) != VK_SUCCESS) {
+        printLn("Failed to create %dx%d texture image", texture->width, texture->height);
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, texture->image, &memRequirements);
+
+    const VkMemoryAllocateInfo allocInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .allocationSize = memRequirements.size,
+        .memoryTypeIndex = findMemoryType(
+            physicalDevice,
+            memRequirements.memoryTypeBits,
+            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+        )
+    };
+
+    if (allocateDeviceMemory(logicalDevice, &allocInfo, &texture->memory) != VK_SUCCESS) {
+        printLn("Failed to allocate texture memory");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+    vkBindImageMemory(logicalDevice, texture->image, texture->memory, 0);
+
+    const VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = texture->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = texture->format,
+        .subresourceRange = {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = texture->mipLevels,
+            .baseArrayLayer = 0,
+            .layerCount = 1
+        }
+    };
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, hostAllocator, &texture->view) != VK_SUCCESS) {
+        printLn("Failed to create texture image view");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+
+    texture->layout = VK_IMAGE_LAYOUT_UNDEFINED;
+}
+
+/**
+ * Copies the levels present in the staging buffer and, when the image has
+ * more levels than that, blits each one from the level above it.
+ * Leaves every level in SHADER_READ_ONLY_OPTIMAL.
+ **/
+void recordTextureUpload(
+    const VkCommandBuffer commandBuffer,
+    Texture *texture,
+    const VkBuffer stagingBuffer,
+    const DecodedImage *image
+) {
+    transitionImageLayout(
+        commandBuffer,
+        texture->image,
+        0,
+        texture->mipLevels,
+        texture->layout,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+    );
+
+    VkBufferImageCopy regions[TEXTURE_MAX_MIP_LEVELS];
+    for (uint32_t level = 0; level < image->mipLevels; level++) {
+        regions[level] = (VkBufferImageCopy){
+            .bufferOffset = image->mipOffsets[level],
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .imageOffset = {0, 0, 0},
+            .imageExtent = {getMipDimension(image->width, level), getMipDimension(image->height, level), 1}
+        };
+    }
+    vkCmdCopyBufferToImage(
+        commandBuffer,
+        stagingBuffer,
+        texture->image,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        image->mipLevels,
+        regions
+    );
+
+    for (uint32_t level = image->mipLevels; level < texture->mipLevels; level++) {
+        transitionImageLayout(
+            commandBuffer,
+            texture->image,
+            level - 1,
+            1,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+        );
+
+        const VkImageBlit blit = {
+            .srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1},
+            .srcOffsets = {
+                {0, 0, 0},
+                {
+                    (int32_t) getMipDimension(texture->width, level - 1),
+                    (int32_t) getMipDimension(texture->height, level - 1),
+                    1
+                }
+            },
+            .dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1},
+            .dstOffsets = {
+                {0, 0, 0},
+                {(int32_t) getMipDimension(texture->width, level), (int32_t) getMipDimension(texture->height, level), 1}
+            }
+        };
+        vkCmdBlitImage(
+            commandBuffer,
+            texture->image,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            texture->image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &blit,
+            VK_FILTER_LINEAR
+        );
+
+        transitionImageLayout(
+            commandBuffer,
+            texture->image,
+            level - 1,
+            1,
+            VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        );
+    }
+
+    // The copied levels when nothing was generated, otherwise only the last one is left
+    const uint32_t remaining = texture->mipLevels > image->mipLevels ? texture->mipLevels - 1 : 0;
+    transitionImageLayout(
+        commandBuffer,
+        texture->image,
+        remaining,
+        texture->mipLevels - remaining,
+        VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    );
+
+    texture->layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+}
+
+/**
+ * Creates the image for a decoded texture and submits its upload without
+ * waiting. Returns false, leaving the texture unready, for formats the device
+ * can't sample.
+ **/
+bool submitTextureUpload(
+    Textures *textures,
+    const uint32_t handle,
+    const DecodedImage *image,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue,
+    TextureUpload *upload
+) {
+    TRACE_ZONE("texture upload");
+    bool canBlit;
+    if (!isTextureFormatSupported(textures, physicalDevice, image, &canBlit)) {
+        printLn("Texture %d has format %d which the device can't sample", handle, image->format);
+        return false;
+    }
+
+    Texture *texture = getTexture(textures, handle);
+    texture->format = image->format;
+    texture->width = image->width;
+    texture->height = image->height;
+    texture->mipLevels = image->generateMips && canBlit
+                             ? getFullMipLevelCount(image->width, image->height)
+                             : image->mipLevels;
+    createTextureImage(texture, physicalDevice, logicalDevice);
+
+    *upload = (TextureUpload){.handle = handle};
+    VkMemoryRequirements memRequirements;
+    createBuffer(
+        &upload->stagingBuffer,
+        image->size,
+        &upload->stagingBufferMemory,
+        &memRequirements,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+
+    Any data;
+    vkMapMemory(logicalDevice, upload->stagingBufferMemory, 0, image->size, 0, &data);
+    memcpy(data, image->data, image->size);
+    vkUnmapMemory(logicalDevice, upload->stagingBufferMemory);
+
+    upload->commandBuffer = beginSingleTimeCommands(textures->commandPool, logicalDevice);
+    recordTextureUpload(upload->commandBuffer, texture, upload->stagingBuffer, image);
+    vkEndCommandBuffer(upload->commandBuffer);
+
+    const VkFenceCreateInfo fenceInfo = {.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    vkCreateFence(logicalDevice, &fenceInfo, hostAllocator, &upload->fence);
+
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &upload->commandBuffer
+    };
+    if (vkQueueSubmit(graphicsQueue, 1, &submitInfo, upload->fence) != VK_SUCCESS) {
+        printLn("Failed to submit texture upload");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+
+    return true;
+}
+
+/**
+ * Called once the upload's fence has signalled: frees the staging memory and
+ * writes the image to a free bindless slot, after which handle resolves to it.
+ * No recorded frame reads a free slot so it is written while the table is bound.
+ **/
+void retireTextureUpload(
+    Textures *textures,
+    BindlessTable *table,
+    const TextureUpload *upload,
+    const VkDevice logicalDevice
+) {
+    vkDestroyFence(logicalDevice, upload->fence, hostAllocator);
+    vkFreeCommandBuffers(logicalDevice, textures->commandPool, 1, &upload->commandBuffer);
+    vkDestroyBuffer(logicalDevice, upload->stagingBuffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, upload->stagingBufferMemory);
+
+    Texture *texture = getTexture(textures, upload->handle);
+    texture->slot = allocateBindlessSlot(table, BINDLESS_TEXTURES);
+    writeBindlessTexture(table, logicalDevice, texture->slot, texture->view, texture->layout);
+
+    texture->state = TEXTURE_READY;
+}
+
+/**
+ * Reserves a handle. The texture stays TEXTURE_LOADING until an upload for it
+ * is retired.
+ **/
+uint32_t allocateTexture(
+    Textures *textures,
+    BindlessTable *table,
+    const VkDevice logicalDevice,
+    const SamplerDescription sampler
+) {
+    uint32_t handle;
+    if (textures->freeHandles.count > 0) {
+        handle = ((uint32_t *) textures->freeHandles.items)[--textures->freeHandles.count];
+    } else {
+        if (textures->textures.count == MAX_TEXTURES) {
+            printLn("Texture capacity of %d reached", MAX_TEXTURES);
+            exit(TEXTURE_CAPACITY_EXCEEDED);
+        }
+
+        reserveTextureArray(&textures->textures, sizeof(Texture), textures->textures.count + 1);
+        handle = textures->textures.count++;
+    }
+    const SamplerCacheEntry *samplerEntry = getCachedSampler(textures, table, logicalDevice, sampler);
+    *getTexture(textures, handle) = (Texture){
+        .sampler = samplerEntry->sampler,
+        .samplerSlot = samplerEntry->slot,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .state = TEXTURE_LOADING
+    };
+
+    return handle;
+}
+
+/**
+ * Gives handle up while frames that sample it may still be in flight.
+ * It resolves to the default texture straight away, its image is destroyed by
+ * retireQueue and its bindless slot is reused once lastUse completes. The
+ * handle itself may be returned by the next allocateTexture.
+ * A texture still loading can't be released, its upload would land on the reused handle.
+ **/
+bool releaseTexture(
+    Textures *textures,
+    BindlessTable *table,
+    RetireQueue *retireQueue,
+    const uint32_t handle,
+    const uint64_t lastUse
+) {
+    if (handle == DEFAULT_TEXTURE || handle >= textures->textures.count) return false;
+
+    Texture *texture = getTexture(textures, handle);
+    if (texture->state == TEXTURE_LOADING || texture->state == TEXTURE_RELEASED) {
+        printLn("Texture %d can't be released while %s", handle, texture->state == TEXTURE_LOADING ? "loading" : "released");
+        return false;
+    }
+
+    if (texture->state == TEXTURE_READY) releaseBindlessSlot(table, BINDLESS_TEXTURES, texture->slot, lastUse);
+
+    // Failed textures never got as far as creating an image
+    if (texture->image != VK_NULL_HANDLE) {
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE_VIEW, .imageView = texture->view}, lastUse);
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_IMAGE, .image = texture->image}, lastUse);
+        retireResource(retireQueue, (RetiredResource){.type = RETIRED_MEMORY, .memory = texture->memory}, lastUse);
+    }
+
+    *texture = (Texture){
+        .image = VK_NULL_HANDLE,
+        .memory = VK_NULL_HANDLE,
+        .view = VK_NULL_HANDLE,
+        .layout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .state = TEXTURE_RELEASED
+    };
+
+    reserveTextureArray(&textures->freeHandles, sizeof(uint32_t), textures->freeHandles.count + 1);
+    ((uint32_t *) textures->freeHandles.items)[textures->freeHandles.count++] = handle;
+    return true;
+}
+
+/**
+ * Queues path for decoding and returns its handle straight away.
+ **/
+uint32_t requestTextureLoad(
+    Textures *textures,
+    BindlessTable *table,
+    const VkDevice logicalDevice,
+    const char *path,
+    const SamplerDescription sampler
+) {
+    const uint32_t handle = allocateTexture(textures, table, logicalDevice, sampler);
+    TextureLoader *loader = &textures->loader;
+
+    pthread_mutex_lock(&loader->mutex);
+    reserveTextureArray(&loader->requests, sizeof(TextureRequest), loader->requests.count + 1);
+    ((TextureRequest *) loader->requests.items)[loader->requests.count++] = (TextureRequest){
+        .handle = handle,
+        .path = strdup(path)
+    };
+    pthread_cond_signal(&loader->requestsAvailable);
+    pthread_mutex_unlock(&loader->mutex);
+
+    return handle;
+}
+
+/**
+ * Uploads an image that is already in memory, skipping the decode threads.
+ * The handle resolves to the default texture until pollTextureLoads retires
+ * the upload. image can be freed as soon as this returns.
+ **/
+uint32_t uploadTexture(
+    Textures *textures,
+    BindlessTable *table,
+    const DecodedImage *image,
+    const SamplerDescription sampler,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    const uint32_t handle = allocateTexture(textures, table, logicalDevice, sampler);
+
+    TextureUpload upload;
+    if (!submitTextureUpload(textures, handle, image, physicalDevice, logicalDevice, graphicsQueue, &upload)) {
+        getTexture(textures, handle)->state = TEXTURE_FAILED;
+        return handle;
+    }
+
+    reserveTextureArray(&textures->uploads, sizeof(TextureUpload), textures->uploads.count + 1);
+    ((TextureUpload *) textures->uploads.items)[textures->uploads.count++] = upload;
+    return handle;
+}
+
+/**
+ * Main thread side of the loader, called once per frame. Retires uploads whose
+ * fence has signalled, then submits up to TEXTURE_UPLOADS_PER_POLL decoded
+ * images. Never waits on the GPU or on the decode threads.
+ **/
+void pollTextureLoads(
+    Textures *textures,
+    BindlessTable *table,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
+    TRACE_ZONE("poll texture loads");
+    for (uint32_t i = 0; i < textures->uploads.count;) {
+        TextureUpload *uploads = (TextureUpload *) textures->uploads.items;
+        if (vkGetFenceStatus(logicalDevice, uploads[i].fence) != VK_SUCCESS) {
+            i++;
+            continue;
+        }
+        retireTextureUpload(textures, table, &uploads[i], logicalDevice);
+        uploads[i] = uploads[--textures->uploads.count];
+    }
+
+    TextureLoader *loader = &textures->loader;
+    TextureDecodeResult results[TEXTURE_UPLOADS_PER_POLL];
+    uint32_t resultCount = 0;
+
+    // trylock so a worker holding the lock never stalls the frame
+    if (pthread_mutex_trylock(&loader->mutex) != 0) return;
+    resultCount = loader->results.count < TEXTURE_UPLOADS_PER_POLL ? loader->results.count : TEXTURE_UPLOADS_PER_POLL;
+    memcpy(results, loader->results.items, sizeof(TextureDecodeResult) * resultCount);
+    memmove(
+        loader->results.items,
+        (TextureDecodeResult *) loader->results.items + resultCount,
+        sizeof(TextureDecodeResult) * (loader->results.count - resultCount)
+    );
+    loader->results.count -= resultCount;
+    pthread_mutex_unlock(&loader->mutex);
+
+    for (uint32_t i = 0; i < resultCount; i++) {
+        TextureUpload upload;
+        if (
+            results[i].decoded &&
+            submitTextureUpload(
+                textures,
+                results[i].handle,
+                &results[i].image,
+                physicalDevice,
+                logicalDevice,
+                graphicsQueue,
+                &upload
+            )
+        ) {
+            reserveTextureArray(&textures->uploads, sizeof(TextureUpload), textures->uploads.count + 1);
+            ((TextureUpload *) textures->uploads.items)[textures->uploads.count++] = upload;
+        } else getTexture(textures, results[i].handle)->state = TEXTURE_FAILED;
+
+        freeDecodedImage(&results[i].image);
+    }
+}
+
+/**
+ * Sets up the decode threads and DEFAULT_TEXTURE, which is uploaded
+ * synchronously so there is always something to resolve handles to.
+ * Being the first texture and sampler it takes slot 0 of both, so a zeroed
+ * InstanceData.texture samples it.
+ * maxAnisotropy is 0 and compressionBC false unless the features were enabled
+ * on the logical device.
+ **/
+void createTextures(
+    Textures *textures,
+    BindlessTable *table,
+    const float maxAnisotropy,
+    const bool compressionBC,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice,
+    const uint32_t queueFamilyIndex,
+    const VkQueue graphicsQueue
+) {
+    *textures = (Textures){
+        .maxAnisotropy = maxAnisotropy,
+        .compressionBC = compressionBC
+    };
+
+    const VkCommandPoolCreateInfo poolInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+        .queueFamilyIndex = queueFamilyIndex
+    };
+    if (vkCreateCommandPool(logicalDevice, &poolInfo, hostAllocator, &textures->commandPool) != VK_SUCCESS) {
+        printLn("Failed to create texture upload command pool");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+
+    const uint32_t defaultTexture = allocateTexture(textures, table, logicalDevice, DEFAULT_SAMPLER);
+    uint8_t white[4] = {255, 255, 255, 255};
+    const DecodedImage image = {
+        .format = VK_FORMAT_R8G8B8A8_UNORM,
+        .width = 1,
+        .height = 1,
+        .mipLevels = 1,
+        .data = white,
+        .size = sizeof(white)
+    };
+
+    TextureUpload upload;
+    if (!submitTextureUpload(textures, defaultTexture, &image, physicalDevice, logicalDevice, graphicsQueue, &upload)) {
+        printLn("Failed to upload the default texture");
+        exit(FAILED_TO_CREATE_TEXTURE);
+    }
+    vkWaitForFences(logicalDevice, 1, &upload.fence, VK_TRUE, UINT64_MAX);
+    retireTextureUpload(textures, table, &upload, logicalDevice);
+
+    startTextureLoader(&textures->loader);
+
+    printLn(
+        "Created textures with %d decode threads, anisotropy %.1f, BC compression %d",
+        textures->loader.threadCount,
+        maxAnisotropy,
+        compressionBC
+    );
+}
+
+/**
+ * The device has to be idle, uploads still in flight are dropped.
+ **/
+void destroyTextures(const VkDevice logicalDevice, Textures *textures) {
+    stopTextureLoader(&textures->loader);
+
+    for (uint32_t i = 0; i < textures->uploads.count; i++) {
+        const TextureUpload upload = ((TextureUpload *) textures->uploads.items)[i];
+        vkDestroyFence(logicalDevice, upload.fence, hostAllocator);
+        vkDestroyBuffer(logicalDevice, upload.stagingBuffer, hostAllocator);
+        freeDeviceMemory(logicalDevice, upload.stagingBufferMemory);
+    }
+
+    for (uint32_t i = 0; i < textures->textures.count; i++) {
+        const Texture *texture = getTexture(textures, i);
+        if (texture->image == VK_NULL_HANDLE) continue;
+        vkDestroyImageView(logicalDevice, texture->view, hostAllocator);
+        vkDestroyImage(logicalDevice, texture->image, hostAllocator);
+        freeDeviceMemory(logicalDevice, texture->memory);
+    }
+
+    for (uint32_t i = 0; i < SAMPLER_CACHE_CAPACITY; i++)
+        if (textures->samplers.entries[i].sampler != VK_NULL_HANDLE)
+            vkDestroySampler(logicalDevice, textures->samplers.entries[i].sampler, hostAllocator);
+
+    printLn(
+        "Sampler cache: %d samplers, %d hits, %d misses",
+        textures->samplers.count,
+        textures->samplers.hits,
+        textures->samplers.misses
+    );
+
+    free(textures->textures.items);
+    free(textures->uploads.items);
+    free(textures->freeHandles.items);
+    vkDestroyCommandPool(logicalDevice, textures->commandPool, hostAllocator);
+}
+
+#endif //VULKAN_TEXTURE_H
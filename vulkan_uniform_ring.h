@@ -0,0 +1,285 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_UNIFORM_RING_H
+#define VULKAN_UNIFORM_RING_H
+
+#include <vulkan/vulkan.h>
+#include <stdlib.h>
+#include <string.h>
+#include "constants.h"
+#include "array.h"
+#include "io.h"
+#include "vulkan_vertex.h"
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+
+/**
+ * Per frame uniform data without per frame buffers or descriptor writes.
+ * One persistently mapped buffer is split into a region per frame in flight
+ * and allocations are bumped through the current frame's region, each
+ * rounded up to the device's offset alignment.
+ * A single descriptor set (set 1) points at the buffer as a dynamic uniform
+ * buffer, every draw selects its block with the dynamic offset it binds with.
+ **/
+typedef struct UniformRing {
+    VkBuffer buffer;
+    VkDeviceMemory memory;
+    uint8_t *mapped; // Stays mapped for the lifetime of the buffer
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
+    VkDeviceSize alignment; // minUniformBufferOffsetAlignment and minStorageBufferOffsetAlignment
+    VkDeviceSize frameSize; // Bytes per frame in flight
+    VkDeviceSize frameStart;
+    VkDeviceSize cursor; // Next free byte, relative to frameStart
+    uint32_t frame;
+} UniformRing;
+
+/**
+ * What set 1 binding 0 holds for a frame, FrameUniforms in triangle.vert (std140).
+ * The camera transform is the inverse of an instance transform: translate by
+ * -position, rotate by -rotation and then scale by zoom.
+ **/
+typedef struct FrameUniforms {
+    Vector2D cameraPosition;
+    Vector2D cameraScale;
+    float cameraRotation;
+    float padding[3];
+} FrameUniforms;
+
+typedef struct Camera2D {
+    Vector2D position;
+    float zoom;
+    float rotation; // Radians
+} Camera2D;
+
+/**
+ * Per draw data in push constants. transform is applied to every instance of
+ * the draw before the camera, which screenSpace skips.
+ **/
+typedef struct DrawPushConstants {
+    Vector2D translation;
+    Vector2D scale;
+    float rotation;
+    uint32_t screenSpace;
+} DrawPushConstants;
+
+// The range set 1 binding 0 exposes from a dynamic offset, the most a single block can be
+#define UNIFORM_RING_BLOCK_SIZE 256
+
+const DrawPushConstants IDENTITY_DRAW = {
+    .translation = {0.0f, 0.0f},
+    .scale = {1.0f, 1.0f},
+    .rotation = 0.0f,
+    .screenSpace = 0
+};
+
+VkDeviceSize alignUniformRingSize(const VkDeviceSize size, const VkDeviceSize alignment) {
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+void createUniformRingDescriptors(UniformRing *ring, const VkDevice logicalDevice) {
+    const VkDescriptorSetLayoutBinding binding = {
+        .binding = 0,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1,
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
+    };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = 1;
+    layoutInfo.pBindings = &binding;
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, hostAllocator, &ring->descriptorSetLayout) != VK_SUCCESS) {
+        printLn("Failed to create uniform ring descriptor set layout");
+        exit(FAILED_TO_CREATE_UNIFORM_RING);
+    }
+
+    const VkDescriptorPoolSize poolSize = {
+        .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .descriptorCount = 1
+    };
+
+    VkDescriptorPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    poolInfo.poolSizeCount = 1;
+    poolInfo.pPoolSizes = &poolSize;
+    poolInfo.maxSets = 1;
+
+    if (vkCreateDescriptorPool(logicalDevice, &poolInfo, hostAllocator, &ring->descriptorPool) != VK_SUCCESS) {
+        printLn("Failed to create uniform ring descriptor pool");
+        exit(FAILED_TO_CREATE_UNIFORM_RING);
+    }
+
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = ring->descriptorPool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &ring->descriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &ring->descriptorSet) != VK_SUCCESS) {
+        printLn("Failed to allocate the uniform ring descriptor set");
+        exit(FAILED_TO_CREATE_UNIFORM_RING);
+    }
+
+    // Written once, only the dynamic offset changes afterwards
+    const VkDescriptorBufferInfo bufferInfo = {
+        .buffer = ring->buffer,
+        .offset = 0,
+        .range = UNIFORM_RING_BLOCK_SIZE
+    };
+    const VkWriteDescriptorSet write = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstSet = ring->descriptorSet,
+        .dstBinding = 0,
+        .dstArrayElement = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC,
+        .pBufferInfo = &bufferInfo
+    };
+    vkUpdateDescriptorSets(logicalDevice, 1, &write, 0, nullptr);
+}
+
+void createUniformRing(
+    UniformRing *ring,
+    const VkDeviceSize frameSize,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
+) {
+    VkPhysicalDeviceProperties deviceProperties = {};
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+
+    const VkDeviceSize uniformAlignment = deviceProperties.limits.minUniformBufferOffsetAlignment;
+    const VkDeviceSize storageAlignment = deviceProperties.limits.minStorageBufferOffsetAlignment;
+
+    *ring = (UniformRing){
+        .alignment = uniformAlignment > storageAlignment ? uniformAlignment : storageAlignment
+    };
+    if (ring->alignment == 0) ring->alignment = 1;
+    // Regions start aligned, the extra block at the end keeps the binding's
+    // full range inside the buffer for an allocation at the very end
+    ring->frameSize = alignUniformRingSize(frameSize, ring->alignment);
+
+    VkMemoryRequirements memRequirements;
+    createBuffer(
+        &ring->buffer,
+        ring->frameSize * MAX_FRAMES_IN_FLIGHT + UNIFORM_RING_BLOCK_SIZE,
+        &ring->memory,
+        &memRequirements,
+        VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        physicalDevice,
+        logicalDevice
+    );
+    vkMapMemory(
+        logicalDevice,
+        ring->memory,
+        0,
+        ring->frameSize * MAX_FRAMES_IN_FLIGHT + UNIFORM_RING_BLOCK_SIZE,
+        0,
+        (Any *) &ring->mapped
+    );
+
+    createUniformRingDescriptors(ring, logicalDevice);
+
+    printLn(
+        "Created uniform ring of %d bytes per frame aligned to %d bytes",
+        (uint32_t) ring->frameSize,
+        (uint32_t) ring->alignment
+    );
+}
+
+/**
+ * Starts frame's region over, the frame's fence has to have been waited on.
+ **/
+void beginUniformRing(UniformRing *ring, const uint32_t frame) {
+    ring->frame = frame;
+    ring->frameStart = ring->frameSize * frame;
+    ring->cursor = 0;
+}
+
+/**
+ * Reserves size bytes in the current frame and returns where to write them.
+ * dynamicOffset is what to bind set 1 with to read them at binding 0.
+ **/
+Any allocateUniformRing(UniformRing *ring, const VkDeviceSize size, uint32_t *dynamicOffset) {
+    const VkDeviceSize alignedSize = alignUniformRingSize(size, ring->alignment);
+
+    if (size > UNIFORM_RING_BLOCK_SIZE || ring->cursor + alignedSize > ring->frameSize) {
+        printLn(
+            "Uniform ring can't fit %d bytes, %d of %d used this frame",
+            (uint32_t) size,
+            (uint32_t) ring->cursor,
+            (uint32_t) ring->frameSize
+        );
+        exit(UNIFORM_RING_CAPACITY_EXCEEDED);
+    }
+
+    *dynamicOffset = (uint32_t) (ring->frameStart + ring->cursor);
+    ring->cursor += alignedSize;
+    return ring->mapped + *dynamicOffset;
+}
+
+uint32_t pushUniformRing(UniformRing *ring, const Any data, const VkDeviceSize size) {
+    uint32_t dynamicOffset;
+    memcpy(allocateUniformRing(ring, size, &dynamicOffset), data, size);
+    return dynamicOffset;
+}
+
+/**
+ * Writes camera for the current frame and returns the offset to bind it with.
+ **/
+uint32_t pushFrameUniforms(UniformRing *ring, const Camera2D *camera) {
+    const FrameUniforms uniforms = {
+        .cameraPosition = camera->position,
+        .cameraScale = {camera->zoom, camera->zoom},
+        .cameraRotation = camera->rotation
+    };
+    return pushUniformRing(ring, (Any) &uniforms, sizeof(FrameUniforms));
+}
+
+void bindUniformRing(
+    const VkCommandBuffer commandBuffer,
+    const UniformRing *ring,
+    const VkPipelineLayout pipelineLayout,
+    const uint32_t dynamicOffset
+) {
+    vkCmdBindDescriptorSets(
+        commandBuffer,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        pipelineLayout,
+        1,
+        1,
+        &ring->descriptorSet,
+        1,
+        &dynamicOffset
+    );
+}
+
+void pushDrawConstants(
+    const VkCommandBuffer commandBuffer,
+    const VkPipelineLayout pipelineLayout,
+    const DrawPushConstants *constants
+) {
+    vkCmdPushConstants(
+        commandBuffer,
+        pipelineLayout,
+        VK_SHADER_STAGE_VERTEX_BIT,
+        0,
+        sizeof(DrawPushConstants),
+        constants
+    );
+}
+
+void destroyUniformRing(const VkDevice logicalDevice, UniformRing *ring) {
+    vkDestroyDescriptorPool(logicalDevice, ring->descriptorPool, hostAllocator);
+    vkDestroyDescriptorSetLayout(logicalDevice, ring->descriptorSetLayout, hostAllocator);
+    vkUnmapMemory(logicalDevice, ring->memory);
+    vkDestroyBuffer(logicalDevice, ring->buffer, hostAllocator);
+    freeDeviceMemory(logicalDevice, ring->memory);
+}
+
+#endif //VULKAN_UNIFORM_RING_H
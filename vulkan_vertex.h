@@ -5,6 +5,10 @@
 #ifndef VULKAN_VERTEX_H
 #define VULKAN_VERTEX_H
 
+#include <stddef.h>
+#include "vulkan_callbacks.h"
+#include "vulkan_memory_budget.h"
+
 typedef struct Vector2D {
     float x;
     float y;
@@ -19,34 +23,40 @@ typedef struct Vector3D {
 typedef struct Vertex {
     Vector2D position;
     Vector3D color;
+    Vector2D uv; // Texture coordinate, (0, 0) is the top left of the texture
 } Vertex;
 
-typedef struct BufferVertices {
-    Uint32SizedMutableArray vertices; // Vertex
-    Uint32SizedMutableArray indices; // uint32_t
-} BufferVertices;
-
-void getBindingDescription(VkVertexInputBindingDescription *bindingDescription) {
-    bindingDescription->binding = 0;
-    bindingDescription->stride = sizeof(Vertex);
-    bindingDescription->inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-}
+/**
+ * Per instance data read at VK_VERTEX_INPUT_RATE_INSTANCE.
+ * The vertex shader scales, rotates (radians) and then translates
+ * the mesh position and tints the vertex color with color.
+ * texture is the bindless index from getTextureIndex, 0 is the default white texture.
+ * depth goes from 0 (nearest) to 1 (farthest), instances at equal depth are drawn in order.
+ **/
+typedef struct InstanceData {
+    Vector2D translation;
+    Vector2D scale;
+    float rotation;
+    Vector3D color;
+    uint32_t texture;
+    float depth;
+} InstanceData;
 
 /**
- * This section defines how the vertex data is going
- * to be read by the gpu.
+ * A mesh on its way into the mesh buffer.
+ * packed meshes are already in the mesh buffer layout, PackedVertex and
+ * indexType wide indices, and are copied to staging as they are. They carry
+ * their bounds since those can't be computed without unpacking the vertices.
+ * This is how meshes come out of a mesh pack, pointing into its mapping.
  **/
-void getAttributeDescriptions(VkVertexInputAttributeDescription *attributeDescriptions) {
-    attributeDescriptions[0].binding = 0;
-    attributeDescriptions[0].location = 0;
-    attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
-    attributeDescriptions[0].offset = offsetof(Vertex, position);
-
-    attributeDescriptions[1].binding = 0;
-    attributeDescriptions[1].location = 1;
-    attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
-    attributeDescriptions[1].offset = offsetof(Vertex, color);
-}
+typedef struct BufferVertices {
+    Uint32SizedMutableArray vertices; // Vertex, PackedVertex when packed
+    Uint32SizedMutableArray indices; // uint32_t, indexType sized when packed
+    bool packed;
+    VkIndexType indexType; // Only read when packed
+    Vector2D center; // Only read when packed
+    float radius; // Only read when packed
+} BufferVertices;
 
 /**
  * The VkPhysicalDeviceMemoryProperties structure has two arrays memoryTypes and memoryHeaps.
@@ -73,13 +83,18 @@ uint32_t findMemoryType(
     exit(1);
 }
 
-void createBuffer(
+/**
+ * Buffers used by more than one queue family are concurrent so they need no
+ * ownership transfers, queueFamilies with a single family (or none) is exclusive.
+ **/
+void createSharedBuffer(
     VkBuffer *vertexBuffer,
     const VkDeviceSize bufferSize,
     VkDeviceMemory *vertexBufferMemory,
     VkMemoryRequirements *memRequirements,
     const VkBufferUsageFlags bufferUsage,
     const VkMemoryPropertyFlags memoryProperties,
+    const Uint32SizedMutableArray queueFamilies, // uint32_t
     const VkPhysicalDevice physicalDevice,
     const VkDevice logicalDevice
 ) {
@@ -87,8 +102,10 @@ void createBuffer(
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = bufferSize;
     bufferInfo.usage = bufferUsage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    if (vkCreateBuffer(logicalDevice, &bufferInfo, nullptr, vertexBuffer) != VK_SUCCESS) {
+    bufferInfo.sharingMode = queueFamilies.count > 1 ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.queueFamilyIndexCount = queueFamilies.count > 1 ? queueFamilies.count : 0;
+    bufferInfo.pQueueFamilyIndices = queueFamilies.count > 1 ? (uint32_t *) queueFamilies.items : nullptr;
+    if (vkCreateBuffer(logicalDevice, &bufferInfo, hostAllocator, vertexBuffer) != VK_SUCCESS) {
         printLn("failed to create vertex buffer!");
         exit(4);
     }
@@ -104,7 +121,7 @@ void createBuffer(
 
     // https://github.com/GPUOpen-LibrariesAndSDKs/VulkanMemoryAllocator
     // memory limit is almost hit once you get to 4096 per vertex
-    if (vkAllocateMemory(logicalDevice, &allocInfo, nullptr, vertexBufferMemory) != VK_SUCCESS) {
+    if (allocateDeviceMemory(logicalDevice, &allocInfo, vertexBufferMemory) != VK_SUCCESS) {
         printLn("failed to allocate vertex buffer memory!");
         exit(1);
     }
@@ -112,14 +129,30 @@ void createBuffer(
     vkBindBufferMemory(logicalDevice, *vertexBuffer, *vertexBufferMemory, 0);
 }
 
-void copyBuffer(
-    VkBuffer srcBuffer,
-    VkBuffer dstBuffer,
-    VkDeviceSize size,
-    VkCommandPool commandPool,
-    VkDevice logicalDevice,
-    VkQueue graphicsQueue
+void createBuffer(
+    VkBuffer *vertexBuffer,
+    const VkDeviceSize bufferSize,
+    VkDeviceMemory *vertexBufferMemory,
+    VkMemoryRequirements *memRequirements,
+    const VkBufferUsageFlags bufferUsage,
+    const VkMemoryPropertyFlags memoryProperties,
+    const VkPhysicalDevice physicalDevice,
+    const VkDevice logicalDevice
 ) {
+    createSharedBuffer(
+        vertexBuffer,
+        bufferSize,
+        vertexBufferMemory,
+        memRequirements,
+        bufferUsage,
+        memoryProperties,
+        (Uint32SizedMutableArray){.items = nullptr, .size = 0, .count = 0},
+        physicalDevice,
+        logicalDevice
+    );
+}
+
+VkCommandBuffer beginSingleTimeCommands(const VkCommandPool commandPool, const VkDevice logicalDevice) {
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
@@ -135,12 +168,15 @@ void copyBuffer(
 
     vkBeginCommandBuffer(commandBuffer, &beginInfo);
 
-    VkBufferCopy copyRegion = {};
-    copyRegion.srcOffset = 0; // Optional
-    copyRegion.dstOffset = 0; // Optional
-    copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+    return commandBuffer;
+}
 
+void endSingleTimeCommands(
+    VkCommandBuffer commandBuffer,
+    const VkCommandPool commandPool,
+    const VkDevice logicalDevice,
+    const VkQueue graphicsQueue
+) {
     vkEndCommandBuffer(commandBuffer);
 
     VkSubmitInfo submitInfo  = {};
@@ -154,47 +190,23 @@ void copyBuffer(
     vkFreeCommandBuffers(logicalDevice, commandPool, 1, &commandBuffer);
 }
 
-void createVertexBuffer(
-    const VkPhysicalDevice physicalDevice,
-    const VkDevice logicalDevice,
-     const BufferVertices bufferVertices,
-    VulkanWindow *window,
+void copyBuffer(
+    VkBuffer srcBuffer,
+    VkBuffer dstBuffer,
+    VkDeviceSize size,
+    VkCommandPool commandPool,
+    VkDevice logicalDevice,
     VkQueue graphicsQueue
 ) {
-    VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
-
-    createBuffer(
-        &stagingBuffer,
-        bufferVertices.vertices.size,
-        &stagingBufferMemory,
-        &window->memRequirements,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        physicalDevice,
-        logicalDevice
-    );
-
-    Any data;
-    vkMapMemory(logicalDevice, stagingBufferMemory, 0, bufferVertices.vertices.size, 0, &data);
-    memcpy(data, bufferVertices.vertices.items, bufferVertices.vertices.size);
-    vkUnmapMemory(logicalDevice, stagingBufferMemory);
-
-    createBuffer(
-        &window->vertexBuffer,
-        bufferVertices.vertices.size,
-        &window->vertexBufferMemory,
-        &window->memRequirements,
-        VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        physicalDevice,
-        logicalDevice
-    );
-
-    copyBuffer(stagingBuffer, window->vertexBuffer, bufferVertices.vertices.size, window->commandPool, logicalDevice, graphicsQueue);
+    const VkCommandBuffer commandBuffer = beginSingleTimeCommands(commandPool, logicalDevice);
 
-    vkDestroyBuffer(logicalDevice, stagingBuffer, nullptr);
-    vkFreeMemory(logicalDevice, stagingBufferMemory, nullptr);
+    VkBufferCopy copyRegion = {};
+    copyRegion.srcOffset = 0; // Optional
+    copyRegion.dstOffset = 0; // Optional
+    copyRegion.size = size;
+    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
 
+    endSingleTimeCommands(commandBuffer, commandPool, logicalDevice, graphicsQueue);
 }
+
 #endif //VULKAN_VERTEX_H
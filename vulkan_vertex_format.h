@@ -0,0 +1,247 @@
+//
+// Created by brymher on 19/10/26.
+//
+
+#ifndef VULKAN_VERTEX_FORMAT_H
+#define VULKAN_VERTEX_FORMAT_H
+
+#include <vulkan/vulkan.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "vulkan_vertex.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VERTEX_FORMAT_X86 1
+#endif
+
+/**
+ * The vertex layout the GPU reads. Vertex stays the authoring format and is
+ * packed into this at upload: half float positions and texture coordinates
+ * and R8G8B8A8_UNORM colors, 12 bytes instead of the 28 of Vertex.
+ **/
+typedef struct PackedVertex {
+    uint16_t position[2]; // VK_FORMAT_R16G16_SFLOAT
+    uint8_t color[4]; // VK_FORMAT_R8G8B8A8_UNORM, alpha is always 255
+    uint16_t uv[2]; // VK_FORMAT_R16G16_SFLOAT so coordinates outside 0..1 can repeat
+} PackedVertex;
+
+typedef struct VertexBindingFormat {
+    uint32_t binding;
+    uint32_t stride;
+    VkVertexInputRate inputRate;
+} VertexBindingFormat;
+
+typedef struct VertexAttributeFormat {
+    uint32_t location;
+    uint32_t binding;
+    VkFormat format;
+    uint32_t offset;
+} VertexAttributeFormat;
+
+/**
+ * The single description of the vertex input. Pipelines get their binding and
+ * attribute descriptions generated from these two tables so adding or
+ * quantizing an attribute is a one line change (plus the shader).
+ **/
+static const VertexBindingFormat VERTEX_BINDINGS[] = {
+    {0, sizeof(PackedVertex), VK_VERTEX_INPUT_RATE_VERTEX},
+    {1, sizeof(InstanceData), VK_VERTEX_INPUT_RATE_INSTANCE},
+};
+
+static const VertexAttributeFormat VERTEX_ATTRIBUTES[] = {
+    {0, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, position)},
+    {1, 0, VK_FORMAT_R8G8B8A8_UNORM, offsetof(PackedVertex, color)},
+    {2, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(InstanceData, translation)},
+    {3, 1, VK_FORMAT_R32G32_SFLOAT, offsetof(InstanceData, scale)},
+    {4, 1, VK_FORMAT_R32_SFLOAT, offsetof(InstanceData, rotation)},
+    {5, 1, VK_FORMAT_R32G32B32_SFLOAT, offsetof(InstanceData, color)},
+    {6, 0, VK_FORMAT_R16G16_SFLOAT, offsetof(PackedVertex, uv)},
+    {7, 1, VK_FORMAT_R32_UINT, offsetof(InstanceData, texture)},
+    {8, 1, VK_FORMAT_R32_SFLOAT, offsetof(InstanceData, depth)},
+};
+
+#define VERTEX_BINDING_COUNT ((uint32_t) (sizeof(VERTEX_BINDINGS) / sizeof(VERTEX_BINDINGS[0])))
+#define VERTEX_ATTRIBUTE_COUNT ((uint32_t) (sizeof(VERTEX_ATTRIBUTES) / sizeof(VERTEX_ATTRIBUTES[0])))
+
+/**
+ * Binding 0 is the per vertex stream from the mesh buffer and
+ * binding 1 is the per instance stream from the frame's instance buffer.
+ **/
+void getBindingDescription(VkVertexInputBindingDescription *bindingDescriptions) {
+    for (uint32_t i = 0; i < VERTEX_BINDING_COUNT; i++) {
+        bindingDescriptions[i].binding = VERTEX_BINDINGS[i].binding;
+        bindingDescriptions[i].stride = VERTEX_BINDINGS[i].stride;
+        bindingDescriptions[i].inputRate = VERTEX_BINDINGS[i].inputRate;
+    }
+}
+
+/**
+ * This section defines how the vertex data is going
+ * to be read by the gpu.
+ **/
+void getAttributeDescriptions(VkVertexInputAttributeDescription *attributeDescriptions) {
+    for (uint32_t i = 0; i < VERTEX_ATTRIBUTE_COUNT; i++) {
+        attributeDescriptions[i].location = VERTEX_ATTRIBUTES[i].location;
+        attributeDescriptions[i].binding = VERTEX_ATTRIBUTES[i].binding;
+        attributeDescriptions[i].format = VERTEX_ATTRIBUTES[i].format;
+        attributeDescriptions[i].offset = VERTEX_ATTRIBUTES[i].offset;
+    }
+}
+
+/**
+ * IEEE 754 binary16 with round to nearest even.
+ * Overflow becomes infinity and NaN stays NaN.
+ **/
+uint16_t packHalf(const float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t exponent = (bits >> 23) & 0xFFu;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+
+    if (exponent == 0xFFu) return (uint16_t) (sign | 0x7C00u | (mantissa ? 0x200u : 0u));
+
+    const int32_t halfExponent = (int32_t) exponent - 127 + 15;
+    if (halfExponent >= 0x1F) return (uint16_t) (sign | 0x7C00u);
+
+    if (halfExponent <= 0) {
+        // Subnormal half or zero
+        if (halfExponent < -10) return (uint16_t) sign;
+        mantissa |= 0x800000u;
+        const uint32_t shift = (uint32_t) (14 - halfExponent);
+        uint32_t half = mantissa >> shift;
+        const uint32_t remainder = mantissa & ((1u << shift) - 1u);
+        const uint32_t halfway = 1u << (shift - 1u);
+        if (remainder > halfway || (remainder == halfway && (half & 1u))) half++;
+        return (uint16_t) (sign | half);
+    }
+
+    uint32_t half = ((uint32_t) halfExponent << 10) | (mantissa >> 13);
+    const uint32_t remainder = mantissa & 0x1FFFu;
+    // A carry out of the mantissa correctly bumps the exponent
+    if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) half++;
+    return (uint16_t) (sign | half);
+}
+
+uint8_t packUnorm8(const float value) {
+    const float clamped = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+    return (uint8_t) (clamped * 255.0f + 0.5f);
+}
+
+int8_t packSnorm8(const float value) {
+    const float clamped = value < -1.0f ? -1.0f : value > 1.0f ? 1.0f : value;
+    const float scaled = clamped * 127.0f;
+    return (int8_t) (scaled < 0.0f ? scaled - 0.5f : scaled + 0.5f);
+}
+
+/**
+ * Packs a unit normal for a VK_FORMAT_R8G8B8A8_SNORM attribute, w is left at 0.
+ **/
+uint32_t packNormalSnorm8(const Vector3D normal) {
+    return (uint32_t) (uint8_t) packSnorm8(normal.x) |
+           (uint32_t) (uint8_t) packSnorm8(normal.y) << 8 |
+           (uint32_t) (uint8_t) packSnorm8(normal.z) << 16;
+}
+
+PackedVertex packVertex(const Vertex vertex) {
+    return (PackedVertex){
+        .position = {packHalf(vertex.position.x), packHalf(vertex.position.y)},
+        .color = {packUnorm8(vertex.color.x), packUnorm8(vertex.color.y), packUnorm8(vertex.color.z), 255},
+        .uv = {packHalf(vertex.uv.x), packHalf(vertex.uv.y)}
+    };
+}
+
+#ifdef VERTEX_FORMAT_X86
+/**
+ * Four vertices per iteration: F16C converts the eight position and eight
+ * uv floats and SSE2 clamps, scales and rounds the twelve color floats.
+ * Only called when the CPU reports F16C.
+ **/
+__attribute__((target("f16c,sse2")))
+uint32_t packVerticesF16C(const Vertex *vertices, PackedVertex *packed, const uint32_t count) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 scale = _mm_set1_ps(255.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+
+    uint32_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        const Vertex *v = &vertices[i];
+
+        const __m128 positions01 = _mm_set_ps(v[1].position.y, v[1].position.x, v[0].position.y, v[0].position.x);
+        const __m128 positions23 = _mm_set_ps(v[3].position.y, v[3].position.x, v[2].position.y, v[2].position.x);
+        const __m128 uvs01 = _mm_set_ps(v[1].uv.y, v[1].uv.x, v[0].uv.y, v[0].uv.x);
+        const __m128 uvs23 = _mm_set_ps(v[3].uv.y, v[3].uv.x, v[2].uv.y, v[2].uv.x);
+        uint16_t halves[8], uvHalves[8];
+        _mm_storel_epi64((__m128i *) &halves[0], _mm_cvtps_ph(positions01, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storel_epi64((__m128i *) &halves[4], _mm_cvtps_ph(positions23, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storel_epi64((__m128i *) &uvHalves[0], _mm_cvtps_ph(uvs01, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storel_epi64((__m128i *) &uvHalves[4], _mm_cvtps_ph(uvs23, _MM_FROUND_TO_NEAREST_INT));
+
+        __m128 r = _mm_set_ps(v[3].color.x, v[2].color.x, v[1].color.x, v[0].color.x);
+        __m128 g = _mm_set_ps(v[3].color.y, v[2].color.y, v[1].color.y, v[0].color.y);
+        __m128 b = _mm_set_ps(v[3].color.z, v[2].color.z, v[1].color.z, v[0].color.z);
+        r = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(r, zero), one), scale), half);
+        g = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(g, zero), one), scale), half);
+        b = _mm_add_ps(_mm_mul_ps(_mm_min_ps(_mm_max_ps(b, zero), one), scale), half);
+
+        const __m128i rgba = _mm_or_si128(
+            _mm_or_si128(_mm_cvttps_epi32(r), _mm_slli_epi32(_mm_cvttps_epi32(g), 8)),
+            _mm_or_si128(_mm_slli_epi32(_mm_cvttps_epi32(b), 16), _mm_set1_epi32((int) 0xFF000000u))
+        );
+        uint32_t colors[4];
+        _mm_storeu_si128((__m128i *) colors, rgba);
+
+        for (uint32_t k = 0; k < 4; k++) {
+            packed[i + k].position[0] = halves[k * 2];
+            packed[i + k].position[1] = halves[k * 2 + 1];
+            memcpy(packed[i + k].color, &colors[k], sizeof(uint32_t));
+            packed[i + k].uv[0] = uvHalves[k * 2];
+            packed[i + k].uv[1] = uvHalves[k * 2 + 1];
+        }
+    }
+
+    return i;
+}
+#endif
+
+/**
+ * Packs count vertices, using the SIMD path when the CPU supports it
+ * and the scalar routines for the rest.
+ **/
+void packVertices(const Vertex *vertices, PackedVertex *packed, const uint32_t count) {
+    uint32_t i = 0;
+
+#ifdef VERTEX_FORMAT_X86
+    if (__builtin_cpu_supports("f16c")) i = packVerticesF16C(vertices, packed, count);
+#endif
+
+    for (; i < count; i++) packed[i] = packVertex(vertices[i]);
+}
+
+/**
+ * 16 bit indices whenever every index of the mesh fits,
+ * 0xFFFF is kept free since it is the primitive restart value.
+ **/
+VkIndexType selectIndexType(const uint32_t vertexCount) {
+    return vertexCount < 65536 ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32;
+}
+
+uint32_t getIndexSize(const VkIndexType indexType) {
+    return indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+void packIndices(const uint32_t *indices, void *packed, const uint32_t count, const VkIndexType indexType) {
+    if (indexType == VK_INDEX_TYPE_UINT32) {
+        memcpy(packed, indices, sizeof(uint32_t) * count);
+        return;
+    }
+
+    uint16_t *narrow = (uint16_t *) packed;
+    for (uint32_t i = 0; i < count; i++) narrow[i] = (uint16_t) indices[i];
+}
+
+#endif //VULKAN_VERTEX_FORMAT_H
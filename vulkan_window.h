@@ -6,6 +6,21 @@
 #define VULKAN_WINDOW_H
 #include <vulkan/vulkan.h>
 #include "vulkan_any.h"
+#include "vulkan_mesh_buffer.h"
+#include "vulkan_instances.h"
+#include "vulkan_culling.h"
+#include "vulkan_particles.h"
+#include "vulkan_batch_2d.h"
+#include "vulkan_texture.h"
+#include "vulkan_bindless.h"
+#include "vulkan_uniform_ring.h"
+#include "vulkan_retire_queue.h"
+#include "vulkan_resize.h"
+#include "trace.h"
+#include "render_graph.h"
+#include "vulkan_depth.h"
+#include "vulkan_pipeline_statistics.h"
+#include "vulkan_draw_list.h"
 
 typedef struct VulkanWindow {
     Any window;
@@ -19,6 +34,8 @@ typedef struct VulkanWindow {
     VkRenderPass renderPass;
     VkPipeline graphicsPipeline;
     Uint32SizedMutableArray swapChainFrameBuffers; //VkFramebuffer
+    VkFormat depthFormat;
+    Uint32SizedMutableArray depthImages; // DepthImage, one per swap chain image
     VkCommandPool commandPool;
     Uint32SizedMutableArray commandBuffers; // VkCommandBuffer
     Uint32SizedMutableArray imageAvailableSemaphores; // VkSemaphore
@@ -26,14 +43,33 @@ typedef struct VulkanWindow {
     Uint32SizedMutableArray inFlightFences; // VkFence
     uint32_t MAX_FRAMES_IN_FLIGHT;
     uint32_t currentFrame;
-    VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    uint64_t frameNumber; // Frames submitted so far
+    RetireQueue retireQueue; // Keyed by frameNumber
+    MeshBuffer meshBuffer;
+    MeshInstances instances;
+    CullingPass cullingPass;
+    ParticleSystem particles;
+    Batch2D batch2D;
+    DrawList drawList; // Rebuilt and sorted every time the main pass is recorded
+    BindlessTable bindless;
+    Textures textures;
+    UniformRing uniformRing;
+    Camera2D camera;
+    uint32_t frameUniformOffset; // Where the current frame's FrameUniforms are in uniformRing
     VkBuffer stagingBuffer;
     VkDeviceMemory stagingBufferMemory;
     VkMemoryRequirements memRequirements;
-    VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
-    bool resized;
+    ResizeController resize;
+    GpuTrace gpuTrace;
+    PipelineStatistics pipelineStatistics;
+    RenderGraph renderGraph; // Built by createFrameGraph once the culling pass exists
+    uint32_t swapChainImageResource; // renderGraph resources set every frame
+    uint32_t depthImageResource;
+    uint32_t culledInstancesResource;
+    uint32_t culledCommandsResource;
+    uint32_t culledCountsResource;
+    uint32_t particleInstancesResource; // Only in the graph when particles are simulated on the graphics queue
+    uint32_t imageIndex; // Swap chain image being recorded
 } VulkanWindow;
 
 